@@ -25,13 +25,6 @@
 /** local function definitions */
 static int bootstrapQSort(const void *par1, const void *par2);
 /*****************************************************************************/
-int bs_parNr, bs_frameNr;
-double *bs_parameter;
-double *bs_uplim;
-double *bs_lowlim;
-double *bs_weight;
-double (*bs_func)(int, double*, void*);
-/*****************************************************************************/
 /// @endcond
 
 /*****************************************************************************/
@@ -45,6 +38,9 @@ double (*bs_func)(int, double*, void*);
   to be NULL.
   This function will not set seed for random number generator, therefore,
   make sure that it is set in your program, for example with srand(time(NULL));. 
+  Unlike bootstrap(), the object function gets objfData, so the bootstrapped
+  TAC (bsTac) and other fit data can be kept in a structure per fit instead
+  of in global variables.
 
 \return Return values:
   - 0, if ok.
@@ -82,19 +78,25 @@ int bootstrapr(
   double *weight,
   /** The object function. */
   double (*objf)(int, double*, void*),
+  /** Pointer to data which is passed on to the object function;
+      NULL if not needed. */
+  void *objfData,
   /** Pointer to a string (allocated for at least 64 chars) where error message
       or other execution status will be written; enter NULL, if not needed. */   
   char *status,
   /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
   int verbose,
 
-  /** Full sampling matrix add later */
+  /** Full sampling matrix (iterNr x parNr) is written here;
+      NULL if not needed. */
   double *bmatrix
 ) {
 
   int ret, i, j, powellItNr, lowindex, upindex;
   double fret=0.0, *parMean, *chainptr, *chain, *delta, *bsFitTac, **matrix;
   double help, *error, *wError, *biasEst, *unbiasPar, *estInOrder;
+  double *bs_parameter, *bs_weight;
+  int bs_parNr, bs_frameNr;
   char bserrmsg[64];
 
   if(verbose>0)
@@ -154,9 +156,6 @@ int bootstrapr(
 
   bs_parNr=parNr;
   bs_frameNr=frameNr;
-  bs_func=objf;
-  bs_lowlim=lowlim;
-  bs_uplim=uplim;
   for(i=0; i<bs_parNr; i++) {
     bs_parameter[i]=parameter[i];
   }
@@ -193,11 +192,11 @@ int bootstrapr(
 
     /* Powell local search */
     for(j=0; j<bs_parNr; j++) {
-      delta[j]=0.01*(bs_uplim[j]-bs_lowlim[j]);
+      delta[j]=0.01*(uplim[j]-lowlim[j]);
       bs_parameter[j]=parameter[j];
     }
     powellItNr=400;
-    ret=powell(bs_parameter, delta, bs_parNr, 0.00001, &powellItNr, &fret, bs_func, NULL, 0);
+    ret=powell(bs_parameter, delta, bs_parNr, 0.00001, &powellItNr, &fret, objf, objfData, 0);
     if(ret>1 && ret!=3)	{
       sprintf(bserrmsg, "error %d in powell()", ret);
       if(verbose>0) fprintf(stderr, "Error: %s.\n", bserrmsg);
@@ -301,8 +300,7 @@ int bootstrapr(
     }
   }
 
-  //
-  for(j=0; j<iterNr; j++){
+  if(bmatrix!=NULL) for(j=0; j<iterNr; j++){
      for(i=0; i<bs_parNr; i++) {
        bmatrix[bs_parNr*j+i]=matrix[i][j]; } }
   //    printf("return full sampling matrix... %f \n", bmatrix[bs_parNr*j+i]); } }
@@ -495,7 +495,16 @@ int bootstrapr(
   double *cLim1, double *cLim2, double *SD, double *parameter,
   double *lowlim, double *uplim, int frameNr, double *origTac,
   double *fitTac, double *bsTAC, int parNr, double *weight,
-  double (*objf)(int, double*, void*), char *status, int verbose, double *matrix
+  double (*objf)(int, double*, void*), void *objfData,
+  char *status, int verbose, double *matrix
+);
+int bootstrapParallel(
+  int iterNr,
+  double *cLim1, double *cLim2, double *SD, double *parameter,
+  double *lowlim, double *uplim, int frameNr, double *origTac,
+  double *fitTac, double **bsTAC, int parNr, double *weight,
+  double (*objf)(int, double*, void*), void **objfData, int threadNr,
+  uint64_t seed, char *status, int verbose, double *matrix
 );
 /*****************************************************************************/
 
@@ -842,6 +851,15 @@ double simplex(
   double maxerr,
   int maxiter
 );
+double simplex_r(
+  double (*_fun)(int, double*, void*),
+  void *fundata,
+  int parNr,
+  double *par,
+  double *delta,
+  double maxerr,
+  int maxiter
+);
 /*****************************************************************************/
 
 /*****************************************************************************/
@@ -1028,6 +1046,12 @@ int tgo(
   void *objfData, int dim, int neighNr, double *fmin, double *gmin,
   int samNr, int tgoNr, int verbose
 );    
+int tgoParallel(
+  double *lowlim, double *uplim, double (*objf)(int, double*, void*),
+  void (*objfBatch)(int n, int dim, double *par, double *f, void *data),
+  void **objfData, int objfDataNr, int dim, int neighNr, double *fmin,
+  double *gmin, int samNr, int tgoNr, uint64_t seed, int verbose
+);
 void tgoRandomParameters(
   TGO_POINT *p, int parNr, int sNr,
   double *low, double *up
@@ -32,6 +32,10 @@ int simC1_i(
   double *t, double *cai, const int nr, 
   const double k1, const double k2, double *ct
 );
+int simC1_batch(
+  double *t, double *ca, const int nr, const int n,
+  const double *k1, const double *k2, double *ct, double *work
+);
 /*****************************************************************************/
 /* sim2cm */
 /*****************************************************************************/
@@ -45,6 +49,11 @@ int simC2_i(
   const double k1, const double k2, const double k3, const double k4,
   double *ct, double *cta, double *ctb
 );
+int simC2_batch(
+  double *t, double *ca, const int nr, const int n,
+  const double *k1, const double *k2, const double *k3, const double *k4,
+  double *ct, double *work
+);
 /*****************************************************************************/
 /* sim3cms */
 /*****************************************************************************/
@@ -168,6 +177,15 @@ int simOxygen(
 /* convolut */
 /*****************************************************************************/
 int convolve1D(double *data, const int n, double *kernel, const int m, double *out);
+int convolve1DFFT(
+  double *data, const int n, double *kernel, const int m, const int kernelNr,
+  double *out
+);
+int convolve1DBatch(
+  double *data, const int n, double *kernel, const int m, const int kernelNr,
+  double *out
+);
+void convolve1DFFTFree();
 int simIsSteadyInterval(double *x, const int n, double *f);
 /*****************************************************************************/
 /* simblood */
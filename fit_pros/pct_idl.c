@@ -25,17 +25,25 @@
 
 /*****************************************************************************/
 static const int parNr=3;   // was 2
-DFT input, data;
-double *ctemeas, *ctsim;
-// static double fVb=-1.0;
-double pmin[MAX_PARAMETERS], pmax[MAX_PARAMETERS];
-// double fk1k2;
-int fitframeNr;
-static double wss_wo_penalty=0.0;
+/** Data for the objective function of one regional pCT fit. */
+typedef struct {
+  /** Input TAC (interpolated to tissue sample times) */
+  DFT *input;
+  /** Tissue data; only the sample weights are used */
+  DFT *data;
+  /** Measured and simulated tissue TAC */
+  double *ctemeas, *ctsim;
+  /** Parameter constraints */
+  double pmin[MAX_PARAMETERS], pmax[MAX_PARAMETERS];
+  /** Nr of samples included in the fit */
+  int fitframeNr;
+  /** WSS without the penalty from constraints, of the latest function call */
+  double wss_wo_penalty;
+} FITDATA;
 
 /*****************************************************************************/
 /* Local functions */
-double pctFunc(int parNr, double *p, void*);
+static double pctFunc(int parNr, double *p, void*);
 /*****************************************************************************/
 
 
@@ -68,6 +76,11 @@ int pCT_idl(int argc, char **argv)
 
   const char *debugfile = "debug.txt";
 
+  DFT          input, data;
+  int          fitframeNr;
+  FITDATA      fd;
+  double      *pmin=fd.pmin, *pmax=fd.pmax;
+
   dftInit(&data); dftInit(&input); resInit(&res);
 
 #ifdef MINGW
@@ -279,6 +292,10 @@ dftPrint(&input); }
   pi++; strcpy(res.parname[pi], "AIC"); strcpy(res.parunit[pi], "");
 
 
+  /* Set data for the objective function */
+  fd.input=&input; fd.data=&data;
+  fd.fitframeNr=fitframeNr;
+
  /*
    *  Fit other than reference regions
    */
@@ -288,7 +305,7 @@ dftPrint(&input); }
     if(verbose>2) printf("\n  %d %s:\n", ri, data.voi[ri].name);
 
     /* Initiate values */
-    ctemeas=data.voi[ri].y; ctsim=data.voi[ri].y2;
+    fd.ctemeas=data.voi[ri].y; fd.ctsim=data.voi[ri].y2;
 
 
     /* Set constraints */
@@ -312,7 +329,7 @@ dftPrint(&input); }
     iterNr=0;
     neighNr = 500;    // used to be 100
     ret=tgo(
-      pmin, pmax, pctFunc, NULL, parNr, 8,
+      pmin, pmax, pctFunc, &fd, parNr, 8,
       &wss, res.voi[ri].parameter, neighNr, iterNr, verbose-8);
     if(ret>0) {
       printf( "\nError in optimization (%d).\n", ret);
@@ -321,7 +338,7 @@ dftPrint(&input); }
     /* Correct fitted parameters to match constraints like inside the function */
     (void)modelCheckParameters(parNr, pmin, pmax, res.voi[ri].parameter,
                                res.voi[ri].parameter, NULL);
-    wss=wss_wo_penalty;
+    wss=fd.wss_wo_penalty;
 
 
 
@@ -329,7 +346,7 @@ dftPrint(&input); }
     if(doBootstrap) {
       if(verbose>2) printf("  bootstrapping\n");
       /* bootstrap changes measured and simulated data, therefore use copies */
-      ctemeas=data.voi[data.voiNr].y2; ctsim=data.voi[data.voiNr].y3;
+      fd.ctemeas=data.voi[data.voiNr].y2; fd.ctsim=data.voi[data.voiNr].y3;
       if(doSD) sd=res.voi[ri].sd; else sd=NULL;
       if(doCL) {cl1=res.voi[ri].cl1; cl2=res.voi[ri].cl2;} else cl1=cl2=NULL;
       // ret=bootstrap(
@@ -352,8 +369,8 @@ dftPrint(&input); }
         // fitted TAC, not modified
         data.voi[ri].y2,
         // tissue TAC noisy data is written to be used by objf
-        ctemeas, 
-        parNr, data.w, pctFunc, tmp, verbose-4,bmatrix
+        fd.ctemeas, 
+        parNr, data.w, pctFunc, &fd, tmp, verbose-4, bmatrix
       );
 
       if(ret) {
@@ -416,21 +433,21 @@ if(verbose>0) {printf( "\n");   resPrint(&res);}
  *  Functions to be minimized
  *
  *****************************************************************************/
-double pctFunc(int parNr, double *p, void *fdata)
+static double pctFunc(int parNr, double *p, void *fdata)
 {
+  FITDATA *fd=(FITDATA*)fdata;
   int fi, ret;
   double Vb, d, wss=0.0;
   double pa[MAX_PARAMETERS], penalty=1.0;
 
   /* Check parameters against the constraints */
-  ret=modelCheckParameters(parNr, pmin, pmax, p, pa, &penalty);
-  if(fdata) {}
+  ret=modelCheckParameters(parNr, fd->pmin, fd->pmax, p, pa, &penalty);
   /* Calculate k2 and k3 */
   // k2=pa[0]/pa[1]; 
   // if(fVb>0.0) Vb=fVb; else Vb=pa[2];
 
   /* Simulate the tissue CT TAC */
-  ret = simpct(input.x,input.voi[0].y,input.frameNr,pa[0],pa[1],pa[2],ctsim);
+  ret = simpct(fd->input->x,fd->input->voi[0].y,fd->input->frameNr,pa[0],pa[1],pa[2],fd->ctsim);
 
 
   if(ret) {
@@ -457,12 +474,12 @@ double pctFunc(int parNr, double *p, void *fdata)
   // }
 
   /* Calculate error */
-  for(fi=0, wss=0.0; fi<fitframeNr; fi++) if(data.w[fi]>0.0) {
-    d=ctemeas[fi]-ctsim[fi]; 
-    wss+=data.w[fi]*d*d;
+  for(fi=0, wss=0.0; fi<fd->fitframeNr; fi++) if(fd->data->w[fi]>0.0) {
+    d=fd->ctemeas[fi]-fd->ctsim[fi]; 
+    wss+=fd->data->w[fi]*d*d;
     // printf("test! %f %f",ctemeas[fi],ctsim[fi]);
   }
-  wss_wo_penalty=wss;
+  fd->wss_wo_penalty=wss;
   wss*=penalty;
   if(0) printf("CBF=%g  MTT=%g  => %g\n",
     pa[0], pa[1], wss);
@@ -201,3 +201,114 @@ int simC2_i(
 /*****************************************************************************/
 
 /*****************************************************************************/
+/** Simulate tissue TACs using two-tissue compartment model and plasma TAC, 
+    at plasma TAC times, for many sets of rate constants at once.
+     
+    @details
+    Numerically the same recurrence as simC2(), but the parameter sets are
+    given in structure-of-arrays layout and advanced through the frames
+    together, so that the inner loop over parameter sets is vectorised
+    (SSE/AVX2/AVX-512 lanes, depending on -march). The arterial integral
+    is computed only once for all sets.
+    Simulated TACs are written frame-major, ct[i*n+j] being frame i of
+    parameter set j; memory for n*nr values must be allocated in the
+    calling program.
+  
+    The units of rate constants must be related to the time unit; 1/min and min,
+    or 1/sec and sec.
+   
+    @return Function returns 0 when succesful, else a value >= 1.
+    @sa simC2, simC1_batch
+ */
+int simC2_batch(
+  /** Array of time values */
+  double *t,
+  /** Array of arterial activities */
+  double *ca,
+  /** Number of values in TACs */
+  const int nr,
+  /** Number of parameter sets */
+  const int n,
+  /** Rate constants K1 of all parameter sets */
+  const double *k1,
+  /** Rate constants k2 of all parameter sets */
+  const double *k2,
+  /** Rate constants k3 of all parameter sets */
+  const double *k3,
+  /** Rate constants k4 of all parameter sets */
+  const double *k4,
+  /** Pointer for n*nr simulated values; must be allocated */
+  double *ct,
+  /** Working memory for 4*n values, or NULL to allocate it here */
+  double *work
+) {
+  int i, j;
+  double dt2, cai, ca_last, t_last;
+  double *ct1_last, *ct2_last, *ct1i_last, *ct2i_last, *buf=NULL;
+
+
+  /* Check for data */
+  if(nr<2 || n<1) return 1;
+  if(t==NULL || ca==NULL || ct==NULL) return 2;
+  if(k1==NULL || k2==NULL || k3==NULL || k4==NULL) return 2;
+
+  /* Check parameters */
+  for(j=0; j<n; j++) if(k1[j]<0.0) return 3;
+
+  /* Compartment values and integrals of the previous frame */
+  if(work==NULL) {
+    buf=(double*)malloc(4*n*sizeof(double)); if(buf==NULL) return 4;
+    work=buf;
+  }
+  ct1_last=work; ct2_last=work+n; ct1i_last=work+2*n; ct2i_last=work+3*n;
+  for(j=0; j<4*n; j++) work[j]=0.0;
+
+  /* Calculate curves */
+  t_last=0.0; if(t[0]<t_last) t_last=t[0];
+  cai=ca_last=0.0;
+  for(i=0; i<nr; i++) {
+    double *cti=ct+(size_t)i*n;
+    /* delta time / 2 */
+    dt2=0.5*(t[i]-t_last);
+    /* calculate values */
+    if(dt2<0.0) {
+      if(buf!=NULL) free(buf);
+      return 5;
+    } else if(dt2>0.0) {
+      /* arterial integral */
+      cai+=(ca[i]+ca_last)*dt2;
+#pragma omp simd
+      for(j=0; j<n; j++) {
+        double r, u, v, ct1, ct2, ct1i, ct2i;
+        /* Calculate partial results */
+        r=1.0+k4[j]*dt2;
+        u=ct1i_last[j]+dt2*ct1_last[j];
+        v=ct2i_last[j]+dt2*ct2_last[j];
+        /* 1st tissue compartment and its integral */
+        ct1 = ( k1[j]*cai - (k2[j] + (k3[j]/r))*u + (k4[j]/r)*v )
+              / ( 1.0 + dt2*(k2[j] + (k3[j]/r)) );
+        ct1i = ct1i_last[j] + dt2*(ct1_last[j]+ct1);
+        /* 2nd tissue compartment and its integral */
+        ct2 = (k3[j]*ct1i - k4[j]*v) / r;
+        ct2i = ct2i_last[j] + dt2*(ct2_last[j]+ct2);
+        /* set very small values to zero */
+        cti[j]=ct1+ct2; if(fabs(cti[j])<1.0e-12) cti[j]=0.0;
+        /* prepare to the next loop */
+        ct1_last[j]=ct1; ct1i_last[j]=ct1i;
+        ct2_last[j]=ct2; ct2i_last[j]=ct2i;
+      }
+    } else {
+      for(j=0; j<n; j++) {
+        cti[j]=ct1_last[j]+ct2_last[j]; if(fabs(cti[j])<1.0e-12) cti[j]=0.0;
+      }
+    }
+    /* prepare to the next loop */
+    t_last=t[i]; ca_last=ca[i];
+  }
+
+  if(buf!=NULL) free(buf);
+  return 0;
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
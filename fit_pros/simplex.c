@@ -6,13 +6,22 @@
 #include "libtpcmodel.h"
 /*****************************************************************************/
 /// @cond
+/** State of one simplex run; kept on the stack of the caller so that
+    simultaneous fits in different threads do not share anything. */
+typedef struct {
+  int     parNr, Worst, NewPnt;
+  double  P[MAX_PARAMETERS+3][MAX_PARAMETERS],
+          C[MAX_PARAMETERS], R[MAX_PARAMETERS+3];
+  /** Objective function without user data, as in simplex() */
+  double  (*func)(double*);
+  /** Objective function with user data, as in simplex_r() */
+  double  (*funcr)(int, double*, void*);
+  void   *funcData;
+} SIMPLEX_STATE;
 /** Local functions */
-void    _simplexGenNew(int M, double F);
-/** Local variables for this routine                                          */
-int     _simplexParNr, Worst, NewPnt;
-double  _simplexP[MAX_PARAMETERS+3][MAX_PARAMETERS],
-        _simplexC[MAX_PARAMETERS], _simplexR[MAX_PARAMETERS+3];
-double  (*_simplexFunc)(double*);
+static double _simplexMinimize(SIMPLEX_STATE *s, double *par, double *delta,
+                               double maxerr, int maxiter);
+static void   _simplexGenNew(SIMPLEX_STATE *s, int M, double F);
 /// @endcond
 /*****************************************************************************/
 
@@ -39,6 +48,73 @@ double simplex(
   double maxerr,
   /** Maximal nr of iterations allowed (stopping rule #2) */
   int maxiter
+) {
+  SIMPLEX_STATE st;
+
+  st.func=_fun; st.funcr=NULL; st.funcData=NULL;
+  st.parNr=parNr;
+  return(_simplexMinimize(&st, par, delta, maxerr, maxiter));
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Downhill simplex function minimization routine, with the objective
+    function interface used by powell() and tgo().
+    All state is local to the call, thus simplex_r() is reentrant and can be
+    run in parallel threads, if the objective function keeps its data in
+    fundata instead of global variables.
+    Note that if any constraints are required for the parameter
+    values they must be set in the function.
+    @return Function returns the least calculated value of func.
+    @sa simplex, powell, tgo
+*/
+double simplex_r(
+  /** Pointer to the function to be minimized */
+  double (*_fun)(int, double*, void*),
+  /** Pointer to data which is passed on to the function; NULL if not needed */
+  void *fundata,
+  /** The number of unknown parameters */
+  int parNr,
+  /** This double array contains the minimized parameters.
+      Initial values must be set. */
+  double *par,
+  /** This double array contains the initial changes to parameters.
+      To fix a parameter, set the corresponding delta to 0. */
+  double *delta,
+  /** Maximal error allowed (stopping rule #1) */
+  double maxerr,
+  /** Maximal nr of iterations allowed (stopping rule #2) */
+  int maxiter
+) {
+  SIMPLEX_STATE st;
+
+  st.func=NULL; st.funcr=_fun; st.funcData=fundata;
+  st.parNr=parNr;
+  return(_simplexMinimize(&st, par, delta, maxerr, maxiter));
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/// \cond
+/** Call the objective function of simplex state s at point p. */
+static double _simplexFunc(SIMPLEX_STATE *s, double *p)
+{
+  if(s->funcr!=NULL) return((*s->funcr)(s->parNr, p, s->funcData));
+  return((*s->func)(p));
+}
+/*****************************************************************************/
+/** The minimization routine shared by simplex() and simplex_r(). */
+static double _simplexMinimize(
+  /** Simplex state with objective function and parNr set */
+  SIMPLEX_STATE *s,
+  /** Initial and minimized parameters */
+  double *par,
+  /** Initial changes to parameters */
+  double *delta,
+  /** Maximal error allowed */
+  double maxerr,
+  /** Maximal nr of iterations allowed */
+  int maxiter
 ) {
   int         i, j, Meas, it;
   double      Max, Min, Max2, Min2, LastChi;
@@ -47,22 +123,21 @@ double simplex(
 
   if(SIMPLEX_TEST>0) printf("in simplex()\n");
   /* SetUp */
-  _simplexFunc=_fun;
-  _simplexParNr=parNr; it=0; NewPnt=_simplexParNr+1;
-  for(i=0; i<_simplexParNr; i++)
-    for(Meas=0; Meas<_simplexParNr+3; Meas++) _simplexP[Meas][i]=par[i];
+  it=0; s->NewPnt=s->parNr+1;
+  for(i=0; i<s->parNr; i++)
+    for(Meas=0; Meas<s->parNr+3; Meas++) s->P[Meas][i]=par[i];
   if(SIMPLEX_TEST) {
-    for(i=0; i<_simplexParNr; i++)
-      printf("%12g   %12g\n", _simplexP[0][i], delta[i]);
-    printf("ChiSqr of guesses: %f\n", (*_simplexFunc)(_simplexP[0]));
+    for(i=0; i<s->parNr; i++)
+      printf("%12g   %12g\n", s->P[0][i], delta[i]);
+    printf("ChiSqr of guesses: %f\n", _simplexFunc(s, s->P[0]));
   }
-  New2=NewPnt+1;
-  for(Meas=0; Meas<=_simplexParNr; Meas++) {
+  New2=s->NewPnt+1;
+  for(Meas=0; Meas<=s->parNr; Meas++) {
     it++;
-    _simplexR[Meas] = (*_simplexFunc)(_simplexP[Meas]);
-    for (i=0; i<_simplexParNr; i++) {
+    s->R[Meas] = _simplexFunc(s, s->P[Meas]);
+    for (i=0; i<s->parNr; i++) {
       if(i==Meas) delta[i]= -delta[i];
-      _simplexP[Meas+1][i] = _simplexP[Meas][i] + delta[i];
+      s->P[Meas+1][i] = s->P[Meas][i] + delta[i];
     }
   }
 
@@ -72,73 +147,74 @@ double simplex(
     for(j=0; j<100; j++) {
       /* Find the max and min response measured */
       Max=0.; Min=1.0E30;
-      for (i=0; i<=_simplexParNr; i++) {
-        if(_simplexR[i] > Max) {Max=_simplexR[i]; Worst=i;}
-        if(_simplexR[i] < Min) {Min=_simplexR[i]; Best=i; }
+      for (i=0; i<=s->parNr; i++) {
+        if(s->R[i] > Max) {Max=s->R[i]; s->Worst=i;}
+        if(s->R[i] < Min) {Min=s->R[i]; Best=i; }
       }
       /* Find 2nd best and 2nd worst, too */
       Max2=0.; Min2=1.0E30;
-      for (i=0; i<=_simplexParNr; i++) {
-        if((_simplexR[i] > Max2) && (_simplexR[i] < Max)) Max2=_simplexR[i];
-        if((_simplexR[i] < Min2) && (_simplexR[i] > Min)) {
-          Min2=_simplexR[i]; NextBest=i;}
+      for (i=0; i<=s->parNr; i++) {
+        if((s->R[i] > Max2) && (s->R[i] < Max)) Max2=s->R[i];
+        if((s->R[i] < Min2) && (s->R[i] > Min)) {
+          Min2=s->R[i]; NextBest=i;}
       }
       /* Calculate centroid of all measurements */
-      for(i=0; i<_simplexParNr; i++) {
-        _simplexC[i]=0.;
-        for(Meas=0; Meas<=_simplexParNr; Meas++)
-          if(Meas!=Worst) _simplexC[i]+=_simplexP[Meas][i];
-        _simplexC[i]/=(double)_simplexParNr;
+      for(i=0; i<s->parNr; i++) {
+        s->C[i]=0.;
+        for(Meas=0; Meas<=s->parNr; Meas++)
+          if(Meas!=s->Worst) s->C[i]+=s->P[Meas][i];
+        s->C[i]/=(double)s->parNr;
       }
       /* Measure the response at the point reflected away from worst */
-      for(i=0; i<_simplexParNr; i++)
-        _simplexP[NewPnt][i] = 2.*_simplexC[i] - _simplexP[Worst][i];
-      _simplexR[NewPnt]= (*_simplexFunc)(_simplexP[NewPnt]);
+      for(i=0; i<s->parNr; i++)
+        s->P[s->NewPnt][i] = 2.*s->C[i] - s->P[s->Worst][i];
+      s->R[s->NewPnt]= _simplexFunc(s, s->P[s->NewPnt]);
       it++;
       /* If this one is better than previous best, then expand in this
           direction */
-      if(_simplexR[NewPnt] < _simplexR[Best]) {
-        _simplexGenNew(New2,2.0); it++;
+      if(s->R[s->NewPnt] < s->R[Best]) {
+        _simplexGenNew(s, New2,2.0); it++;
       } else {
         /* If this one is worse than previous worst, measure point halfway
            between worst and centroid */
-        if(_simplexR[NewPnt] > _simplexR[Worst]) {
-          _simplexGenNew(New2,-0.5); it++;
+        if(s->R[s->NewPnt] > s->R[s->Worst]) {
+          _simplexGenNew(s, New2,-0.5); it++;
         } else {
           /* If newest response is worse than next best point
              but better than worst, measure response halfway
              between centroid and newest point */
-          if((_simplexR[NextBest] < _simplexR[NewPnt]) &&
-             (_simplexR[NewPnt] < _simplexR[Worst])) {
-            _simplexGenNew(New2,0.5); it++;
+          if((s->R[NextBest] < s->R[s->NewPnt]) &&
+             (s->R[s->NewPnt] < s->R[s->Worst])) {
+            _simplexGenNew(s, New2,0.5); it++;
           } else {
             /* If none of the above, keep the new point as best */
-            for(i=0; i<_simplexParNr; i++)
-              _simplexP[Worst][i] = _simplexP[NewPnt][i];
-            _simplexR[Worst] = _simplexR[NewPnt];
+            for(i=0; i<s->parNr; i++)
+              s->P[s->Worst][i] = s->P[s->NewPnt][i];
+            s->R[s->Worst] = s->R[s->NewPnt];
           }
         }
       }
     }
-    if(SIMPLEX_TEST>0) printf(" it=%i; ChiSqr=%f\n", it, _simplexR[Best]);
+    if(SIMPLEX_TEST>0) printf(" it=%i; ChiSqr=%f\n", it, s->R[Best]);
     if(SIMPLEX_TEST>1)
-      for(i=0; i<_simplexParNr; i++) printf("     %12g\n", _simplexP[Best][i]);
+      for(i=0; i<s->parNr; i++) printf("     %12g\n", s->P[Best][i]);
     /* Check if fitting is not proceeding */
-    if(_simplexR[Best] == LastChi) {
-      for(i=0; i<_simplexParNr; i++) par[i]=_simplexP[Best][i];
-      return _simplexR[Best];
+    if(s->R[Best] == LastChi) {
+      for(i=0; i<s->parNr; i++) par[i]=s->P[Best][i];
+      return s->R[Best];
     }
-    LastChi = _simplexR[Best];
-  } while ((_simplexR[Best]>maxerr) && (it<=maxiter));
+    LastChi = s->R[Best];
+  } while ((s->R[Best]>maxerr) && (it<=maxiter));
 
-  for(i=0; i<_simplexParNr; i++) par[i]=_simplexP[Best][i];
+  for(i=0; i<s->parNr; i++) par[i]=s->P[Best][i];
   if(SIMPLEX_TEST>0) printf("out simplex()\n");
-  return _simplexR[Best];
+  return s->R[Best];
 }
 /*****************************************************************************/
-/// \cond
 /** _simplexGenNew() */
-void _simplexGenNew(
+static void _simplexGenNew(
+  /** Simplex state */
+  SIMPLEX_STATE *s,
   /** M */
   int M, 
   /** F!=1.0 */
@@ -146,16 +222,16 @@ void _simplexGenNew(
 ) {
   int i;
 
-  for(i=0; i<_simplexParNr; i++)
-    _simplexP[M][i] = _simplexC[i] + F*(_simplexC[i]-_simplexP[Worst][i]);
-  _simplexR[M] = (*_simplexFunc)(_simplexP[M]);
-  if (_simplexR[M] < _simplexR[NewPnt]) {
-    /*_simplexP[M][M]*/
-    for(i=0; i<_simplexParNr; i++) _simplexP[Worst][i] = _simplexP[M][i];    
-    _simplexR[Worst] = _simplexR[M];
+  for(i=0; i<s->parNr; i++)
+    s->P[M][i] = s->C[i] + F*(s->C[i]-s->P[s->Worst][i]);
+  s->R[M] = _simplexFunc(s, s->P[M]);
+  if (s->R[M] < s->R[s->NewPnt]) {
+    /*s->P[M][M]*/
+    for(i=0; i<s->parNr; i++) s->P[s->Worst][i] = s->P[M][i];    
+    s->R[s->Worst] = s->R[M];
   } else {
-    for (i=0; i<_simplexParNr; i++) _simplexP[Worst][i] = _simplexP[NewPnt][i];
-    _simplexR[Worst] = _simplexR[NewPnt];
+    for (i=0; i<s->parNr; i++) s->P[s->Worst][i] = s->P[s->NewPnt][i];
+    s->R[s->Worst] = s->R[s->NewPnt];
   }
 }
 /*****************************************************************************/
@@ -17,12 +17,24 @@
 
 /*****************************************************************************/
 static const int parNr=3;
-int fitframeNr=0;
-double *t, *cr, *ct, *tis, *w; /* These are pointers, not allocated */
-double pmin[MAX_PARAMS], pmax[MAX_PARAMS];
-static double wss_wo_penalty=0.0;
+/** Data for the objective function of one regional SRTM fit. */
+typedef struct {
+  /* These are pointers, not allocated */
+  /** Sample times and reference region TAC */
+  double *t, *cr;
+  /** Measured and simulated tissue TAC */
+  double *tis, *ct;
+  /** Sample weights */
+  double *w;
+  /** Parameter constraints */
+  double pmin[MAX_PARAMS], pmax[MAX_PARAMS];
+  /** Nr of samples included in the fit */
+  int fitframeNr;
+  /** WSS without the penalty from constraints, of the latest function call */
+  double wss_wo_penalty;
+} FITDATA;
 /* Local functions */
-double srtmFunc(int parNr, double *p, void*);
+static double srtmFunc(int parNr, double *p, void*);
 /*****************************************************************************/
 
 
@@ -49,6 +61,9 @@ int srtm_idl(int argc, char **argv)
 
   DFT data, input, temp; 
   RES res; 
+  int fitframeNr=0;
+  FITDATA fd;
+  double *pmin=fd.pmin, *pmax=fd.pmax;
   dftInit(&data); dftInit(&temp); dftInit(&input); resInit(&res);
 
 
@@ -284,14 +299,15 @@ dftPrint(&data);
   int tgoNr=0, neighNr=0, iterNr=0;
   double wss;
   /* Set common data pointers */
-  t=data.x; cr=data.voi[ref].y;
+  fd.t=data.x; fd.cr=data.voi[ref].y; fd.w=data.w;
+  fd.fitframeNr=fitframeNr;
   double refIntegral=data.voi[ref].y3[fitframeNr-1];
   /* Fit model to one TAC at a time */
   for(int ri=0; ri<data.voiNr; ri++) if(ri!=ref) {
 
     if(verbose>1) printf("Region %d %s\n", ri+1, data.voi[ri].name);
     /* Set data pointers */
-    tis=data.voi[ri].y; ct=data.voi[ri].y2; w=data.w;
+    fd.tis=data.voi[ri].y; fd.ct=data.voi[ri].y2;
     double *p=res.voi[ri].parameter;
 
     /* Set common parameter constraints */
@@ -316,7 +332,7 @@ dftPrint(&data);
     TGO_SQUARED_TRANSF=0;
     tgoNr=220;
     neighNr=20;
-    ret=tgo(pmin, pmax, srtmFunc, NULL, parNr, neighNr, &wss, p, tgoNr, iterNr, verbose-8);
+    ret=tgo(pmin, pmax, srtmFunc, &fd, parNr, neighNr, &wss, p, tgoNr, iterNr, verbose-8);
     if(ret>0) {
       printf( "Error in optimization (%d).\n", ret);
       dftEmpty(&data); resEmpty(&res); return(6);
@@ -327,7 +343,7 @@ dftPrint(&data);
     }
     /* Correct fitted parameters to match constraints like inside the function */
     (void)modelCheckParameters(parNr, pmin, pmax, p, p, NULL);
-    p[parNr]=wss=wss_wo_penalty;
+    p[parNr]=wss=fd.wss_wo_penalty;
     if(verbose>2) printf("wss := %g\nfitframeNr := %d\n", wss, fitframeNr);
 
 
@@ -336,7 +352,7 @@ dftPrint(&data);
     if(doBootstrap) {
       if(verbose>2) printf("  bootstrapping...\n");
       /* bootstrap changes measured and simulated data, therefore use copies */
-      tis=data.voi[bsi].y; ct=data.voi[bsi].y2;
+      fd.tis=data.voi[bsi].y; fd.ct=data.voi[bsi].y2;
       if(doSD) sd=res.voi[ri].sd; else sd=NULL;
       if(doCL) {cl1=res.voi[ri].cl1; cl2=res.voi[ri].cl2;} else cl1=cl2=NULL;
 
@@ -351,8 +367,8 @@ dftPrint(&data);
         // measured and fitted original TAC, not modified
         data.voi[ri].y, data.voi[ri].y2,
         // tissue TAC noisy data is written to be used by objf
-        tis, 
-        parNr, w, srtmFunc, tmp, verbose-5, bmatrix
+        fd.tis, 
+        parNr, data.w, srtmFunc, &fd, tmp, verbose-5, bmatrix
       );
 // printf("return full sampling matrix... %f %f\n", matrix[0], matrix[100] );
 // for(int i=0; i<parNr*bootstrapIter; i++) { bmatrix[i]=matrix[i]; }
@@ -365,7 +381,7 @@ dftPrint(&data);
         }
       }
       // back to what pointers were
-      tis=data.voi[ri].y; tis=data.voi[ri].y2;
+      fd.tis=data.voi[ri].y; fd.ct=data.voi[ri].y2;
     }
 
   } /* Next VOI */
@@ -403,32 +419,32 @@ dftPrint(&data);
  *  Functions to be minimized
  *
  *****************************************************************************/
-double srtmFunc(int parNr, double *p, void *fdata)
+static double srtmFunc(int parNr, double *p, void *fdata)
 {
+  FITDATA *fd=(FITDATA*)fdata;
   int ret;
   double R1, k2, BP, d, wss=0.0;
   double pa[MAX_PARAMETERS], penalty=1.0;
 
 
   /* Check parameters against the constraints */
-  ret=modelCheckParameters(parNr, pmin, pmax, p, pa, &penalty);
-  if(fdata) {}
+  ret=modelCheckParameters(parNr, fd->pmin, fd->pmax, p, pa, &penalty);
   /* Get parameters */
   R1=pa[0]; k2=pa[1]; BP=pa[2];
 
   /* Simulate the tissue PET TAC */
-  ret=simSRTM(t, cr, fitframeNr, R1, k2, BP, ct);
+  ret=simSRTM(fd->t, fd->cr, fd->fitframeNr, R1, k2, BP, fd->ct);
   if(ret) {
     printf( "  error %d in simulation\n", ret);
     return(nan(""));
   }
 
   /* Calculate error */
-  for(int i=0; i<fitframeNr; i++) if(w[i]>0.0) {
-    d=ct[i]-tis[i]; 
-    wss+=w[i]*d*d;
+  for(int i=0; i<fd->fitframeNr; i++) if(fd->w[i]>0.0) {
+    d=fd->ct[i]-fd->tis[i]; 
+    wss+=fd->w[i]*d*d;
   }
-  wss_wo_penalty=wss;
+  fd->wss_wo_penalty=wss;
   wss*=penalty;
   if(0) printf("R1=%g  k2=%g  BP=%g  => %g\n", R1, k2, BP, wss);
 
@@ -25,17 +25,27 @@
 
 /*****************************************************************************/
 static const int parNr=3;
-DFT input, data;
-double *petmeas, *petsim;
-static double fVb=-1.0;
-double pmin[MAX_PARAMETERS], pmax[MAX_PARAMETERS];
-double fk1k2;
-int fitframeNr;
-static double wss_wo_penalty=0.0;
+/** Data for the objective function of one regional 1TCM fit. */
+typedef struct {
+  /** Input TAC (interpolated to tissue sample times) */
+  DFT *input;
+  /** Tissue data; only the sample weights are used */
+  DFT *data;
+  /** Measured and simulated tissue TAC */
+  double *petmeas, *petsim;
+  /** Fixed Vb, or <0 if Vb is fitted */
+  double fVb;
+  /** Parameter constraints */
+  double pmin[MAX_PARAMETERS], pmax[MAX_PARAMETERS];
+  /** Nr of samples included in the fit */
+  int fitframeNr;
+  /** WSS without the penalty from constraints, of the latest function call */
+  double wss_wo_penalty;
+} FITDATA;
 
 /*****************************************************************************/
 /* Local functions */
-double cm2Func(int parNr, double *p, void*);
+static double cm2Func(int parNr, double *p, void*);
 /*****************************************************************************/
 
 
@@ -68,6 +78,12 @@ int tcm1_idl(int argc, char **argv)
 
   const char *debugfile = "debug.txt";
 
+  DFT          input, data;
+  double       fVb=-1.0;
+  int          fitframeNr;
+  FITDATA      fd;
+  double      *pmin=fd.pmin, *pmax=fd.pmax;
+
   dftInit(&data); dftInit(&input); resInit(&res);
 
 #ifdef MINGW
@@ -288,6 +304,11 @@ dftPrint(&input); }
   pi++; strcpy(res.parname[pi], "AIC"); strcpy(res.parunit[pi], "");
 
 
+  /* Set data for the objective function */
+  fd.input=&input; fd.data=&data;
+  fd.fVb=fVb;
+  fd.fitframeNr=fitframeNr;
+
  /*
    *  Fit other than reference regions
    */
@@ -297,7 +318,7 @@ dftPrint(&input); }
     if(verbose>2) printf("\n  %d %s:\n", ri, data.voi[ri].name);
 
     /* Initiate values */
-    petmeas=data.voi[ri].y; petsim=data.voi[ri].y2;
+    fd.petmeas=data.voi[ri].y; fd.petsim=data.voi[ri].y2;
 
     /* Set constraints */
     pmin[0]=def_pmin[0];    pmax[0]=def_pmax[0];   /* K1    */
@@ -319,7 +340,7 @@ dftPrint(&input); }
     // neighNr=6*fittedparNr;
     iterNr=0;
     ret=tgo(
-      pmin, pmax, cm2Func, NULL, parNr, 8,
+      pmin, pmax, cm2Func, &fd, parNr, 8,
       &wss, res.voi[ri].parameter, 100, 0, verbose-8);
     if(ret>0) {
       printf( "\nError in optimization (%d).\n", ret);
@@ -328,7 +349,7 @@ dftPrint(&input); }
     /* Correct fitted parameters to match constraints like inside the function */
     (void)modelCheckParameters(parNr, pmin, pmax, res.voi[ri].parameter,
                                res.voi[ri].parameter, NULL);
-    wss=wss_wo_penalty;
+    wss=fd.wss_wo_penalty;
 
 
 
@@ -336,7 +357,7 @@ dftPrint(&input); }
     if(doBootstrap) {
       if(verbose>2) printf("  bootstrapping\n");
       /* bootstrap changes measured and simulated data, therefore use copies */
-      petmeas=data.voi[data.voiNr].y2; petsim=data.voi[data.voiNr].y3;
+      fd.petmeas=data.voi[data.voiNr].y2; fd.petsim=data.voi[data.voiNr].y3;
       if(doSD) sd=res.voi[ri].sd; else sd=NULL;
       if(doCL) {cl1=res.voi[ri].cl1; cl2=res.voi[ri].cl2;} else cl1=cl2=NULL;
       // ret=bootstrap(
@@ -359,8 +380,8 @@ dftPrint(&input); }
         // fitted TAC, not modified
         data.voi[ri].y2,
         // tissue TAC noisy data is written to be used by objf
-        petmeas, 
-        parNr, data.w, cm2Func, tmp, verbose-4,bmatrix
+        fd.petmeas, 
+        parNr, data.w, cm2Func, &fd, tmp, verbose-4, bmatrix
       );
 
       if(ret) {
@@ -423,25 +444,25 @@ if(verbose>0) {printf( "\n");   resPrint(&res);}
  *  Functions to be minimized
  *
  *****************************************************************************/
-double cm2Func(int parNr, double *p, void *fdata)
+static double cm2Func(int parNr, double *p, void *fdata)
 {
+  FITDATA *fd=(FITDATA*)fdata;
   int fi, ret;
   double Vb, k2, d, wss=0.0;
   double pa[MAX_PARAMETERS], penalty=1.0;
 
   /* Check parameters against the constraints */
-  ret=modelCheckParameters(parNr, pmin, pmax, p, pa, &penalty);
-  if(fdata) {}
+  ret=modelCheckParameters(parNr, fd->pmin, fd->pmax, p, pa, &penalty);
   /* Calculate k2 and k3 */
-  k2=pa[0]/pa[1]; if(fVb>=0.0) Vb=fVb; else Vb=pa[2];
+  k2=pa[0]/pa[1]; if(fd->fVb>=0.0) Vb=fd->fVb; else Vb=pa[2];
 
   /* Simulate the tissue PET TAC */
   // ret=simC3vs(
   //   input.x, input.voi[0].y, input.voi[1].y, input.frameNr,
   //   pa[0], k2, k3, 0.0, 0.0, 0.0, 0.0, Vb, 1.0,
   //   input.voi[0].y2, NULL, NULL, NULL, NULL, NULL);
-  ret=simC1( input.x,input.voi[0].y,input.frameNr,pa[0],k2,
-      petsim);
+  ret=simC1( fd->input->x,fd->input->voi[0].y,fd->input->frameNr,pa[0],k2,
+      fd->petsim);
   if(ret) {
     printf("error %d in simulation\n", ret);
     return(nan(""));
@@ -466,11 +487,11 @@ double cm2Func(int parNr, double *p, void *fdata)
   }
 
   /* Calculate error */
-  for(fi=0, wss=0.0; fi<fitframeNr; fi++) if(data.w[fi]>0.0) {
-    d=petmeas[fi]-petsim[fi]; 
-    wss+=data.w[fi]*d*d;
+  for(fi=0, wss=0.0; fi<fd->fitframeNr; fi++) if(fd->data->w[fi]>0.0) {
+    d=fd->petmeas[fi]-fd->petsim[fi]; 
+    wss+=fd->data->w[fi]*d*d;
   }
-  wss_wo_penalty=wss;
+  fd->wss_wo_penalty=wss;
   wss*=penalty;
   if(0) printf("K1=%g  k2=%g Vb=%g  => %g\n",
     pa[0], k2, Vb, wss);
@@ -6,6 +6,8 @@
 /*****************************************************************************/
 #include "libtpcmodel.h"
 #include "libtpcmisc.h"
+#include "tpccm.h"
+#include <time.h>
 /*****************************************************************************/
 
 /*****************************************************************************/
@@ -32,12 +34,15 @@ int test_onedim2(int VERBOSE);
 int test_banana1(int VERBOSE);
 int test_rastrigin(int VERBOSE);
 int test_nptrange(int VERBOSE);
+int test_simC2_batch(int VERBOSE);
+int test_tgoParallel(int VERBOSE);
 int test_bootstrap1(int VERBOSE);
 double bobyqa_problem1(int n, double *x, void *func_data);
 double bobyqa_problem2(int n, double *x, void *func_data);
 double optfunc_dejong2(int n, double *x, void *func_data);
 double optfunc_rastrigin(int n, double *x, void *func_data);
 double func_deviation(int parNr, double *p, void *fdata);
+double optfunc_dejong2_counted(int n, double *x, void *func_data);
 /*****************************************************************************/
 
 /*****************************************************************************/
@@ -125,6 +130,10 @@ int main(
     fprintf(stderr, "failed (%d).\n", ret); return(i);}
   i++; if((ret=test_nptrange(verbose-1))!=0) {
     fprintf(stderr, "failed (%d).\n", ret); return(i);}
+  i++; if((ret=test_simC2_batch(verbose-1))!=0) {
+    fprintf(stderr, "failed (%d).\n", ret); return(i);}
+  i++; if((ret=test_tgoParallel(verbose-1))!=0) {
+    fprintf(stderr, "failed (%d).\n", ret); return(i);}
 
 
   if(verbose>0) printf("\nAll tests passed.\n\n");
@@ -2935,6 +2944,123 @@ double optfunc_rastrigin(int n, double *x, void *func_data)
 }
 /******************************************************************************/
 
+/******************************************************************************/
+/** Compare simC2_batch() against simC2() for a range of parameter sets, and
+ *  report simulated TACs per second of both in verbose mode. */
+int test_simC2_batch(int VERBOSE)
+{
+  printf("test_simC2_batch()\n");
+
+  const int frameNr=23, setNr=1000, repeats=200;
+  double t[]={0.166667,0.283333,0.366667,0.466667,0.550000,0.616667,0.716667,
+    0.833333,0.950000,1.06667,1.18333,1.31667,1.46667,1.60000,1.78333,1.95000,
+    3.70000,6.76667,11.8833,20.1167,32.0333,45.5833,57.8333};
+  double ca[]={0.0,0.0,0.0,0.0375032,0.331662,0.474564,0.592856,0.416336,
+    0.0932330,0.0784635,0.0513207,0.0438369,0.0386417,0.0339184,0.0288506,
+    0.0261968,0.0188040,0.0222774,0.0185163,0.0176231,0.0123044,0.00832840,
+    0.00534190};
+  double k1[setNr], k2[setNr], k3[setNr], k4[setNr], work[4*setNr];
+  double ct[frameNr], d, maxd=0.0, t1, t2;
+  double *bct;
+  int i, j, r, ret;
+  clock_t c;
+
+  for(j=0; j<setNr; j++) {
+    k1[j]=0.05+0.001*j; k2[j]=0.1+0.002*j;
+    k3[j]=0.0001*(j%500); k4[j]=0.001*(j%13);
+  }
+  bct=(double*)malloc(frameNr*setNr*sizeof(double)); if(bct==NULL) return 1;
+
+  ret=simC2_batch(t, ca, frameNr, setNr, k1, k2, k3, k4, bct, work);
+  if(ret!=0) {free(bct); return 2;}
+  for(j=0; j<setNr; j++) {
+    ret=simC2(t, ca, frameNr, k1[j], k2[j], k3[j], k4[j], ct, NULL, NULL);
+    if(ret!=0) {free(bct); return 3;}
+    for(i=0; i<frameNr; i++) {
+      d=fabs(ct[i]-bct[i*setNr+j]); if(d>maxd) maxd=d;
+    }
+  }
+  if(VERBOSE) printf("  max difference to simC2 := %g\n", maxd);
+  if(maxd>1.0E-12) {free(bct); return 4;}
+
+  /* Invalid parameter set must be noticed as with simC2() */
+  k1[setNr/2]=-1.0;
+  ret=simC2_batch(t, ca, frameNr, setNr, k1, k2, k3, k4, bct, NULL);
+  k1[setNr/2]=0.05+0.001*(setNr/2);
+  if(ret!=3) {free(bct); return 5;}
+
+  if(VERBOSE) {
+    c=clock();
+    for(r=0; r<repeats; r++) for(j=0; j<setNr; j++)
+      simC2(t, ca, frameNr, k1[j], k2[j], k3[j], k4[j], ct, NULL, NULL);
+    t1=(double)(clock()-c)/CLOCKS_PER_SEC;
+    c=clock();
+    for(r=0; r<repeats; r++)
+      simC2_batch(t, ca, frameNr, setNr, k1, k2, k3, k4, bct, work);
+    t2=(double)(clock()-c)/CLOCKS_PER_SEC;
+    if(t1>0.0 && t2>0.0)
+      printf("  TACs/sec: simC2 %g, simC2_batch %g\n",
+             repeats*setNr/t1, repeats*setNr/t2);
+  }
+
+  free(bct);
+  return 0;
+}
+/******************************************************************************/
+
+/******************************************************************************/
+/* Banana function, which counts its calls in the thread data */
+double optfunc_dejong2_counted(int n, double *x, void *func_data)
+{
+  if(func_data!=NULL) (*(int*)func_data)++;
+  return optfunc_dejong2(n, x, NULL);
+}
+
+int test_tgoParallel(int VERBOSE)
+{
+  printf("test_tgoParallel()\n");
+
+  const int n=4, threadNr=4;
+  const uint64_t seed=12345;
+  double xl[]={-2.0,-2.0,-2.0,-2.0}, xu[]={2.0,2.0,2.0,2.0};
+  double x1[4], xn[4], x0[4], f1, fn, f0;
+  int evalNr[4]={0,0,0,0};
+  void *data[4]={evalNr, evalNr+1, evalNr+2, evalNr+3};
+  int i, ret;
+
+  TGO_LOCAL_OPT=0; TGO_SQUARED_TRANSF=1; TGO_LOCAL_INSIDE=0;
+
+  /* One thread with thread data */
+  ret=tgoParallel(xl, xu, optfunc_dejong2_counted, NULL, data, 1, n, 10,
+                  &f1, x1, 400, 2, seed, 0);
+  if(ret!=0) {if(VERBOSE) printf("  tgoParallel() error %d\n", ret); return 1;}
+  if(evalNr[0]<1 || evalNr[1]!=0) return 2;
+  if(VERBOSE) printf("  1 thread: f=%g after %d evaluations\n", f1, evalNr[0]);
+
+  /* Several threads, each with its own data; same seed, same result */
+  for(i=0; i<threadNr; i++) evalNr[i]=0;
+  ret=tgoParallel(xl, xu, optfunc_dejong2_counted, NULL, data, threadNr, n, 10,
+                  &fn, xn, 400, 2, seed, 0);
+  if(ret!=0) {if(VERBOSE) printf("  tgoParallel() error %d\n", ret); return 3;}
+  if(VERBOSE) {
+    printf("  %d threads: f=%g after", threadNr, fn);
+    for(i=0; i<threadNr; i++) printf(" %d", evalNr[i]);
+    printf(" evaluations\n");
+  }
+  if(fn!=f1) return 4;
+  for(i=0; i<n; i++) if(xn[i]!=x1[i]) return 5;
+
+  /* Without thread data one thread is used, with the same result */
+  ret=tgoParallel(xl, xu, optfunc_dejong2_counted, NULL, NULL, 0, n, 10,
+                  &f0, x0, 400, 2, seed, 0);
+  if(ret!=0) return 6;
+  if(f0!=f1) return 7;
+  for(i=0; i<n; i++) if(x0[i]!=x1[i]) return 8;
+
+  return 0;
+}
+/******************************************************************************/
+
 /******************************************************************************/
 /* Simple Objective functions working like in model fitting programs,
    requiring global arrays simdata, measdata, pmin, pmax, p, and w, and
@@ -265,7 +265,7 @@ extern "C" int tgo(
       sampled_points[IDmin].topomin=1;
       for(k=0; k<dim; k++)
         sampled_points[IDmin].delta[k]=0.1*(uplim[k]-lowlim[k]);
-      sampled_points[i].fvalrange+=100.0*fabs(sampled_points[i].fvalue);
+      sampled_points[IDmin].fvalrange+=100.0*fabs(sampled_points[IDmin].fvalue);
       if(verbose>2) {
         printf("  ; therefore minimum was set to point %d at %e\n", 
           IDmin, sampled_points[IDmin].fvalue);
@@ -511,7 +511,8 @@ int bootstrapr(
   double *cLim1, double *cLim2, double *SD, double *parameter,
   double *lowlim, double *uplim, int frameNr, double *origTac,
   double *fitTac, double *bsTAC, int parNr, double *weight,
-  double (*objf)(int, double*, void*), char *status, int verbose, double *matrix
+  double (*objf)(int, double*, void*), void *objfData,
+  char *status, int verbose, double *matrix
 );
 
 int temp_roundf(float e);
\ No newline at end of file
@@ -25,6 +25,16 @@
 #include <iostream>
 #include <armadillo>
 #include <dlfcn.h>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// plugin providing simPatlak/simLogan for models 5 and 6; set from the Makefile,
+// otherwise looked up on the library search path
+#ifndef MTGA_IDL_LIB
+#define MTGA_IDL_LIB "libmtga_idl.so"
+#endif
 
 struct norm_data {
     double nsample;
@@ -45,6 +55,15 @@ struct norm_data {
     double tstop;
     double k2;
     double sensitivity;
+
+    // filled once by tac_lik_prepare
+    arma::vec results;
+    arma::vec dresults;     // nsample rows of nparams values d(results)/d(parameter) for the gradient samplers
+    arma::vec basis_a;
+    arma::vec basis_b;
+    unsigned int startframe;
+    unsigned int stopframe;
+    unsigned long neval;
 };
 
 double ll_dens_tpc2(const arma::vec& vals_inp, void* ll_data)
@@ -83,120 +102,163 @@ double log_pr_dens_tpc2(const arma::vec& vals_inp, void* ll_data)
     // return ret;
 }
 
-double simC2_main_rwmh(const arma::vec& vals_inp, void* ll_data)
+// Prepare the likelihood once per rwmh_tac_2tpc call: scratch TAC buffer,
+// fit-window frame range and, for the graphical models (5/6), the basis
+// curves of the Patlak/Logan plot so that no plugin is touched per draw.
+static int tac_lik_prepare(norm_data* dta)
 {
-    int rett; 
     const char *debugfile  = "debug.txt";  
-    norm_data* dta = reinterpret_cast<norm_data*>(ll_data);
     int nsample = (int)(dta->nsample);
-    int nparams = (int)(dta->nparams); 
-    bool verbose_flag = dta->debug; 
-    int startframe = 0;
-    int stopframe = nsample;
 
-    double *results  = (double *)malloc(nsample*sizeof(double));
-    double *plasma_t = (double *)malloc(nsample*sizeof(double));
-    double *plasma_c = (double *)malloc(nsample*sizeof(double));
-    double *prior    = (double *)malloc(nparams*sizeof(double));
-  
+    dta->results.zeros(nsample);
+    dta->dresults.zeros(nsample*(int)(dta->nparams));
+    dta->neval = 0;
 
-    for (int i=0; i < nsample; i++)
-    {
-        *(plasma_t+i) = (dta->plasma_t)[i];    // start from first image
-        *(plasma_c+i) = (dta->plasma_c)[i];    // start from first image
-    } 
-
-    if (dta->model == 0) {
-                  for(int i=0;i<nsample;i++) {  results[i]=vals_inp(0)*plasma_t[i]+vals_inp(1); }      }      
-    if (dta->model == 1) {
-                  rett=simC1(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1), results); }
-    if (dta->model == 2) {
-                  rett=simC2(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1),vals_inp(2),vals_inp(3), results, NULL, NULL); }
-    if (dta->model == 3) {   
-                  rett=simSRTM(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1),vals_inp(2), results); }
-    if (dta->model == 4) {   
-                  rett=simRTCM(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1),vals_inp(2),vals_inp(3), results, NULL, NULL); }
-    if (dta->model == 5) { 
-                double *plasma_t1 = (double *)malloc(nsample*sizeof(double));
-                for (int i=0; i < nsample; i++) {  *(plasma_t1+i) = (dta->plasma_t1)[i]; }
-                double tstart = (double)(dta->tstart);
-                double tstop  = (double)(dta->tstop);    
-  
-
-                void  *imglib = NULL;
-                int (*dummy)(unsigned int,double,double,double*,double*,double*,double,double,double*,unsigned int);
-                int handle;
-                imglib = dlopen("/home/tsun/bin/tpcclib-master/build/bin/libmtga_idl.so", RTLD_LAZY);   
-
-                if ( imglib != NULL ) {
-                    *(void **)(&dummy) = dlsym(imglib, "simPatlak");
-                    handle=dummy(nsample,vals_inp(0),vals_inp(1),plasma_t,plasma_t1,plasma_c,tstart,tstop,results,0);  
-                }
-                free(plasma_t1);
-                // rett=simPatlak(nsample,vals_inp(0),vals_inp(1),plasma_t,plasma_t1,tstart,tstop,results,0);  
-                } 
-    if (dta->model == 6) { 
-                double *plasma_t1 = (double *)malloc(nsample*sizeof(double));
-                for (int i=0; i < nsample; i++) {  *(plasma_t1+i) = (dta->plasma_t1)[i]; }
-                double tstart = (double)(dta->tstart);
-                double tstop  = (double)(dta->tstop);   
-                double k2     = (double)(dta->k2); 
-
-                void  *imglib = NULL;
-                int (*dummy)(unsigned int,double,double,double*,double*,double*,double,double,double*,unsigned int,double);
-                int handle;
-                imglib = dlopen("/home/tsun/bin/tpcclib-master/build/bin/libmtga_idl.so", RTLD_LAZY);
-                if ( imglib != NULL ) {
-                    *(void **)(&dummy) = dlsym(imglib, "simLogan");
-                    handle=dummy(nsample,vals_inp(0),vals_inp(1),plasma_t,plasma_t1,plasma_c,tstart,tstop,results,0,k2);  
-                }
-                free(plasma_t1);
-                // rett=simLogan(nsample,vals_inp(0),vals_inp(1),plasma_t,plasma_t1,tstart,tstop,results,0, k2);
-                }     
-    
-    if (dta->model == 7) {
-        rett = simpct(plasma_t,plasma_c,nsample,vals_inp(0),vals_inp(1),vals_inp(2), results);
+    dta->startframe = 0;
+    dta->stopframe  = nsample;
+    if (dta->tstart > 0.1) { 
+        for (int i=0; i < nsample; i++) { if (dta->plasma_t[i] > dta->tstart) { dta->startframe = i; break;}}
+        for (int i=nsample-1; i >=0; i--) { if (dta->plasma_t[i] < dta->tstop) { dta->stopframe = i+1; break;}}
     }
 
+    if (dta->model != 5 && dta->model != 6) return 0;
 
-    arma::vec result1(nsample);
-    for (int i=0; i < nsample; i++)
-    {
-        result1(i) = *(results+i);    // start from first image
+    // Patlak and Logan curves are linear in both parameters, output = p0*basis_a + p1*basis_b,
+    // so simulate them once with unit parameters and keep the two basis curves
+    dta->basis_a.zeros(nsample);
+    dta->basis_b.zeros(nsample);
+
+    void  *imglib = NULL;
+    imglib = dlopen(MTGA_IDL_LIB, RTLD_LAZY);
+    if ( imglib == NULL ) {
+        FILE *pfile = fopen(debugfile, "a+");
+        fprintf(pfile, "cannot open %s\n", MTGA_IDL_LIB);
+        fclose(pfile);
+        return 1;
     }
 
-    if (dta->tstart > 0.1) { 
-        for (int i=0; i < nsample; i++) { if (plasma_t[i] > dta->tstart) { startframe = i; break;}}
-        for (int i=nsample-1; i >=0; i--) { if (plasma_t[i] < dta->tstop) { stopframe = i+1; break;}}
-        }
-    // printf("startframe stopframe %d %d",startframe,stopframe);
+    if (dta->model == 5) {
+        int (*dummy)(unsigned int,double,double,double*,double*,double*,double,double,double*,unsigned int);
+        *(void **)(&dummy) = dlsym(imglib, "simPatlak");
+        if (dummy == NULL) { dlclose(imglib); return 2; }
+        dummy(nsample,1.0,0.0,dta->plasma_t.memptr(),dta->plasma_t1.memptr(),dta->plasma_c.memptr(),
+              dta->tstart,dta->tstop,dta->basis_a.memptr(),0);
+        dummy(nsample,0.0,1.0,dta->plasma_t.memptr(),dta->plasma_t1.memptr(),dta->plasma_c.memptr(),
+              dta->tstart,dta->tstop,dta->basis_b.memptr(),0);
+    }
+    if (dta->model == 6) {
+        int (*dummy)(unsigned int,double,double,double*,double*,double*,double,double,double*,unsigned int,double);
+        *(void **)(&dummy) = dlsym(imglib, "simLogan");
+        if (dummy == NULL) { dlclose(imglib); return 2; }
+        dummy(nsample,1.0,0.0,dta->plasma_t.memptr(),dta->plasma_t1.memptr(),dta->plasma_c.memptr(),
+              dta->tstart,dta->tstop,dta->basis_a.memptr(),0,dta->k2);
+        dummy(nsample,0.0,1.0,dta->plasma_t.memptr(),dta->plasma_t1.memptr(),dta->plasma_c.memptr(),
+              dta->tstart,dta->tstop,dta->basis_b.memptr(),0,dta->k2);
+    }
+    dlclose(imglib);
+
+    return 0;
+}
+
+// Simulate the model TAC for one parameter set into the prepared scratch buffer
+static int tac_lik_sim(const arma::vec& vals_inp, norm_data* dta)
+{
+    int rett = 0;
+    int nsample = (int)(dta->nsample);
+    double *plasma_t = dta->plasma_t.memptr();
+    double *plasma_c = dta->plasma_c.memptr();
+    double *results  = dta->results.memptr();
+
+    switch (dta->model) {
+    case 0:
+        for(int i=0;i<nsample;i++) {  results[i]=vals_inp(0)*plasma_t[i]+vals_inp(1); }
+        break;
+    case 1:
+        rett=simC1(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1), results); break;
+    case 2:
+        rett=simC2(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1),vals_inp(2),vals_inp(3), results, NULL, NULL); break;
+    case 3:
+        rett=simSRTM(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1),vals_inp(2), results); break;
+    case 4:
+        rett=simRTCM(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1),vals_inp(2),vals_inp(3), results, NULL, NULL); break;
+    case 5:
+    case 6: {
+        const double *ba = dta->basis_a.memptr();
+        const double *bb = dta->basis_b.memptr();
+        for(int i=0;i<nsample;i++) {  results[i]=vals_inp(0)*ba[i]+vals_inp(1)*bb[i]; }
+        break; }
+    case 7:
+        rett=simpct(plasma_t,plasma_c,nsample,vals_inp(0),vals_inp(1),vals_inp(2), results); break;
+    }
+    dta->neval++;
+
+    return rett;
+}
+
+// Simulate the model TAC and its derivatives w.r.t. the parameters in one pass
+static int tac_lik_sim_grad(const arma::vec& vals_inp, norm_data* dta)
+{
+    int rett = 0;
+    int nsample = (int)(dta->nsample);
+    double *plasma_t = dta->plasma_t.memptr();
+    double *plasma_c = dta->plasma_c.memptr();
+    double *results  = dta->results.memptr();
+    double *dresults = dta->dresults.memptr();
+    int np = (int)(dta->nparams);
+
+    switch (dta->model) {
+    case 0:
+        for(int i=0;i<nsample;i++) {  
+            results[i]=vals_inp(0)*plasma_t[i]+vals_inp(1); 
+            dresults[i*np]=plasma_t[i]; dresults[i*np+1]=1.0; }
+        break;
+    case 1:
+        rett=simC1_d(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1), results, dresults, np); break;
+    case 2:
+        rett=simC2_d(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1),vals_inp(2),vals_inp(3), results, dresults, np); break;
+    case 3:
+        rett=simSRTM_d(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1),vals_inp(2), results, dresults, np); break;
+    case 4:
+        rett=simRTCM_d(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1),vals_inp(2),vals_inp(3), results, dresults, np); break;
+    case 5:
+    case 6: {
+        const double *ba = dta->basis_a.memptr();
+        const double *bb = dta->basis_b.memptr();
+        for(int i=0;i<nsample;i++) {  
+            results[i]=vals_inp(0)*ba[i]+vals_inp(1)*bb[i]; 
+            dresults[i*np]=ba[i]; dresults[i*np+1]=bb[i]; }
+        break; }
+    case 7:
+        rett=simpct_d(plasma_t,plasma_c,nsample,vals_inp(0),vals_inp(1),vals_inp(2), results, dresults, np); break;
+    }
+    dta->neval++;
+
+    return rett;
+}
+
+double simC2_main_rwmh(const arma::vec& vals_inp, void* ll_data)
+{
+    norm_data* dta = reinterpret_cast<norm_data*>(ll_data);
+    int nparams = (int)(dta->nparams); 
+
+    tac_lik_sim(vals_inp, dta);
+
+    const double *results  = dta->results.memptr();
+    const double *tissue_c = dta->tissue_c.memptr();
+    const double *weight   = dta->weight.memptr();
     double ret = 0.0;
-	// arma::vec weight(nsample);
-	for (int i=startframe; i < stopframe; i++)
-    {  ret -= (dta->weight)[i]*(result1[i]-(dta->tissue_c)[i]) *(result1[i]-(dta->tissue_c)[i]);     ///1e5 before there is no such scale and does not work 
+	for (unsigned int i=dta->startframe; i < dta->stopframe; i++)
+    {  double d = results[i]-tissue_c[i]; ret -= weight[i]*d*d;     ///1e5 before there is no such scale and does not work 
     }  
 
     if (dta->useprior ==1) {
-        for (int j=startframe; j < stopframe; j++)
-        {  unsigned int lambda = 1.0; double sigma=1.0; ret -= lambda* (vals_inp[j]-prior[j])*sigma*(vals_inp[j]-prior[j]); 
+        for (int j=0; j < nparams; j++)
+        {  double lambda = 1.0; double sigma=1.0; ret -= lambda* (vals_inp[j]-dta->prior[j])*sigma*(vals_inp[j]-dta->prior[j]); 
         }
     }
 
     ret *= dta->sensitivity; //1e3; //1e2;   ///////////////
 
-    //  const double ret = - arma::accu(arma::pow(result1-dta->tissue_c,2))  *100000;   /// before there is no such scale and does not work
-    if (verbose_flag) {
-        FILE *pfile = fopen(debugfile, "a+");
-    // fprintf(pfile, "rett value %f %f %f %f %d supplied\n", (dta->weight)(0), (dta->weight)(1),(dta->weight)(2),(dta->weight)(3), nsample);
-    fprintf(pfile, "ret value %f %f %f %f %f supplied\n", vals_inp(0), vals_inp(1), vals_inp(2), vals_inp(3), ret);
-    fclose(pfile);
-    }
-
-    free(results);  
-    free(plasma_t); 
-    free(plasma_c); 
-    free(prior); 
-
      return ret;
     //return ll_dens(vals_inp,ll_data) + log_pr_dens(vals_inp,ll_data);
 }
@@ -204,115 +266,62 @@ double simC2_main_rwmh(const arma::vec& vals_inp, void* ll_data)
 
 double simC2_main_hmc(const arma::vec& vals_inp, arma::vec* grad_out, void* ll_data)
 {
-    int rett; 
-    const char *debugfile  = "debug.txt";  
     norm_data* dta = reinterpret_cast<norm_data*>(ll_data);
     int nsample = (int)(dta->nsample); 
-    bool verbose_flag = dta->debug; 
-
-    double *results = (double *)malloc(nsample*sizeof(double));
-    double *plasma_t = (double *)malloc(nsample*sizeof(double));
-    double *plasma_c = (double *)malloc(nsample*sizeof(double));
+    int nparams = (int)(dta->nparams); 
 
-    for (int i=0; i < nsample; i++)
-    {
-        *(plasma_t+i) = (dta->plasma_t)[i];    // start from first image
-        *(plasma_c+i) = (dta->plasma_c)[i];    // start from first image
-    } 
-
-    if (dta->model == 0) {
-                  for(int i=0;i<nsample;i++) {  results[i]=vals_inp(0)*plasma_t[i]+vals_inp(1); }    }
-    if (dta->model == 1) {
-                  rett=simC1(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1), results); }
-    if (dta->model == 2) {
-                  rett=simC2(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1),vals_inp(2),vals_inp(3), results, NULL, NULL); }
-    if (dta->model == 3) {   
-                  rett=simSRTM(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1),vals_inp(2), results); }
-    if (dta->model == 4) {   
-                  rett=simRTCM(plasma_t, plasma_c, nsample, vals_inp(0),vals_inp(1),vals_inp(2),vals_inp(3), results, NULL, NULL); }
-    if (dta->model == 5) { 
-                double *plasma_t1 = (double *)malloc(nsample*sizeof(double));
-                for (int i=0; i < nsample; i++) {  *(plasma_t1+i) = (dta->plasma_t1)[i]; }
-                double tstart = (double)(dta->tstart);
-                double tstop  = (double)(dta->tstop);    
-
-                void  *imglib = NULL;
-                int (*dummy)(unsigned int,double,double,double*,double*,double*,double,double,double*,unsigned int);
-                int handle;
-                imglib = dlopen("/home/tsun/bin/tpcclib-master/build/bin/libmtga_idl.so", RTLD_LAZY);
-                if ( imglib != NULL ) {
-                    *(void **)(&dummy) = dlsym(imglib, "simPatlak");
-                    handle=dummy(nsample,vals_inp(0),vals_inp(1),plasma_t,plasma_t1,plasma_c,tstart,tstop,results,0);  
-                }
-                free(plasma_t1);
-                // rett=simPatlak(nsample,vals_inp(0),vals_inp(1),plasma_t,plasma_t1,tstart,tstop,results,0);  
-                } 
-    if (dta->model == 6) { 
-                double *plasma_t1 = (double *)malloc(nsample*sizeof(double));
-                for (int i=0; i < nsample; i++) {  *(plasma_t1+i) = (dta->plasma_t1)[i]; }
-                double tstart = (double)(dta->tstart);
-                double tstop  = (double)(dta->tstop);   
-                double k2     = (double)(dta->k2); 
-
-                void  *imglib = NULL;
-                int (*dummy)(unsigned int,double,double,double*,double*,double*,double,double,double*,unsigned int,double);
-                int handle;
-                imglib = dlopen("/home/tsun/bin/tpcclib-master/build/bin/libmtga_idl.so", RTLD_LAZY);
-                if ( imglib != NULL ) {
-                    *(void **)(&dummy) = dlsym(imglib, "simLogan");
-                    handle=dummy(nsample,vals_inp(0),vals_inp(1),plasma_t,plasma_t1,plasma_c,tstart,tstop,results,0,k2);  
-                }
-                free(plasma_t1);
-                // rett=simLogan(nsample,vals_inp(0),vals_inp(1),plasma_t,plasma_t1,tstart,tstop,results,0, k2);
-                } 
-
-    if (dta->model == 7) {
-         rett = simpct(plasma_t,plasma_c,nsample,vals_inp(0),vals_inp(1),vals_inp(2), results);
-    }
-
-    arma::vec result1(nsample);
-    for (int i=0; i < nsample; i++)
-    {
-        result1(i) = *(results+i);    // start from first image
+    if (grad_out) {
+        tac_lik_sim_grad(vals_inp, dta);
+    } else {
+        tac_lik_sim(vals_inp, dta);
     }
 
+    const double *results  = dta->results.memptr();
+    const double *tissue_c = dta->tissue_c.memptr();
+    const double *weight   = dta->weight.memptr();
     double ret = 0.0;
-	// arma::vec weight(nsample);
 	for (int i=0; i < nsample; i++)
     {
     // need to be modified to incorporate prior
-      ret -= (dta->weight)[i]*(result1[i]-(dta->tissue_c)[i]) *(result1[i]-(dta->tissue_c)[i]);  //  *1e5;     ///1e5 before there is no such scale and does not work
+      double d = results[i]-tissue_c[i]; ret -= weight[i]*d*d;  //  *1e5;     ///1e5 before there is no such scale and does not work
     }
-    //  const double ret = - arma::accu(arma::pow(result1-dta->tissue_c,2))  *100000;   /// before there is no such scale and does not work
-    if (verbose_flag) {
-        FILE *pfile = fopen(debugfile, "a+");
-        fprintf(pfile, "ret value %f %f %d supplied\n", vals_inp(0), ret, verbose_flag);
-        fclose(pfile);
+
+    // analytic gradient of the weighted SSE from the model sensitivities
+    if (grad_out) {
+        const double *dresults = dta->dresults.memptr();
+        grad_out->zeros(nparams);
+        for (int i=0; i < nsample; i++) {
+            double r = 2.0*weight[i]*(results[i]-tissue_c[i]);
+            for (int j=0; j < nparams; j++) { (*grad_out)(j) -= r*dresults[i*nparams+j]; }
+        }
     }
-    free(results);  
-    free(plasma_t); 
-    free(plasma_c); 
-    // if (dta->model == 5 || dta->model == 6) {  free(plasma_t1); }
+
      return ret;
     //return ll_dens(vals_inp,ll_data) + log_pr_dens(vals_inp,ll_data);
 }
 
-extern "C" int rwmh_tac_2tpc(int argc, float * argv[])
-{
-    const char *debugfile  = "debug.txt";  
-
-
-    /* debug */
-    if (argc > 23 || argc <= 1) {
-        FILE *pfile = fopen(debugfile, "a+");
-        fprintf(pfile, "NIproj3d: 22 arguments required, %d supplied\n", argc);
-        fclose(pfile);
-        return -1;
-    }
+// Sampler settings shared by the single and multi-chain entry points
+struct tac_run {
+    arma::vec initial_val;
+    arma::vec lb;
+    arma::vec ub;
+    double par_scale;
+    double step_size;
+    unsigned int n_burnin;
+    unsigned int n_draws;
+    unsigned int mcmc;
+    float *output;
+};
 
-    norm_data dta;
+// Read argv[0..18] as documented for rwmh_tac_2tpc; the optional Patlak/Logan
+// arguments (plasma_t1, tstart, tstop, k2) start at argv[optarg]
+static int tac_parse_args(int argc, float * argv[], int optarg, norm_data& dta, tac_run& run)
+{
     unsigned int nsample = *(unsigned int*) argv[0];
     dta.nsample = nsample;
+    dta.tstart = 0.0;
+    dta.tstop  = 0.0;
+    dta.k2     = -1.0;
 
     unsigned int usemodel = *(unsigned int*)argv[14];
     dta.model = usemodel;
@@ -321,180 +330,444 @@ extern "C" int rwmh_tac_2tpc(int argc, float * argv[])
     if (dta.model == 0 || dta.model == 1 || dta.model == 5 || dta.model == 6) { dta.nparams = 2; };
     if (dta.model == 2 || dta.model == 3 || dta.model == 4) { dta.nparams = 4; };
     if (dta.model == 7) { dta.nparams = 3; };
+    unsigned int nparams = (unsigned int)dta.nparams;
 
     double *x_dta = (double *)argv[1];
-    arma::vec tac(nsample);
-    for (int i=0;i<nsample;i++) {
-       tac[i] = *(x_dta+i);
-    }
-    dta.tissue_c = tac;
+    dta.tissue_c.set_size(nsample);
+    for (unsigned int i=0;i<nsample;i++) { dta.tissue_c[i] = *(x_dta+i); }
 
     double *y_dta = (double *)argv[2];
-    arma::vec plasma_t(nsample);
-    for (int i=0;i<nsample;i++) {
-       plasma_t[i] = *(y_dta+i);
-    }
-    dta.plasma_t = plasma_t;
+    dta.plasma_t.set_size(nsample);
+    for (unsigned int i=0;i<nsample;i++) { dta.plasma_t[i] = *(y_dta+i); }
 
     double *z_dta = (double *)argv[3];
-    arma::vec plasma_c(nsample);
-    for (int i=0;i<nsample;i++) {
-       plasma_c[i] = *(z_dta+i);
-    }
-    dta.plasma_c = plasma_c;
+    dta.plasma_c.set_size(nsample);
+    for (unsigned int i=0;i<nsample;i++) { dta.plasma_c[i] = *(z_dta+i); }
 
     double *w_dta = (double *)argv[4];
-    arma::vec weight(nsample);
-    for (int i=0;i<nsample;i++) {
-       weight[i] = *(w_dta+i);
-    }
-    dta.weight = weight;
+    dta.weight.set_size(nsample);
+    for (unsigned int i=0;i<nsample;i++) { dta.weight[i] = *(w_dta+i); }
 
     double *pri = (double *)argv[5];
-    arma::vec prior(dta.nparams);
-    for (int i=0;i<dta.nparams;i++) {
-       prior[i] = *(pri+i);
-    }
-    dta.prior = prior;
+    dta.prior.set_size(nparams);
+    for (unsigned int i=0;i<nparams;i++) { dta.prior[i] = *(pri+i); }
 
-    float *output = (float*)argv[6]; 
- 
-
-    // double K1 = *(double*)argv[7];
-    // double k2 = *(double*)argv[8];
-    // double k3 = *(double*)argv[9];
-    // double k4 = *(double*)argv[10];
+    run.output = (float*)argv[6]; 
 
     double *iv = (double *)argv[7];
-    arma::vec initial_val(dta.nparams);
-    for (int i=0;i<dta.nparams;i++) {
-       initial_val[i] = *(iv+i);
-    }
+    run.initial_val.set_size(nparams);
+    for (unsigned int i=0;i<nparams;i++) { run.initial_val[i] = *(iv+i); }
 
     double *lowb = (double *)argv[8];
-    arma::vec lb(dta.nparams);
-    for (int i=0;i<dta.nparams;i++) {
-       lb[i] = *(lowb+i);
-    }
+    run.lb.set_size(nparams);
+    for (unsigned int i=0;i<nparams;i++) { run.lb[i] = *(lowb+i); }
 
     double *highb = (double *)argv[9];
-    arma::vec ub(dta.nparams);
-    for (int i=0;i<dta.nparams;i++) {
-       ub[i] = *(highb+i);
-    }
-
-    double par_scale = *(double*)argv[10];
-    double step_size  = *(double*)argv[11];
+    run.ub.set_size(nparams);
+    for (unsigned int i=0;i<nparams;i++) { run.ub[i] = *(highb+i); }
 
-    unsigned int n_burnin  = *(unsigned int*)argv[12]; 
-    unsigned int n_draws   = *(unsigned int*)argv[13];  
+    run.par_scale = *(double*)argv[10];
+    run.step_size = *(double*)argv[11];
+    run.n_burnin  = *(unsigned int*)argv[12]; 
+    run.n_draws   = *(unsigned int*)argv[13];  
 
-    // double lb0 = *(double*)argv[15];
-    // double lb1 = *(double*)argv[16];
-    // double lb2 = *(double*)argv[17];
-    // double lb3 = *(double*)argv[18];
-
-    // double ub0 = *(double*)argv[19];
-    // double ub1 = *(double*)argv[20];
-    // double ub2 = *(double*)argv[21];
-    // double ub3 = *(double*)argv[22];
-
-    unsigned int verbose_flag = *(unsigned int*)argv[15];
-    dta.debug = verbose_flag;
-
-    unsigned int mcmc = *(unsigned int*)argv[16];
-
-    unsigned int useprior = *(unsigned int*)argv[17];
-    dta.useprior = useprior;
+    dta.debug = *(unsigned int*)argv[15];
+    run.mcmc  = *(unsigned int*)argv[16];
+    dta.useprior = *(unsigned int*)argv[17];
     
     dta.sensitivity  = *(double*)argv[18];   
     if (dta.sensitivity == 0.0) { dta.sensitivity = 1.0; }
 
-    // if ((double *)argv[18] != NULL) {
-    if (argc > 19) {
+    if (argc > optarg) {
         printf("Sampling with PATLAK or LOGAN model!\n"); 
-        double *y_dta = (double *)argv[19];
-        arma::vec plasma_t1(nsample);
-        for (int i=0;i<nsample;i++) {
-            plasma_t1[i] = *(y_dta+i);
-        }
-        dta.plasma_t1 = plasma_t1;
+        double *t1_dta = (double *)argv[optarg];
+        dta.plasma_t1.set_size(nsample);
+        for (unsigned int i=0;i<nsample;i++) { dta.plasma_t1[i] = *(t1_dta+i); }
 
-        double tstart = *(double*)argv[20]; dta.tstart = tstart;
-        double tstop  = *(double*)argv[21]; dta.tstop = tstop; 
-    
-    if ((double *)argv[22] != NULL) {    double k2     = *(double*)argv[21]; dta.k2 = k2;  }
+        dta.tstart = *(double*)argv[optarg+1];
+        dta.tstop  = *(double*)argv[optarg+2]; 
+        if (argc > optarg+3 && (double *)argv[optarg+3] != NULL) { dta.k2 = *(double*)argv[optarg+3]; }
     }
 
-    // if (verbose_flag) {
-    //     FILE *pfile = fopen(debugfile, "a+");
-    //     fprintf(pfile, " %f %f %f %f supplied\n", initial_val(0),initial_val(1),initial_val(2),initial_val(3));
-    //     fprintf(pfile, " %f %f %f %f supplied\n", lb(0),lb(1),lb(2),lb(3));
-    //     fprintf(pfile, " %f %f %f %f supplied\n", ub(0),ub(1),ub(2),ub(3));
-    //     fclose(pfile);
-    // }
-    // initial estimate
-    // arma::vec initial_val(4);
-    // initial_val(0) = K1;
-    // initial_val(1) = k2;
-    // initial_val(2) = k3;
-    // initial_val(3) = k4;
-
-    // // arma::vec ub(1);
-    // // ub(0) = 1.0;
-    // arma::vec lb(4);
-    // // lb(0) = -arma::datum::inf;
-    // lb(0) = lb0;
-    // lb(1) = lb1;
-    // lb(2) = lb2;
-    // lb(3) = lb3;
-
-    // arma::vec ub(4);
-    // ub(0) = ub0;
-    // ub(1) = ub1;
-    // ub(2) = ub2;
-    // ub(3) = ub3;
-    // // ub(0) = arma::datum::inf;
-
-
-    // mcmc setting
+    return 0;
+}
+
+// Run one chain of the selected sampler from start; draws is n_draws x nparams
+static void tac_sample(norm_data& dta, const tac_run& run, const arma::vec& start,
+                       unsigned int n_burnin, unsigned int n_draws, arma::mat& draws, double& accept_rate)
+{
     mcmc::algo_settings_t settings;
 
     settings.vals_bound = true;
-    settings.lower_bounds = lb;
-    settings.upper_bounds = ub;
+    settings.lower_bounds = run.lb;
+    settings.upper_bounds = run.ub;
 
-    arma::vec grad_out;
-    arma::mat draws_out;
-    if (mcmc==0) {
-         settings.rwmh_par_scale = par_scale;
+    if (run.mcmc==0) {
+         settings.rwmh_par_scale = run.par_scale;
          settings.rwmh_n_burnin = n_burnin;
          settings.rwmh_n_draws  = n_draws;
-        
-         mcmc::rwmh(initial_val,draws_out,simC2_main_rwmh,&dta,settings);
+         mcmc::rwmh(start,draws,simC2_main_rwmh,&dta,settings);
+         accept_rate = settings.rwmh_accept_rate;
      }
-    if (mcmc==1) { 
-        //  settings.hmc_par_scale = par_scale;
-         settings.hmc_step_size = step_size;
+    if (run.mcmc==1) { 
+         settings.hmc_step_size = run.step_size;
          settings.hmc_n_burnin = n_burnin;
          settings.hmc_n_draws  = n_draws;
-         mcmc::hmc(initial_val,draws_out,simC2_main_hmc,&dta,settings);
+         mcmc::hmc(start,draws,simC2_main_hmc,&dta,settings);
+         accept_rate = settings.hmc_accept_rate;
+    }
+    if (run.mcmc==2) { 
+         settings.mala_step_size = run.step_size;
+         settings.mala_n_burnin = n_burnin;
+         settings.mala_n_draws  = n_draws;
+         mcmc::mala(start,draws,simC2_main_hmc,&dta,settings);
+         accept_rate = settings.mala_accept_rate;
+    }
+}
+
+// Split-R-hat (Gelman et al., BDA3) of parameter j from the first n draws of each chain
+static double tac_split_rhat(const std::vector<arma::mat>& chains, unsigned int n, unsigned int j)
+{
+    unsigned int h = n/2;
+    unsigned int m = 2*chains.size();
+    if (h < 2) return arma::datum::inf;
+
+    double W = 0.0, mean_all = 0.0;
+    std::vector<double> means(m);
+    for (unsigned int s=0; s < m; s++) {
+        const double *x = chains[s/2].colptr(j) + (s%2)*h;
+        double mu = 0.0, var = 0.0;
+        for (unsigned int i=0; i < h; i++) { mu += x[i]; }
+        mu /= h;
+        for (unsigned int i=0; i < h; i++) { var += (x[i]-mu)*(x[i]-mu); }
+        W += var/(h-1);
+        means[s] = mu; mean_all += mu;
+    }
+    W /= m; mean_all /= m;
+    double B = 0.0;
+    for (unsigned int s=0; s < m; s++) { B += (means[s]-mean_all)*(means[s]-mean_all); }
+    B *= (double)h/(m-1);
+
+    if (W <= 0.0) return 1.0;
+    double var_plus = (h-1.0)/h*W + B/h;
+    return std::sqrt(var_plus/W);
+}
+
+// Effective sample size of parameter j over the split chains, autocorrelations summed
+// with Geyer's initial positive sequence (as in Stan)
+static double tac_ess(const std::vector<arma::mat>& chains, unsigned int n, unsigned int j)
+{
+    unsigned int h = n/2;
+    unsigned int m = 2*chains.size();
+    if (h < 4) return 0.0;
+
+    std::vector<double> means(m);
+    double W = 0.0, mean_all = 0.0;
+    for (unsigned int s=0; s < m; s++) {
+        const double *x = chains[s/2].colptr(j) + (s%2)*h;
+        double mu = 0.0, var = 0.0;
+        for (unsigned int i=0; i < h; i++) { mu += x[i]; }
+        mu /= h;
+        for (unsigned int i=0; i < h; i++) { var += (x[i]-mu)*(x[i]-mu); }
+        W += var/(h-1);
+        means[s] = mu; mean_all += mu;
+    }
+    W /= m; mean_all /= m;
+    double B = 0.0;
+    for (unsigned int s=0; s < m; s++) { B += (means[s]-mean_all)*(means[s]-mean_all); }
+    B *= (double)h/(m-1);
+    double var_plus = (h-1.0)/h*W + B/h;
+    if (var_plus <= 0.0) return (double)m*h;
+
+    // rho_t = 1 - (W - mean autocovariance at lag t) / var_plus
+    double tau = -1.0;
+    for (unsigned int t=0; t+1 < h; t+=2) {
+        double pair = 0.0;
+        for (unsigned int l=t; l < t+2; l++) {
+            double acov = 0.0;
+            for (unsigned int s=0; s < m; s++) {
+                const double *x = chains[s/2].colptr(j) + (s%2)*h;
+                double a = 0.0;
+                for (unsigned int i=0; i+l < h; i++) { a += (x[i]-means[s])*(x[i+l]-means[s]); }
+                acov += a/h;
+            }
+            acov /= m;
+            pair += 1.0 - (W - acov)/var_plus;
+        }
+        if (pair <= 0.0) break;
+        tau += 2.0*pair;
+    }
+    if (tau <= 0.0) tau = 1.0;
+    return (double)m*h/tau;
+}
+
+extern "C" int rwmh_tac_2tpc(int argc, float * argv[])
+{
+    const char *debugfile  = "debug.txt";  
+
+
+    /* debug */
+    if (argc > 23 || argc <= 1) {
+        FILE *pfile = fopen(debugfile, "a+");
+        fprintf(pfile, "NIproj3d: 22 arguments required, %d supplied\n", argc);
+        fclose(pfile);
+        return -1;
     }
 
+    norm_data dta;
+    tac_run run;
+    tac_parse_args(argc, argv, 19, dta, run);
+
+    if (tac_lik_prepare(&dta) != 0) { return -2; }
+
+    arma::mat draws_out;
+    double accept_rate = 0.0;
+    std::chrono::steady_clock::time_point tic = std::chrono::steady_clock::now();
+    tac_sample(dta, run, run.initial_val, run.n_burnin, run.n_draws, draws_out, accept_rate);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tic).count();
 
     // force saving in arma_ascii format
     draws_out.save("A.txt", arma::arma_ascii);
 
     // if(verbose_flag) {
      FILE *pfile = fopen(debugfile, "a+");
-        fprintf(pfile, "rwmh_accept_rate, %f \n", settings.rwmh_accept_rate);
+        fprintf(pfile, "rwmh_accept_rate, %f \n", accept_rate);
+        fprintf(pfile, "likelihood evaluations, %lu in %f s, %f evaluations/sec \n", 
+                dta.neval, elapsed, elapsed > 0.0 ? dta.neval/elapsed : 0.0);
         fclose(pfile);
     // }
 
-    for(int i=0; i <draws_out.size(); i++) {
-        *(output+i) = draws_out[i];
+    for(unsigned int i=0; i <draws_out.size(); i++) {
+        *(run.output+i) = draws_out[i];
     }
 
 
+    return 0;
+}
+
+// Multi-chain version of rwmh_tac_2tpc: n_chains independent chains started from the 
+// initial value (chain 0) and from points dispersed inside the lb/ub box, run in 
+// parallel with OpenMP. Split-R-hat and ESS are computed in-process; if rhat_stop > 0 
+// the draws are taken in rounds and sampling ends once all split-R-hats are below it.
+//
+// argv[0..18] as in rwmh_tac_2tpc, output must hold n_chains*n_draws*nparams values
+// argv[19] n_chains   (unsigned int)
+// argv[20] seed       (unsigned int)
+// argv[21] rhat_stop  (double, 0 = always take n_draws)
+// argv[22] diag       (double array of 2*nparams+1: split-R-hat, ESS, draws per chain)
+// argv[23..26] optional plasma_t1, tstart, tstop, k2 as argv[19..22] of rwmh_tac_2tpc
+//
+// output holds the chains stacked per parameter: output[(j*n_chains + c)*ndone + i],
+// where ndone = diag[2*nparams] is the number of draws kept per chain
+extern "C" int rwmh_tac_2tpc_chains(int argc, float * argv[])
+{
+    const char *debugfile  = "debug.txt";  
+
+    if (argc > 27 || argc < 23) {
+        FILE *pfile = fopen(debugfile, "a+");
+        fprintf(pfile, "rwmh_tac_2tpc_chains: 23 to 27 arguments required, %d supplied\n", argc);
+        fclose(pfile);
+        return -1;
+    }
+
+    norm_data dta;
+    tac_run run;
+    tac_parse_args(argc, argv, 23, dta, run);
+
+    unsigned int n_chains  = *(unsigned int*)argv[19];
+    unsigned int seed      = *(unsigned int*)argv[20];
+    double rhat_stop       = *(double*)argv[21];
+    double *diag           = (double *)argv[22];
+    if (n_chains < 1) { n_chains = 1; }
+    unsigned int nparams = (unsigned int)dta.nparams;
+
+    if (tac_lik_prepare(&dta) != 0) { return -2; }
+
+    // dispersed starting points inside the box, chain 0 from the initial value
+    std::vector<arma::vec> start(n_chains, run.initial_val);
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> unif(0.1, 0.9);
+    for (unsigned int c=1; c < n_chains; c++) {
+        for (unsigned int j=0; j < nparams; j++) { start[c][j] = run.lb[j] + (run.ub[j]-run.lb[j])*unif(gen); }
+    }
+
+    // each chain owns its scratch buffers
+    std::vector<norm_data> cdta(n_chains, dta);
+    std::vector<arma::mat> chains(n_chains);
+    std::vector<double> accept(n_chains, 0.0);
+    for (unsigned int c=0; c < n_chains; c++) { chains[c].zeros(run.n_draws, nparams); }
+
+    unsigned int chunk = run.n_draws;
+    if (rhat_stop > 0.0) { chunk = std::max(100u, run.n_draws/10); }
+
+    unsigned int ndone = 0, round = 0;
+    double maxrhat = arma::datum::inf;
+    std::chrono::steady_clock::time_point tic = std::chrono::steady_clock::now();
+    while (ndone < run.n_draws) {
+        unsigned int nb = (ndone == 0) ? run.n_burnin : 0;
+        unsigned int nd = std::min(chunk, run.n_draws - ndone);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int c=0; c < (int)n_chains; c++) {
+            // stream depends on chain and round only, not on the thread that runs it
+            arma::arma_rng::set_seed(seed + 1000003u*(c+1) + round);
+            arma::mat part;
+            tac_sample(cdta[c], run, start[c], nb, nd, part, accept[c]);
+            for (unsigned int j=0; j < nparams; j++) {
+                for (unsigned int i=0; i < nd; i++) { chains[c](ndone+i, j) = part(i, j); }
+                start[c][j] = part(nd-1, j);
+            }
+        }
+        ndone += nd; round++;
+
+        if (rhat_stop > 0.0) {
+            maxrhat = 0.0;
+            for (unsigned int j=0; j < nparams; j++) { maxrhat = std::max(maxrhat, tac_split_rhat(chains, ndone, j)); }
+            if (dta.debug) {
+                FILE *pfile = fopen(debugfile, "a+");
+                fprintf(pfile, "round %u, draws per chain %u, max split-R-hat %f\n", round, ndone, maxrhat);
+                fclose(pfile);
+            }
+            if (maxrhat < rhat_stop) break;
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tic).count();
+
+    for (unsigned int j=0; j < nparams; j++) {
+        diag[j]         = tac_split_rhat(chains, ndone, j);
+        diag[nparams+j] = tac_ess(chains, ndone, j);
+    }
+    diag[2*nparams] = ndone;
+
+    for (unsigned int j=0; j < nparams; j++) {
+        for (unsigned int c=0; c < n_chains; c++) {
+            const double *x = chains[c].colptr(j);
+            float *out = run.output + ((size_t)j*n_chains + c)*ndone;
+            for (unsigned int i=0; i < ndone; i++) { out[i] = x[i]; }
+        }
+    }
+
+    unsigned long neval = 0;
+    for (unsigned int c=0; c < n_chains; c++) { neval += cdta[c].neval; }
+    FILE *pfile = fopen(debugfile, "a+");
+    for (unsigned int c=0; c < n_chains; c++) { fprintf(pfile, "chain %u accept_rate, %f \n", c, accept[c]); }
+    fprintf(pfile, "likelihood evaluations, %lu in %f s, %f evaluations/sec \n", 
+            neval, elapsed, elapsed > 0.0 ? neval/elapsed : 0.0);
+    fclose(pfile);
+
+    return 0;
+}
+
+// Posterior mean, SD and 2.5/50/97.5% quantiles of column j of the draws; buf is reused
+static void tac_summary(const arma::mat& draws, unsigned int j, std::vector<double>& buf,
+                        double& mean, double& sd, double q[3])
+{
+    unsigned int n = draws.n_rows;
+    const double *x = draws.colptr(j);
+    double mu = 0.0, m2 = 0.0;
+    for (unsigned int i=0; i < n; i++) {
+        double d = x[i]-mu; mu += d/(i+1); m2 += d*(x[i]-mu);
+    }
+    mean = mu;
+    sd = (n > 1) ? std::sqrt(m2/(n-1)) : 0.0;
+
+    const double prob[3] = {0.025, 0.5, 0.975};
+    buf.assign(x, x+n);
+    for (int k=0; k < 3; k++) {
+        size_t pos = (size_t)(prob[k]*(n-1) + 0.5);
+        std::nth_element(buf.begin(), buf.begin()+pos, buf.end());
+        q[k] = buf[pos];
+    }
+}
+
+// Whole-image version of rwmh_tac_2tpc: samples every masked voxel of a dynamic 
+// image against one shared input function with OpenMP threads and writes posterior 
+// summaries into parametric images instead of the draws.
+//
+// argv[0..18] as in rwmh_tac_2tpc, except
+//   argv[1] TACs of all voxels, nvox*nsample doubles with voxel index fastest 
+//           (IDL img[ncol,nrow,nplane,nframe] layout)
+//   argv[6] posterior mean image, nvox*nparams floats (IDL fltarr(ncol,nrow,nplane,nparams))
+// argv[19] nvox       (unsigned int)
+// argv[20] mask       (int array of nvox, nonzero voxels are sampled; NULL = all)
+// argv[21] seed       (unsigned int)
+// argv[22] SD image, nvox*nparams floats
+// argv[23] quantile image, nvox*nparams*3 floats, 2.5%, 50% and 97.5% as the last dimension
+// argv[24..27] optional plasma_t1, tstart, tstop, k2 as argv[19..22] of rwmh_tac_2tpc
+extern "C" int rwmh_tac_2tpc_img(int argc, float * argv[])
+{
+    const char *debugfile  = "debug.txt";  
+
+    if (argc > 28 || argc < 24) {
+        FILE *pfile = fopen(debugfile, "a+");
+        fprintf(pfile, "rwmh_tac_2tpc_img: 24 to 28 arguments required, %d supplied\n", argc);
+        fclose(pfile);
+        return -1;
+    }
+
+    norm_data dta;
+    tac_run run;
+    tac_parse_args(argc, argv, 24, dta, run);
+
+    unsigned int nsample = (unsigned int)dta.nsample;
+    unsigned int nparams = (unsigned int)dta.nparams;
+    const double *tacs   = (double *)argv[1];
+    unsigned int nvox    = *(unsigned int*)argv[19];
+    const int *mask      = (int *)argv[20];
+    unsigned int seed    = *(unsigned int*)argv[21];
+    float *meanimg       = run.output;
+    float *sdimg         = (float *)argv[22];
+    float *qimg          = (float *)argv[23];
+    unsigned int verbose_flag = dta.debug;
+
+    if (tac_lik_prepare(&dta) != 0) { return -2; }
+    // no per-evaluation logging from the voxel loop
+    dta.debug = 0;
+
+    for (size_t k=0; k < (size_t)nvox*nparams; k++) { meanimg[k] = sdimg[k] = 0.0; }
+    for (size_t k=0; k < (size_t)nvox*nparams*3; k++) { qimg[k] = 0.0; }
+
+    unsigned long neval = 0;
+    unsigned int nsampled = 0;
+    std::chrono::steady_clock::time_point tic = std::chrono::steady_clock::now();
+
+    #pragma omp parallel reduction(+:neval,nsampled)
+    {
+        // per-thread likelihood scratch, draws and quantile buffer reused across voxels
+        norm_data vdta = dta;
+        arma::mat draws;
+        std::vector<double> buf;
+        double accept_rate;
+
+        #pragma omp for schedule(dynamic,16)
+        for (int v=0; v < (int)nvox; v++) {
+            if (mask != NULL && mask[v] == 0) continue;
+
+            for (unsigned int i=0; i < nsample; i++) { vdta.tissue_c[i] = tacs[(size_t)i*nvox + v]; }
+            arma::arma_rng::set_seed(seed + v);
+            tac_sample(vdta, run, run.initial_val, run.n_burnin, run.n_draws, draws, accept_rate);
+
+            for (unsigned int j=0; j < nparams; j++) {
+                double mean, sd, q[3];
+                tac_summary(draws, j, buf, mean, sd, q);
+                meanimg[(size_t)j*nvox + v] = mean;
+                sdimg[(size_t)j*nvox + v]   = sd;
+                for (int k=0; k < 3; k++) { qimg[((size_t)k*nparams + j)*nvox + v] = q[k]; }
+            }
+            nsampled++;
+        }
+        neval += vdta.neval;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tic).count();
+
+    if (verbose_flag) {
+        FILE *pfile = fopen(debugfile, "a+");
+        fprintf(pfile, "voxels sampled, %u in %f s, %f voxels/sec \n", 
+                nsampled, elapsed, elapsed > 0.0 ? nsampled/elapsed : 0.0);
+        fprintf(pfile, "likelihood evaluations, %lu, %f evaluations/sec \n", 
+                neval, elapsed > 0.0 ? neval/elapsed : 0.0);
+        fclose(pfile);
+    }
+
     return 0;
 }
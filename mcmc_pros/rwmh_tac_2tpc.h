@@ -12,6 +12,8 @@
 
 
 extern "C" int rwmh_tac_2tpc(int argc, float * argv[]);
+extern "C" int rwmh_tac_2tpc_chains(int argc, float * argv[]);
+extern "C" int rwmh_tac_2tpc_img(int argc, float * argv[]);
 
 
 int simC1(
@@ -45,6 +47,26 @@ int simC1_i(
 );
 
 
+int simC1_d(
+  /** Array of time values */
+  double *t,
+  /** Array of arterial activities */
+  double *ca,
+  /** Number of values in TACs */
+  const int nr,
+  /** Rate constant of the model */
+  const double k1,
+  /** Rate constant of the model */
+  const double k2,
+  /** Pointer for TAC array to be simulated, or NULL */
+  double *ct,
+  /** Pointer for derivative array, nr rows of dstride values; must be
+      allocated */
+  double *dct,
+  /** Distance between consecutive rows in dct; at least 2 */
+  const int dstride
+);
+
 int simMBF(
   /** Array of time values */
   double *t,
@@ -110,6 +132,31 @@ int simC2_i(
 ); 
 
 
+int simC2_d(
+  /** Array of time values */
+  double *t,
+  /** Array of arterial activities */
+  double *ca,
+  /** Number of values in TACs */
+  const int nr,
+  /** Rate constant of the model */
+  const double k1,
+  /** Rate constant of the model */
+  const double k2,
+  /** Rate constant of the model */
+  const double k3,
+  /** Rate constant of the model */
+  const double k4,
+  /** Pointer for TAC array to be simulated, or NULL */
+  double *ct,
+  /** Pointer for derivative array, nr rows of dstride values; must be
+      allocated */
+  double *dct,
+  /** Distance between consecutive rows in dct; at least 4 */
+  const int dstride
+); 
+
+
 int simRTCM(
   /** Array of time values */
   double *t,
@@ -168,6 +215,53 @@ int simTRTM(
 );
 
 
+int simRTCM_d(
+  /** Array of time values */
+  double *t,
+  /** Reference region activities */
+  double *cr,
+  /** Number of values in TACs */
+  const int nr,
+  /** Ratio K1/K1' */
+  const double R1,
+  /** Rate constant of the model */
+  const double k2,
+  /** Rate constant of the model */
+  const double k3,
+  /** Rate constant of the model */
+  const double k4,
+  /** Pointer for TAC array to be simulated; must be allocated */
+  double *ct,
+  /** Pointer for derivative array, nr rows of dstride values; must be
+      allocated */
+  double *dct,
+  /** Distance between consecutive rows in dct; at least 4 */
+  const int dstride
+);
+
+int simSRTM_d(
+  /** Array of time values */
+  double *t,
+  /** Reference region activities */
+  double *cr,
+  /** Number of values in TACs */
+  const int nr,
+  /** Ratio K1/K1' */
+  const double R1,
+  /** Rate constant of the model */
+  const double k2,
+  /** Binding potential */
+  const double BP,
+  /** Pointer for TAC array to be simulated; must be allocated */
+  double *ct,
+  /** Pointer for derivative array, nr rows of dstride values; must be
+      allocated */
+  double *dct,
+  /** Distance between consecutive rows in dct; at least 3 */
+  const int dstride
+);
+
+
 int simpct
 (
     double *ts,
@@ -179,4 +273,17 @@ int simpct
     double *tac
 );
 
+int simpct_d
+(
+    double *ts,
+    double *ctt,
+    int    frameNr,
+    double cbf,
+    double mtt,
+	double delay,
+    double *tac,
+    double *dct,
+    const int dstride
+);
+
 #endif  /** _RWMH_TAC_2TPC_H_ */
\ No newline at end of file
@@ -83,3 +83,54 @@ int simpct
 }
 /*****************************************************************************/
 
+
+/*****************************************************************************/
+/** @brief Simulate the perfusion CT tissue curve as in simpct(), together with
+    its partial derivatives with respect to cbf, mtt and delay.
+    @details Derivatives are written row by row into dct, dct[i*dstride+j]
+    being d(tac[i])/dpj for j=0..2 (cbf, mtt, delay), as in simC2_d(). The residue function is a step in delay,
+    so d(tac)/d(delay) is zero almost everywhere and is returned as zero; samplers
+    using these gradients still explore delay through the accept/reject step.
+    @sa simpct
+    @return Function returns 0 when successful, or 1 if input data is not valid.
+*/
+int simpct_d
+(
+    double *ts,
+    double *ctt,
+    int    frameNr,
+    double cbf,
+    double mtt,
+	double delay,
+    double *tac,
+    double *dct,
+    const int dstride
+) {
+
+  int     n = frameNr;
+  if(n<1 || ctt==NULL || tac==NULL || dct==NULL || dstride<3) return 1;
+
+  double  data[frameNr];
+  double  ddata[frameNr];   // residue function for unit cbf
+  double  dmtt[frameNr];
+  for (int i=0;i<n;i++) { 
+    ddata[i]=exp( -(ts[i]-mtt))/6000.0; dmtt[i]=cbf*ddata[i];
+    if (ts[i] < mtt) { ddata[i] = 1.0/6000.0; dmtt[i] = 0.0; }
+	if (ts[i] < delay) { ddata[i] = 0.0; dmtt[i] = 0.0; }    // !
+    data[i]=cbf*ddata[i];
+    }
+
+  for(int di=0; di<n; di++) {
+    double s=0.0, s1=0.0, s2=0.0;
+    int k=0;
+    for(int dj=di; dj>=0; dj--, k++) {
+      s  += data[dj]  * ctt[k];
+      s1 += ddata[dj] * ctt[k];
+      s2 += dmtt[dj]  * ctt[k];
+    }
+    tac[di]=s; dct[di*dstride]=s1; dct[di*dstride+1]=s2; dct[di*dstride+2]=0.0;
+  }
+
+  return 0;
+}
+/*****************************************************************************/
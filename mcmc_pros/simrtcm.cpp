@@ -233,3 +233,204 @@ int simTRTM(
 /*****************************************************************************/
 
 /*****************************************************************************/
+/** Simulate tissue TAC using full reference tissue compartment model and
+ *  reference region TAC, together with its partial derivatives with respect
+ *  to the model parameters.
+ *   
+ *  @details
+ *  Memory for ct and dct must be allocated in the calling program.
+ *  Derivatives follow from forward sensitivity recurrences of the scheme
+ *  used in simRTCM(). Derivatives are written row by row into dct,
+ *  dct[i*dstride+j] being d(ct[i])/dpj for j=0..3 (R1, k2, k3, k4), as in
+ *  simC2_d().
+ * 
+ *  @return Function returns 0 when successful, else a value >= 1.
+ *  @sa simRTCM, simSRTM_d
+ */
+int simRTCM_d(
+  /** Array of time values */
+  double *t,
+  /** Reference region activities */
+  double *cr,
+  /** Number of values in TACs */
+  const int nr,
+  /** Ratio K1/K1' */
+  const double R1,
+  /** Rate constant of the model */
+  const double k2,
+  /** Rate constant of the model */
+  const double k3,
+  /** Rate constant of the model */
+  const double k4,
+  /** Pointer for TAC array to be simulated; must be allocated */
+  double *ct,
+  /** Pointer for derivative array, nr rows of dstride values; must be
+      allocated */
+  double *dct,
+  /** Distance between consecutive rows in dct; at least 4 */
+  const int dstride
+) {
+  int i, j;
+  double f, b, w, q, p, den, dt2;
+  double cri, cr_last, t_last;
+  double cf, cf_last, cb, cb_last;
+  double cfi, cfi_last, cbi, cbi_last;
+  double df, db, dw, dq, dp, dn;
+  double dcf[4], dcf_last[4], dcb[4], dcb_last[4];
+  double dcfi[4], dcfi_last[4], dcbi[4], dcbi_last[4];
+
+
+  /* Check for data */
+  if(nr<2) return 1;
+  if(ct==NULL || dct==NULL || dstride<4) return 2;
+
+  /* Calculate curves */
+  t_last=0.0; if(t[0]<t_last) t_last=t[0];
+  cri=cr_last=0.0; cf_last=cb_last=cfi_last=cbi_last=cf=cb=cfi=cbi=0.0;
+  for(j=0; j<4; j++) {
+    dcf[j]=dcb[j]=dcfi[j]=dcbi[j]=0.0;
+    dcf_last[j]=dcb_last[j]=dcfi_last[j]=dcbi_last[j]=0.0;
+  }
+  for(i=0; i<nr; i++) {
+    /* delta time / 2 */
+    dt2=0.5*(t[i]-t_last);
+    /* calculate values */
+    if(dt2<0.0) {
+      return 5;
+    } else if(dt2>0.0) {
+      /* reference integral */
+      cri+=(cr[i]+cr_last)*dt2;
+      /* partial results */
+      f=cfi_last+dt2*cf_last;
+      b=cbi_last+dt2*cb_last;
+      w=k2 + k3 + k2*k4*dt2;
+      q=1.0 + k4*dt2;
+      p=R1*cr[i] + k2*cri;
+      den=1.0 + dt2*(w+k4);
+      /* 1st tissue compartment and its integral */
+      cf = ( q*p + k4*b - w*f ) / den;
+      cfi = cfi_last + dt2*(cf_last+cf);
+      /* 2nd tissue compartment and its integral */
+      cb = (k3*cfi - k4*b) / q;
+      cbi = cbi_last + dt2*(cb_last+cb);
+      /* sensitivities; j=0..3 for R1,k2,k3,k4 */
+      for(j=0; j<4; j++) {
+        df=dcfi_last[j]+dt2*dcf_last[j];
+        db=dcbi_last[j]+dt2*dcb_last[j];
+        dw=(j==1 ? 1.0+k4*dt2 : 0.0) + (j==2 ? 1.0 : 0.0) + (j==3 ? k2*dt2 : 0.0);
+        dq=(j==3 ? dt2 : 0.0);
+        dp=(j==0 ? cr[i] : 0.0) + (j==1 ? cri : 0.0);
+        dn=dq*p + q*dp + (j==3 ? b : 0.0) + k4*db - dw*f - w*df;
+        dcf[j] = (dn - cf*dt2*(dw + (j==3 ? 1.0 : 0.0))) / den;
+        dcfi[j] = dcfi_last[j] + dt2*(dcf_last[j]+dcf[j]);
+        dcb[j] = ( (j==2 ? cfi : 0.0) + k3*dcfi[j]
+                 - (j==3 ? b : 0.0) - k4*db - cb*dq ) / q;
+        dcbi[j] = dcbi_last[j] + dt2*(dcb_last[j]+dcb[j]);
+      }
+    }
+    /* copy values to argument arrays; set very small values to zero */
+    ct[i]=cf+cb; if(fabs(ct[i])<1.0e-12) ct[i]=0.0;
+    for(j=0; j<4; j++) dct[i*dstride+j]=dcf[j]+dcb[j];
+    /* prepare to the next loop */
+    t_last=t[i]; cr_last=cr[i];
+    cf_last=cf; cfi_last=cfi;
+    cb_last=cb; cbi_last=cbi;
+    for(j=0; j<4; j++) {
+      dcf_last[j]=dcf[j]; dcfi_last[j]=dcfi[j];
+      dcb_last[j]=dcb[j]; dcbi_last[j]=dcbi[j];
+    }
+  }
+
+  return 0;
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Simulate tissue TAC using simplified reference tissue input compartment
+ *  model, together with its partial derivatives with respect to the model
+ *  parameters.
+ *   
+ *  @details
+ *  Memory for ct and dct must be allocated in the calling program.
+ *  Derivatives follow from forward sensitivity recurrences of the scheme
+ *  used in simSRTM(). Derivatives are written row by row into dct,
+ *  dct[i*dstride+j] being d(ct[i])/dpj for j=0..2 (R1, k2, BP), as in
+ *  simC2_d().
+ * 
+ *  @return Function returns 0 when successful, else a value >= 1.
+ *  @sa simSRTM, simRTCM_d
+ */
+int simSRTM_d(
+  /** Array of time values */
+  double *t,
+  /** Reference region activities */
+  double *cr,
+  /** Number of values in TACs */
+  const int nr,
+  /** Ratio K1/K1' */
+  const double R1,
+  /** Rate constant of the model */
+  const double k2,
+  /** Binding potential */
+  const double BP,
+  /** Pointer for TAC array to be simulated; must be allocated */
+  double *ct,
+  /** Pointer for derivative array, nr rows of dstride values; must be
+      allocated */
+  double *dct,
+  /** Distance between consecutive rows in dct; at least 3 */
+  const int dstride
+) {
+  int i, j;
+  double dt2, g, w, den;
+  double cri, cr_last, t_last;
+  double c, ct_last, cti, cti_last;
+  double dg, dw, dn;
+  double d[3], d_last[3], di[3], di_last[3];
+
+
+  /* Check for data */
+  if(nr<2) return 1;
+  if(ct==NULL || dct==NULL || dstride<3) return 2;
+
+  /* Calculate curves */
+  t_last=0.0; if(t[0]<t_last) t_last=t[0];
+  cri=cr_last=0.0; c=cti=ct_last=cti_last=0.0;
+  for(j=0; j<3; j++) d[j]=d_last[j]=di[j]=di_last[j]=0.0;
+  g=k2/(1.0+BP);
+  for(i=0; i<nr; i++) {
+    /* delta time / 2 */
+    dt2=0.5*(t[i]-t_last);
+    /* calculate values */
+    if(dt2<0.0) {
+      return 5;
+    } else if(dt2>0.0) {
+      /* reference integral */
+      cri+=(cr[i]+cr_last)*dt2;
+      /* Tissue compartment and its integral */
+      w=cti_last+dt2*ct_last; den=1.0 + dt2*g;
+      c = ( R1*cr[i] + k2*cri - g*w ) / den;
+      cti = cti_last + dt2*(ct_last+c);
+      /* sensitivities; j=0..2 for R1,k2,BP */
+      for(j=0; j<3; j++) {
+        dw=di_last[j]+dt2*d_last[j];
+        dg=(j==1 ? 1.0/(1.0+BP) : 0.0) + (j==2 ? -g/(1.0+BP) : 0.0);
+        dn=(j==0 ? cr[i] : 0.0) + (j==1 ? cri : 0.0) - dg*w - g*dw;
+        d[j] = (dn - c*dt2*dg) / den;
+        di[j] = di_last[j] + dt2*(d_last[j]+d[j]);
+      }
+    }
+    /* set very small values to zero */
+    ct[i]=c; if(fabs(ct[i])<1.0e-12) ct[i]=0.0;
+    for(j=0; j<3; j++) dct[i*dstride+j]=d[j];
+    /* prepare to the next loop */
+    t_last=t[i]; cr_last=cr[i];
+    ct_last=ct[i]; cti_last=cti;
+    for(j=0; j<3; j++) {d_last[j]=d[j]; di_last[j]=di[j];}
+  }
+
+  return 0;
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
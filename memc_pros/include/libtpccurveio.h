@@ -388,6 +388,7 @@ typedef struct {
 void csvInit(CSV *csv);
 void csvEmpty(CSV *csv);
 int csvRead(CSV *csv, char *fname);
+int csvReadBuffer(CSV *csv, const char *contents, size_t len);
 int csv2dft(CSV *csv, DFT *dft);
 int csv2dft_a(CSV *csv, DFT *dft);
 int csv2dft_b(CSV *csv, DFT *dft);
@@ -525,6 +526,7 @@ int dftDecayCorrection(
 /*****************************************************************************/
 /* dftio */
 int dftRead(char *filename, DFT *data);
+int dftReadBatch(int fileNr, char **filename, DFT *dft, int *status);
 int dftWrite(DFT *data, char *filename);
 void dftPrint(DFT *data);
 int dftFormat(char *fname);
@@ -1851,6 +1851,26 @@ typedef struct {
 } IMG;
 /*****************************************************************************/
 
+/*****************************************************************************/
+#ifndef IMG_TILE_SIZE
+/** Default max nr of pixels in one IMG_TILE */
+#define IMG_TILE_SIZE 256
+#endif
+/** Tile of consecutive image pixels and their TACs; see imgGetTile() */
+typedef struct {
+  /** Index of the first pixel in the tile; pixels are indexed in the order
+      of IMG data, i.e. column index changes fastest and plane slowest */
+  int first;
+  /** Nr of pixels in the tile */
+  int pxlNr;
+  /** Nr of frames in each pixel TAC */
+  int frameNr;
+  /** Pointer to pixel TACs inside IMG data, pxlNr x frameNr values;
+      value of frame fi of pixel i is tac[i*frameNr+fi] */
+  float *tac;
+} IMG_TILE;
+/*****************************************************************************/
+
 /*****************************************************************************/
 /* IMG units (deprecated) */
 /// @cond
@@ -2280,6 +2300,35 @@ typedef struct {
    *  or big endian (0). */
   int byte_order;
 } NIFTI_DSR;
+
+/** Nifti image data file mapped into memory with niftiMapImagedata(). */
+typedef struct {
+  /** Dimension of Column (x) */
+  int dimx;
+  /** Dimension of Row (y) */
+  int dimy;
+  /** Dimension of Plane (z) */
+  int dimz;
+  /** Dimension of Time (t), as in the header */
+  int dimt;
+  /** Nr of frames that actually are in the file */
+  int frameNr;
+  /** Nr of bytes in one frame */
+  size_t frameSize;
+  /** Pointer to the start of image data in the mapping */
+  char *data;
+  /** Pointer to voxel values of all frames in place, frame-major, when data is
+   *  stored as floats in native byte order without scaling; otherwise NULL. */
+  float *fdata;
+  /** Copy of the Nifti header */
+  NIFTI_DSR dsr;
+/// @cond
+  /** 'Hidden' start address of the mapping */
+  void *_addr;
+  /** 'Hidden' size of the mapping */
+  size_t _size;
+/// @endcond
+} NIFTI_MAP;
 /*****************************************************************************/
 
 /*****************************************************************************/
@@ -2320,6 +2369,8 @@ float ecat7rFloat(void *bufi, int isvax, int islittle);
 int ecat7rInt(void *bufi, int isvax, int islittle);
 int ecat7ReadImageMatrix(FILE *fp, int first_block, int last_block,
   ECAT7_imageheader *h, float **fdata);
+int ecat7ReadImageMatrices(FILE *fp, ECAT7_MatDir *matdir, int matrixNr,
+  int pxlNr, ECAT7_imageheader *h, float *fdata);
 int ecat7Read2DScanMatrix(FILE *fp, int first_block, int last_block,
   ECAT7_2Dscanheader *h, float **fdata);
 int ecat7ReadScanMatrix(FILE *fp, int first_block, int last_block,
@@ -2671,6 +2722,14 @@ float fmean(float *data, int n, float *sd);
 void fMinMaxFin(float *data, int n, float *fmin, float *fmax);
 /*****************************************************************************/
 
+/*****************************************************************************/
+/* imgtile */
+int imgPixelNr(IMG *img);
+int imgTileNr(IMG *img, int tileSize);
+int imgGetTile(IMG *img, int tileSize, int ti, IMG_TILE *tile);
+int imgTilePixel(IMG *img, IMG_TILE *tile, int i, int *zi, int *yi, int *xi);
+/*****************************************************************************/
+
 /*****************************************************************************/
 /* imgunits */
 int imgUnitId(char *unit);
@@ -2722,6 +2781,15 @@ void niftiRemoveFNameExtension(char *fname);
 int niftiReadImagedata(
   FILE *fp, NIFTI_DSR *h, int frame, float *data, int verbose, char *status
 );
+void niftiMapInit(NIFTI_MAP *map);
+int niftiMapImagedata(
+  const char *datfile, NIFTI_DSR *dsr, NIFTI_MAP *map, int verbose, char *status
+);
+float *niftiMapFrame(
+  NIFTI_MAP *map, int frame, float *buf, int verbose, char *status
+);
+void niftiMapRelease(NIFTI_MAP *map, int frame);
+void niftiUnmap(NIFTI_MAP *map);
 int niftiWriteHeader(
   char *filename, NIFTI_DSR *dsr, int verbose, char *status
 );
@@ -162,6 +162,10 @@ int imgsegmClusterExpand(
   int pi, int ri, int ci, int pj, int rj, int cj, float CVlim, float CClim,
   int verbose
 );
+int imgsegmClusters(
+  IMG *cimg, IMG *simg, IMG *dimg, float CVlim, float CClim, int slabNr,
+  int *clusterNr, int verbose
+);
 float imgsegmPearson(
   float *x, float *y, int nr
 );
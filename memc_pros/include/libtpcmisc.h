@@ -305,6 +305,7 @@ void iftEmpty(IFT *ift);
 int iftPut(IFT *ift, char *key, char *value, char *cmt_type);
 int iftPutDouble(IFT *ift, char *key, double value, char *cmt_type);
 int iftRead(IFT *ift, char *filename, int is_key_required);
+int iftReadBuffer(IFT *ift, const char *buf, size_t len, int is_key_required);
 char *iftReadValue(char *filename, char *keystr);
 int iftWriteItem(IFT *ift, int item, FILE *fp);
 int iftWrite(IFT *ift, char *filename);
@@ -424,6 +425,7 @@ int str_token_list_add(STR_TOKEN_LIST *lst, char *new_item);
 int str_token_list_del(STR_TOKEN_LIST *lst, int item);
 int str_token_list_read(const char *filename, STR_TOKEN_LIST *lst);
 int textfileReadLines(const char *filename, STR_TOKEN_LIST *lst);
+char *textfileReadContents(const char *filename, size_t *len);
 int readStrtokens(const char *filename, char ***toklist);
 int asciiCommentLine(const char *line, int *cont);
 /*****************************************************************************/
@@ -502,7 +502,16 @@ int bootstrapr(
   double *cLim1, double *cLim2, double *SD, double *parameter,
   double *lowlim, double *uplim, int frameNr, double *origTac,
   double *fitTac, double *bsTAC, int parNr, double *weight,
-  double (*objf)(int, double*, void*), char *status, int verbose, double *matrix
+  double (*objf)(int, double*, void*), void *objfData,
+  char *status, int verbose, double *matrix
+);
+int bootstrapParallel(
+  int iterNr,
+  double *cLim1, double *cLim2, double *SD, double *parameter,
+  double *lowlim, double *uplim, int frameNr, double *origTac,
+  double *fitTac, double **bsTAC, int parNr, double *weight,
+  double (*objf)(int, double*, void*), void **objfData, int threadNr,
+  uint64_t seed, char *status, int verbose, double *matrix
 );
 /*****************************************************************************/
 
@@ -719,6 +728,21 @@ int mtga_best_perp(
   double *x, double *y, int nr,
   double *slope, double *ic, double *ssd, int *fnr
 );
+int patlak_block_data(
+  int data_nr, double *i, double *ii, int tac_nr, float **c, double *x, double *y
+);
+int logan_block_data(
+  int data_nr, double *i, double *ii, int tac_nr, float **c, double *ci,
+  double k2, double *x, double *y
+);
+int mtga_block_fit(
+  int data_nr, int tac_nr, double *x, double *y, linefit_method method,
+  double *slope, double *ic, double *sd, double *ssd, int *nr, double *work
+);
+int mtga_perp_line(
+  int nr, double mx, double my, double qxx, double qyy, double qxy,
+  double *slope, double *ic, double *ssd
+);
 /*****************************************************************************/
 
 /*****************************************************************************/
@@ -849,6 +873,15 @@ double simplex(
   double maxerr,
   int maxiter
 );
+double simplex_r(
+  double (*_fun)(int, double*, void*),
+  void *fundata,
+  int parNr,
+  double *par,
+  double *delta,
+  double maxerr,
+  int maxiter
+);
 /*****************************************************************************/
 
 /*****************************************************************************/
@@ -925,6 +958,9 @@ int simMBF(
 int simC1(
   double *t, double *ca, int nr, double k1, double k2, double *ct
 );
+int simC1_v1(
+  double *t, double *ca, int nr, double k1, double k2, double *ct
+);
 int simC3DIvs(
   double *t, double *ca1, double *ca2, double *cb, int nr,
   double k1, double k2, double k3, double k4, double k5, double k6,
@@ -1035,6 +1071,12 @@ int tgo(
   void *objfData, int dim, int neighNr, double *fmin, double *gmin,
   int samNr, int tgoNr, int verbose
 );    
+int tgoParallel(
+  double *lowlim, double *uplim, double (*objf)(int, double*, void*),
+  void (*objfBatch)(int n, int dim, double *par, double *f, void *data),
+  void **objfData, int objfDataNr, int dim, int neighNr, double *fmin,
+  double *gmin, int samNr, int tgoNr, uint64_t seed, int verbose
+);
 void tgoRandomParameters(
   TGO_POINT *p, int parNr, int sNr,
   double *low, double *up
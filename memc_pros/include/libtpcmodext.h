@@ -122,6 +122,92 @@ int img_logan(
 );
 /*****************************************************************************/
 
+/*****************************************************************************/
+// img_mtga_stream.c
+/** Running sums for computing pixel-by-pixel Gjedde-Patlak or Logan plot
+    from dynamic image one frame at a time. */
+typedef struct {
+  /** Gjedde-Patlak (0) or Logan (1) plot */
+  int logan;
+  /** Reference region k2 for Logan plot, or <=0 if not used */
+  double k2;
+  /** Index of the first frame in line fit range */
+  int start;
+  /** Index of the last frame in line fit range */
+  int end;
+  /** Nr of frames added so far */
+  int frameNr;
+  /** Image z dimension */
+  int dimz;
+  /** Image y dimension */
+  int dimy;
+  /** Image x dimension */
+  int dimx;
+  /** Start time of line fit range (sec) */
+  float fit_start;
+  /** End time of line fit range (sec) */
+  float fit_end;
+  /** Input AUC at the end of line fit range (min) */
+  double input_auc;
+  /** Middle time of the previous frame, for pixel AUCs */
+  float last_x;
+  /** End time of the previous frame, for pixel AUCs */
+  float last_x2;
+  /** Pointer to the input TAC data; not allocated here */
+  DFT *input;
+  /** Integrals of image-derived input at its sample times, or NULL */
+  double *input_ii;
+  /** Pixel values in the previous frame */
+  float *last_y;
+  /** Pixel integrals to the end of the previous frame */
+  float *box;
+  /** Pixel AUCs to the middle of the latest frame */
+  float *auc;
+  /** Pixel AUCs to the middle of the last frame in line fit range (min) */
+  float *auc_fit;
+  /** Nr of plot points for each pixel */
+  double *sn;
+  /** Mean of plot x values for each pixel */
+  double *mx;
+  /** Mean of plot y values for each pixel */
+  double *my;
+  /** Sum of squared deviations of plot x values for each pixel */
+  double *qxx;
+  /** Sum of squared deviations of plot y values for each pixel */
+  double *qyy;
+  /** Sum of products of x and y deviations for each pixel */
+  double *qxy;
+  /** Middle time of the first frame in line fit range; not for user */
+  float _fit_start_mid;
+  /** Allocated memory for float pixel data; not for user */
+  float *_fdata;
+  /** Allocated memory for double pixel data; not for user */
+  double *_ddata;
+} IMG_MTGA_STREAM;
+
+void imgMtgaStreamInit(IMG_MTGA_STREAM *s);
+void imgMtgaStreamEmpty(IMG_MTGA_STREAM *s);
+int imgMtgaStreamSetup(
+  IMG_MTGA_STREAM *s, DFT *input, IMG *img, int start, int end, int logan,
+  double k2, char *status, int verbose
+);
+int imgMtgaStreamAddFrame(
+  IMG_MTGA_STREAM *s, IMG *img, int frame_index, int verbose
+);
+int imgMtgaStreamResult(
+  IMG_MTGA_STREAM *s, IMG *img, float thrs, IMG *slope_img, IMG *ic_img,
+  IMG *nr_img, char *status, int verbose
+);
+int img_patlak_stream(
+  DFT *input, const char *petfile, int start, int end, float thrs,
+  IMG *ki_img, IMG *ic_img, IMG *nr_img, char *status, int verbose
+);
+int img_logan_stream(
+  DFT *input, const char *petfile, int start, int end, float thrs,
+  double k2, IMG *vt_img, IMG *ic_img, IMG *nr_img, char *status, int verbose
+);
+/*****************************************************************************/
+
 /*****************************************************************************/
 // img_k1.c
 int img_k1_using_ki(
@@ -129,6 +215,22 @@ int img_k1_using_ki(
   char *status, int verbose
 );
 /*****************************************************************************/
+
+/*****************************************************************************/
+// img_bfm.c
+int img_srtm_bfm(
+  DFT *ref, IMG *dyn_img, int frame_nr, int bfNr, double t3min, double t3max,
+  IMG *r1_img, IMG *k2_img, IMG *bp_img, char *status, int verbose
+);
+int img_1tcm_bfm(
+  DFT *input, IMG *dyn_img, int frame_nr, int bfNr, double k2min, double k2max,
+  IMG *k1_img, IMG *k2_img, IMG *va_img, char *status, int verbose
+);
+int img_irr2tcm_bfm(
+  DFT *input, IMG *dyn_img, int frame_nr, int bfNr, double thetamin, double thetamax,
+  IMG *ki_img, IMG *k1_img, IMG *k2k3_img, IMG *va_img, char *status, int verbose
+);
+/*****************************************************************************/
 // dftint.c
 int dftInterpolateCheckStart(
   DFT *input, DFT *output, char *status, int verbose
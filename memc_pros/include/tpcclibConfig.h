@@ -27,6 +27,7 @@
 #define HAVE_GETTIMEOFDAY
 #define HAVE_GETPID
 #define HAVE_GET_CURRENT_DIR_NAME
+#define HAVE_MMAP
 /* #undef HAVE__MKDIR */
 // Do certain struct members exist?
 /* #undef HAVE_TM_GMTOFF */
@@ -36,6 +36,7 @@ void csvEmpty(
 /*****************************************************************************/
 /** Read CSV file.
  *  @return Non-zero in case of an error.
+ *  @sa csvReadBuffer
  */
 int csvRead(
   /** Pointer to CSV struct */
@@ -45,32 +46,59 @@ int csvRead(
 ) {
   if(CSV_TEST>2) {printf("csvRead('%s')\n", fname); fflush(stdout);}
 
-  FILE *fp;
-  int i, nr, ret, nonprintable=0, inside_quotes=0, previous, col_nr=0;
+  char *allfile;
+  size_t len;
+  int ret;
+
+  if(csv==NULL || fname==NULL) return CSV_ERROR;
+  /* Read the file contents */
+  allfile=textfileReadContents(fname, &len);
+  if(allfile==NULL) return CSV_CANNOTOPEN;
+  ret=csvReadBuffer(csv, allfile, len);
+  free(allfile);
+  return(ret);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Read CSV data from file contents that are already in memory.
+ *  @return Non-zero in case of an error.
+ *  @sa csvRead
+ */
+int csvReadBuffer(
+  /** Pointer to CSV struct */
+  CSV *csv,
+  /** Pointer to file contents; not modified */
+  const char *contents,
+  /** Length of file contents (bytes) */
+  size_t len
+) {
+  if(CSV_TEST>2) {printf("csvReadBuffer(csv, contents, %zu)\n", len); fflush(stdout);}
+
+  size_t k;
+  int i, nr, ret, inside_quotes=0, previous, col_nr=0;
   const int MAX_CSV_FIELD_LENGTH=1024;
   char buf[MAX_CSV_FIELD_LENGTH+1];
   int tabnr, spacenr, commanr;
   
   
-  if(csv==NULL || fname==NULL) return CSV_ERROR;
-  /* Open file */
-  fp=fopen(fname, "r"); if(fp==NULL) return CSV_CANNOTOPEN;
+  if(csv==NULL || contents==NULL) return CSV_ERROR;
 
-  /* Check the file size */
-  nr=nonprintable=0; while((ret=fgetc(fp))!=EOF) {
-    if(iscntrl(ret) && ret!=13 && ret!=10 && ret!=9) {nonprintable=1; break;}
-    nr++;
+  /* Check the content size */
+  for(k=0; k<len; k++) {
+    ret=(unsigned char)contents[k];
+    if(iscntrl(ret) && ret!=13 && ret!=10 && ret!=9) break;
   }
-  if(CSV_TEST>0) printf("filesize := %d\n", nr);
-  if(nr<2) {fclose(fp); return CSV_INVALIDFORMAT;}
-  if(nr>5000000) {fclose(fp); return CSV_TOOBIG;}
-  rewind(fp);
+  if(CSV_TEST>0) printf("filesize := %zu\n", k);
+  if(k<2) return CSV_INVALIDFORMAT;
+  if(k>5000000) return CSV_TOOBIG;
 
   /* Determine the field separator (unless set outside) */
   if(csv->separator==(char)0) {
     /* Check if ; or tab or space or comma character is found outside double quotes */
     inside_quotes=0; nr=0; tabnr=0; spacenr=0; commanr=0;
-    while((ret=fgetc(fp))!=EOF) {
+    for(k=0; k<len; k++) {
+      ret=(unsigned char)contents[k];
       if(ret=='"') {
         if(inside_quotes==0) inside_quotes=1; else inside_quotes=0;
 	continue;
@@ -92,15 +120,15 @@ int csvRead(
     else if(tabnr>0) csv->separator='\t'; 
     else if(commanr>spacenr) csv->separator=',';
     else csv->separator=' ';
-    rewind(fp);
   }
   if(CSV_TEST>0) printf("separator := '%c'\n", csv->separator);
   /* We will not accept space as separator for CSV */
-  if(csv->separator==' ') {fclose(fp); return CSV_INVALIDFORMAT;}
+  if(csv->separator==' ') return CSV_INVALIDFORMAT;
 
   /* Determine the number of fields in CSV file */
   inside_quotes=0; nr=0; previous=0;
-  while((ret=fgetc(fp))!=EOF) {
+  for(k=0; k<len; k++) {
+    ret=(unsigned char)contents[k];
     if((previous==13 || previous==10) && (ret==13 || ret==10)) {previous=ret; continue;}
     if(ret=='"') {
       if(inside_quotes==0) inside_quotes=1; else inside_quotes=0;
@@ -118,17 +146,18 @@ int csvRead(
     } //printf("%c", (char)ret);
     previous=ret;
   }
-  rewind(fp); if(CSV_TEST>0) printf("field_nr := %d\n", nr);
+  if(CSV_TEST>0) printf("field_nr := %d\n", nr);
 
   /* Allocate memory for fields */
   csv->c=(CSV_item*)calloc(nr, sizeof(CSV_item));
-  if(csv->c==NULL) {fclose(fp); return CSV_OUTOFMEMORY;}
+  if(csv->c==NULL) return CSV_OUTOFMEMORY;
   csv->nr=nr;
 
-  /* Copy field contents from CSV file */
+  /* Copy field contents */
   if(CSV_TEST>0) printf("  copying contents...\n");
   inside_quotes=0; nr=0; previous=0; i=0; col_nr=0;
-  while((ret=fgetc(fp))!=EOF) {
+  for(k=0; k<len; k++) {
+    ret=(unsigned char)contents[k];
     if((previous==13 || previous==10) && (ret==13 || ret==10)) {previous=ret; continue;}
     if(ret=='"') {
       if(inside_quotes==0) inside_quotes=1; else inside_quotes=0;
@@ -139,13 +168,6 @@ int csvRead(
         buf[i]=(char)0; strCleanSpaces(buf); if(CSV_TEST>10) printf("'%s'\n", buf);
         if(nr>=csv->nr) {printf("  index overflow\n"); break;}
         csv->c[nr].content=strdup(buf);
-/*
-        if(i>0) {
-          if(nr>=csv->nr) {printf("  index overflow\n"); break;}
-          csv->c[nr].content=(char*)malloc(i+1);
-          if(csv->c[nr].content!=NULL) strcpy(csv->c[nr].content, buf);
-        } //if(CSV_TEST>10) printf("---\n");
-*/
         csv->c[nr].row=1+csv->row_nr; csv->c[nr].col=1+col_nr;
 	i=0; nr++; col_nr++; previous=ret;
 	continue;
@@ -155,13 +177,6 @@ int csvRead(
         if(nr>=csv->nr) {printf("   index overflow\n"); break;}
         csv->c[nr].content=strdup(buf);
         if(CSV_TEST>10) printf("===\n");
-/*
-        if(i>0) {
-          if(nr>=csv->nr) {printf("   index overflow\n"); break;}
-          csv->c[nr].content=(char*)malloc(i+1);
-          if(csv->c[nr].content!=NULL) strcpy(csv->c[nr].content, buf);
-        } if(CSV_TEST>10) printf("===\n");
-*/
         col_nr++; if(col_nr>csv->col_nr) csv->col_nr=col_nr;
         csv->c[nr].row=1+csv->row_nr; csv->c[nr].col=col_nr;
         i=0; nr++; col_nr=0; previous=ret; csv->row_nr++;
@@ -174,7 +189,6 @@ int csvRead(
   }
   if(CSV_TEST>0) printf("  ... copied: nr=%d\n", nr);
 
-  fclose(fp);
   return CSV_OK;
 }
 /*****************************************************************************/
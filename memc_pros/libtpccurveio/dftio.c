@@ -14,72 +14,244 @@ int DFT_NR_OF_DECIMALS = 3;
 /*****************************************************************************/
 
 /*****************************************************************************/
-/** Read TAC file contents into specified DFT data structure. Reads standard DFT files, 
-    plain DFT files, and some other formats.
-    @sa dftFormat, dftWrite
-    @return Returns 0 when successful, in case of error sets dfterrmsg.
+/// @cond
+/** Read the next line from file contents into s, like fgets() would read
+    it from the file.
+    @return Returns s, or NULL if there is nothing left to read.
  */
-int dftRead(
+static char *dftGetsContents(
+  /** Pointer to string where line is written */
+  char *s,
+  /** Size of string, including terminal null */
+  int size,
+  /** Pointer to current read position, which is moved to the next line */
+  const char **pos,
+  /** Pointer to the end of contents */
+  const char *end
+) {
+  const char *p=*pos, *nl;
+  size_t n;
+  if(p>=end || size<1) return(NULL);
+  n=(size_t)(end-p); if(n>(size_t)(size-1)) n=(size_t)(size-1);
+  nl=memchr(p, '\n', n); if(nl!=NULL) n=(size_t)(nl-p)+1;
+  memcpy(s, p, n); s[n]=(char)0; *pos=p+n;
+  return(s);
+}
+
+/** Convert string token into double like atof_with_check(); simple decimal
+    numbers whose digits form an integer mantissa of at most 2^53 (about 15-16
+    significant digits) and whose scaled exponent is within +-22, which is the
+    common case in TAC files, are converted directly with exact rounding; all
+    other strings are converted with atof_with_check().
+    @return Returns 0 if successful, and 1 in case of an error.
+ */
+static int dftAtofToken(
+  /** String token, without spaces; NULL is accepted as an error */
+  char *str,
+  /** Pointer to the double float */
+  double *v
+) {
+  static const double p10[23]={1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+    1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    1e21, 1e22};
+  const char *p=str;
+  uint64_t m=0;
+  int neg=0, sep=0, dig=0, sig=0, e=0;
+
+  if(str==NULL) {*v=nan(""); return(1);}
+  if(*p=='+' || *p=='-') {neg=(*p=='-'); p++;}
+  for(;; p++) {
+    if(*p>='0' && *p<='9') {
+      dig++; if(sep) e--;
+      if(m==0 && *p=='0') continue;
+      if(++sig>19) return(atof_with_check(str, v));
+      m=10*m+(uint64_t)(*p-'0');
+    } else if((*p=='.' || *p==',') && !sep) sep=1;
+    else break;
+  }
+  if(dig==0) return(atof_with_check(str, v));
+  if(*p=='e' || *p=='E') {
+    int es=1, ev=0, en=0;
+    p++; if(*p=='+' || *p=='-') {if(*p=='-') es=-1; p++;}
+    for(; *p>='0' && *p<='9'; p++) if(++en<6) ev=10*ev+(*p-'0');
+    if(en==0 || en>=6) return(atof_with_check(str, v));
+    e+=es*ev;
+  }
+  if(*p!=(char)0) return(atof_with_check(str, v));
+  if(m==0) {
+    /* atof_with_check() accepts zero only if string starts with '0' */
+    p=str; while(*p=='+' || *p=='-' || *p==' ') p++;
+    if(*p!='0') {*v=nan(""); return(1);}
+    *v=neg ? -0.0 : 0.0; return(0);
+  }
+  if(m>(1ULL<<53) || e<-22 || e>22) return(atof_with_check(str, v));
+  *v=(e<0) ? (double)m/p10[-e] : (double)m*p10[e];
+  if(neg) *v=-*v;
+  return(0);
+}
+
+/** Determine the type of TAC file from its contents, as dftFormat().
+    @return Returns DFT_FORMAT_UNKNOWN or other format id defined in dft.h.
+ */
+static int dftFormatContents(
+  /** Pointer to file contents */
+  const char *contents,
+  /** Length of file contents (bytes) */
+  size_t len,
+  /** Pointer to file name; this string is not modified. */
+  char *fname,
+  /** Pointer to initiated CSV struct, where file contents are left when
+      identified as CSV format, so that they need not be parsed again;
+      enter NULL if not needed. */
+  CSV *csvcache
+) {
+  const char *pos, *end=contents+len;
+  char tmp[256];
+  size_t k;
+  int c;
+
+  /* Binary data? */
+  for(k=0; k<len; k++) {
+    c=(unsigned char)contents[k];
+    if(!isalnum(c) && !isspace(c) && !isgraph(c) && c!=169) return DFT_FORMAT_UNKNOWN;
+  }
+
+  /* File with one title line without comment mark? */
+  tmp[0]=(char)0; pos=contents;
+  while(dftGetsContents(tmp, 10, &pos, end) != NULL) {if(strlen(tmp)) break;}
+  if(strncasecmp(tmp, "Time[", 5)==0) return DFT_FORMAT_PMOD;
+  if(strncasecmp(tmp, "Start[", 6)==0) return DFT_FORMAT_PMOD;
+  if(strcasestr(tmp, "Start\tEnd\t")!=NULL) return DFT_FORMAT_PMOD;
+
+  /* Read the first line that is not empty or comment line */
+  pos=contents;
+  while(dftGetsContents(tmp, 32, &pos, end) != NULL) {
+    if(strlen(tmp)==0) continue;
+    if(tmp[0]=='#') continue;
+    if(strncmp(tmp, "//", 2)==0) continue;
+    break;
+  }
+
+  /* Check for identification strings */
+  if(strncasecmp(tmp, "DFT", 3)==0) return DFT_FORMAT_STANDARD;
+  else if(strncasecmp(tmp, "FIT1", 3)==0) return DFT_FORMAT_FIT;
+  else if(strncasecmp(tmp, "cpt", 3)==0) return DFT_FORMAT_NCI;
+
+  /* Identify certain filename extensions */
+  if(fncasematch(fname, "*.idwc")==1 || fncasematch(fname, "*.idw")==1)
+    return DFT_FORMAT_IDWC;
+  if(fncasematch(fname, "*.if")==1) return DFT_FORMAT_IF;
+
+  /* Try to read as CSV */
+  CSV csv; csvInit(&csv);
+  if(csvReadBuffer(&csv, contents, len)==0) {
+    int format=DFT_FORMAT_UNKNOWN;
+    if(csv.separator==';') format=DFT_FORMAT_CSV_INT;
+    else if(csv.separator==',') format=DFT_FORMAT_CSV_UK;
+    else if(csv.separator=='\t') {
+      int i, commas=0, dots=0;
+      for(i=0; i<csv.nr; i++) {
+        if(strchr(csv.c[i].content, ',')!=NULL) commas++;
+        else if(strchr(csv.c[i].content, '.')!=NULL) dots++;
+      }
+      if(dots>commas) format=DFT_FORMAT_CSV_UK; else format=DFT_FORMAT_CSV_INT;
+    }
+    if(CSV_TEST>1) printf("  format=%d\n", format);
+    if(format!=DFT_FORMAT_UNKNOWN) {
+      if(csvcache!=NULL) *csvcache=csv; else csvEmpty(&csv);
+      return(format);
+    }
+  }
+  csvEmpty(&csv);
+
+  return DFT_FORMAT_PLAIN;
+}
+
+/** Read TAC formats that are not parsed from file contents in memory.
+    Readers use global variables, therefore only one thread at a time
+    may be here.
+    @return Returns 0 when successful, in case of error sets errmsg.
+ */
+static int dftReadOtherFormat(
   /** Name of file to be read. */
   char *filename,
-  /** Pointer to initiated DFT struct where data will be written; any old content is deleted. */
-  DFT *data
+  /** DFT_FORMAT_NCI, DFT_FORMAT_IDWC, or DFT_FORMAT_IF */
+  int type,
+  /** Pointer to initiated DFT struct where data will be written. */
+  DFT *data,
+  /** Pointer to string (at least 64 chars) where error message is written. */
+  char *errmsg
 ) {
-  const int verbose=0;
-  if(verbose>0) {printf("%s(%s, dft)\n", __func__, filename); fflush(stdout);}
+  int ret=0;
+#pragma omp critical(dftReadOtherFormat)
+  {
+    if(type==DFT_FORMAT_NCI) { // TPC format before DFT
+      ret=roikbqRead(filename, data);
+      if(ret==0) dftFrametimes(data);
+    } else if(type==DFT_FORMAT_IDWC) {
+      ret=idwcRead(filename, data);
+      if(ret==0 && strlen(data->studynr)==0) studynr_from_fname(filename, data->studynr);
+    } else {
+      ret=ifRead(filename, data);
+      if(ret==0 && strlen(data->studynr)==0) studynr_from_fname(filename, data->studynr);
+    }
+    if(ret!=0 && errmsg!=dfterrmsg) strcpy(errmsg, dfterrmsg);
+  }
+  return(ret);
+}
 
-  FILE *fp;
-  char *cptr, *line, *lptr, temp[128];
+/** Read TAC file contents, that are already in memory, into DFT struct.
+    Global variables are not used, except with formats which are read with
+    dftReadOtherFormat().
+    @return Returns 0 when successful, in case of error sets errmsg.
+ */
+static int dftReadContents(
+  /** Name of file to be read. */
+  char *filename,
+  /** Pointer to file contents. */
+  const char *contents,
+  /** Length of file contents (bytes). */
+  size_t len,
+  /** Pointer to initiated DFT struct where data will be written. */
+  DFT *data,
+  /** Pointer to string (at least 64 chars) where error message is written. */
+  char *errmsg,
+  /** Pointer to the nr of decimals for concentration values, which is
+      increased if data contains more decimals. */
+  int *decimals
+) {
+  const int verbose=0;
+  const char *pos, *end=contents+len;
+  char *cptr, *line, *lptr, *saveptr, temp[128];
   int ret, i, j, c, type=0, voiNr=0, frameNr=0, longest=0;
+  size_t k;
   double f;
   IFT ift;
+  CSV csv;
 
 
-  /* Empty data */
-  if(data==NULL) {strcpy(dfterrmsg, "invalid data"); return 1;}
-  dftEmpty(data);
-
-  /* Check if file can be opened for read; then close it for now */
-  if(verbose>1) {printf("opening file\n"); fflush(stdout);}
-  fp=fopen(filename, "r");
-  if(fp==NULL) {strcpy(dfterrmsg, "cannot open file"); return 1;}
-  fclose(fp);
-
   /* Try to identify the file format */
-  type=dftFormat(filename);
+  csvInit(&csv);
+  type=dftFormatContents(contents, len, filename, &csv);
   if(type==DFT_FORMAT_UNKNOWN) {
-    strcpy(dfterrmsg, "unknown file format"); return 1;
+    strcpy(errmsg, "unknown file format"); return 1;
   } else if(type==DFT_FORMAT_FIT) {
-    strcpy(dfterrmsg, "cannot read fit file"); return 1;
+    strcpy(errmsg, "cannot read fit file"); return 1;
   }
 
   /* Read some special formats */
-  if(type==DFT_FORMAT_NCI) { // TPC format before DFT
-    if(verbose>1) {printf("calling roikbqRead()\n"); fflush(stdout);}
-    ret=roikbqRead(filename, data); if(ret!=0) return ret;
-    dftFrametimes(data);
-    return(0);
-  } else if(type==DFT_FORMAT_IDWC) {
-    if(verbose>1) {printf("calling idwcRead()\n"); fflush(stdout);}
-    ret=idwcRead(filename, data); if(ret!=0) return ret;
-    if(strlen(data->studynr)==0) studynr_from_fname(filename, data->studynr);
-    return(0);
-  } else if(type==DFT_FORMAT_IF) {
-    if(verbose>1) {printf("calling iftRead()\n"); fflush(stdout);}
-    ret=ifRead(filename, data); if(ret!=0) return ret;
-    if(strlen(data->studynr)==0) studynr_from_fname(filename, data->studynr);
-    return(0);
+  if(type==DFT_FORMAT_NCI || type==DFT_FORMAT_IDWC || type==DFT_FORMAT_IF) {
+    if(verbose>1) {printf("calling dftReadOtherFormat()\n"); fflush(stdout);}
+    return(dftReadOtherFormat(filename, type, data, errmsg));
   } else if(type==DFT_FORMAT_CSV_INT || type==DFT_FORMAT_CSV_UK) {
-    CSV csv;
-    csvInit(&csv); //CSV_TEST=100;
-    if(verbose>1) {printf("calling csvRead()\n"); fflush(stdout);}
-    ret=csvRead(&csv, filename);
-    if(ret==0) ret=csv2dft(&csv, data);
+    /* CSV contents were already read when identifying the format */
+    ret=csv2dft(&csv, data);
     csvEmpty(&csv);
     if(ret==0) {
       /* Try to read information from an interfile-type header */
       IFT ift; iftInit(&ift);
-      if(iftRead(&ift, filename, 1)==0 && ift.keyNr>0) dft_fill_hdr_from_IFT(data, &ift);
+      if(iftReadBuffer(&ift, contents, len, 1)==0 && ift.keyNr>0)
+        dft_fill_hdr_from_IFT(data, &ift);
       iftEmpty(&ift);
       /* study number, too */
       if(strlen(data->studynr)==0) studynr_from_fname(filename, data->studynr);
@@ -89,87 +261,75 @@ int dftRead(
     }
     // if not ok, then just drop through with plain format
     type=DFT_FORMAT_PLAIN;
-#if(0)
-    if(ret!=0) {strcpy(dfterrmsg, "cannot read file"); return ret;}
-    ret=csv2dft(&csv, data); csvEmpty(&csv);
-    if(ret!=0) {strcpy(dfterrmsg, "invalid CSV format"); return ret;}
-    if(strlen(data->studynr)==0) studynr_from_fname(filename, data->studynr);
-    return(0);
-#endif
   }
 
   /* Try to read supported TAC formats, not the others */
   if(type!=DFT_FORMAT_PLAIN && type!=DFT_FORMAT_STANDARD &&
      type!=DFT_FORMAT_IFT && type!=DFT_FORMAT_PMOD
   ) {
-    strcpy(dfterrmsg, "unsupported file format"); return 1;
+    strcpy(errmsg, "unsupported file format"); return 1;
   }
 
   /* Try to read information from an interfile-type header */
-  if(verbose>1) {printf("calling iftRead()\n"); fflush(stdout);}
+  if(verbose>1) {printf("calling iftReadBuffer()\n"); fflush(stdout);}
   iftInit(&ift);
-  if(iftRead(&ift, filename, 1)!=0) iftEmpty(&ift);
-
-  /* Open file */
-  if(verbose>1) {printf("re-opening file\n"); fflush(stdout);}
-  fp=fopen(filename, "r");
-  if(fp==NULL) {
-    strcpy(dfterrmsg, "cannot open file"); iftEmpty(&ift); return 1;
-  }
+  if(iftReadBuffer(&ift, contents, len, 1)!=0) iftEmpty(&ift);
 
   /* Get the length of the longest line */
-  i=0; while((c=fgetc(fp))!=EOF) {
-    if(c==10 || c==13) {if(i>longest) longest=i; i=0;} else i++;}
+  for(k=0, i=0; k<len; k++) {
+    c=(unsigned char)contents[k];
+    if(c==10 || c==13) {if(i>longest) longest=i; i=0;} else i++;
+  }
   if(i>longest) longest=i;
-  rewind(fp); longest+=2;
+  longest+=2;
   if(verbose>1) {printf("  longest := %d\n", longest); fflush(stdout);}
 
   /* and allocate memory for string of that length */
   line=(char*)malloc((longest+1)*sizeof(char));
-  if(line==NULL) {strcpy(dfterrmsg, "out of memory"); iftEmpty(&ift); fclose(fp); return 2;}
+  if(line==NULL) {strcpy(errmsg, "out of memory"); iftEmpty(&ift); return 2;}
 
   /* Get the frame number */
-  i=0; while(fgets(line, longest, fp)!=NULL && *line) {
+  i=0; pos=contents;
+  while(dftGetsContents(line, longest, &pos, end)!=NULL && *line) {
     if(line[0]=='#') continue;
     cptr=strchr(line, '#'); if(cptr!=NULL) *cptr=(char)0;
     for(j=0; j<(int)strlen(line); j++)
       if(isalnum((int)line[j]) || line[j]=='.') {i++; break;}
   }
-  rewind(fp); frameNr=i;
+  frameNr=i;
   if(type==DFT_FORMAT_STANDARD) frameNr-=4; /* title lines */
   if(type==DFT_FORMAT_PMOD) frameNr-=1;
   if(verbose>1) {printf("frameNr := %d\n", frameNr); fflush(stdout);}
   if(frameNr<1) {
-    strcpy(dfterrmsg, "contains no data");
-    iftEmpty(&ift); free(line); fclose(fp); return 1;
+    strcpy(errmsg, "contains no data");
+    iftEmpty(&ift); free(line); return 1;
   }
 
   /* Get the number of curves */
   /* find first line that is not an empty or a comment line */
-  while(fgets(line, longest, fp)!=NULL) {
+  pos=contents;
+  while(dftGetsContents(line, longest, &pos, end)!=NULL) {
     if(line[0]=='#') continue;
     /* If PMOD file, then read it from the title */
     if(type==DFT_FORMAT_PMOD) {voiNr=dftGetPmodTitle(NULL, line); break;}
     /* In plain data file that is first frame, which starts with time */
     /* In normal DFT file that is 1st title line, which starts with 'DFT' */
-    char *nline; nline=strdup(line); lptr=nline;
-    cptr=strtok(lptr, " \t\n\r"); if(cptr==NULL) {free(nline); continue;}
-    voiNr=0; while((cptr=strtok(NULL, " \t\n\r"))!=NULL) voiNr++;
-    free(nline);
+    cptr=strtok_r(line, " \t\n\r", &saveptr); if(cptr==NULL) continue;
+    voiNr=0; while((cptr=strtok_r(NULL, " \t\n\r", &saveptr))!=NULL) voiNr++;
     break;
   }
-  rewind(fp);
+  pos=contents;
   if(verbose>1) {printf("voiNr := %d\n", voiNr); fflush(stdout);}
   if(voiNr<1) {
-    strcpy(dfterrmsg, "contains no curves");
-    iftEmpty(&ift); free(line); fclose(fp); return 1;
+    strcpy(errmsg, "contains no curves");
+    iftEmpty(&ift); free(line); return 1;
   }
 
   /* Allocate memory for data */
   if(verbose>1) {printf("allocating memory\n"); fflush(stdout);}
   if(dftSetmem(data, frameNr, voiNr)) {
-    strcpy(dfterrmsg, "out of memory");
-    iftEmpty(&ift); free(line); fclose(fp); return 2;
+    strcpy(errmsg, "out of memory");
+    iftEmpty(&ift); free(line); return 2;
   }
 
   /* For plain data files, set defaults for title data */
@@ -196,46 +356,42 @@ int dftRead(
 
   /* Try to read information from a single title line in PMOD files */
   if(type==DFT_FORMAT_PMOD) {
-    if(fgets(line, longest, fp)==NULL) {
-      strcpy(dfterrmsg, "wrong format"); free(line); fclose(fp); return 101;}
+    if(dftGetsContents(line, longest, &pos, end)==NULL) {
+      strcpy(errmsg, "wrong format"); free(line); return 101;}
     if(verbose>1) {printf("calling dftGetPmodTitle\n"); fflush(stdout);}
     dftGetPmodTitle(data, line);
     // do not rewind!
   }
 
-  /* 
+  /*
    *  Read DFT title lines, if they exist
    */
-  i=0; 
+  i=0;
   if(type==DFT_FORMAT_STANDARD) {
     if(verbose>1) {printf("reading DFT title lines\n"); fflush(stdout);}
     do {
-      if(fgets(line, longest, fp)==NULL) {
-        strcpy(dfterrmsg, "wrong format"); free(line); fclose(fp); return 102;}
+      if(dftGetsContents(line, longest, &pos, end)==NULL) {
+        strcpy(errmsg, "wrong format"); free(line); return 102;}
       lptr=line;
       /* Check for comment line */
       if(line[0]=='#') { /* Read comment only if there is space left */
-#if(1)
         strlcat(data->comments, line, _DFT_COMMENT_LEN);
-#else
-        if(strlen(data->comments)+strlen(line)<_DFT_COMMENT_LEN) strcat(data->comments, line);
-#endif
         continue;
       }
       cptr=strchr(line, '#'); if(cptr!=NULL) *cptr=(char)0;
       /* Read first token, and check for empty lines as well */
-      cptr=strtok(lptr, " \t\n\r"); if(cptr==NULL) continue; else i++;
+      cptr=strtok_r(lptr, " \t\n\r", &saveptr); if(cptr==NULL) continue; else i++;
       if(i==1) { /* VOI names */
         for(j=0; j<voiNr; j++) {
-          if((cptr=strtok(NULL, " \t\n\r"))==NULL) {
-            strcpy(dfterrmsg, "wrong format"); free(line); fclose(fp); return 103;}
+          if((cptr=strtok_r(NULL, " \t\n\r", &saveptr))==NULL) {
+            strcpy(errmsg, "wrong format"); free(line); return 103;}
           if(strlen(cptr)>1 || *cptr!='.') {
             strncpy(data->voi[j].name, cptr, MAX_REGIONNAME_LEN);
             data->voi[j].name[MAX_REGIONNAME_LEN]=(char)0;
             strncpy(data->voi[j].voiname, cptr, MAX_REGIONSUBNAME_LEN);
             data->voi[j].voiname[MAX_REGIONSUBNAME_LEN]=(char)0;
             /* if name is long, then divide it into name subfields */
-            if(strlen(cptr)>MAX_REGIONSUBNAME_LEN) { 
+            if(strlen(cptr)>MAX_REGIONSUBNAME_LEN) {
               strncpy(data->voi[j].hemisphere, cptr+MAX_REGIONSUBNAME_LEN, MAX_REGIONSUBNAME_LEN);
               data->voi[j].hemisphere[MAX_REGIONSUBNAME_LEN]=(char)0;
               if(strlen(cptr)>2*MAX_REGIONSUBNAME_LEN) {
@@ -254,9 +410,9 @@ int dftRead(
           strlcpy(data->studynr, cptr, MAX_STUDYNR_LEN);
         } else strcpy(data->studynr, "");
         for(j=0; j<voiNr; j++) {
-          if((cptr=strtok(NULL, " \t\n\r"))==NULL) {
-            strcpy(dfterrmsg, "missing field on 2nd line");
-            free(line); fclose(fp); return 104;
+          if((cptr=strtok_r(NULL, " \t\n\r", &saveptr))==NULL) {
+            strcpy(errmsg, "missing field on 2nd line");
+            free(line); return 104;
           }
           if(strlen(cptr)>1 || *cptr!='.') {
             strncpy(data->voi[j].hemisphere, cptr, MAX_REGIONSUBNAME_LEN);
@@ -268,8 +424,8 @@ int dftRead(
           }
         }
         /* check that there are no more contents */
-        if((cptr=strtok(NULL, " \t\n\r"))!=NULL) {
-          strcpy(dfterrmsg, "wrong format"); free(line); fclose(fp); return 105;}
+        if((cptr=strtok_r(NULL, " \t\n\r", &saveptr))!=NULL) {
+          strcpy(errmsg, "wrong format"); free(line); return 105;}
       } else if(i==3) { /* unit and VOI place (planes) */
         /* first, copy the unit */
         strlcpy(data->unit, cptr, 13); //data->unit[12]=(char)0;
@@ -277,9 +433,9 @@ int dftRead(
         int len, ii=0;
         j=0;
         while(j<voiNr) {
-          if((cptr=strtok(NULL, " \t\n\r"))==NULL) {
-            strcpy(dfterrmsg, "missing field on 3rd line");
-            free(line); fclose(fp); return 106;
+          if((cptr=strtok_r(NULL, " \t\n\r", &saveptr))==NULL) {
+            strcpy(errmsg, "missing field on 3rd line");
+            free(line); return 106;
           }
           len=strlen(cptr);
           /* check if cunit consists of two parts */
@@ -303,19 +459,19 @@ int dftRead(
         else if(strcasecmp(cptr, "End")==0) data->timetype=DFT_TIME_END;
         else if(strcasecmp(cptr, "Distance")==0) data->timetype=DFT_TIME_MIDDLE;
         else if(strcasecmp(cptr, "Distances")==3) data->timetype=DFT_TIME_STARTEND;
-        else {strcpy(dfterrmsg, "wrong format"); free(line); fclose(fp); return 108;}
+        else {strcpy(errmsg, "wrong format"); free(line); return 108;}
         /* time unit */
-        if((cptr=strtok(NULL, " \t\n\r"))==NULL) {
-          strcpy(dfterrmsg, "wrong format"); free(line); fclose(fp); return 109;}
+        if((cptr=strtok_r(NULL, " \t\n\r", &saveptr))==NULL) {
+          strcpy(errmsg, "wrong format"); free(line); return 109;}
         strcpy(temp, ""); j=sscanf(cptr, "(%127s)", temp);
         j=strlen(temp)-1; if(j>=0 && temp[j]==')') temp[j]=(char)0;
         data->timeunit=petTunitId(temp);
         if(data->timeunit<0) {
-          strcpy(dfterrmsg, "wrong format"); free(line); fclose(fp); return 110;}
+          strcpy(errmsg, "wrong format"); free(line); return 110;}
         /* volumes */
         for(j=0; j<voiNr; j++) {
-          if((cptr=strtok(NULL, " \t\n\r"))==NULL) {
-            strcpy(dfterrmsg, "wrong format"); free(line); fclose(fp); return 111;}
+          if((cptr=strtok_r(NULL, " \t\n\r", &saveptr))==NULL) {
+            strcpy(errmsg, "wrong format"); free(line); return 111;}
           if(strlen(cptr)==1 && *cptr=='.') data->voi[j].size=0.0;
           else data->voi[j].size=atof_dpi(cptr);
         }
@@ -325,59 +481,50 @@ int dftRead(
 
   /* Read data lines */
   if(verbose>1) {printf("reading data lines\n"); fflush(stdout);}
-  i=0; while(fgets(line, longest, fp)!=NULL) {
+  i=0; while(dftGetsContents(line, longest, &pos, end)!=NULL) {
 
     /* Check for comment line */
     if(line[0]=='#') { /* Read comment only if there is space left */
       strlcat(data->comments, line, _DFT_COMMENT_LEN);
       continue;
     }
-    // remove end-of-line comment    
+    // remove end-of-line comment
     cptr=strchr(line, '#'); if(cptr!=NULL) *cptr=(char)0;
 
     /* Read first token, and check for empty lines as well */
-    char *nline; nline=strdup(line); lptr=nline;
-    cptr=strtok(lptr, " \t\n\r"); if(cptr==NULL) {free(nline); continue;}
+    cptr=strtok_r(line, " \t\n\r", &saveptr); if(cptr==NULL) continue;
     if(i<frameNr) {
       /* Read time(s) */
-      if(atof_with_check(cptr, &f)!=0) {
-        strcpy(dfterrmsg, "wrong format"); 
-        free(line); free(nline); fclose(fp); return 130;
+      if(dftAtofToken(cptr, &f)!=0) {
+        strcpy(errmsg, "wrong format"); free(line); return 130;
       }
       if(data->timetype==DFT_TIME_STARTEND) {
-        data->x1[i]=f; cptr=strtok(NULL, " \t\n\r");
-        if(atof_with_check(cptr, &data->x2[i])!=0) {
-          strcpy(dfterrmsg, "wrong format"); 
-          free(line); free(nline); fclose(fp); return 131;
+        data->x1[i]=f; cptr=strtok_r(NULL, " \t\n\r", &saveptr);
+        if(dftAtofToken(cptr, &data->x2[i])!=0) {
+          strcpy(errmsg, "wrong format"); free(line); return 131;
         }
         data->x[i]=0.5*(data->x1[i]+data->x2[i]);
       } else data->x[i]=f;
       /* curve data */
       for(j=0; j<voiNr; j++) {
-        if((cptr=strtok(NULL, " \t\n\r"))==NULL) {
-          strcpy(dfterrmsg, "wrong format"); 
-          free(line); free(nline); fclose(fp); return 132;
+        if((cptr=strtok_r(NULL, " \t\n\r", &saveptr))==NULL) {
+          strcpy(errmsg, "wrong format"); free(line); return 132;
         }
-        if(strlen(cptr)==1 && *cptr=='.') 
+        if(strlen(cptr)==1 && *cptr=='.')
           data->voi[j].y[i]=nan("");
         else {
-          if(atof_with_check(cptr, &data->voi[j].y[i])!=0) {
-            strcpy(dfterrmsg, "wrong format"); 
-            free(line); free(nline); fclose(fp); return 133;
+          if(dftAtofToken(cptr, &data->voi[j].y[i])!=0) {
+            strcpy(errmsg, "wrong format"); free(line); return 133;
           }
           c=dec_nr(cptr);
-          if(c>DFT_NR_OF_DECIMALS && c<11) DFT_NR_OF_DECIMALS=c;
+          if(c>*decimals && c<11) *decimals=c;
         }
       }
     }
-    free(nline);
     i++;
   }
-  if(i!=frameNr) {
-    strcpy(dfterrmsg, "wrong format"); fclose(fp); free((char*)line); return 134;}
-
-  /* Close file */
-  fclose(fp); free((char*)line);
+  free(line);
+  if(i!=frameNr) {strcpy(errmsg, "wrong format"); return 134;}
 
   /* Set voiNr and frameNr, and type */
   data->voiNr=voiNr; data->frameNr=frameNr;
@@ -387,7 +534,7 @@ int dftRead(
     data->_type=type; // keeping PMOD format
     // unless TAC names could not be read
     for(i=0; i<data->voiNr; i++) if(strlen(data->voi[i].name)<1) {
-      data->_type=DFT_FORMAT_PLAIN; break;} 
+      data->_type=DFT_FORMAT_PLAIN; break;}
   } else {
     data->_type=type;
   }
@@ -401,7 +548,7 @@ int dftRead(
     for(j=0; j<data->frameNr; j++) data->w[j]=data->voi[i].y[j];
     /* Move the following VOIs one step backwards */
     for(c=i+1; c<data->voiNr; c++) if(dftCopyvoi(data, c, c-1)) {
-      strcpy(dfterrmsg, "cannot read weight"); return 4;}
+      strcpy(errmsg, "cannot read weight"); return 4;}
     data->voiNr--;
     break;
   }
@@ -416,6 +563,95 @@ int dftRead(
 
   return(0);
 }
+/// @endcond
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Read TAC file contents into specified DFT data structure. Reads standard DFT files,
+    plain DFT files, and some other formats.
+    @details File is read into memory only once, and its format is identified and
+    the data parsed from there, except for a few rarely used formats.
+    @sa dftFormat, dftWrite, dftReadBatch
+    @return Returns 0 when successful, in case of error sets dfterrmsg.
+ */
+int dftRead(
+  /** Name of file to be read. */
+  char *filename,
+  /** Pointer to initiated DFT struct where data will be written; any old content is deleted. */
+  DFT *data
+) {
+  char *contents;
+  size_t len;
+  int ret;
+
+  /* Empty data */
+  if(data==NULL) {strcpy(dfterrmsg, "invalid data"); return 1;}
+  dftEmpty(data);
+
+  /* Read the file contents */
+  contents=textfileReadContents(filename, &len);
+  if(contents==NULL) {strcpy(dfterrmsg, "cannot open file"); return 1;}
+  ret=dftReadContents(filename, contents, len, data, dfterrmsg, &DFT_NR_OF_DECIMALS);
+  free(contents);
+  return(ret);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Read a set of TAC files into an array of DFT structs, using parallel
+    threads if available. Each file is read as with dftRead().
+
+    In case of errors, dfterrmsg is set for the first file that could not be read.
+    @sa dftRead
+    @return Returns 0 when all files were read, otherwise the nr of files that
+    could not be read.
+ */
+int dftReadBatch(
+  /** Nr of files to read. */
+  int fileNr,
+  /** Array of file names. */
+  char **filename,
+  /** Array of initiated DFT structs, one for each file, where data will be
+      written; any old contents are deleted. */
+  DFT *dft,
+  /** Array where dftRead() return code is written for each file;
+      enter NULL if not needed. */
+  int *status
+) {
+  int fi, failedNr=0, firstFailed=fileNr, decNr=DFT_NR_OF_DECIMALS;
+  char firstmsg[64];
+
+  if(fileNr<1) return(0);
+  if(filename==NULL || dft==NULL) {strcpy(dfterrmsg, "invalid data"); return(fileNr);}
+  strcpy(firstmsg, "");
+
+#pragma omp parallel for schedule(dynamic) reduction(+:failedNr) reduction(max:decNr)
+  for(fi=0; fi<fileNr; fi++) {
+    char errmsg[64], *contents;
+    size_t len;
+    int ret, d=DFT_NR_OF_DECIMALS;
+
+    dftEmpty(dft+fi);
+    contents=textfileReadContents(filename[fi], &len);
+    if(contents==NULL) {
+      strcpy(errmsg, "cannot open file"); ret=1;
+    } else {
+      ret=dftReadContents(filename[fi], contents, len, dft+fi, errmsg, &d);
+      free(contents);
+    }
+    if(d>decNr) decNr=d;
+    if(status!=NULL) status[fi]=ret;
+    if(ret!=0) {
+      failedNr++;
+#pragma omp critical(dftReadBatchError)
+      if(fi<firstFailed) {firstFailed=fi; strcpy(firstmsg, errmsg);}
+    }
+  }
+
+  if(decNr>DFT_NR_OF_DECIMALS) DFT_NR_OF_DECIMALS=decNr;
+  if(failedNr>0) strcpy(dfterrmsg, firstmsg);
+  return(failedNr);
+}
 /*****************************************************************************/
 
 /*****************************************************************************/
@@ -431,86 +667,15 @@ int dftFormat(
 ) {
   if(CSV_TEST>0) {printf("dftFormat('%s')\n", fname); fflush(stdout);}
 
-  FILE *fp;
-  char tmp[256];
-  int c;
-
-
-  /* Open file */
-  fp=fopen(fname, "r");
-  if(fp==NULL) return DFT_FORMAT_UNKNOWN;
+  char *contents;
+  size_t len;
+  int format;
 
-  /* Binary data? */
-  while((c=fgetc(fp))!=EOF) 
-    if(!isalnum(c) && !isspace(c) && !isgraph(c) && c!=169) {
-      fclose(fp); return DFT_FORMAT_UNKNOWN;
-    }
-  rewind(fp);
-
-  /* File with one title line without comment mark? */
-  while(fgets(tmp, 10, fp) != NULL) {if(strlen(tmp)) break;}
-  if(strncasecmp(tmp, "Time[", 5)==0) {fclose(fp); return DFT_FORMAT_PMOD;}
-  if(strncasecmp(tmp, "Start[", 6)==0) {fclose(fp); return DFT_FORMAT_PMOD;}
-  if(strcasestr(tmp, "Start\tEnd\t")!=NULL) {fclose(fp); return DFT_FORMAT_PMOD;}
-  rewind(fp);
-
-  /* Read the first line that is not empty or comment line */
-  while(fgets(tmp, 32, fp) != NULL) {
-    if(strlen(tmp)==0) continue;
-    if(tmp[0]=='#') continue;
-    if(strncmp(tmp, "//", 2)==0) continue;
-    break;
-  }
-  rewind(fp);
-
-  /* Check for identification strings */
-  if(strncasecmp(tmp, "DFT", 3)==0) {fclose(fp); return DFT_FORMAT_STANDARD;}
-  else if(strncasecmp(tmp, "FIT1", 3)==0) {fclose(fp); return DFT_FORMAT_FIT;}
-  else if(strncasecmp(tmp, "cpt", 3)==0) {fclose(fp); return DFT_FORMAT_NCI;}
-
-  /* Identify certain filename extensions */
-  if(fncasematch(fname, "*.idwc")==1 || fncasematch(fname, "*.idw")==1) {
-    fclose(fp); return DFT_FORMAT_IDWC;}
-  if(fncasematch(fname, "*.if")==1) {fclose(fp); return DFT_FORMAT_IF;}
-
-  fclose(fp);
-
-  /* Try to read as CSV */
-  CSV csv; csvInit(&csv);
-  if(csvRead(&csv, fname)==0) {
-    int format=DFT_FORMAT_UNKNOWN;
-    if(csv.separator==';') format=DFT_FORMAT_CSV_INT;
-    else if(csv.separator==',') format=DFT_FORMAT_CSV_UK;
-    else if(csv.separator=='\t') {
-      int i, commas=0, dots=0;
-      for(i=0; i<csv.nr; i++) {
-        if(strchr(csv.c[i].content, ',')!=NULL) commas++;
-        else if(strchr(csv.c[i].content, '.')!=NULL) dots++;
-      }
-      if(dots>commas) format=DFT_FORMAT_CSV_UK; else format=DFT_FORMAT_CSV_INT;
-    }
-    if(CSV_TEST>1) printf("  format=%d\n", format);
-    csvEmpty(&csv);
-    if(format!=DFT_FORMAT_UNKNOWN) return(format);
-  }
-
-#if(0)
-  if(fncasematch(fname, "*.csv")==1) {
-    /* If ';' is found, then international format, otherwise UK format */
-    while((c=fgetc(fp))!=EOF)
-      if(c==';') {fclose(fp); return DFT_FORMAT_CSV_INT;}
-    fclose(fp); return DFT_FORMAT_CSV_UK;
-  }
-  if(fncasematch(fname, "*.tsv")==1) {
-    /* If ',' is found, then international format, otherwise UK format */
-    while((c=fgetc(fp))!=EOF)
-      if(c==',') {fclose(fp); return DFT_FORMAT_CSV_INT;}
-    fclose(fp); return DFT_FORMAT_CSV_UK;
-  }
-  fclose(fp);
-#endif
-
-  return DFT_FORMAT_PLAIN;
+  contents=textfileReadContents(fname, &len);
+  if(contents==NULL) return DFT_FORMAT_UNKNOWN;
+  format=dftFormatContents(contents, len, fname, NULL);
+  free(contents);
+  return(format);
 }
 /*****************************************************************************/
 
@@ -997,7 +1162,7 @@ int dft_fill_hdr_from_IFT(
   IFT *ift
 ) {
   int ki, ri, ok_nr=0, ret;
-  char keystr[256], *cptr;
+  char keystr[256], *cptr, *saveptr;
 
   //printf("dft_fill_hdr_from_IFT()\n");
 
@@ -1045,11 +1210,11 @@ int dft_fill_hdr_from_IFT(
   strcpy(keystr, "sizes"); ki=iftGet(ift, keystr);
   if(ki==-1) {strcpy(keystr, "volumes"); ki=iftGet(ift, keystr);}
   if(ki>=0 && strlen(ift->item[ki].value)) {
-    ri=0; cptr=strtok(ift->item[ki].value, " ;\t");
+    ri=0; cptr=strtok_r(ift->item[ki].value, " ;\t", &saveptr);
     while(cptr!=NULL && ri<dft->_voidataNr) {
       if(strcmp(cptr, ".")==0) {ri++; continue;}
       dft->voi[ri++].size=atof_dpi(cptr);
-      cptr=strtok(NULL, " ;\t");
+      cptr=strtok_r(NULL, " ;\t", &saveptr);
     }
     ok_nr++;
   }
@@ -1141,7 +1306,7 @@ int dftGetPmodTitle(
   //if(dft==NULL) printf(" dft=NULL\n");
 
   int ti=0, ri, ret, tabs=0, timetype=DFT_TIME_MIDDLE;
-  char *cptr, *cptr2, rname[MAX_REGIONNAME_LEN+1];
+  char *cptr, *cptr2, *saveptr, rname[MAX_REGIONNAME_LEN+1];
   char unit[MAX_UNITS_LEN+1], separs[8];
 
   /* Check the input */
@@ -1155,7 +1320,7 @@ int dftGetPmodTitle(
   /* Make a copy of title line */
   char ntl[1+strlen(title_line)], *tl;
   strcpy(ntl, title_line); tl=ntl;
-  cptr=strtok(tl, separs); if(cptr==NULL) return 2;
+  cptr=strtok_r(tl, separs, &saveptr); if(cptr==NULL) return 2;
   ti=ri=0;
   while(cptr!=NULL) {
     if(ti==0) {
@@ -1195,7 +1360,7 @@ int dftGetPmodTitle(
       ri++;
     }
     ti++;
-    cptr=strtok(NULL, separs);
+    cptr=strtok_r(NULL, separs, &saveptr);
   }
   if(dft==NULL) {
     return(ri);
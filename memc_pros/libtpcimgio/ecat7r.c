@@ -150,29 +150,14 @@ int ecat7ReadMainheader(
 /*****************************************************************************/
 
 /*****************************************************************************/
-/*!
- * Read ECAT 7.x image header
- *
- * @param fp 	input file pointer
- * @param blk block number [1..number of blocks]
- * @param h	Ecat7 image header
- * @return 0 if ok, 1 == invalid parameters, 2 == first header block not found,
- * 3 == header block not read properly
- */
-int ecat7ReadImageheader(FILE *fp, int blk, ECAT7_imageheader *h) {
-  unsigned char buf[MatBLKSIZE];
+/// @cond
+/** Copy ECAT 7.x image header fields from header block that has been read
+    into buf; contents of buf are byte swapped on little endian platforms. */
+static void ecat7ParseImageheader(unsigned char *buf, ECAT7_imageheader *h) {
   int little; /* 1 if current platform is little endian (i386), else 0 */
 
-  if(ECAT7_TEST) printf("ecat7ReadImageheader()\n");
-  if(fp==NULL || h==NULL) return(1);
   little=little_endian(); if(ECAT7_TEST) printf("little=%d\n", little);
 
-  /* Seek the subheader block */
-  fseek(fp, (blk-1)*MatBLKSIZE, SEEK_SET);
-  if(ftell(fp)!=(blk-1)*MatBLKSIZE) return(2);
-  /* Read the header block */
-  if(fread(buf, MatBLKSIZE, 1, fp)<1) return(3);
-
   /* Copy the header fields and swap if necessary */
   if(little) swabip(buf+0, 2);
   memcpy(&h->data_type, buf+0, 2);
@@ -293,7 +278,33 @@ int ecat7ReadImageheader(FILE *fp, int blk, ECAT7_imageheader *h) {
   memcpy(&h->recon_views, buf+238, 2);
   memcpy(&h->fill_cti, buf+240, 174);
   memcpy(&h->fill_user, buf+414, 96);
+}
+/// @endcond
+/*****************************************************************************/
+
+/*****************************************************************************/
+/*!
+ * Read ECAT 7.x image header
+ *
+ * @param fp 	input file pointer
+ * @param blk block number [1..number of blocks]
+ * @param h	Ecat7 image header
+ * @return 0 if ok, 1 == invalid parameters, 2 == first header block not found,
+ * 3 == header block not read properly
+ */
+int ecat7ReadImageheader(FILE *fp, int blk, ECAT7_imageheader *h) {
+  unsigned char buf[MatBLKSIZE];
+
+  if(ECAT7_TEST) printf("ecat7ReadImageheader()\n");
+  if(fp==NULL || h==NULL) return(1);
 
+  /* Seek the subheader block */
+  fseek(fp, (blk-1)*MatBLKSIZE, SEEK_SET);
+  if(ftell(fp)!=(blk-1)*MatBLKSIZE) return(2);
+  /* Read the header block */
+  if(fread(buf, MatBLKSIZE, 1, fp)<1) return(3);
+
+  ecat7ParseImageheader(buf, h);
   return(0);
 }
 /*****************************************************************************/
@@ -774,6 +785,101 @@ int ecat7Read2DNormheader(FILE *fp, int blk, ECAT7_2Dnormheader *h) {
 }
 /*****************************************************************************/
 
+/*****************************************************************************/
+/// @cond
+/** Convert byte order of ECAT7 matrix data in place, if necessary, and
+    VAX floats to native floats. Values are processed as whole 16- or 32-bit
+    words, which compilers can vectorise, instead of one byte at a time.
+    @return 0 if ok, or 2 if data type is not supported.
+ */
+static int ecat7SwapMatrixdata(char *data, int byteNr, int dtype) {
+  int i, n, little, swap, wordBytes;
+  unsigned short int s;
+  unsigned int u;
+
+  little=little_endian();
+  switch(dtype) {
+    case ECAT7_BYTE: /* byte format...no translation necessary */
+      return(0);
+    case ECAT7_VAXI2:  /* byte conversion necessary on big endian platform */
+      wordBytes=2; swap=!little; break;
+    case ECAT7_SUNI2:  /* SUN short ; byte conversion necessary on
+                          little endian platforms */
+      wordBytes=2; swap=little; break;
+    case ECAT7_VAXI4:  /* 32-bit int format is same in VAX and i386;
+                          byte conversion necessary on big endian platform */
+      wordBytes=4; swap=!little; break;
+    case ECAT7_IEEER4: /* IEEE float ; byte conversion necessary on
+                          little endian platforms */
+    case ECAT7_SUNI4:  /* SUN int ; byte conversion necessary on
+                          little endian platforms */
+      wordBytes=4; swap=little; break;
+    case ECAT7_VAXR4:  /* swap words on i386 and bytes on SUN, and subtract
+                          2 from exponent; zero stays zero, as in ecat7rFloat() */
+      for(i=0, n=byteNr/4; i<n; i++) {
+        memcpy(&u, data+4*i, 4);
+        if(little) u=(u<<16)|(u>>16);
+        else u=((u&0x00FF00FFU)<<8)|((u>>8)&0x00FF00FFU);
+        u=(u==0) ? 0 : u-(2U<<23);
+        memcpy(data+4*i, &u, 4);
+      }
+      return(0);
+    default:  /* if something else, for now think it as an error */
+      return(2);
+  }
+  if(!swap) return(0);
+  if(wordBytes==2) {
+    for(i=0, n=byteNr/2; i<n; i++) {
+      memcpy(&s, data+2*i, 2);
+      s=(unsigned short int)((s<<8)|(s>>8));
+      memcpy(data+2*i, &s, 2);
+    }
+  } else {
+    for(i=0, n=byteNr/4; i<n; i++) {
+      memcpy(&u, data+4*i, 4);
+      u=(u>>24)|((u>>8)&0x0000FF00U)|((u<<8)&0x00FF0000U)|(u<<24);
+      memcpy(data+4*i, &u, 4);
+    }
+  }
+  return(0);
+}
+
+/** Convert image matrix data, with byte order already converted, to floats
+    multiplied by the scale factor in the image header. */
+static void ecat7ImagedataToFloat(
+  char *mdata, ECAT7_imageheader *h, int pxlNr, float *fdata
+) {
+  int i;
+  short int s;
+  float f;
+
+  if(h->data_type==ECAT7_BYTE) {
+    for(i=0; i<pxlNr; i++)
+      fdata[i]=h->scale_factor*(float)mdata[i];
+  } else if(h->data_type==ECAT7_VAXI2 || h->data_type==ECAT7_SUNI2) {
+    for(i=0; i<pxlNr; i++) {
+      memcpy(&s, mdata+2*i, 2);
+      f=h->scale_factor*(float)s;
+      fdata[i]=(f>-1.0E+22 && f<1.0E+22) ? f : 0.0;
+    }
+  } else if(h->data_type==ECAT7_VAXI4 || h->data_type==ECAT7_SUNI4) {
+    int n;
+    for(i=0; i<pxlNr; i++) {
+      memcpy(&n, mdata+4*i, 4);
+      f=h->scale_factor*(float)n;
+      fdata[i]=(f>-1.0E+22 && f<1.0E+22) ? f : 0.0;
+    }
+  } else if(h->data_type==ECAT7_VAXR4 || h->data_type==ECAT7_IEEER4) {
+    memcpy(fdata, mdata, pxlNr*4);
+    for(i=0; i<pxlNr; i++) {
+      f=fdata[i]*h->scale_factor;
+      fdata[i]=(f>-1.0E+22 && f<1.0E+22) ? f : 0.0;
+    }
+  }
+}
+/// @endcond
+/*****************************************************************************/
+
 /*****************************************************************************/
 /*!
  * Read ECAT7 matrix data and convert byte order if necessary
@@ -791,10 +897,6 @@ int ecat7Read2DNormheader(FILE *fp, int blk, ECAT7_2Dnormheader *h) {
 int ecat7ReadMatrixdata(
   FILE *fp, int start_block, int block_nr, char *data, int dtype
 ) {
-  int i, n, little, err=0;
-  char *cptr;
-  float f;
-
   if(ECAT7_TEST) printf("ecat7ReadMatrixdata(fp, %d, %d, data, %d)\n",
     start_block, block_nr, dtype);
   /* Check the arguments */
@@ -805,38 +907,7 @@ int ecat7ReadMatrixdata(
   /* Read the data blocks */
   if(fread(data, MatBLKSIZE, block_nr, fp) < (unsigned int)block_nr) return(2);
   /* Translate data if necessary */
-  little=little_endian();
-  switch(dtype) {
-    case ECAT7_BYTE: /* byte format...no translation necessary */
-      break;
-    case ECAT7_VAXI2:  /* byte conversion necessary on big endian platform */
-      if(!little) {cptr=data; swabip(cptr, block_nr*MatBLKSIZE);}
-      break;
-    case ECAT7_VAXI4:
-      for(i=0, cptr=data; i<block_nr*MatBLKSIZE; i+=4, cptr+=4) {
-        n=ecat7rInt(cptr, 1, little); memcpy(cptr, &n, 4);
-      }
-      break;
-    case ECAT7_VAXR4:
-      for(i=0, cptr=data; i<block_nr*MatBLKSIZE; i+=4, cptr+=4) {
-        f=ecat7rFloat(cptr, 1, little); memcpy(cptr, &f, 4);
-      }
-      break;
-    case ECAT7_IEEER4: /* IEEE float ; byte conversion necessary on
-                          little endian platforms */
-    case ECAT7_SUNI4:  /* SUN int ; byte conversion necessary on
-                          little endian platforms */
-      if(little) swawbip(data, block_nr*MatBLKSIZE);
-      break;
-    case ECAT7_SUNI2:  /* SUN short ; byte conversion necessary on
-                          little endian platforms */
-      if(little) swabip(data, block_nr*MatBLKSIZE);
-      break;
-    default:  /* if something else, for now think it as an error */ 
-      err=2;
-      break;
-  }
-  return(err);
+  return(ecat7SwapMatrixdata(data, block_nr*MatBLKSIZE, dtype));
 }
 /*****************************************************************************/
 
@@ -854,15 +925,14 @@ int ecat7ReadMatrixdata(
  * @return 0 if ok, 1 invalid input, 5 failed to read subheader,
  * 6 invalid image (x,y,z) dimensions, 8 failed to allocate memory for meta-data,
  * 9 failed to read matrix data, 11 failed to allocate memory for voxel data
+ * @sa ecat7ReadImageMatrices
  */
 int ecat7ReadImageMatrix(
   FILE *fp, int first_block, int last_block, ECAT7_imageheader *h, float **fdata
 ) {
-  int i, ret, blockNr, pxlNr;
-  char *mdata, *mptr;
-  float *_fdata, *fptr;
-  short int *sptr;
-  int *iptr;
+  int ret, blockNr, pxlNr;
+  char *mdata;
+  float *_fdata;
   
   
   if(ECAT7_TEST) printf("ecat7ReadImageMatrix(fp, %d, %d, hdr, fdata)\n",
@@ -894,9 +964,8 @@ int ecat7ReadImageMatrix(
     sprintf(ecat7errmsg, "cannot allocate memory.\n");
     return(8);  
   }
-  mptr=mdata;
-  ret=ecat7ReadMatrixdata(fp, first_block+1, blockNr, mptr, h->data_type);
-  if(ret || mdata==NULL) {
+  ret=ecat7ReadMatrixdata(fp, first_block+1, blockNr, mdata, h->data_type);
+  if(ret) {
     sprintf(ecat7errmsg, "cannot read matrix data (%d).\n", ret);
     free(mdata); return(9);
   }
@@ -909,32 +978,104 @@ int ecat7ReadImageMatrix(
   }
 
   /* Convert matrix data to floats */
-  fptr=_fdata; mptr=mdata;
-  if(h->data_type==ECAT7_BYTE) {
-    for(i=0; i<pxlNr; i++, mptr++, fptr++)
-      *fptr=h->scale_factor*(float)(*mptr);
-  } else if(h->data_type==ECAT7_VAXI2 || h->data_type==ECAT7_SUNI2) {
-    for(i=0; i<pxlNr; i++, mptr+=2, fptr++) {
-      sptr=(short int*)mptr;
-      *fptr=h->scale_factor*(float)(*sptr);
-      if(!(*fptr>-1.0E+22 && *fptr<1.0E+22)) *fptr=0.0;
+  ecat7ImagedataToFloat(mdata, h, pxlNr, _fdata);
+  free(mdata);
+  *fdata=_fdata;
+
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Set ecat7errmsg; ecat7ReadImageMatrices() is called from parallel frame
+    reading threads, which must not write the message at the same time. */
+static void ecat7SetErrmsg(const char *msg) {
+#pragma omp critical(ecat7errmsg)
+  sprintf(ecat7errmsg, "%s", msg);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/*!
+ * Read the subheaders and data of several ECAT7 image matrices, for example
+ * all planes of one frame, into preallocated memory.
+ * Matrices that are stored next to each other in the file are read with one
+ * fread() call, instead of separate reads for each subheader and data.
+ * Note: data is not calibrated with factor in main header.
+ *
+ * @param fp ECAT file pointer
+ * @param matdir Matrix directory entries of the matrices to read
+ * @param matrixNr Nr of matrices to read
+ * @param pxlNr Nr of pixels in each matrix; matrix dimensions in subheaders
+ *   must match this
+ * @param h Array of matrixNr subheaders which are filled
+ * @param fdata Preallocated array for matrixNr*pxlNr floats; data of matrix m
+ *   is placed at fdata+m*pxlNr
+ * @return 0 if ok, 1 invalid input, 6 invalid image (x,y,z) dimensions,
+ * 8 failed to allocate memory, 9 failed to read matrix data
+ * @sa ecat7ReadImageMatrix, ecat7ReadMatlist
+ */
+int ecat7ReadImageMatrices(
+  FILE *fp, ECAT7_MatDir *matdir, int matrixNr, int pxlNr,
+  ECAT7_imageheader *h, float *fdata
+) {
+  int m, m1, m2, blockNr, bufBlockNr=0, n, ret;
+  char *buf=NULL, *mptr;
+
+  if(ECAT7_TEST) printf("ecat7ReadImageMatrices(fp, matdir, %d, %d, h, fdata)\n",
+    matrixNr, pxlNr);
+  if(fp==NULL || matdir==NULL || matrixNr<1 || pxlNr<1 || h==NULL ||
+     fdata==NULL) {
+    ecat7SetErrmsg("invalid function parameter.\n");
+    return(1);
+  }
+  for(m=0; m<matrixNr; m++) if(matdir[m].strtblk<=MatFirstDirBlk ||
+      matdir[m].endblk<=matdir[m].strtblk) {
+    ecat7SetErrmsg("invalid function parameter.\n");
+    return(1);
+  }
+
+  for(m1=0; m1<matrixNr; m1=m2+1) {
+    /* Find the run of matrices that are stored next to each other */
+    blockNr=matdir[m1].endblk-matdir[m1].strtblk+1;
+    for(m2=m1; m2<matrixNr-1 && matdir[m2+1].strtblk==matdir[m2].endblk+1; m2++)
+      blockNr+=matdir[m2+1].endblk-matdir[m2+1].strtblk+1;
+    if(blockNr>bufBlockNr) {
+      free(buf); buf=(char*)malloc((size_t)blockNr*MatBLKSIZE);
+      if(buf==NULL) {
+        ecat7SetErrmsg("cannot allocate memory.\n");
+        return(8);
+      }
+      bufBlockNr=blockNr;
     }
-  } else if(h->data_type==ECAT7_VAXI4 || h->data_type==ECAT7_SUNI4) {
-    for(i=0; i<pxlNr; i++, mptr+=4, fptr++) {
-      iptr=(int*)mptr;
-      *fptr=h->scale_factor*(float)(*iptr);
-      if(!(*fptr>-1.0E+22 && *fptr<1.0E+22)) *fptr=0.0;
+    /* Read subheaders and data of the run at once */
+    ret=fseek(fp, (long)(matdir[m1].strtblk-1)*MatBLKSIZE, SEEK_SET);
+    if(ret==0 && fread(buf, MatBLKSIZE, blockNr, fp)<(size_t)blockNr) ret=1;
+    if(ret) {
+      ecat7SetErrmsg("cannot read matrix data.\n");
+      free(buf); return(9);
     }
-  } else if(h->data_type==ECAT7_VAXR4 || h->data_type==ECAT7_IEEER4) {
-    memcpy(fptr, mptr, pxlNr*4);
-    for(i=0; i<pxlNr; i++, fptr++) {
-      *fptr *= h->scale_factor;
-      if(!(*fptr>-1.0E+22 && *fptr<1.0E+22)) *fptr=0.0;
+    /* Process each matrix */
+    for(m=m1, mptr=buf; m<=m2; m++) {
+      ecat7ParseImageheader((unsigned char*)mptr, h+m);
+      if(ECAT7_TEST>4) ecat7PrintImageheader(h+m, stdout);
+      n=h[m].x_dimension*h[m].y_dimension;
+      if(h[m].num_dimensions>2) n*=h[m].z_dimension;
+      blockNr=matdir[m].endblk-matdir[m].strtblk;
+      if(n!=pxlNr || ecat7pxlbytes(h[m].data_type)<1 ||
+         (size_t)blockNr*MatBLKSIZE<(size_t)pxlNr*ecat7pxlbytes(h[m].data_type))
+      {
+        ecat7SetErrmsg("invalid matrix dimension.\n");
+        free(buf); return(6);
+      }
+      mptr+=MatBLKSIZE;
+      ecat7SwapMatrixdata(mptr, pxlNr*ecat7pxlbytes(h[m].data_type),
+                          h[m].data_type);
+      ecat7ImagedataToFloat(mptr, h+m, pxlNr, fdata+(size_t)m*pxlNr);
+      mptr+=(size_t)blockNr*MatBLKSIZE;
     }
   }
-  free(mdata);
-  *fdata=_fdata;
-
+  free(buf);
   return(0);
 }
 /*****************************************************************************/
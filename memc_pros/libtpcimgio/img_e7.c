@@ -5,6 +5,232 @@
 /*****************************************************************************/
 #include "libtpcimgio.h"
 /*****************************************************************************/
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+/*****************************************************************************/
+#ifndef IMG_E7_BATCH_PIXELS
+/** Frames are read in batches of at most this many pixels by imgReadEcat7(),
+    unless one frame is larger, or more frames are needed for all threads. */
+#define IMG_E7_BATCH_PIXELS 16777216
+#endif
+/*****************************************************************************/
+
+/*****************************************************************************/
+/// @cond
+/** Copy frame information from ECAT 7 image subheader into IMG. */
+static void imgEcat7ImageFrameInfo(
+  ECAT7_imageheader *h, IMG *img, int fi
+) {
+  img->start[fi]=h->frame_start_time/1000.;
+  img->end[fi]=img->start[fi]+h->frame_duration/1000.;
+  img->mid[fi]=0.5*(img->start[fi]+img->end[fi]);
+  if(h->decay_corr_fctr>1.0) {
+    img->decayCorrFactor[fi]=h->decay_corr_fctr;
+    img->decayCorrection=IMG_DC_CORRECTED;
+  } else {
+    img->decayCorrFactor[fi]=0.0;
+    img->decayCorrection=IMG_DC_UNKNOWN;
+  }
+}
+
+/** Read all frames of ECAT 7 image or volume into allocated IMG.
+    Matrix list must be sorted by plane, and contain frameNr frames for each
+    plane. All planes of one frame are read with ecat7ReadImageMatrices(),
+    and frames of a batch are read concurrently.
+    Pixel values are multiplied by calib.
+    @return 0 if ok, 1 in case of an error.
+ */
+static int imgEcat7ReadImageFrames(
+  const char *fname, FILE *fp, ECAT7_MATRIXLIST *mlist, int frameNr,
+  float calib, IMG *img
+) {
+  /* Nr of matrices in one frame, and nr of pixels in each */
+  const int matNr=mlist->matrixNr/frameNr;
+  const int dimx=img->dimx, pxlNr=img->dimx*img->dimy;
+  const size_t framePxlNr=(size_t)img->dimz*pxlNr;
+  if(matNr<1 || img->dimz%matNr!=0) return(1);
+  const int matPxlNr=pxlNr*(img->dimz/matNr);
+
+  /* Several frames are copied into IMG at a time, since pixel values of
+     consecutive frames are stored next to each other */
+  int batchNr=IMG_E7_BATCH_PIXELS/framePxlNr;
+#ifdef _OPENMP
+  if(batchNr<omp_get_max_threads()) batchNr=omp_get_max_threads();
+#endif
+  if(batchNr<1) batchNr=1;
+  if(batchNr>frameNr) batchNr=frameNr;
+  float *fdata=(float*)malloc(batchNr*framePxlNr*sizeof(float));
+  ECAT7_imageheader *ih=(ECAT7_imageheader*)malloc(
+    (size_t)batchNr*matNr*sizeof(ECAT7_imageheader));
+  ECAT7_MatDir *md=(ECAT7_MatDir*)malloc(
+    (size_t)batchNr*matNr*sizeof(ECAT7_MatDir));
+  FILE **fps=(FILE**)calloc(batchNr, sizeof(FILE*));
+  int ret=(fdata==NULL || ih==NULL || md==NULL || fps==NULL);
+  /* Frames of a batch are read concurrently, each thread with its own
+     file pointer */
+  int fpNr=1;
+#ifdef _OPENMP
+  fpNr=omp_get_max_threads();
+#endif
+  if(fpNr>batchNr) fpNr=batchNr;
+  if(ret==0) {
+    fps[0]=fp;
+    for(int b=1; b<fpNr && ret==0; b++)
+      if((fps[b]=fopen(fname, "rb"))==NULL) ret=1;
+  }
+
+  ECAT7_imageheader *lh=NULL;
+  for(int f1=0; f1<frameNr && ret==0; f1+=batchNr) {
+    const int n=(f1+batchNr<=frameNr) ? batchNr : frameNr-f1;
+#pragma omp parallel for schedule(dynamic) num_threads(fpNr)
+    for(int b=0; b<n; b++) {
+      FILE *tfp=fps[0];
+#ifdef _OPENMP
+      tfp=fps[omp_get_thread_num()];
+#endif
+      ECAT7_MatDir *bmd=md+(size_t)b*matNr;
+      for(int m=0; m<matNr; m++) bmd[m]=mlist->matdir[m*frameNr+f1+b];
+      if(ecat7ReadImageMatrices(tfp, bmd, matNr, matPxlNr,
+           ih+(size_t)b*matNr, fdata+b*framePxlNr))
+      {
+#pragma omp atomic write
+        ret=1;
+      }
+    }
+    if(ret) break;
+    /* Copy the batch into IMG; frames of each pixel are next to each other */
+#pragma omp parallel for schedule(static)
+    for(int zi=0; zi<img->dimz; zi++) {
+      for(int yi=0; yi<img->dimy; yi++) for(int xi=0; xi<dimx; xi++) {
+        const float *p=fdata+(size_t)zi*pxlNr+yi*dimx+xi;
+        float *v=img->m[zi][yi][xi]+f1;
+        for(int b=0; b<n; b++) v[b]=calib*p[b*framePxlNr];
+      }
+    }
+    /* Frame information is taken from the subheader of the last plane */
+    for(int b=0; b<n; b++) {
+      lh=ih+(size_t)b*matNr+matNr-1;
+      imgEcat7ImageFrameInfo(lh, img, f1+b);
+    }
+  }
+  if(ret==0) {
+    /* Image information from the last subheader */
+    img->_dataType=lh->data_type;
+    img->zoom=lh->recon_zoom;
+    img->sizex=10.*lh->x_pixel_size;
+    img->sizey=10.*lh->y_pixel_size;
+    img->sizez=10.*lh->z_pixel_size;
+    img->resolutionx=10.*lh->x_resolution;
+    img->resolutiony=10.*lh->y_resolution;
+    img->resolutionz=10.*lh->z_resolution;
+    img->xform[0]=NIFTI_XFORM_UNKNOWN; // qform
+    img->xform[1]=NIFTI_XFORM_SCANNER_ANAT; // sform
+    img->quatern[6]=img->sizex; img->quatern[9]=img->sizex;
+    img->quatern[11]=img->sizey; img->quatern[13]=img->sizey;
+    img->quatern[16]=img->sizez; img->quatern[17]=img->sizez;
+    img->mt[0]=lh->mt_1_1;
+    img->mt[1]=lh->mt_1_2;
+    img->mt[2]=lh->mt_1_3;
+    img->mt[3]=lh->mt_1_4;
+    img->mt[4]=lh->mt_2_1;
+    img->mt[5]=lh->mt_2_2;
+    img->mt[6]=lh->mt_2_3;
+    img->mt[7]=lh->mt_2_4;
+    img->mt[8]=lh->mt_3_1;
+    img->mt[9]=lh->mt_3_2;
+    img->mt[10]=lh->mt_3_3;
+    img->mt[11]=lh->mt_3_4;
+    /* Set plane numbers */
+    if(matNr==1 && img->dimz>1) {
+      for(int pi=0; pi<img->dimz; pi++) img->planeNumber[pi]=pi+1;
+    } else {
+      ECAT7_Matval matval;
+      for(int pi=0; pi<matNr; pi++) {
+        ecat7_id_to_val(mlist->matdir[pi*frameNr].id, &matval);
+        img->planeNumber[pi]=matval.plane;
+      }
+    }
+  }
+
+  if(fps!=NULL) for(int b=1; b<fpNr; b++) if(fps[b]!=NULL) fclose(fps[b]);
+  free(fps); free(md); free(ih); free(fdata);
+  return(ret);
+}
+
+/** Read one frame of ECAT 7 image or volume into allocated IMG; all planes
+    of the frame are read with ecat7ReadImageMatrices(), and calibrated.
+    Plane numbers in the matrix list must be continuous.
+    @return STATUS_OK, or error status.
+ */
+static int imgEcat7ReadImageFrame(
+  FILE *fp, ECAT7_MATRIXLIST *mlist, ECAT7_mainheader *mh, int frame_to_read,
+  IMG *img, int frame_index
+) {
+  ECAT7_Matval matval;
+  int m, matNr=0, seqplane=-1, ret=STATUS_OK;
+
+  /* List the matrices that belong to the required frame */
+  ECAT7_MatDir *md=(ECAT7_MatDir*)malloc(mlist->matrixNr*sizeof(ECAT7_MatDir));
+  int *plane=(int*)malloc(mlist->matrixNr*sizeof(int));
+  if(md==NULL || plane==NULL) {free(md); free(plane); return STATUS_NOMEMORY;}
+  for(m=0; m<mlist->matrixNr; m++) {
+    ecat7_id_to_val(mlist->matdir[m].id, &matval);
+    if(mh->num_frames>=mh->num_gates) {
+      if(matval.frame!=frame_to_read) continue;
+    } else {
+      if(matval.gate!=frame_to_read) continue;
+    }
+    md[matNr]=mlist->matdir[m]; plane[matNr++]=matval.plane;
+  }
+  if(matNr==0) {free(md); free(plane); return STATUS_NOMATRIX;}
+
+  /* Read all matrices */
+  const int is2D=(img->_fileFormat==IMG_E7_2D);
+  const int dimx=img->dimx, pxlNr=img->dimx*img->dimy;
+  const int matPxlNr=is2D ? pxlNr : img->dimz*pxlNr;
+  const float calib=(mh->ecat_calibration_factor>0.0) ?
+    mh->ecat_calibration_factor : 1.0;
+  float *fdata=(float*)malloc((size_t)matNr*matPxlNr*sizeof(float));
+  ECAT7_imageheader *ih=(ECAT7_imageheader*)malloc(
+    matNr*sizeof(ECAT7_imageheader));
+  if(fdata==NULL || ih==NULL) ret=STATUS_NOMEMORY;
+  else if(ecat7ReadImageMatrices(fp, md, matNr, matPxlNr, ih, fdata))
+    ret=STATUS_NOMATRIX;
+
+  /* Copy matrix data into IMG, each 2D matrix into its own plane */
+  if(ret==STATUS_OK && is2D) {
+    for(m=0; m<matNr && ret==STATUS_OK; m++) {
+      seqplane=plane[m]-1;
+      if(seqplane<0 || seqplane>=img->dimz) {ret=STATUS_MISSINGMATRIX; break;}
+      if(IMG_TEST>5)
+        printf("  putting data into m[%d][][][%d]\n", seqplane, frame_index);
+      const float *p=fdata+(size_t)m*matPxlNr;
+      for(int yi=0; yi<img->dimy; yi++) for(int xi=0; xi<dimx; xi++)
+        img->m[seqplane][yi][xi][frame_index]=calib*(*p++);
+      img->planeNumber[seqplane]=plane[m];
+    }
+  } else if(ret==STATUS_OK) {
+    /* one volume matrix per frame; if there are more, the last one is used */
+    seqplane=matNr-1;
+    const float *p=fdata+(size_t)seqplane*matPxlNr;
+    for(int pi=0; pi<img->dimz; pi++) {
+      if(IMG_TEST>5)
+        printf("  putting data into m[%d][][][%d]\n", pi, frame_index);
+      for(int yi=0; yi<img->dimy; yi++) for(int xi=0; xi<dimx; xi++)
+        img->m[pi][yi][xi][frame_index]=calib*(*p++);
+    }
+  }
+  if(ret==STATUS_OK) imgEcat7ImageFrameInfo(ih+matNr-1, img, frame_index);
+  free(md); free(plane); free(fdata); free(ih);
+  if(ret!=STATUS_OK) return(ret);
+
+  /* check that correct number of planes was read */
+  if(seqplane>0 && (seqplane+1 != img->dimz)) return STATUS_MISSINGMATRIX;
+  return STATUS_OK;
+}
+/// @endcond
+/*****************************************************************************/
 
 /*****************************************************************************/
 /** Read ECAT 7 image, volume or 2D sinogram.
@@ -167,19 +393,25 @@ int imgReadEcat7(
       img->_fileFormat=IMG_UNKNOWN; break;
   }
 
-  if(dimz>1) {
+  if(img->type==IMG_TYPE_IMAGE) {
+    /* Read image matrices one frame at a time, and calibrate */
+    ret=imgEcat7ReadImageFrames(fname, fp, &mlist, frameNr,
+      (main_header.ecat_calibration_factor>0.0) ?
+        main_header.ecat_calibration_factor : 1.0, img);
+    if(ret) {
+      if(IMG_TEST) printf("ecat7ReadImageMatrices()\n%s\n", ecat7errmsg);
+      fclose(fp); imgSetStatus(img, STATUS_NOMATRIX);
+      ecat7EmptyMatlist(&mlist); return(13);
+    }
+  } else if(dimz>1) {
     /* Read ECAT volume matrices */
     fi=0;
     for(m=0; m<mlist.matrixNr; m++) {
       /* Get matrix values */
       ecat7_id_to_val(mlist.matdir[m].id, &matval);
       /* Read subheader and data */
-      if(img->type==IMG_TYPE_IMAGE)
-        ret=ecat7ReadImageMatrix(fp, mlist.matdir[m].strtblk,
-              mlist.matdir[m].endblk, &image_header, &fdata);
-      else
-        ret=ecat7ReadScanMatrix(fp, mlist.matdir[m].strtblk,
-              mlist.matdir[m].endblk, &scan_header, &fdata);
+      ret=ecat7ReadScanMatrix(fp, mlist.matdir[m].strtblk,
+            mlist.matdir[m].endblk, &scan_header, &fdata);
       if(ret || fdata==NULL) {
         if(IMG_TEST) printf("ecat7ReadXMatrix()=%d\n%s\n", ret, ecat7errmsg);
         fclose(fp); imgSetStatus(img, STATUS_NOMATRIX);
@@ -192,42 +424,6 @@ int imgReadEcat7(
         img->end[fi]=img->start[fi]+polmap_header.frame_duration/1000.;
         img->mid[fi]=0.5*(img->start[fi]+img->end[fi]);
         img->sizex=0.001*polmap_header.pixel_size;
-      } else if(img->type==IMG_TYPE_IMAGE) {
-        img->_dataType=image_header.data_type;
-        img->start[fi]=image_header.frame_start_time/1000.;
-        img->end[fi]=img->start[fi]+image_header.frame_duration/1000.;
-        img->mid[fi]=0.5*(img->start[fi]+img->end[fi]);
-        if(image_header.decay_corr_fctr>1.0) {
-          img->decayCorrFactor[fi]=image_header.decay_corr_fctr;
-          img->decayCorrection=IMG_DC_CORRECTED;
-        } else {
-          img->decayCorrFactor[fi]=0.0;
-          img->decayCorrection=IMG_DC_UNKNOWN;
-        }
-        img->zoom=image_header.recon_zoom;
-        img->sizex=10.*image_header.x_pixel_size;
-        img->sizey=10.*image_header.y_pixel_size;
-        img->sizez=10.*image_header.z_pixel_size;
-        img->resolutionx=10.*image_header.x_resolution;
-        img->resolutiony=10.*image_header.y_resolution;
-        img->resolutionz=10.*image_header.z_resolution;
-        img->xform[0]=NIFTI_XFORM_UNKNOWN; // qform
-        img->xform[1]=NIFTI_XFORM_SCANNER_ANAT; // sform
-        img->quatern[6]=img->sizex; img->quatern[9]=img->sizex;
-        img->quatern[11]=img->sizey; img->quatern[13]=img->sizey;
-        img->quatern[16]=img->sizez; img->quatern[17]=img->sizez;
-        img->mt[0]=image_header.mt_1_1;
-        img->mt[1]=image_header.mt_1_2;
-        img->mt[2]=image_header.mt_1_3;
-        img->mt[3]=image_header.mt_1_4;
-        img->mt[4]=image_header.mt_2_1;
-        img->mt[5]=image_header.mt_2_2;
-        img->mt[6]=image_header.mt_2_3;
-        img->mt[7]=image_header.mt_2_4;
-        img->mt[8]=image_header.mt_3_1;
-        img->mt[9]=image_header.mt_3_2;
-        img->mt[10]=image_header.mt_3_3;
-        img->mt[11]=image_header.mt_3_4;
       } else {
         img->_dataType=scan_header.data_type;
         img->start[fi]=scan_header.frame_start_time/1000.;
@@ -265,9 +461,6 @@ int imgReadEcat7(
       if(img->type==IMG_TYPE_POLARMAP)
         ret=ecat7ReadPolarmapMatrix(fp, mlist.matdir[m].strtblk,
               mlist.matdir[m].endblk, &polmap_header, &fdata);
-      else if(img->type==IMG_TYPE_IMAGE)
-        ret=ecat7ReadImageMatrix(fp, mlist.matdir[m].strtblk,
-              mlist.matdir[m].endblk, &image_header, &fdata);
       else
         ret=ecat7Read2DScanMatrix(fp, mlist.matdir[m].strtblk,
               mlist.matdir[m].endblk, &scan2d_header, &fdata);
@@ -283,42 +476,6 @@ int imgReadEcat7(
         img->end[fi]=img->start[fi]+polmap_header.frame_duration/1000.;
         img->mid[fi]=0.5*(img->start[fi]+img->end[fi]);
         img->sizex=0.001*polmap_header.pixel_size;
-      } else if(img->type==IMG_TYPE_IMAGE) {
-        img->_dataType=image_header.data_type;
-        img->start[fi]=image_header.frame_start_time/1000.;
-        img->end[fi]=img->start[fi]+image_header.frame_duration/1000.;
-        img->mid[fi]=0.5*(img->start[fi]+img->end[fi]);
-        if(image_header.decay_corr_fctr>1.0) {
-          img->decayCorrFactor[fi]=image_header.decay_corr_fctr;
-          img->decayCorrection=IMG_DC_CORRECTED;
-        } else {
-          img->decayCorrFactor[fi]=0.0;
-          img->decayCorrection=IMG_DC_UNKNOWN;
-        }
-        img->zoom=image_header.recon_zoom;
-        img->sizex=10.*image_header.x_pixel_size;
-        img->sizey=10.*image_header.y_pixel_size;
-        img->sizez=10.*image_header.z_pixel_size;
-        img->resolutionx=10.*image_header.x_resolution;
-        img->resolutiony=10.*image_header.y_resolution;
-        img->resolutionz=10.*image_header.z_resolution;
-        img->xform[0]=NIFTI_XFORM_UNKNOWN; // qform
-        img->xform[1]=NIFTI_XFORM_SCANNER_ANAT; // sform
-        img->quatern[6]=img->sizex; img->quatern[9]=img->sizex;
-        img->quatern[11]=img->sizey; img->quatern[13]=img->sizey;
-        img->quatern[16]=img->sizez; img->quatern[17]=img->sizez;
-        img->mt[0]=image_header.mt_1_1;
-        img->mt[1]=image_header.mt_1_2;
-        img->mt[2]=image_header.mt_1_3;
-        img->mt[3]=image_header.mt_1_4;
-        img->mt[4]=image_header.mt_2_1;
-        img->mt[5]=image_header.mt_2_2;
-        img->mt[6]=image_header.mt_2_3;
-        img->mt[7]=image_header.mt_2_4;
-        img->mt[8]=image_header.mt_3_1;
-        img->mt[9]=image_header.mt_3_2;
-        img->mt[10]=image_header.mt_3_3;
-        img->mt[11]=image_header.mt_3_4;
       } else {
         img->_dataType=scan2d_header.data_type;
         img->start[fi]=scan2d_header.frame_start_time/1000.;
@@ -345,8 +502,8 @@ int imgReadEcat7(
   }
   fclose(fp); ecat7EmptyMatlist(&mlist);
 
-  /* Calibrate */
-  if(main_header.ecat_calibration_factor>0.0)
+  /* Calibrate; image data was calibrated when read */
+  if(img->type!=IMG_TYPE_IMAGE && main_header.ecat_calibration_factor>0.0)
     for(pi=0; pi<img->dimz; pi++)
       for(yi=0; yi<img->dimy; yi++) for(xi=0; xi<img->dimx; xi++)
         for(fi=0; fi<img->dimt; fi++)
@@ -1081,7 +1238,6 @@ int imgReadEcat7Frame(
   int ret, m, i, pi, xi, yi, frame, plane, seqplane, pxlNr;
   /* int blkNr=0; */
   ECAT7_mainheader main_header;
-  ECAT7_imageheader image_header;
   ECAT7_2Dscanheader scan2d_header;
   ECAT7_scanheader scan_header;
   ECAT7_polmapheader polmap_header;
@@ -1125,6 +1281,16 @@ int imgReadEcat7Frame(
   /*ret=ecat7GetMatrixBlockSize(&mlist, &blkNr);
     if(ret) {fclose(fp); return ret;}*/
 
+  /* Read image matrices of the frame at once */
+  if(img->type==IMG_TYPE_IMAGE) {
+    ret=imgEcat7ReadImageFrame(fp, &mlist, &main_header, frame_to_read,
+                               img, frame_index);
+    ecat7EmptyMatlist(&mlist); fclose(fp);
+    if(ret!=STATUS_OK) return(ret);
+    imgSetStatus(img, STATUS_OK);
+    return STATUS_OK;
+  }
+
   /* Read all matrices that belong to the required frame */
   /*blkNr=-1;*/
   ret=0; seqplane=-1; pxlNr=img->dimx*img->dimy;
@@ -1139,10 +1305,7 @@ int imgReadEcat7Frame(
     
     /* Read subheader and data */
     if(IMG_TEST>4) printf("reading matrix %d,%d\n", frame, plane);
-    if(img->type==IMG_TYPE_IMAGE) { /* 2D or 3D image */
-      ret=ecat7ReadImageMatrix(fp, mlist.matdir[m].strtblk,
-              mlist.matdir[m].endblk, &image_header, &fdata);
-    } else if(img->type==IMG_TYPE_POLARMAP) {  /* polarmap */
+    if(img->type==IMG_TYPE_POLARMAP) {  /* polarmap */
       ret=ecat7ReadPolarmapMatrix(fp, mlist.matdir[m].strtblk,
               mlist.matdir[m].endblk, &polmap_header, &fdata);
     } else if(img->dimz>1) { /* 3D sinogram */
@@ -1156,19 +1319,7 @@ int imgReadEcat7Frame(
       fclose(fp); ecat7EmptyMatlist(&mlist); return STATUS_NOMATRIX;}
 
     /* Copy information concerning this frame and make correction to data */
-    if(img->type==IMG_TYPE_IMAGE) {
-      img->start[frame_index]=image_header.frame_start_time/1000.;
-      img->end[frame_index]=
-        img->start[frame_index]+image_header.frame_duration/1000.;
-      img->mid[frame_index]=0.5*(img->start[frame_index]+img->end[frame_index]);
-      if(image_header.decay_corr_fctr>1.0) {
-        img->decayCorrFactor[frame_index]=image_header.decay_corr_fctr;
-        img->decayCorrection=IMG_DC_CORRECTED;
-      } else {
-        img->decayCorrFactor[frame_index]=0.0;
-        img->decayCorrection=IMG_DC_UNKNOWN;
-      }
-    } else if(img->type==IMG_TYPE_POLARMAP) {  /* polarmap */
+    if(img->type==IMG_TYPE_POLARMAP) {  /* polarmap */
       img->start[frame_index]=polmap_header.frame_start_time/1000.;
       img->end[frame_index]=
         img->start[frame_index]+polmap_header.frame_duration/1000.;
@@ -1215,13 +1366,13 @@ int imgReadEcat7Frame(
         img->planeNumber[seqplane]=plane;
     }
     free(fdata);
-    /* Calibrate */
-    if(main_header.ecat_calibration_factor>0.0)
-      for(pi=0; pi<img->dimz; pi++)
-        for(yi=0; yi<img->dimy; yi++) for(xi=0; xi<img->dimx; xi++)
-          img->m[pi][yi][xi][frame_index]*=main_header.ecat_calibration_factor;
   } /* next matrix */
   if(IMG_TEST>3) printf("end of matrices.\n");
+  /* Calibrate, once per frame when all planes have been read */
+  if(seqplane>=0 && main_header.ecat_calibration_factor>0.0)
+    for(pi=0; pi<img->dimz; pi++)
+      for(yi=0; yi<img->dimy; yi++) for(xi=0; xi<img->dimx; xi++)
+        img->m[pi][yi][xi][frame_index]*=main_header.ecat_calibration_factor;
   ecat7EmptyMatlist(&mlist);
   fclose(fp);
 
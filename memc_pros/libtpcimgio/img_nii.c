@@ -10,15 +10,107 @@
 #include "libtpcimgio.h"
 /*****************************************************************************/
 
+/*****************************************************************************/
+/// @cond
+/** Read all frames of Nifti image into IMG with header already filled and
+    memory allocated, mapping the image data file into memory.
+
+    Nifti header and SIF are read only once, and the voxel values are copied
+    from the mapping into IMG without intermediate buffer, when they are
+    stored as floats without scaling.
+    @return 0 if ok, STATUS_UNSUPPORTED if data can not be read via memory
+     mapping, and otherwise IMG status code.
+ */
+static int imgReadNiftiMapped(
+  const char *filename, IMG *img, int verbose
+) {
+  char basefile[FILENAME_MAX], tmp[256];
+  char datfile[FILENAME_MAX], hdrfile[FILENAME_MAX], siffile[FILENAME_MAX];
+  NIFTI_DSR dsr;
+  NIFTI_MAP map;
+  SIF sif;
+  int ret, fi;
+  float *fdata=NULL;
+
+  if(verbose>0) {printf("imgReadNiftiMapped(%s, ...)\n", filename); fflush(stdout);}
+
+  strcpy(basefile, filename); niftiRemoveFNameExtension(basefile);
+  if(strlen(basefile)<1) return(STATUS_FAULT);
+  ret=niftiExists(basefile, hdrfile, datfile, siffile, &dsr, verbose-2, tmp);
+  if(ret==0) {
+    imgSetStatus(img, STATUS_NOFILE);
+    if(verbose>0) fprintf(stderr, "Error: %s\n", tmp);
+    return(STATUS_NOFILE);
+  }
+
+  niftiMapInit(&map);
+  ret=niftiMapImagedata(datfile, &dsr, &map, verbose-1, tmp);
+  if(verbose>1) printf("niftiMapImagedata() -> %s\n", tmp);
+  if(ret!=0 || map.dimz!=img->dimz || map.dimy!=img->dimy || map.dimx!=img->dimx
+     || map.frameNr<img->dimt)
+  {
+    niftiUnmap(&map); return(STATUS_UNSUPPORTED);
+  }
+  if(map.fdata==NULL) {
+    fdata=(float*)malloc((size_t)img->dimx*img->dimy*img->dimz*sizeof(float));
+    if(fdata==NULL) {niftiUnmap(&map); return(STATUS_UNSUPPORTED);}
+  }
+
+  /* Copy one frame at a time, releasing the pages of the previous frame */
+  for(fi=0; fi<img->dimt; fi++) {
+    float *fptr=niftiMapFrame(&map, 1+fi, fdata, verbose-2, tmp);
+    if(fptr==NULL) {
+      if(verbose>1) printf("niftiMapFrame() -> %s\n", tmp);
+      free(fdata); niftiUnmap(&map); return(STATUS_UNSUPPORTED);
+    }
+    const int dimy=img->dimy, dimx=img->dimx;
+#pragma omp parallel for schedule(static)
+    for(int zi=0; zi<img->dimz; zi++) {
+      const float *p=fptr+(size_t)zi*dimy*dimx;
+      for(int yi=0; yi<dimy; yi++)
+        for(int xi=0; xi<dimx; xi++)
+          img->m[zi][yi][xi][fi]=*p++;
+    }
+    niftiMapRelease(&map, 1+fi);
+    img->decayCorrFactor[fi]=0.0;
+  }
+  free(fdata); niftiUnmap(&map);
+
+  /* Set plane numbers */
+  for(int zi=0; zi<img->dimz; zi++) img->planeNumber[zi]=zi+1;
+
+  /* Try to read frame time information from SIF file */
+  sifInit(&sif);
+  if(sifRead(siffile, &sif)!=0) {
+    if(verbose>1) {fprintf(stdout, "  cannot read SIF (%s)\n", siffile); fflush(stdout);}
+  } else {
+    for(fi=0; fi<img->dimt && fi<sif.frameNr; fi++) {
+      img->start[fi]=sif.x1[fi]; img->end[fi]=sif.x2[fi];
+      img->mid[fi]=0.5*(img->start[fi]+img->end[fi]);
+      img->prompts[fi]=sif.prompts[fi]; img->randoms[fi]=sif.randoms[fi];
+    }
+    sifEmpty(&sif);
+  }
+
+  imgSetStatus(img, STATUS_OK);
+  return(STATUS_OK);
+}
+/// @endcond
+/*****************************************************************************/
+
 /*****************************************************************************/
 /** Read Nifti-1 image.
 
     Nifti database name must be given with path. Either one file with
     extension .nii, or image and header files with extensions .img and .hdr must exist.
     Also SIF file with .sif extension is used, if it exists.
+
+    Image data file is mapped into memory when possible, otherwise it is read
+    one frame at a time.
   
     @return 0 if ok, and otherwise IMG status code (<>0); sets IMG->statmsg in case of an error.
-    @sa imgInit, imgReadNiftiFirstFrame, imgReadNiftiHeader, imgWriteNifti
+    @sa imgInit, imgReadNiftiFirstFrame, imgReadNiftiHeader, imgWriteNifti,
+        niftiMapImagedata
  */
 int imgReadNifti(
   /** Nifti database name with path, with or without extension */
@@ -56,7 +148,12 @@ int imgReadNifti(
     return STATUS_NOMEMORY;
   }
 
-  /* Read one frame at a time */
+  /* Read all frames from memory-mapped file, if possible */
+  ret=imgReadNiftiMapped(filename, img, verbose-1);
+  if(ret==STATUS_OK) return(STATUS_OK);
+  if(ret!=STATUS_UNSUPPORTED) return(ret);
+
+  /* Otherwise read one frame at a time */
   for(fi=0; fi<img->dimt; fi++) {
     ret=imgReadNiftiFrame(filename, 1+fi, img, fi, verbose-1);
     if(ret) return(ret);
@@ -0,0 +1,112 @@
+/// @file imgtile.c
+/// @author Vesa Oikonen
+/// @brief Traversing IMG data pixel-by-pixel in tiles of pixel TACs.
+///
+///  In IMG data the TAC of each pixel is stored contiguously, and pixels
+///  follow each other column by column, row by row, and plane by plane.
+///  Therefore a tile, i.e. a block of consecutive pixels, is a contiguous
+///  matrix of pixel TACs in the IMG data itself, and it can be processed
+///  without following the m[][][][] pointers for each pixel and frame.
+///  Tiles are accessed by index, so that they can be distributed to threads.
+///
+/*****************************************************************************/
+#include "libtpcimgio.h"
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Get the number of pixels in one frame of IMG data.
+    @sa imgTileNr, imgGetTile
+    @return Returns the nr of pixels, or 0 if IMG does not contain data.
+ */
+int imgPixelNr(
+  /** Pointer to IMG data. */
+  IMG *img
+) {
+  if(img==NULL || img->status!=IMG_STATUS_OCCUPIED) return(0);
+  return(img->dimz*img->dimy*img->dimx);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Get the number of tiles that are needed to cover all pixels of IMG data.
+    @sa imgGetTile, imgPixelNr
+    @return Returns the nr of tiles, or 0 in case of an error.
+ */
+int imgTileNr(
+  /** Pointer to IMG data. */
+  IMG *img,
+  /** Max nr of pixels in one tile; for example IMG_TILE_SIZE. */
+  int tileSize
+) {
+  int pxlNr=imgPixelNr(img);
+  if(pxlNr<1 || tileSize<1) return(0);
+  return(1+(pxlNr-1)/tileSize);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Get the specified tile of pixel TACs from IMG data.
+
+    Tile contains a pointer to the IMG data, and nothing is allocated or
+    copied; changes made through the tile pointer are made to the IMG data.
+    Tiles with the same index and tile size contain the same pixels in all
+    images that have the same x, y, and z dimensions. Therefore the results
+    computed from the pixel TACs in the tile of a dynamic image can be
+    written in the tile of a parametric image, at tac[i*frameNr].
+    Tiles do not overlap, and they can be processed in parallel.
+    @sa imgTileNr, imgTilePixel, imgPixelNr
+    @return Returns 0 if successful, and >0 in case of an error.
+ */
+int imgGetTile(
+  /** Pointer to IMG data. */
+  IMG *img,
+  /** Max nr of pixels in one tile; for example IMG_TILE_SIZE. */
+  int tileSize,
+  /** Tile index [0..imgTileNr()-1]. */
+  int ti,
+  /** Pointer to tile struct, which is filled here. */
+  IMG_TILE *tile
+) {
+  if(tile==NULL) return(1);
+  tile->first=tile->pxlNr=tile->frameNr=0; tile->tac=NULL;
+  int pxlNr=imgPixelNr(img);
+  if(pxlNr<1 || tileSize<1 || img->dimt<1) return(2);
+  if(ti<0 || ti>=imgTileNr(img, tileSize)) return(3);
+  tile->first=ti*tileSize;
+  tile->pxlNr=pxlNr-tile->first; if(tile->pxlNr>tileSize) tile->pxlNr=tileSize;
+  tile->frameNr=img->dimt;
+  tile->tac=img->pixel+(size_t)tile->first*img->dimt;
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Get the plane, row, and column of a pixel in the tile, for example
+    to check a mask image or to print the pixel position.
+    @sa imgGetTile
+    @return Returns 0 if successful, and >0 in case of an error.
+ */
+int imgTilePixel(
+  /** Pointer to IMG data where the tile is from. */
+  IMG *img,
+  /** Pointer to the tile. */
+  IMG_TILE *tile,
+  /** Pixel index in the tile [0..pxlNr-1]. */
+  int i,
+  /** Plane index [0..dimz-1] is written here. */
+  int *zi,
+  /** Row index [0..dimy-1] is written here. */
+  int *yi,
+  /** Column index [0..dimx-1] is written here. */
+  int *xi
+) {
+  if(img==NULL || tile==NULL || zi==NULL || yi==NULL || xi==NULL) return(1);
+  if(img->dimx<1 || img->dimy<1 || i<0 || i>=tile->pxlNr) return(2);
+  int pi=tile->first+i;
+  *xi=pi%img->dimx; pi/=img->dimx;
+  *yi=pi%img->dimy; *zi=pi/img->dimy;
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
@@ -14,6 +14,11 @@
 ///
 /******************************************************************************/
 #include "libtpcimgio.h"
+#if defined HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 /******************************************************************************/
 
 /*****************************************************************************/
@@ -605,101 +610,22 @@ int niftiPrintHeader(
 /*****************************************************************************/
 
 /*****************************************************************************/
-/** Read Nifti image data, convert byte order if necessary,
-    and scale values to floats. Reads only one frame at a time!
-    @return Returns 0 if successful, >1 in case of an error, and specifically
-     -1 in case that contents after the last image frame was requested.
+/// @cond
+/** Convert byte order of one frame of raw Nifti image data in place if
+    necessary, and scale the values to floats.
+    @return Returns 0 if successful, and 5 if data format is not supported.
  */
-int niftiReadImagedata(
-  /** File pointer to start of image data file, opened previously in binary mode. */
-  FILE *fp,
-  /** Pointer to previously filled Nifti header structure */
-  NIFTI_DSR *dsr,
-  /** Frame number to read [1..number of frames]. */
-  int frame,
-  /** Pointer to image float data allocated previously for dimz*dimy*dimx floats. */
-  float *data,
-  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
-  int verbose,
-  /** Pointer to a string (allocated for at least 64 chars) where error message
-      or other execution status will be written; enter NULL, if not needed. */
-  char *status
+static int niftiConvertImagedata(
+  char *mdata, NIFTI_DSR *dsr, int pxlNr, float *data, int verbose, char *status
 ) {
-  int dimNr, dimx, dimy, dimz=1, dimt=1, pxlNr=0;
-  int i, n, little, start_pos, rawSize;
-  char *mdata, *mptr;
+  int i, little, rawSize;
+  char *mptr;
   float *fptr, ss, si;
   short int *sptr;
   int *iptr;
   double d;
 
-
-  if(verbose>0) {
-    printf("niftiReadImagedata(fp, h, %d, data, %d)\n", frame, verbose);
-    fflush(stdout);
-  }
-  /* Check the arguments */
-  if(status!=NULL) sprintf(status, "invalid function input");
-  if(frame<=0 || fp==NULL || dsr==NULL || data==NULL) return(1);
-
-  /* Get the image data start location from header, in case of single file
-     format */
-  if(strcasecmp(dsr->h.magic, "n+1")==0) start_pos=(int)dsr->h.vox_offset;
-  else start_pos=0;
-  if(start_pos<0) start_pos=-start_pos;
-  if(verbose>2) printf("  image_start_pos := %d\n", start_pos);
-  /* edit it later to move to the correct frame */
-
-  /* Get the image dimensions from header */
-  if(status!=NULL) sprintf(status, "invalid image dimensions");
-  dimNr=dsr->h.dim[0]; if(dimNr<2 || dimNr>4) return(2);
-  dimx=dsr->h.dim[1];
-  dimy=dsr->h.dim[2];
-  if(dimNr>2) dimz=dsr->h.dim[3];
-  if(dimNr>3) dimt=dsr->h.dim[4];
-  if(frame>dimt) return(-1);
-  pxlNr=dimx*dimy*dimz; if(pxlNr<1) return(4);
-
-  // data_type is unused in Nifti
-  /* Check that datatype is supported */
-  if(verbose>1) printf("  verifying datatype\n");
-  n=0;
-  if(dsr->h.datatype & NIFTI_DT_RGB) n+=NIFTI_DT_RGB;
-  if(dsr->h.datatype & NIFTI_DT_COMPLEX) n+=NIFTI_DT_COMPLEX;
-  if(dsr->h.datatype & NIFTI_DT_BINARY) n+=NIFTI_DT_BINARY;
-  if(dsr->h.datatype==NIFTI_DT_UNKNOWN) n+=512;
-  if(n!=0) {
-    if(verbose>0) printf("datatype error %d\n", n);
-    if(status!=NULL) sprintf(status, "unsupported pixel datatype %d", dsr->h.datatype);
-    return(6);
-  }
-
-  /* Allocate memory for the binary data */
-  if(verbose>1) printf("  allocating memory for binary data\n");
-  if(status!=NULL) sprintf(status, "invalid pixel data format");
-  if(dsr->h.bitpix<8) return(5); // We don't support bit data
-  rawSize=pxlNr*(dsr->h.bitpix/8); if(rawSize<1) return(6);
-  if(verbose>1) printf("  pxlNr=%d  rawSize=%d\n", pxlNr, rawSize);
-  if(status!=NULL) sprintf(status, "out of memory");
-  mdata=(char*)malloc(rawSize); if(mdata==NULL) return(11);
-
-  /* Seek the start of current frame data */
-  if(verbose>1) printf("  seeking file position\n");
-  start_pos+=(frame-1)*rawSize;
-  if(verbose>2) printf("start_pos=%d\n", start_pos);
-  fseek(fp, start_pos, SEEK_SET);
-  if(ftell(fp)!=start_pos) {
-    if(status!=NULL) sprintf(status, "could not move to start_pos %d", start_pos);
-    free(mdata); return(7);
-  }
-
-  /* Read the data */
-  if(verbose>1) printf("  reading binary data\n");
-  mptr=mdata;
-  if((n=fread(mptr, rawSize, 1, fp)) < 1) {
-    if(status!=NULL) sprintf(status, "could read only %d bytes when request was %d", n, rawSize);
-    free(mdata); return(8);
-  }
+  rawSize=pxlNr*(dsr->h.bitpix/8);
 
   /* Convert byte order if necessary */
   little=little_endian(); mptr=mdata;
@@ -712,8 +638,8 @@ int niftiReadImagedata(
       case 64: swawbip(mptr, rawSize); break;
       default:
         if(verbose>5) printf("unsupported nifti bitpix := %d\n", dsr->h.bitpix);
-        sprintf(status, "unsupported nifti bitpix := %d", dsr->h.bitpix);
-        free(mdata); return(5);
+        if(status!=NULL) sprintf(status, "unsupported nifti bitpix := %d", dsr->h.bitpix);
+        return(5);
     }
   }
 
@@ -730,7 +656,7 @@ int niftiReadImagedata(
         if(status!=NULL)
           sprintf(status, "invalid combination of datatype and bitpix (%d, %d)",
             dsr->h.datatype, dsr->h.bitpix);
-        free(mdata); return(5);
+        return(5);
       }
       fptr=data;
       for(i=0; i<pxlNr; i++, mptr++, fptr++) *fptr=si+ss*(float)(*mptr);
@@ -740,7 +666,7 @@ int niftiReadImagedata(
         if(status!=NULL)
           sprintf(status, "invalid combination of datatype and bitpix (%d, %d)",
             dsr->h.datatype, dsr->h.bitpix);
-        free(mdata); return(5);
+        return(5);
       }
       fptr=data;
       for(i=0; i<pxlNr; i++, mptr+=2, fptr++) {
@@ -752,7 +678,7 @@ int niftiReadImagedata(
         if(status!=NULL)
           sprintf(status, "invalid combination of datatype and bitpix (%d, %d)",
             dsr->h.datatype, dsr->h.bitpix);
-        free(mdata); return(5);
+        return(5);
       }
       fptr=data;
       for(i=0; i<pxlNr; i++, mptr+=2, fptr++) {
@@ -764,12 +690,12 @@ int niftiReadImagedata(
         if(status!=NULL)
           sprintf(status, "invalid combination of datatype and bitpix (%d, %d)",
             dsr->h.datatype, dsr->h.bitpix);
-        free(mdata); return(5);
+        return(5);
       }
       fptr=data;
       if(dsr->h.bitpix==16) {
         for(i=0; i<pxlNr; i++, mptr+=2, fptr++) {
-          iptr=(int*)mptr; *fptr=si+ss*(float)(*iptr);
+          sptr=(short int*)mptr; *fptr=si+ss*(float)(*sptr);
         }
       } else if(dsr->h.bitpix==32) {
         for(i=0; i<pxlNr; i++, mptr+=4, fptr++) {
@@ -779,14 +705,15 @@ int niftiReadImagedata(
       break;
     case NIFTI_DT_FLOAT: // 16
       if(dsr->h.bitpix==32) {
-        fptr=data; memcpy(fptr, mptr, pxlNr*4);
-        for(i=0, fptr=data; i<pxlNr; i++, fptr++) *fptr*=ss;
-        for(i=0, fptr=data; i<pxlNr; i++, fptr++) *fptr+=si;
+        fptr=data; if((char*)fptr!=mptr) memcpy(fptr, mptr, pxlNr*4);
+        /* scale only if necessary */
+        if(ss!=1.0) for(i=0, fptr=data; i<pxlNr; i++, fptr++) *fptr*=ss;
+        if(si!=0.0) for(i=0, fptr=data; i<pxlNr; i++, fptr++) *fptr+=si;
       } else {
         if(status!=NULL)
           sprintf(status, "invalid combination of datatype and bitpix (%d, %d)",
             dsr->h.datatype, dsr->h.bitpix);
-        free(mdata); return(5);
+        return(5);
       }
       break;
     case NIFTI_DT_DOUBLE:
@@ -794,7 +721,7 @@ int niftiReadImagedata(
         if(status!=NULL)
           sprintf(status, "invalid combination of datatype and bitpix (%d, %d)",
             dsr->h.datatype, dsr->h.bitpix);
-        free(mdata); return(5);
+        return(5);
       }
       for(i=0, fptr=data; i<pxlNr; i++, mptr+=8, fptr++) {
         memcpy(&d, mptr, 8); *fptr=si+ss*d;
@@ -803,16 +730,325 @@ int niftiReadImagedata(
     default:
       if(status!=NULL)
         sprintf(status, "unsupported pixel datatype %d", dsr->h.datatype);
-      free(mdata); return(5);
+      return(5);
+  }
+  return(0);
+}
+
+/** Check the image dimensions and datatype in Nifti header, and get the
+    image data start position and frame size in bytes.
+    @return Returns 0 if successful, and >1 in case of an error.
+ */
+static int niftiImagedataLayout(
+  NIFTI_DSR *dsr, int *dimx, int *dimy, int *dimz, int *dimt,
+  long int *start_pos, int *rawSize, int verbose, char *status
+) {
+  int n, pxlNr;
+
+  /* Get the image data start location from header, in case of single file
+     format */
+  if(strcasecmp(dsr->h.magic, "n+1")==0) *start_pos=(long int)dsr->h.vox_offset;
+  else *start_pos=0;
+  if(*start_pos<0) *start_pos=-*start_pos;
+  if(verbose>2) printf("  image_start_pos := %ld\n", *start_pos);
+
+  /* Get the image dimensions from header */
+  if(status!=NULL) sprintf(status, "invalid image dimensions");
+  n=dsr->h.dim[0]; if(n<2 || n>4) return(2);
+  *dimx=dsr->h.dim[1];
+  *dimy=dsr->h.dim[2];
+  *dimz=1; if(n>2) *dimz=dsr->h.dim[3];
+  *dimt=1; if(n>3) *dimt=dsr->h.dim[4];
+  pxlNr=(*dimx)*(*dimy)*(*dimz); if(pxlNr<1) return(4);
+
+  // data_type is unused in Nifti
+  /* Check that datatype is supported */
+  if(verbose>1) printf("  verifying datatype\n");
+  n=0;
+  if(dsr->h.datatype & NIFTI_DT_RGB) n+=NIFTI_DT_RGB;
+  if(dsr->h.datatype & NIFTI_DT_COMPLEX) n+=NIFTI_DT_COMPLEX;
+  if(dsr->h.datatype & NIFTI_DT_BINARY) n+=NIFTI_DT_BINARY;
+  if(dsr->h.datatype==NIFTI_DT_UNKNOWN) n+=512;
+  if(n!=0) {
+    if(verbose>0) printf("datatype error %d\n", n);
+    if(status!=NULL) sprintf(status, "unsupported pixel datatype %d", dsr->h.datatype);
+    return(6);
+  }
+
+  if(status!=NULL) sprintf(status, "invalid pixel data format");
+  if(dsr->h.bitpix<8) return(5); // We don't support bit data
+  *rawSize=pxlNr*(dsr->h.bitpix/8); if(*rawSize<1) return(6);
+  if(verbose>1) printf("  pxlNr=%d  rawSize=%d\n", pxlNr, *rawSize);
+  return(0);
+}
+/// @endcond
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Read Nifti image data, convert byte order if necessary,
+    and scale values to floats. Reads only one frame at a time!
+    @sa niftiMapImagedata
+    @return Returns 0 if successful, >1 in case of an error, and specifically
+     -1 in case that contents after the last image frame was requested.
+ */
+int niftiReadImagedata(
+  /** File pointer to start of image data file, opened previously in binary mode. */
+  FILE *fp,
+  /** Pointer to previously filled Nifti header structure */
+  NIFTI_DSR *dsr,
+  /** Frame number to read [1..number of frames]. */
+  int frame,
+  /** Pointer to image float data allocated previously for dimz*dimy*dimx floats. */
+  float *data,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose,
+  /** Pointer to a string (allocated for at least 64 chars) where error message
+      or other execution status will be written; enter NULL, if not needed. */
+  char *status
+) {
+  int dimx, dimy, dimz, dimt;
+  int n, ret, rawSize;
+  long int start_pos;
+  char *mdata, *mptr;
+
+
+  if(verbose>0) {
+    printf("niftiReadImagedata(fp, h, %d, data, %d)\n", frame, verbose);
+    fflush(stdout);
+  }
+  /* Check the arguments */
+  if(status!=NULL) sprintf(status, "invalid function input");
+  if(frame<=0 || fp==NULL || dsr==NULL || data==NULL) return(1);
+
+  /* Get the image data location and dimensions from header */
+  ret=niftiImagedataLayout(dsr, &dimx, &dimy, &dimz, &dimt, &start_pos,
+                           &rawSize, verbose, status);
+  if(ret) return(ret);
+  if(frame>dimt) return(-1);
+
+  /* Allocate memory for the binary data */
+  if(verbose>1) printf("  allocating memory for binary data\n");
+  if(status!=NULL) sprintf(status, "out of memory");
+  mdata=(char*)malloc(rawSize); if(mdata==NULL) return(11);
+
+  /* Seek the start of current frame data */
+  if(verbose>1) printf("  seeking file position\n");
+  start_pos+=(long int)(frame-1)*rawSize;
+  if(verbose>2) printf("start_pos=%ld\n", start_pos);
+  fseek(fp, start_pos, SEEK_SET);
+  if(ftell(fp)!=start_pos) {
+    if(status!=NULL) sprintf(status, "could not move to start_pos %ld", start_pos);
+    free(mdata); return(7);
   }
 
+  /* Read the data */
+  if(verbose>1) printf("  reading binary data\n");
+  mptr=mdata;
+  if((n=fread(mptr, rawSize, 1, fp)) < 1) {
+    if(status!=NULL) sprintf(status, "could read only %d bytes when request was %d", n, rawSize);
+    free(mdata); return(8);
+  }
+
+  /* Convert byte order and scale to floats */
+  ret=niftiConvertImagedata(mdata, dsr, dimx*dimy*dimz, data, verbose, status);
+  free(mdata); if(ret) return(ret);
+
   if(verbose>1) {printf("  data read successfully.\n"); fflush(stdout);}
-  free(mdata);
   if(status!=NULL) sprintf(status, "ok");
   return 0;
 }
 /*****************************************************************************/
 
+/*****************************************************************************/
+/** Initiate the NIFTI_MAP struct before any use.
+    @sa niftiMapImagedata, niftiUnmap
+ */
+void niftiMapInit(
+  /** Pointer to NIFTI_MAP struct. */
+  NIFTI_MAP *map
+) {
+  if(map==NULL) return;
+  memset(map, 0, sizeof(NIFTI_MAP));
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Map Nifti image data file into memory, instead of reading it.
+
+    Voxel values are then accessed frame-by-frame with niftiMapFrame().
+    When the data is stored as 32-bit floats in native byte order without
+    scaling, the frames are used in place, and the pages are read from disk
+    only when accessed; map->fdata then points to the voxel values of all
+    frames, frame-major, with x index running fastest.
+    Mapping is private, therefore changes to the mapped values are never
+    written to the file.
+    @sa niftiMapInit, niftiMapFrame, niftiUnmap, niftiReadImagedata
+    @return Returns 0 if successful, 12 if memory mapping is not supported
+     on this platform, and other value >0 in case of an error.
+ */
+int niftiMapImagedata(
+  /** Name of image data file (.nii or .img). */
+  const char *datfile,
+  /** Pointer to previously filled Nifti header structure; contents are
+      copied into map. */
+  NIFTI_DSR *dsr,
+  /** Pointer to initiated NIFTI_MAP struct; any previous mapping is removed. */
+  NIFTI_MAP *map,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose,
+  /** Pointer to a string (allocated for at least 64 chars) where error message
+      or other execution status will be written; enter NULL, if not needed. */
+  char *status
+) {
+  int ret, rawSize;
+  long int start_pos;
+
+  if(verbose>0) {printf("niftiMapImagedata(%s, h, map, %d)\n", datfile, verbose); fflush(stdout);}
+  if(status!=NULL) sprintf(status, "invalid function input");
+  if(datfile==NULL || dsr==NULL || map==NULL) return(1);
+  niftiUnmap(map);
+
+  ret=niftiImagedataLayout(dsr, &map->dimx, &map->dimy, &map->dimz, &map->dimt,
+                           &start_pos, &rawSize, verbose, status);
+  if(ret) {niftiMapInit(map); return(ret);}
+  map->dsr=*dsr; map->frameSize=(size_t)rawSize;
+
+#if defined HAVE_MMAP
+  int fd;
+  struct stat st;
+  size_t frameNr;
+
+  if(status!=NULL) sprintf(status, "cannot open %s", datfile);
+  fd=open(datfile, O_RDONLY); if(fd<0) {niftiMapInit(map); return(3);}
+  if(fstat(fd, &st)!=0 || (size_t)st.st_size<(size_t)start_pos+map->frameSize) {
+    if(status!=NULL) sprintf(status, "no image data in %s", datfile);
+    close(fd); niftiMapInit(map); return(8);
+  }
+  /* Frames that are only partially in the file are not accessed */
+  frameNr=((size_t)st.st_size-(size_t)start_pos)/map->frameSize;
+  if(frameNr<(size_t)map->dimt) map->frameNr=(int)frameNr; else map->frameNr=map->dimt;
+  map->_size=(size_t)start_pos+(size_t)map->frameNr*map->frameSize;
+  map->_addr=mmap(NULL, map->_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map->_addr==MAP_FAILED) {
+    if(status!=NULL) sprintf(status, "cannot map %s", datfile);
+    niftiMapInit(map); return(11);
+  }
+  map->data=(char*)map->_addr+start_pos;
+  /* Data can be used in place if no conversion is needed */
+  if(map->dsr.h.datatype==NIFTI_DT_FLOAT && map->dsr.h.bitpix==32 &&
+     little_endian()==map->dsr.byte_order &&
+     (map->dsr.h.scl_slope==0.0 || map->dsr.h.scl_slope==1.0) &&
+     map->dsr.h.scl_inter==0.0 && start_pos%sizeof(float)==0)
+    map->fdata=(float*)map->data;
+  if(verbose>1) printf("  frameNr=%d  in_place=%d\n", map->frameNr, map->fdata!=NULL);
+  if(status!=NULL) sprintf(status, "ok");
+  return(0);
+#else
+  if(verbose>0) printf("memory mapping not supported\n");
+  if(status!=NULL) sprintf(status, "memory mapping not supported");
+  niftiMapInit(map); return(12);
+#endif
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Get the voxel values of one frame from memory-mapped Nifti image data.
+    @sa niftiMapImagedata, niftiMapRelease
+    @return Returns pointer to the dimz*dimy*dimx voxel values, with x index
+     running fastest; either in place inside the mapping (if map->fdata!=NULL),
+     or in the buffer given as argument. NULL is returned in case of an error,
+     or if frame is not in the file.
+ */
+float *niftiMapFrame(
+  /** Pointer to NIFTI_MAP struct, mapped with niftiMapImagedata(). */
+  NIFTI_MAP *map,
+  /** Frame number [1..number of frames]. */
+  int frame,
+  /** Pointer to buffer for dimz*dimy*dimx floats, where values are converted,
+      if they can not be used in place; may be NULL if map->fdata!=NULL. */
+  float *buf,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose,
+  /** Pointer to a string (allocated for at least 64 chars) where error message
+      or other execution status will be written; enter NULL, if not needed. */
+  char *status
+) {
+  size_t pxlNr;
+  char *mptr;
+
+  if(verbose>0) printf("niftiMapFrame(map, %d)\n", frame);
+  if(status!=NULL) sprintf(status, "invalid function input");
+  if(map==NULL || map->data==NULL || frame<1) return(NULL);
+  if(frame>map->frameNr) {
+    if(status!=NULL) sprintf(status, "frame %d not in file", frame);
+    return(NULL);
+  }
+  pxlNr=(size_t)map->dimx*map->dimy*map->dimz;
+  if(map->fdata!=NULL) {
+    if(status!=NULL) sprintf(status, "ok");
+    return(map->fdata+(frame-1)*pxlNr);
+  }
+  if(buf==NULL) return(NULL);
+  mptr=map->data+(frame-1)*map->frameSize;
+  if(little_endian()!=map->dsr.byte_order && map->dsr.h.bitpix>8) {
+    /* Byte order is converted in place, thus work on a copy */
+    char *mdata=(char*)malloc(map->frameSize);
+    if(mdata==NULL) {if(status!=NULL) sprintf(status, "out of memory"); return(NULL);}
+    memcpy(mdata, mptr, map->frameSize);
+    int ret=niftiConvertImagedata(mdata, &map->dsr, pxlNr, buf, verbose, status);
+    free(mdata); if(ret) return(NULL);
+  } else {
+    NIFTI_DSR dsr=map->dsr; dsr.byte_order=little_endian();
+    if(niftiConvertImagedata(mptr, &dsr, pxlNr, buf, verbose, status)) return(NULL);
+  }
+  if(status!=NULL) sprintf(status, "ok");
+  return(buf);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Tell that the memory pages of one frame of memory-mapped Nifti image data
+    are not needed for now, to limit the memory usage while processing a large
+    image frame-by-frame.
+    If the frame is accessed again, it is re-read from the file; any changes
+    made to the values in place are then lost.
+    @sa niftiMapFrame, niftiUnmap
+ */
+void niftiMapRelease(
+  /** Pointer to NIFTI_MAP struct, mapped with niftiMapImagedata(). */
+  NIFTI_MAP *map,
+  /** Frame number [1..number of frames]. */
+  int frame
+) {
+  if(map==NULL || map->_addr==NULL || frame<1 || frame>map->frameNr) return;
+#if defined HAVE_MMAP
+  long int page=sysconf(_SC_PAGESIZE); if(page<1) return;
+  size_t first=(size_t)(map->data-(char*)map->_addr)+(frame-1)*map->frameSize;
+  size_t last=first+map->frameSize;
+  /* Only whole pages inside this frame are released */
+  first=(first+page-1)/page*page; last=last/page*page;
+  if(last>first) madvise((char*)map->_addr+first, last-first, MADV_DONTNEED);
+#endif
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Remove the memory mapping of Nifti image data.
+    @sa niftiMapImagedata, niftiMapInit
+ */
+void niftiUnmap(
+  /** Pointer to NIFTI_MAP struct. */
+  NIFTI_MAP *map
+) {
+  if(map==NULL) return;
+#if defined HAVE_MMAP
+  if(map->_addr!=NULL) munmap(map->_addr, map->_size);
+#endif
+  niftiMapInit(map);
+}
+/*****************************************************************************/
+
 /*****************************************************************************/
 /** Write NIfTI-1 header contents.
 
@@ -632,12 +632,109 @@ int imgFast2DGaussianFilter(
 /*****************************************************************************/
 
 /*****************************************************************************/
+/// @cond
+#ifndef IMGFILTER_LANES
+/** Minimum nr of values (lines times frames) filtered together in
+    imgFast3DGaussianFilter(); several lines are processed at once if there
+    are fewer frames. */
+#define IMGFILTER_LANES 16
+#endif
+
+/** Recursive Gaussian filter passes along n points for a set of lanes,
+    stored point-major in buf[n*laneNr]; each lane is filtered independently,
+    and the loop over lanes can be vectorised.
+ */
+static void imgFastGaussianLines(
+  float *buf, const int n, const int laneNr, const int step_nr,
+  const float nu, const float boundaryscale
+) {
+  for(int step=0; step<step_nr; step++) {
+    float *p=buf;
+#pragma omp simd
+    for(int l=0; l<laneNr; l++) p[l]*=boundaryscale;
+    /* Filter forwards */
+    for(int i=1; i<n; i++) {
+      float *q=p; p+=laneNr;
+#pragma omp simd
+      for(int l=0; l<laneNr; l++) p[l]+=nu*q[l];
+    }
+#pragma omp simd
+    for(int l=0; l<laneNr; l++) p[l]*=boundaryscale;
+    /* Filter backwards */
+    for(int i=n-1; i>0; i--) {
+      float *q=p; p-=laneNr;
+#pragma omp simd
+      for(int l=0; l<laneNr; l++) p[l]+=nu*q[l];
+    }
+  }
+}
+
+/** One pass of imgFast3DGaussianFilter() along the given dimension (0=x, 1=y,
+    2=z), for frames [f1, f1+frameNr), multiplying the results by scale.
+    @return 0 if successful, or 1 if out of memory.
+ */
+static int imgFast3DGaussianPass(
+  IMG *img, const int dim, const int f1, const int frameNr, const int step_nr,
+  const float nu, const float boundaryscale, const float scale
+) {
+  /* Line length n, and the two other dimensions, latter of which is
+     blocked so that adjacent lines are filtered together */
+  const int n = dim==0 ? img->dimx : (dim==1 ? img->dimy : img->dimz);
+  const int dimA = dim==2 ? img->dimy : img->dimz;
+  const int dimB = dim==0 ? img->dimy : img->dimx;
+  int blockNr=(IMGFILTER_LANES+frameNr-1)/frameNr;
+  if(blockNr>dimB) blockNr=dimB;
+  const int bNr=(dimB+blockNr-1)/blockNr;
+  int ret=0;
+
+#pragma omp parallel
+  {
+  /* One scratch buffer per thread */
+  float *buf=(float*)malloc((size_t)n*blockNr*frameNr*sizeof(float));
+  if(buf==NULL) {
+#pragma omp atomic write
+    ret=1;
+  }
+#pragma omp for collapse(2) schedule(static)
+  for(int ai=0; ai<dimA; ai++) for(int bi=0; bi<bNr; bi++) {
+    if(buf==NULL) continue;
+    const int b1=bi*blockNr, bn=(b1+blockNr<=dimB) ? blockNr : dimB-b1;
+    const int laneNr=bn*frameNr;
+    /* Copy the lines into buffer, frames of each voxel next to each other */
+    for(int i=0; i<n; i++) for(int b=0; b<bn; b++) {
+      float *v;
+      if(dim==0) v=img->m[ai][b1+b][i]; 
+      else if(dim==1) v=img->m[ai][i][b1+b]; 
+      else v=img->m[i][ai][b1+b];
+      memcpy(buf+(size_t)i*laneNr+b*frameNr, v+f1, frameNr*sizeof(float));
+    }
+    imgFastGaussianLines(buf, n, laneNr, step_nr, nu, boundaryscale);
+    /* Copy and scale the filtered data back */
+    for(int i=0; i<n; i++) for(int b=0; b<bn; b++) {
+      float *v, *p=buf+(size_t)i*laneNr+b*frameNr;
+      if(dim==0) v=img->m[ai][b1+b][i]; 
+      else if(dim==1) v=img->m[ai][i][b1+b]; 
+      else v=img->m[i][ai][b1+b];
+      v+=f1;
+      for(int fi=0; fi<frameNr; fi++) v[fi]=scale*p[fi];
+    }
+  }
+  free(buf);
+  }
+  return(ret);
+}
+/// @endcond
+
 /** Apply fast approximate 3D Gaussian filter to whole dynamic image in IMG struct.
 
     This function implements the fast Gaussian convolution algorithm with IIR approximation 
     (Alvarez L and Mazorra L, SIAM Journal on Numerical Analysis, 1994;31(2):590-605), and 
     is based on C code written by Pascal Getreuer <http://www.getreuer.info/home/gaussianiir>.
 
+    All frames of a dynamic image are filtered together, with the frames of
+    each voxel (and adjacent lines, when there are only few frames) in float
+    SIMD lanes, and the image lines of each pass are divided between threads.
+
     @sa imgFast2DGaussianFilter, imgThresholdingLowHigh, imgSmoothMax
     @return If an error is encountered, function returns a non-zero value. 
         Otherwise 0 is returned.
@@ -659,9 +756,8 @@ int imgFast3DGaussianFilter(
   /** Pointer to error message, at least 128 characters; NULL, if not needed. */
   char *errmsg 
 ) {
-  int i, xi, yi, zi, fi, mindim, step;
+  int mindim, f1, frameNr;
   double lambda, nu, boundaryscale, postscale;
-  double *ptr, *dimg;
 
 
   if(verbose>0)
@@ -690,70 +786,18 @@ int imgFast3DGaussianFilter(
     printf("postscale := %g\n", postscale);
   }
 
-  /* Setup memory for a image frame (3D matrix) */
-  if(verbose>1) printf("Allocating memory\n");
-  dimg=(double*)malloc(img->dimz*img->dimx*img->dimy*sizeof(double));
-  if(dimg==NULL) {if(errmsg!=NULL) strcpy(errmsg, "out of memory"); return 5;}
-
   /* Process the required image frame(s) */
+  if(frame>=0) {f1=frame; frameNr=1;} else {f1=0; frameNr=img->dimt;}
   if(verbose>1) printf("Gaussian filtering...\n");
-  for(fi=0; fi<img->dimt; fi++) {
-    if(frame>=0 && frame!=fi) continue;
-    if(verbose>2) printf("  frame %d\n", fi+1);
-    /* Copy image 3D matrix data to double buffer */
-    for(zi=i=0; zi<img->dimz; zi++)
-      for(yi=0; yi<img->dimy; yi++)
-        for(xi=0; xi<img->dimx; xi++)
-          dimg[i++]=img->m[zi][yi][xi][fi];
-    /* Filter horizontally along each image row */
-    for(zi=0; zi<img->dimz; zi++) {
-      for(yi=0; yi<img->dimy; yi++) {
-        for(step=0; step<step_nr; step++) {
-          ptr = dimg+img->dimx*(yi+img->dimy*zi); ptr[0]*=boundaryscale;
-          /* Filter rightwards */
-          for(xi=1; xi<img->dimx; xi++) ptr[xi]+=nu*ptr[xi-1];
-          ptr[xi=img->dimx-1]*=boundaryscale;
-          /* Filter leftwards */
-          for(; xi>0; xi--) ptr[xi-1]+=nu*ptr[xi];
-        }
-      }
+  /* Filter along image rows, columns, and z-dimension; scale at the end */
+  for(int dim=0; dim<3; dim++) {
+    if(verbose>2) printf("  dimension %d\n", dim+1);
+    if(imgFast3DGaussianPass(img, dim, f1, frameNr, step_nr, nu, boundaryscale,
+                             dim==2 ? postscale : 1.0)) {
+      if(errmsg!=NULL) strcpy(errmsg, "out of memory");
+      return 5;
     }
-    /* Filter vertically along each image column */
-    for(zi=0; zi<img->dimz; zi++) {
-      for(xi=0; xi<img->dimx; xi++) {
-        for(step=0; step<step_nr; step++) {
-          ptr=dimg+xi+img->dimx*img->dimy*zi; ptr[0]*=boundaryscale;
-          /* Filter downwards */
-          for(i=img->dimx; i<img->dimx*img->dimy; i+=img->dimx)
-            ptr[i]+=nu*ptr[i-img->dimx];
-          ptr[i=img->dimx*(img->dimy-1)]*=boundaryscale;
-          /* Filter upwards */
-          for(; i>0; i-=img->dimx) ptr[i-img->dimx]+=nu*ptr[i];
-        }
-      }
-    }
-    /* Filter along image z-dimension */
-    for(yi=0; yi<img->dimy; yi++) {
-      for(xi=0; xi<img->dimx; xi++) {
-        for(step=0; step<step_nr; step++) {
-          ptr=dimg+xi+img->dimx*yi; ptr[0]*=boundaryscale;
-          for(i=img->dimx*img->dimy; i<img->dimx*img->dimy*img->dimz; i+=img->dimx*img->dimy)
-            ptr[i]+=nu*ptr[i-img->dimx*img->dimy];
-          ptr[i=img->dimx*img->dimy*(img->dimz-1)]*=boundaryscale;
-          for(; i>0; i-=img->dimx*img->dimy)
-            ptr[i-img->dimx*img->dimy]+=nu*ptr[i];
-        }
-      }
-    }
-    /* Copy and scale image 3D matrix data back from the buffer */
-    for(zi=i=0; zi<img->dimz; zi++)
-      for(yi=0; yi<img->dimy; yi++)
-        for(xi=0; xi<img->dimx; xi++)
-          img->m[zi][yi][xi][fi]=postscale*dimg[i++];
-  } // next frame
-
-  /* Free memory */
-  free(dimg);
+  }
 
   if(errmsg!=NULL) strcpy(errmsg, "ok");
   if(verbose>1) printf("  Gaussian convolution done.\n");
@@ -203,14 +203,49 @@ int imgsegmFindMaxOutsideClusters(
 /*****************************************************************************/
 
 /*****************************************************************************/
+/// @cond
+/** Test whether pixel [pi,ri,ci] fits into cluster started from pixel
+    [pj,rj,cj], based on AUCs and TAC correlation.
+    @return Returns 1 if pixel belongs to cluster, otherwise 0.
+ */
+static int imgsegmClusterTest(
+  IMG *simg, IMG *dimg, int pi, int ri, int ci, int pj, int rj, int cj,
+  float CVlim, float CClim, int verbose
+) {
+  /* Check that AUCs are matching */
+  {
+  float mean=0.5*(simg->m[pi][ri][ci][0]+simg->m[pj][rj][cj][0]);
+  float a=simg->m[pi][ri][ci][0]-mean; 
+  float b=simg->m[pj][rj][cj][0]-mean;
+  float cv;
+  if(fabs(mean)>1.0e-10) cv=(a*a + b*b) / mean; else cv=0.0;
+  if(verbose>2) printf("cv=%g CVlim=%g mean=%g\n", cv, CVlim, mean);
+  if(cv>CVlim) {
+    if(verbose>2) printf("AUCs are not matching, %g>%g\n", cv, CVlim);
+    return(0);
+  }
+  }
+
+  /* Check that TACs are correlating */
+  {
+  float r=imgsegmPearson(dimg->m[pj][rj][cj], dimg->m[pi][ri][ci], dimg->dimt);
+  if(verbose>3) printf("  r=%g CClim=%g\n", r, CClim);
+  if(r<CClim) {
+    if(verbose>2) printf("TACs are not correlating, %g<%g\n", r, CClim);
+    return(0);
+  }
+  }
+  return(1);
+}
+/// @endcond
+
 /** Expands the cluster locally to its neighbour pixels.
 
-    Calls itself recursively until neighbouring pixels do not belong to cluster.
-    Because of recursion, program which uses this function needs a large space
-    for stack: add the following line to your program: 
-    unsigned _stklen = 4194304;
+    Pixels are added to the cluster until neighbouring pixels do not belong to
+    cluster. Pixels to be expanded are kept in a queue, not in recursive calls,
+    therefore large clusters do not need a large stack.
 
-    @sa imgMaskErode, imgMaskDilate
+    @sa imgsegmClusters, imgMaskErode, imgMaskDilate
 
     @return Returns 0, if test pixel belongs to cluster, and 1 if not, 
      and >1 in case of an error.
@@ -265,29 +300,9 @@ int imgsegmClusterExpand(
     return(1);
   }
 
-  /* Check that AUCs are matching */
-  {
-  float mean=0.5*(simg->m[pi][ri][ci][0]+simg->m[pj][rj][cj][0]);
-  float a=simg->m[pi][ri][ci][0]-mean; 
-  float b=simg->m[pj][rj][cj][0]-mean;
-  float cv;
-  if(fabs(mean)>1.0e-10) cv=(a*a + b*b) / mean; else cv=0.0;
-  if(verbose>2) printf("cv=%g CVlim=%g mean=%g\n", cv, CVlim, mean);
-  if(cv>CVlim) {
-    if(verbose>2) printf("AUCs are not matching, %g>%g\n", cv, CVlim);
+  /* Check that test pixel fits into cluster */
+  if(!imgsegmClusterTest(simg, dimg, pi, ri, ci, pj, rj, cj, CVlim, CClim, verbose))
     return(1);
-  }
-  }
-
-  /* Check that TACs are correlating */
-  {
-  float r=imgsegmPearson(dimg->m[pj][rj][cj], dimg->m[pi][ri][ci], dimg->dimt);
-  if(verbose>3) printf("  r=%g CClim=%g\n", r, CClim);
-  if(r<CClim) {
-    if(verbose>2) printf("TACs are not correlating, %g<%g\n", r, CClim);
-    return(1);
-  }
-  }
 
   /* If we got this far, the test pixel belongs to the cluster */
   cimg->m[pi][ri][ci][0]=clusterID;
@@ -296,20 +311,276 @@ int imgsegmClusterExpand(
     fflush(stdout);
   }
 
+  /* Queue of cluster pixels whose neighbours are not yet checked; each pixel
+     is added only once, when it is added to the cluster */
+  int qsize=1024, qhead=0, qtail=0;
+  int *queue=(int*)malloc(3*qsize*sizeof(int));
+  if(queue==NULL) return(5);
+  queue[0]=pi; queue[1]=ri; queue[2]=ci; qtail=1;
+
   /* Check if the neighbouring pixels belong to this cluster */
-  for(int pk=pi-1; pk<=pi+1; pk++) if(pk>=0 && pk<cimg->dimz)
-    for(int rk=ri-1; rk<=ri+1; rk++) if(rk>=0 && rk<cimg->dimy)
-      for(int ck=ci-1; ck<=ci+1; ck++) if(ck>=0 && ck<cimg->dimx)
-        if((pk!=pi || rk!=ri || ck!=ci) && cimg->m[pk][rk][ck][0]<-0.1) {
-          int ret=imgsegmClusterExpand(cimg, simg, dimg, clusterID,
-                 pk, rk, ck, pj, rj, cj, CVlim, CClim, verbose);
-          if(ret>1) return(ret);
+  while(qhead<qtail) {
+    int *q=queue+3*(qhead%qsize); qhead++;
+    int pl=q[0], rl=q[1], cl=q[2];
+    for(int pk=pl-1; pk<=pl+1; pk++) if(pk>=0 && pk<cimg->dimz)
+      for(int rk=rl-1; rk<=rl+1; rk++) if(rk>=0 && rk<cimg->dimy)
+        for(int ck=cl-1; ck<=cl+1; ck++) if(ck>=0 && ck<cimg->dimx) {
+          if(cimg->m[pk][rk][ck][0]>=-0.1) continue;
+          if(!imgsegmClusterTest(simg, dimg, pk, rk, ck, pj, rj, cj,
+                                 CVlim, CClim, verbose)) continue;
+          cimg->m[pk][rk][ck][0]=clusterID;
+          if(verbose>1) {
+            printf("  [%d][%d][%d] belongs to cluster %d\n", pk, rk, ck, clusterID);
+            fflush(stdout);
+          }
+          /* Enlarge the circular queue if it is full */
+          if(qtail-qhead==qsize) {
+            int *nq=(int*)realloc(queue, 6*qsize*sizeof(int));
+            if(nq==NULL) {free(queue); return(5);}
+            queue=nq;
+            /* move the wrapped part after the old end */
+            int h=qhead%qsize;
+            memcpy(queue+3*qsize, queue, 3*h*sizeof(int));
+            qhead=h; qtail=h+qsize; qsize*=2;
+          }
+          q=queue+3*(qtail%qsize); qtail++;
+          q[0]=pk; q[1]=rk; q[2]=ck;
         }
+  }
+  free(queue);
 
   return(0);
 }
 /*****************************************************************************/
 
+/*****************************************************************************/
+/// @cond
+/** Pixel data shared by the slabs in imgsegmClusters(). */
+typedef struct {
+  /** Image dimensions */
+  int dimz, dimy, dimx, dimt;
+  /** Sum image values */
+  float *sum;
+  /** Normalised TACs, dimt values per pixel; zero mean and unit norm. */
+  float *ztac;
+  /** Flag for TACs with no variance; those correlate with anything. */
+  char *flat;
+  /** Local cluster ID of each pixel; -1 for pixels not in any cluster, 0 for
+      pixels that must not be clustered. */
+  int *lab;
+  /** ID of the cluster against which pixel was last tested. */
+  int *visit;
+} IMGSEGMCLUSTERDATA;
+
+/** Heap order of pixels: larger sum first, then smaller pixel index. */
+static int imgsegmHeapBefore(const float *sum, int a, int b)
+{
+  float va=sum[a], vb=sum[b];
+  if(isnan(va)) return(0);
+  if(isnan(vb)) return(1);
+  return(va>vb || (va==vb && a<b));
+}
+
+/** Sift the pixel at heap position k down to its place. */
+static void imgsegmHeapDown(const float *sum, int *heap, int n, int k)
+{
+  int v=heap[k];
+  while(1) {
+    int c=2*k+1; if(c>=n) break;
+    if(c+1<n && imgsegmHeapBefore(sum, heap[c+1], heap[c])) c++;
+    if(!imgsegmHeapBefore(sum, heap[c], v)) break;
+    heap[k]=heap[c]; k=c;
+  }
+  heap[k]=v;
+}
+
+/** Grow all clusters inside planes [z1,z2).
+    @return Returns the nr of clusters, or <0 if out of memory.
+ */
+static int imgsegmClusterSlab(
+  IMGSEGMCLUSTERDATA *d, int z1, int z2, float CVlim, float CClim
+) {
+  const int dimy=d->dimy, dimx=d->dimx, dimt=d->dimt;
+  const int first=z1*dimy*dimx, pxlNr=(z2-z1)*dimy*dimx;
+  int clusterNr=0, n=0;
+
+  /* Max-heap of free pixels by sum, to find the seed of next cluster */
+  int *heap=(int*)malloc(2*pxlNr*sizeof(int));
+  if(heap==NULL) return(-1);
+  int *queue=heap+pxlNr;
+  for(int i=first; i<first+pxlNr; i++) if(d->lab[i]<0) heap[n++]=i;
+  for(int k=n/2-1; k>=0; k--) imgsegmHeapDown(d->sum, heap, n, k);
+
+  while(n>0) {
+    /* Take the free pixel with the largest sum as seed */
+    int seed=heap[0]; heap[0]=heap[--n]; imgsegmHeapDown(d->sum, heap, n, 0);
+    if(d->lab[seed]>=0) continue;
+    clusterNr++;
+    d->lab[seed]=clusterNr; d->visit[seed]=clusterNr;
+    const float *zs=d->ztac+(size_t)seed*dimt;
+    const float ss=d->sum[seed];
+    int qhead=0, qtail=0; queue[qtail++]=seed;
+    /* Breadth-first search of neighbours that fit into the cluster */
+    while(qhead<qtail) {
+      int i=queue[qhead++];
+      int pl=i/(dimy*dimx), rl=(i/dimx)%dimy, cl=i%dimx;
+      for(int pk=pl-1; pk<=pl+1; pk++) if(pk>=z1 && pk<z2)
+        for(int rk=rl-1; rk<=rl+1; rk++) if(rk>=0 && rk<dimy)
+          for(int ck=cl-1; ck<=cl+1; ck++) if(ck>=0 && ck<dimx) {
+            int j=(pk*dimy+rk)*dimx+ck;
+            /* Test each pixel only once per cluster */
+            if(d->lab[j]>=0 || d->visit[j]==clusterNr) continue;
+            d->visit[j]=clusterNr;
+            /* Check that AUCs are matching, as in imgsegmClusterExpand() */
+            float mean=0.5*(d->sum[j]+ss);
+            float a=d->sum[j]-mean, b=ss-mean, cv;
+            if(fabs(mean)>1.0e-10) cv=(a*a + b*b) / mean; else cv=0.0;
+            if(cv>CVlim) continue;
+            /* Check that TACs are correlating */
+            if(!d->flat[seed] && !d->flat[j]) {
+              const float *zj=d->ztac+(size_t)j*dimt;
+              float r=0.0;
+#pragma omp simd reduction(+:r)
+              for(int fi=0; fi<dimt; fi++) r+=zs[fi]*zj[fi];
+              if(r<CClim) continue;
+            }
+            d->lab[j]=clusterNr; queue[qtail++]=j;
+          }
+    }
+  }
+  free(heap);
+  return(clusterNr);
+}
+/// @endcond
+
+/** Segments the image into clusters of adjacent pixels with matching AUCs and
+    correlating TACs.
+
+    Produces the same clusters as calling imgsegmFindMaxOutsideClusters() and
+    imgsegmClusterExpand() repeatedly until all pixels belong to some cluster,
+    but the TACs are normalised beforehand, making Pearson's correlation
+    coefficient a dot product, and the seeds are taken from a max-heap instead
+    of searching the whole image for each cluster.
+    Correlation coefficients are calculated with differently ordered float
+    operations than in imgsegmPearson(), therefore pixels with correlation very
+    close to CClim may be assigned differently.
+
+    Optionally the image planes can be divided into slabs, which are segmented
+    in parallel; clusters then do not extend across slab borders.
+    Results do not depend on the number of threads.
+
+    @sa imgsegmMaskToCluster, imgsegmClusterExpand, imgsegmClusterMean
+    @return Returns 0 if successful, and >0 in case of an error.
+ */
+int imgsegmClusters(
+  /** Pointer to cluster image, prepared with imgsegmMaskToCluster(); pixels
+      with value -1 are assigned to clusters 1, 2, 3, ... */
+  IMG *cimg,
+  /** Pointer to sum image. */
+  IMG *simg,
+  /** Pointer to dynamic image. */
+  IMG *dimg,
+  /** CV limit. */
+  float CVlim,
+  /** CC limit. */
+  float CClim,
+  /** Nr of slabs to segment in parallel; enter 1 to let clusters extend over
+      the whole image. */
+  int slabNr,
+  /** The number of clusters is written here; enter NULL if not needed. */
+  int *clusterNr,
+  /** Verbose level; if zero, then only warnings are printed into stderr. */
+  int verbose
+) {
+  if(verbose>0) {
+    printf("imgsegmClusters(cimg, simg, dimg, %f, %f, %d, %d)\n",
+       CVlim, CClim, slabNr, verbose);
+    fflush(stdout);
+  }
+  if(clusterNr!=NULL) *clusterNr=0;
+  if(cimg==NULL || cimg->status!=IMG_STATUS_OCCUPIED) return(2);
+  if(simg==NULL || simg->status!=IMG_STATUS_OCCUPIED) return(3);
+  if(dimg==NULL || dimg->status!=IMG_STATUS_OCCUPIED) return(4);
+  if(simg->dimx!=cimg->dimx || simg->dimy!=cimg->dimy || simg->dimz!=cimg->dimz)
+    return(5);
+  if(dimg->dimx!=cimg->dimx || dimg->dimy!=cimg->dimy || dimg->dimz!=cimg->dimz)
+    return(5);
+  if(slabNr<1) slabNr=1;
+  if(slabNr>cimg->dimz) slabNr=cimg->dimz;
+
+  IMGSEGMCLUSTERDATA d;
+  d.dimz=cimg->dimz; d.dimy=cimg->dimy; d.dimx=cimg->dimx; d.dimt=dimg->dimt;
+  const int pxlNr=d.dimz*d.dimy*d.dimx, dimt=d.dimt;
+  d.sum=(float*)malloc(pxlNr*sizeof(float));
+  d.ztac=(float*)malloc((size_t)pxlNr*dimt*sizeof(float));
+  d.flat=(char*)malloc(pxlNr*sizeof(char));
+  d.lab=(int*)malloc(pxlNr*sizeof(int));
+  d.visit=(int*)calloc(pxlNr, sizeof(int));
+  int *slabClusterNr=(int*)calloc(slabNr, sizeof(int));
+  if(d.sum==NULL || d.ztac==NULL || d.flat==NULL || d.lab==NULL || d.visit==NULL
+     || slabClusterNr==NULL)
+  {
+    free(d.sum); free(d.ztac); free(d.flat); free(d.lab); free(d.visit);
+    free(slabClusterNr);
+    return(6);
+  }
+
+  /* Copy sums and normalised TACs of free pixels into contiguous arrays */
+#pragma omp parallel for schedule(static)
+  for(int zi=0; zi<d.dimz; zi++) {
+    int i=zi*d.dimy*d.dimx;
+    for(int yi=0; yi<d.dimy; yi++) for(int xi=0; xi<d.dimx; xi++, i++) {
+      d.sum[i]=simg->m[zi][yi][xi][0];
+      d.lab[i]=(cimg->m[zi][yi][xi][0]<-0.1) ? -1 : 0;
+      d.flat[i]=1;
+      if(d.lab[i]==0) continue;
+      const float *y=dimg->m[zi][yi][xi];
+      float *z=d.ztac+(size_t)i*dimt;
+      double mean=0.0, ss=0.0;
+      for(int fi=0; fi<dimt; fi++) mean+=y[fi];
+      mean/=(double)dimt;
+      for(int fi=0; fi<dimt; fi++) {z[fi]=y[fi]-mean; ss+=(double)z[fi]*z[fi];}
+      if(dimt<3 || !(ss>0.0)) continue;
+      float f=1.0/sqrt(ss);
+      for(int fi=0; fi<dimt; fi++) z[fi]*=f;
+      d.flat[i]=0;
+    }
+  }
+
+  /* Segment the slabs */
+  int ret=0;
+#pragma omp parallel for schedule(dynamic)
+  for(int si=0; si<slabNr; si++) {
+    int z1=si*d.dimz/slabNr, z2=(si+1)*d.dimz/slabNr;
+    slabClusterNr[si]=imgsegmClusterSlab(&d, z1, z2, CVlim, CClim);
+    if(slabClusterNr[si]<0) {
+#pragma omp atomic write
+      ret=7;
+    }
+  }
+
+  /* Write cluster IDs, numbered consecutively over the slabs */
+  if(ret==0) {
+    int n=0;
+    for(int si=0; si<slabNr; si++) {
+      int z1=si*d.dimz/slabNr, z2=(si+1)*d.dimz/slabNr;
+      for(int zi=z1; zi<z2; zi++) {
+        int i=zi*d.dimy*d.dimx;
+        for(int yi=0; yi<d.dimy; yi++) for(int xi=0; xi<d.dimx; xi++, i++)
+          if(d.lab[i]>0) cimg->m[zi][yi][xi][0]=n+d.lab[i];
+      }
+      n+=slabClusterNr[si];
+    }
+    if(clusterNr!=NULL) *clusterNr=n;
+    if(verbose>1) printf("  %d clusters\n", n);
+  }
+
+  free(d.sum); free(d.ztac); free(d.flat); free(d.lab); free(d.visit);
+  free(slabClusterNr);
+  return(ret);
+}
+/*****************************************************************************/
+
 /*****************************************************************************/
 /** Calculates Pearson's correlation coefficient between x[] and y[] values.
 
@@ -14,91 +14,35 @@ int IFT_SPACE_AFTER_EQ_SIGN = 1;
 /******************************************************************************/
 
 /******************************************************************************/
-/** Read IFT file keys and values. Previous contents of IFT are preserved.
-
-    This function can read the initial ASCII part of files that contain also
-    binary data.
-
-   @return Returns 0 if ok. Sets ift->status.
+/// @cond
+/** Fill IFT with keys and values from file contents, which are modified.
+    @return Returns 0 if ok. Sets ift->status.
  */
-int iftRead(
-  /** Pointer to initiated but empty IFT */
+static int iftParseContents(
+  /** Pointer to initiated IFT */
   IFT *ift,
-  /** Input file name */
-  char *filename,
+  /** File contents as a NUL-terminated string */
+  char *allfile,
   /** 0=key name is not required, 1=only lines with key and equals sign are read */
-  int is_key_required
+  int is_key_required,
+  /** Nr of keys in IFT before reading */
+  int initial_key_nr
 ) {
-  int i, ret, nr=0, line=0, eq_type=0, initial_key_nr=0, nonprintable=0;
-  char *allfile, *cptr, *key_ptr, *value_ptr, *eq_ptr, *eq_ptr2, *cmt_ptr;
+  int i, ret, line=0, eq_type=0;
+  char *cptr, *key_ptr, *value_ptr, *eq_ptr, *eq_ptr2, *cmt_ptr, *saveptr;
   char empty_char=(char)0;
-  FILE *fp;
-
-
-  /* Check function input */
-  if(IFT_TEST) printf("iftRead(*ift, %s)\n", filename);
-  if(ift==NULL) return(1);
-  if(filename==NULL || strlen(filename)<1) {
-    iftSetStatus(ift, IFT_FAULT); return(1);
-  }
-  if(ift->keyNr>0) initial_key_nr=ift->keyNr;
-
-  /* Open file */
-  if(strcasecmp(filename, "stdin")==0) {
-    fp=stdin;
-  } else {
-    fp=fopen(filename, "r");
-    if(fp==NULL) {iftSetStatus(ift, IFT_CANNOTREAD); return(2);}
-  }
-
-  /* Get file size */
-  nr=nonprintable=0; while((ret=fgetc(fp))!=EOF) {
-    if(iscntrl(ret) && ret!=13 && ret!=10 && ret!=9) {
-      nonprintable=1; break;}
-    nr++;
-  }
-  if(nr<2) {
-    if(strcasecmp(filename, "stdin")!=0) fclose(fp);
-    if(nonprintable>0) {
-      /* File contains non-printable characters; maybe binary file */
-      iftSetStatus(ift, IFT_UNKNOWNFORMAT);
-    } else {
-      /* File just din't have any content */
-      iftSetStatus(ift, IFT_NODATA);
-    }
-    return(3);
-  }
-  if(IFT_TEST>1) printf("  the size of file is %d bytes\n", nr);
-  if(nr>5000000) {
-    if(strcasecmp(filename, "stdin")!=0) fclose(fp);
-    iftSetStatus(ift, IFT_UNKNOWNFORMAT); return(3);
-  }
-  rewind(fp);
-
-  /* Allocate memory for file contents */
-  allfile=(char*)malloc((nr+1)*sizeof(char));
-  if(allfile==NULL) {
-    if(strcasecmp(filename, "stdin")!=0) fclose(fp);
-    iftSetStatus(ift, IFT_NOMEMORY); return(4);
-  }
-
-  /* Read file contents and close the file */
-  i=0; while((ret=fgetc(fp))!=EOF && i<nr) allfile[i++]=(char)ret;
-  allfile[i]=(char)0;
-  if(strcasecmp(filename, "stdin")!=0) fclose(fp);
 
-  /* and then fill the list */
   /* separate the first line */
-  cptr=strtok(allfile, "\n\r"); line=0;
-  do {
+  cptr=strtok_r(allfile, "\n\r", &saveptr); line=0;
+  if(cptr!=NULL) do {
     if(IFT_TEST>2) printf("line %d: '%s'\n", line, cptr);
     /* Remove initial spaces and tabs */
     i=strspn(cptr, " \t"); cptr+=i;
-    if(strlen(cptr)<1) {cptr=strtok(NULL, "\n\r"); continue;}
+    if(strlen(cptr)<1) {cptr=strtok_r(NULL, "\n\r", &saveptr); continue;}
     /* Check if line starts with a comment character */
     if((cmt_ptr=strchr("#!;%", cptr[0]))!=NULL) {
       cmt_ptr=cptr; cptr++; i=strspn(cptr, " \t"); cptr+=i;
-      if(strlen(cptr)<1) {cptr=strtok(NULL, "\n\r"); continue;}
+      if(strlen(cptr)<1) {cptr=strtok_r(NULL, "\n\r", &saveptr); continue;}
     }
     if(IFT_TEST>2) printf("  line %d: '%s'\n", line, cptr);
     /* Find the 'equals' sign */
@@ -117,7 +61,7 @@ int iftRead(
     }
     if(eq_ptr==NULL) {
       /* Equals sign not found; if required, then ignore this line */
-      if(is_key_required) {cptr=strtok(NULL, "\n\r"); continue;}
+      if(is_key_required) {cptr=strtok_r(NULL, "\n\r", &saveptr); continue;}
       /* If not required, then key="" */
       key_ptr=eq_ptr=&empty_char; value_ptr=cptr;
     } else {
@@ -134,7 +78,7 @@ int iftRead(
     /* Remove tail spaces and tabs */
     i=strlen(key_ptr); while(i>0 && isspace((int)key_ptr[i-1])) i--; key_ptr[i]=(char)0;
     if(i==0) { /* Length of key name is zero */
-      if(is_key_required) {cptr=strtok(NULL, "\n\r"); continue;}
+      if(is_key_required) {cptr=strtok_r(NULL, "\n\r", &saveptr); continue;}
     }
     i=strlen(value_ptr); while(i>0 && isspace((int)value_ptr[i-1])) i--; value_ptr[i]=(char)0;
     if(IFT_TEST>2) printf("  key='%s' value='%s'\n", key_ptr, value_ptr);
@@ -143,7 +87,7 @@ int iftRead(
     if((key_ptr[0]=='\'' && key_ptr[i]=='\'') || (key_ptr[0]=='\"' && key_ptr[i]=='\"')) {
       key_ptr[i]=(char)0; if(i>0) key_ptr++;}
     if(strlen(key_ptr)<1) { /* Length of key name without comments is zero */
-      if(is_key_required) {cptr=strtok(NULL, "\n\r"); continue;}
+      if(is_key_required) {cptr=strtok_r(NULL, "\n\r", &saveptr); continue;}
     }
     i=strlen(value_ptr)-1; if(i<0) i=0;
     if((value_ptr[0]=='\'' && value_ptr[i]=='\'') || (value_ptr[0]=='\"' && value_ptr[i]=='\"')) {
@@ -152,13 +96,12 @@ int iftRead(
     /* Put key and value in the list */
     ret=iftPut(ift, key_ptr, value_ptr, cmt_ptr);
     if(ret) {
-      free(allfile); iftEmpty(ift); iftSetStatus(ift, IFT_FAULT);
+      iftEmpty(ift); iftSetStatus(ift, IFT_FAULT);
       return(10+ret);
     }
     /* separate the next line */
-    cptr=strtok(NULL, "\n\r"); line++;
+    cptr=strtok_r(NULL, "\n\r", &saveptr); line++;
   } while(cptr!=NULL);
-  free(allfile);
   if(IFT_TEST>2) printf("eq_type=%d\n", eq_type);
   ift->type=eq_type;
   /* Did we actually get any data? */
@@ -167,6 +110,137 @@ int iftRead(
   iftSetStatus(ift, IFT_OK);
   return(0);
 }
+/// @endcond
+/*****************************************************************************/
+
+/******************************************************************************/
+/** Read IFT file keys and values. Previous contents of IFT are preserved.
+
+    This function can read the initial ASCII part of files that contain also
+    binary data.
+
+   @return Returns 0 if ok. Sets ift->status.
+   @sa iftReadBuffer
+ */
+int iftRead(
+  /** Pointer to initiated but empty IFT */
+  IFT *ift,
+  /** Input file name */
+  char *filename,
+  /** 0=key name is not required, 1=only lines with key and equals sign are read */
+  int is_key_required
+) {
+  int i, ret, nr=0, initial_key_nr=0, nonprintable=0;
+  char *allfile;
+  FILE *fp;
+
+
+  /* Check function input */
+  if(IFT_TEST) printf("iftRead(*ift, %s)\n", filename);
+  if(ift==NULL) return(1);
+  if(filename==NULL || strlen(filename)<1) {
+    iftSetStatus(ift, IFT_FAULT); return(1);
+  }
+  if(ift->keyNr>0) initial_key_nr=ift->keyNr;
+
+  /* Open file */
+  if(strcasecmp(filename, "stdin")==0) {
+    fp=stdin;
+  } else {
+    fp=fopen(filename, "r");
+    if(fp==NULL) {iftSetStatus(ift, IFT_CANNOTREAD); return(2);}
+  }
+
+  /* Get file size */
+  nr=nonprintable=0; while((ret=fgetc(fp))!=EOF) {
+    if(iscntrl(ret) && ret!=13 && ret!=10 && ret!=9) {
+      nonprintable=1; break;}
+    nr++;
+  }
+  if(nr<2) {
+    if(strcasecmp(filename, "stdin")!=0) fclose(fp);
+    if(nonprintable>0) {
+      /* File contains non-printable characters; maybe binary file */
+      iftSetStatus(ift, IFT_UNKNOWNFORMAT);
+    } else {
+      /* File just din't have any content */
+      iftSetStatus(ift, IFT_NODATA);
+    }
+    return(3);
+  }
+  if(IFT_TEST>1) printf("  the size of file is %d bytes\n", nr);
+  if(nr>5000000) {
+    if(strcasecmp(filename, "stdin")!=0) fclose(fp);
+    iftSetStatus(ift, IFT_UNKNOWNFORMAT); return(3);
+  }
+  rewind(fp);
+
+  /* Allocate memory for file contents */
+  allfile=(char*)malloc((nr+1)*sizeof(char));
+  if(allfile==NULL) {
+    if(strcasecmp(filename, "stdin")!=0) fclose(fp);
+    iftSetStatus(ift, IFT_NOMEMORY); return(4);
+  }
+
+  /* Read file contents and close the file */
+  i=0; while((ret=fgetc(fp))!=EOF && i<nr) allfile[i++]=(char)ret;
+  allfile[i]=(char)0;
+  if(strcasecmp(filename, "stdin")!=0) fclose(fp);
+
+  /* and then fill the list */
+  ret=iftParseContents(ift, allfile, is_key_required, initial_key_nr);
+  free(allfile);
+  return(ret);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Read IFT keys and values from file contents that are already in memory.
+    Previous contents of IFT are preserved.
+
+    Contents are processed like in iftRead(), up to the first non-printable
+    character; the buffer is not modified, and need not be NUL-terminated.
+   @return Returns 0 if ok. Sets ift->status.
+   @sa iftRead
+ */
+int iftReadBuffer(
+  /** Pointer to initiated IFT */
+  IFT *ift,
+  /** Pointer to file contents */
+  const char *buf,
+  /** Length of file contents (bytes) */
+  size_t len,
+  /** 0=key name is not required, 1=only lines with key and equals sign are read */
+  int is_key_required
+) {
+  size_t nr;
+  int ret, nonprintable=0;
+  char *allfile;
+
+  if(IFT_TEST) printf("iftReadBuffer(*ift, buf, %zu)\n", len);
+  if(ift==NULL) return(1);
+  if(buf==NULL) {iftSetStatus(ift, IFT_FAULT); return(1);}
+
+  /* Get content size */
+  for(nr=0; nr<len; nr++) {
+    ret=(unsigned char)buf[nr];
+    if(iscntrl(ret) && ret!=13 && ret!=10 && ret!=9) {nonprintable=1; break;}
+  }
+  if(nr<2) {
+    if(nonprintable>0) iftSetStatus(ift, IFT_UNKNOWNFORMAT);
+    else iftSetStatus(ift, IFT_NODATA);
+    return(3);
+  }
+  if(nr>5000000) {iftSetStatus(ift, IFT_UNKNOWNFORMAT); return(3);}
+
+  /* Make a modifiable copy of the contents, and fill the list */
+  allfile=(char*)malloc((nr+1)*sizeof(char));
+  if(allfile==NULL) {iftSetStatus(ift, IFT_NOMEMORY); return(4);}
+  memcpy(allfile, buf, nr); allfile[nr]=(char)0;
+  ret=iftParseContents(ift, allfile, is_key_required, ift->keyNr);
+  free(allfile);
+  return(ret);
+}
 /*****************************************************************************/
 
 /*****************************************************************************/
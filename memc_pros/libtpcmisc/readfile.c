@@ -236,6 +236,42 @@ int readStrtokens(
 }
 /*****************************************************************************/
 
+/*****************************************************************************/
+/** Read the whole contents of a file into memory with one read call.
+ *  Remember to free the memory of the returned string.
+ *  @return Returns pointer to the file contents, with a terminal null added
+ *  after the last byte, or NULL if file cannot be opened or read, or in case
+ *  of memory allocation error.
+ *  @sa textfileReadLines
+ */
+char *textfileReadContents(
+  /** Name of file to read */
+  const char *filename,
+  /** Pointer where the nr of bytes read is written; enter NULL if not needed */
+  size_t *len
+) {
+  FILE *fp;
+  long size;
+  size_t nr;
+  char *allfile;
+
+  if(len!=NULL) *len=0;
+  if(filename==NULL || strlen(filename)<1) return(NULL);
+  fp=fopen(filename, "r"); if(fp==NULL) return(NULL);
+  /* Get file size */
+  if(fseek(fp, 0, SEEK_END)!=0 || (size=ftell(fp))<0) {fclose(fp); return(NULL);}
+  rewind(fp);
+  /* Allocate memory for file contents, and read them */
+  allfile=(char*)malloc((size_t)size+1);
+  if(allfile==NULL) {fclose(fp); return(NULL);}
+  nr=fread(allfile, 1, (size_t)size, fp);
+  if(nr<(size_t)size && ferror(fp)) {fclose(fp); free(allfile); return(NULL);}
+  fclose(fp); allfile[nr]=(char)0;
+  if(len!=NULL) *len=nr;
+  return(allfile);
+}
+/*****************************************************************************/
+
 /*****************************************************************************/
 /** Check if ASCII text line starts with comment character '#'.
  *  Comment character is searched from the first non-space character (space
@@ -24,7 +24,7 @@ int rnameSplit(
   int max_name_len
 ) {
   char temp[MAX_REGIONNAME_LEN+1], temp2[MAX_REGIONNAME_LEN+1];
-  char *cptr, *lptr, space[64];
+  char *cptr, *lptr, *saveptr, space[64];
   int nr;
 
   if(rname==NULL || name1==NULL || name2==NULL || name3==NULL) return(0);
@@ -43,11 +43,11 @@ int rnameSplit(
   }
   strcat(space, "\n\r");
   nr=0; lptr=temp;
-  cptr=strtok(lptr, space); if(cptr==NULL) return(nr);
+  cptr=strtok_r(lptr, space, &saveptr); if(cptr==NULL) return(nr);
   strncpy(name1, cptr, max_name_len); name1[max_name_len]=(char)0; nr++;
-  cptr=strtok(NULL, space); if(cptr==NULL) return(nr);
+  cptr=strtok_r(NULL, space, &saveptr); if(cptr==NULL) return(nr);
   strncpy(name2, cptr, max_name_len); name2[max_name_len]=(char)0; nr++;
-  cptr=strtok(NULL, space); if(cptr==NULL) return(nr);
+  cptr=strtok_r(NULL, space, &saveptr); if(cptr==NULL) return(nr);
   strncpy(name3, cptr, max_name_len); name3[max_name_len]=(char)0; nr++;
   return(nr);
 }
@@ -69,7 +69,7 @@ int rnameRmDots(
    *  Enter NULL, if previous string is to be modified instead. */
   char *rname2
 ) {
-  char *temp, *out, *cptr, *lptr;
+  char *temp, *out, *cptr, *lptr, *saveptr;
   int len, c=0;
 
   if(rname1==NULL) return -1;
@@ -82,13 +82,13 @@ int rnameRmDots(
 
   /* remove dots and extra spaces */
   lptr=temp;
-  cptr=strtok(lptr, " \t\n\r");
+  cptr=strtok_r(lptr, " \t\n\r", &saveptr);
   while(cptr!=NULL) {
     if(strcmp(cptr, ".")!=0) {
       if(strlen(out)>0) strcat(out, " ");
       strcat(out, cptr); c++;
     }
-    cptr=strtok(NULL, " \t\n\r");
+    cptr=strtok_r(NULL, " \t\n\r", &saveptr);
   }
   free(temp);
   return c;
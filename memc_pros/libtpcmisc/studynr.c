@@ -24,7 +24,7 @@ int studynr_in_fname(
 ) {
   unsigned int i;
   int ret;
-  char *cptr, *lptr, temp[FILENAME_MAX], temp2[FILENAME_MAX];
+  char *cptr, *lptr, *saveptr, temp[FILENAME_MAX], temp2[FILENAME_MAX];
 
   //printf("studynr_in_filename(%s, string)\n", fname);
   if(fname==NULL || studynr==NULL) return(1);
@@ -35,7 +35,7 @@ int studynr_in_fname(
   //i=strlen(cptr); if(i>FILENAME_MAX-1) i=FILENAME_MAX-1;
   strlcpy(temp, cptr, FILENAME_MAX); lptr=temp;
   /* Verify tokens in filename whether they are valid as study number */
-  cptr=strtok(lptr, "_-+{}!~.()");
+  cptr=strtok_r(lptr, "_-+{}!~.()", &saveptr);
   while(cptr!=NULL && !studynr[0]) {
     strcpy(temp2, cptr);
     /* Remove everything after the letter+digit parts */
@@ -49,7 +49,7 @@ int studynr_in_fname(
       if(studynr_rm_zeroes(studynr)!=0) strcpy(studynr, "");
       if(studynr_to_lowercase(studynr)!=0) strcpy(studynr, "");
     }
-    cptr=strtok(NULL, "_-+{}!~.()");
+    cptr=strtok_r(NULL, "_-+{}!~.()", &saveptr);
   }
   if(!studynr[0]) return(2);
   return 0;
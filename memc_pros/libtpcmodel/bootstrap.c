@@ -25,13 +25,6 @@
 /** local function definitions */
 static int bootstrapQSort(const void *par1, const void *par2);
 /*****************************************************************************/
-int bs_parNr, bs_frameNr;
-double *bs_parameter;
-double *bs_uplim;
-double *bs_lowlim;
-double *bs_weight;
-double (*bs_func)(int, double*, void*);
-/*****************************************************************************/
 /// @endcond
 
 /*****************************************************************************/
@@ -92,6 +85,8 @@ int bootstrap(
   int ret, i, j, powellItNr, lowindex, upindex;
   double fret=0.0, *parMean, *chainptr, *chain, *delta, *bsFitTac, **matrix;
   double help, *error, *wError, *biasEst, *unbiasPar, *estInOrder;
+  double *bs_parameter, *bs_weight;
+  int bs_parNr, bs_frameNr;
   char bserrmsg[64];
 
   if(verbose>0)
@@ -150,9 +145,6 @@ int bootstrap(
 
   bs_parNr=parNr;
   bs_frameNr=frameNr;
-  bs_func=objf;
-  bs_lowlim=lowlim;
-  bs_uplim=uplim;
   for(i=0; i<bs_parNr; i++) {
     bs_parameter[i]=parameter[i];
   }
@@ -189,11 +181,11 @@ int bootstrap(
 
     /* Powell local search */
     for(j=0; j<bs_parNr; j++) {
-      delta[j]=0.01*(bs_uplim[j]-bs_lowlim[j]);
+      delta[j]=0.01*(uplim[j]-lowlim[j]);
       bs_parameter[j]=parameter[j];
     }
     powellItNr=400;
-    ret=powell(bs_parameter, delta, bs_parNr, 0.00001, &powellItNr, &fret, bs_func, NULL, 0);
+    ret=powell(bs_parameter, delta, bs_parNr, 0.00001, &powellItNr, &fret, objf, NULL, 0);
     if(ret>1 && ret!=3)	{
       sprintf(bserrmsg, "error %d in powell()", ret);
       if(verbose>0) fprintf(stderr, "Error: %s.\n", bserrmsg);
@@ -16,6 +16,9 @@
 ///
 /*****************************************************************************/
 #include "libtpcmodel.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 /*****************************************************************************/
 /// @cond
 #ifndef RAND_MAX
@@ -24,13 +27,7 @@
 /*****************************************************************************/
 /** local function definitions */
 static int bootstrapQSort(const void *par1, const void *par2);
-/*****************************************************************************/
-int bs_parNr, bs_frameNr;
-double *bs_parameter;
-double *bs_uplim;
-double *bs_lowlim;
-double *bs_weight;
-double (*bs_func)(int, double*, void*);
+static double bootstrapSelect(double *a, int n, int k);
 /*****************************************************************************/
 /// @endcond
 
@@ -45,6 +42,9 @@ double (*bs_func)(int, double*, void*);
   to be NULL.
   This function will not set seed for random number generator, therefore,
   make sure that it is set in your program, for example with srand(time(NULL));. 
+  Unlike bootstrap(), the object function gets objfData, so the bootstrapped
+  TAC (bsTac) and other fit data can be kept in a structure per fit instead
+  of in global variables.
 
 \return Return values:
   - 0, if ok.
@@ -82,19 +82,25 @@ int bootstrapr(
   double *weight,
   /** The object function. */
   double (*objf)(int, double*, void*),
+  /** Pointer to data which is passed on to the object function;
+      NULL if not needed. */
+  void *objfData,
   /** Pointer to a string (allocated for at least 64 chars) where error message
       or other execution status will be written; enter NULL, if not needed. */   
   char *status,
   /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
   int verbose,
 
-  /** Full sampling matrix add later */
+  /** Full sampling matrix (iterNr x parNr) is written here;
+      NULL if not needed. */
   double *bmatrix
 ) {
 
   int ret, i, j, powellItNr, lowindex, upindex;
   double fret=0.0, *parMean, *chainptr, *chain, *delta, *bsFitTac, **matrix;
   double help, *error, *wError, *biasEst, *unbiasPar, *estInOrder;
+  double *bs_parameter, *bs_weight;
+  int bs_parNr, bs_frameNr;
   char bserrmsg[64];
 
   if(verbose>0)
@@ -154,9 +160,6 @@ int bootstrapr(
 
   bs_parNr=parNr;
   bs_frameNr=frameNr;
-  bs_func=objf;
-  bs_lowlim=lowlim;
-  bs_uplim=uplim;
   for(i=0; i<bs_parNr; i++) {
     bs_parameter[i]=parameter[i];
   }
@@ -193,11 +196,11 @@ int bootstrapr(
 
     /* Powell local search */
     for(j=0; j<bs_parNr; j++) {
-      delta[j]=0.01*(bs_uplim[j]-bs_lowlim[j]);
+      delta[j]=0.01*(uplim[j]-lowlim[j]);
       bs_parameter[j]=parameter[j];
     }
     powellItNr=400;
-    ret=powell(bs_parameter, delta, bs_parNr, 0.00001, &powellItNr, &fret, bs_func, NULL, 0);
+    ret=powell(bs_parameter, delta, bs_parNr, 0.00001, &powellItNr, &fret, objf, objfData, 0);
     if(ret>1 && ret!=3)	{
       sprintf(bserrmsg, "error %d in powell()", ret);
       if(verbose>0) fprintf(stderr, "Error: %s.\n", bserrmsg);
@@ -301,8 +304,7 @@ int bootstrapr(
     }
   }
 
-  //
-  for(j=0; j<iterNr; j++){
+  if(bmatrix!=NULL) for(j=0; j<iterNr; j++){
      for(i=0; i<bs_parNr; i++) {
        bmatrix[bs_parNr*j+i]=matrix[i][j]; } }
   //    printf("return full sampling matrix... %f \n", bmatrix[bs_parNr*j+i]); } }
@@ -328,6 +330,244 @@ int bootstrapr(
 } /* end bootstrap() */
 /*****************************************************************************/
 
+/*****************************************************************************/
+/** Parallel version of bootstrapr().
+
+  Bootstrap iterations are run in parallel, one thread for each item in
+  objfData[] and bsTac[]. Each iteration resamples the weighted residuals
+  with its own Mersenne Twister stream, initiated with the given seed and
+  the iteration index, therefore the results are the same regardless of the
+  nr of threads, and the global random number generator is not used.
+  Each refit is started from the original parameter estimates.
+  Confidence limits are found by selection instead of sorting the
+  parameter chains.
+
+  Object function must read the bootstrapped TAC from the bsTac[] array
+  of the same index as its objfData[].
+
+\return Return values:
+  - 0, if ok.
+  - 1 - 3 if some of the given parameters is not qualified.
+  - 4, if Powell fails, and 5, if out of memory.
+  @sa bootstrapr, powell, mertwiInitByArray64
+*/
+int bootstrapParallel(
+  /** Bootstrap iteration number (>=100), set to zero to use the default (200). */
+  int iterNr,
+  /** Vector to put the lower confidence limits to; NULL if not needed. */
+  double *cLim1,
+  /** Vector to put the upper confidence limits to; NULL if not needed. */
+  double *cLim2,
+  /** Vector to put the standard deviations to; NULL if not needed. */
+  double *SD,
+  /** Best parameter estimates (preserved by this function). */
+  double *parameter,
+  /** Lower limits for the parameters. */
+  double *lowlim,
+  /** Upper limits for the parameters. */
+  double *uplim,
+  /** Nr of samples in tissue TAC data. */
+  int frameNr,
+  /** Measured tissue TAC values (not modified). */
+  double *origTac,
+  /** Best fitted tissue TAC values (not modified). */
+  double *fitTac,
+  /** Pointers to (empty) tissue TAC vectors, one for each thread, where
+   *  bootstrapped TACs will be written, and which will be used by objective
+   *  function to calculate WSS. */
+  double **bsTac,
+  /** Nr of parameters. */
+  int parNr,
+  /** sample weights. */
+  double *weight,
+  /** The object function. */
+  double (*objf)(int, double*, void*),
+  /** Data for the object function, one for each thread; array can be NULL
+   *  if object function needs no data. */
+  void **objfData,
+  /** Nr of items in bsTac[] and objfData[], and max nr of threads to use. */
+  int threadNr,
+  /** Seed for the random number generator. */
+  uint64_t seed,
+  /** Pointer to a string (allocated for at least 64 chars) where error message
+      or other execution status will be written; enter NULL, if not needed. */   
+  char *status,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose,
+  /** Full sampling matrix (iterNr x parNr) is written here;
+      NULL if not needed. */
+  double *bmatrix
+) {
+  int i, j, lowindex, upindex, powellfailNr=0, errorNr=0, lastret=0;
+  double help, *chain, *wError, *sWeight, *work, *parMean, biasEst;
+  char bserrmsg[64];
+
+  if(verbose>0)
+    printf("%s(%d, ..., %d, ..., %d, ..., %d)\n", __func__, iterNr, frameNr,
+           parNr, verbose);
+
+  /* Checking the given parameters */
+  if(status!=0) strcpy(status, "");
+  if(iterNr<100) iterNr=200;
+  if(frameNr<1 || parNr<1 || threadNr<1) {
+    strcpy(bserrmsg, "invalid nr of frames, parameters or threads");
+    if(verbose>0) fprintf(stderr, "Error: %s.\n", bserrmsg);
+    if(status!=0) strcpy(status, bserrmsg);
+    return(1);
+  }
+  if(bsTac==NULL || parameter==NULL || objf==NULL || origTac==NULL ||
+     fitTac==NULL || weight==NULL)
+  {
+    strcpy(bserrmsg, "some of the given parameters are not pointing anywhere");
+    if(verbose>0) fprintf(stderr, "Error: %s.\n", bserrmsg);
+    if(status!=0) strcpy(status, bserrmsg);
+    return(2);
+  }
+  for(i=0; i<threadNr; i++) if(bsTac[i]==NULL) {
+    strcpy(bserrmsg, "some of the given parameters are not pointing anywhere");
+    if(verbose>0) fprintf(stderr, "Error: %s.\n", bserrmsg);
+    if(status!=0) strcpy(status, bserrmsg);
+    return(2);
+  }
+  for(i=0; i<parNr; i++) {
+    if(lowlim[i]>uplim[i]) {
+      strcpy(bserrmsg, "given limit values are not qualified");
+      if(verbose>0) fprintf(stderr, "Error: %s.\n", bserrmsg);
+      if(status!=0) strcpy(status, bserrmsg);
+      return(3);
+    }
+  }
+  if(threadNr>iterNr) threadNr=iterNr;
+
+  /* Allocating memory: parameter chains, weighted errors and weights, and
+     parameters and deltas for each thread */
+  if(verbose>1) printf("  allocating memory\n");
+  chain=(double*)malloc((iterNr*parNr)*sizeof(double));
+  wError=(double*)malloc(2*frameNr*sizeof(double));
+  work=(double*)malloc(2*threadNr*parNr*sizeof(double));
+  parMean=(double*)malloc(parNr*sizeof(double));
+  if(chain==NULL || wError==NULL || work==NULL || parMean==NULL) {
+    strcpy(bserrmsg, "out of memory");
+    if(verbose>0) fprintf(stderr, "Error: %s.\n", bserrmsg);
+    if(status!=0) strcpy(status, bserrmsg);
+    free(chain); free(wError); free(work); free(parMean);
+    return(5);
+  }
+  sWeight=wError+frameNr;
+
+  /* check the weights and calculate the weighted errors */
+  for(i=0; i<frameNr; i++) {
+    if(weight[i]<=0.0) sWeight[i]=1.0; else sWeight[i]=weight[i];
+    wError[i]=(origTac[i]-fitTac[i])/sqrt(sWeight[i]);
+  }
+  if(verbose>3) {
+    printf("  weighted errors:\n  ");
+    for(i=0; i<frameNr; i++) printf("%g ", wError[i]);
+    printf("\n");
+  }
+
+  /*
+   *  bootstrap iterations
+   */
+  if(verbose>1) printf("  bootstrap iterations with %d thread(s)\n", threadNr);
+#pragma omp parallel for num_threads(threadNr) if(threadNr>1) \
+  schedule(dynamic) reduction(+:powellfailNr,errorNr) private(j)
+  for(i=0; i<iterNr; i++) {
+    int t=0, ret, powellItNr;
+    double fret=0.0, *p, *delta, *tac;
+    uint64_t key[2];
+    MERTWI mt;
+#ifdef _OPENMP
+    if(threadNr>1) t=omp_get_thread_num();
+#endif
+    p=work+2*t*parNr; delta=p+parNr; tac=bsTac[t];
+
+    /* sample a new error distribution from the stream of this iteration */
+    key[0]=seed; key[1]=(uint64_t)i;
+    mertwiInit(&mt); mertwiInitByArray64(&mt, key, 2);
+    for(j=0; j<frameNr; j++)
+      tac[j]=fitTac[j]
+            +sWeight[j]*wError[(int)(frameNr*mertwiRandomDouble2(&mt))];
+
+    /* Powell local search, starting from the original estimates */
+    for(j=0; j<parNr; j++) {
+      delta[j]=0.01*(uplim[j]-lowlim[j]);
+      p[j]=parameter[j];
+    }
+    powellItNr=400;
+    ret=powell(p, delta, parNr, 0.00001, &powellItNr, &fret, objf,
+               objfData==NULL ? NULL : objfData[t], 0);
+    if(ret>1 && ret!=3) {
+      errorNr++;
+#pragma omp atomic write
+      lastret=ret;
+    }
+    if(ret==3) powellfailNr++; // powell sometimes fails, do not worry if not too often
+
+    for(j=0; j<parNr; j++) chain[j*iterNr+i]=p[j];
+  } /* end of bootstrap iterations */
+  free(work);
+
+  if(errorNr>0 || powellfailNr>(iterNr/3)) {
+    sprintf(bserrmsg, "error %d in powell()", errorNr>0 ? lastret : 3);
+    if(verbose>0) {
+      if(errorNr>0) fprintf(stderr, "Error: %s.\n", bserrmsg);
+      else fprintf(stderr, "Error: too often %s.\n", bserrmsg);
+    }
+    if(status!=0) strcpy(status, bserrmsg);
+    free(chain); free(wError); free(parMean);
+    return(4);
+  }
+  if(verbose>4) {
+    printf("Bootstrap matrix:\n");
+    for(i=0; i<iterNr; i++) {
+      for(j=0; j<parNr; j++) printf("%g ", chain[j*iterNr+i]);
+      printf("\n");
+    }
+  }
+  if(bmatrix!=NULL) for(i=0; i<iterNr; i++)
+    for(j=0; j<parNr; j++) bmatrix[parNr*i+j]=chain[j*iterNr+i];
+
+  /* Computing the mean and standard deviation of each parameter */
+  for(j=0; j<parNr; j++) {
+    double *c=chain+j*iterNr;
+    for(i=0, help=0.0; i<iterNr; i++) help+=c[i];
+    parMean[j]=help/(double)iterNr;
+    if(verbose>1) {
+      printf("parMean[%d] := %g\n", j, parMean[j]);
+      printf("parameter[%d] := %g\n", j, parameter[j]);
+    }
+    if(SD!=NULL) {
+      for(i=0, help=0.0; i<iterNr; i++)
+        help+=(c[i]-parMean[j])*(c[i]-parMean[j]);
+      SD[j]=sqrt(help/(double)(iterNr-1));
+      if(verbose>1) printf("SD[%d] := %g\n", j, SD[j]);
+    }
+  }
+
+  /* Computing the 95% confidence intervals for each parameter estimate */
+  if(cLim1!=NULL && cLim2!=NULL) {
+    lowindex=(int)temp_roundf(0.025*iterNr);
+    upindex=(int)temp_roundf(0.975*iterNr)-1;
+    if(verbose>1) printf("lowindex := %d\nupindex := %d\n", lowindex, upindex);
+    for(j=0; j<parNr; j++) {
+      double *c=chain+j*iterNr, lo, up;
+      biasEst=parMean[j]-parameter[j];
+      /* after selecting the lower limit, the upper one is above it */
+      lo=bootstrapSelect(c, iterNr, lowindex);
+      up=bootstrapSelect(c+lowindex, iterNr-lowindex, upindex-lowindex);
+      if(fabs(lo-biasEst)<1e-99) cLim1[j]=0.0; else cLim1[j]=lo-biasEst;
+      if(fabs(up-biasEst)<1e-99) cLim2[j]=0.0; else cLim2[j]=up-biasEst;
+      if(verbose>1) printf("  %g - %g\n", cLim1[j], cLim2[j]);
+    }
+  }
+
+  free(chain); free(wError); free(parMean);
+  if(verbose>0) {printf("  end of bootstrapParallel()\n");}
+  return(0);
+} /* end bootstrapParallel() */
+/*****************************************************************************/
+
 /*****************************************************************************/
 /// @cond
 int bootstrapQSort(const void *par1, const void *par2)
@@ -336,6 +576,24 @@ int bootstrapQSort(const void *par1, const void *par2)
   else if( *((double*)par1) > *((double*)par2)) return(1);
   else return(0);
 }
+/** Returns the k:th smallest value in array a[n]; array is partially
+    reordered so that a[k] contains that value, values before it are not
+    larger and values after it are not smaller. */
+static double bootstrapSelect(double *a, int n, int k)
+{
+  int lo=0, hi=n-1, i, j;
+  double pivot, t;
+  while(hi>lo) {
+    pivot=a[lo+(hi-lo)/2]; i=lo; j=hi;
+    while(i<=j) {
+      while(a[i]<pivot) i++;
+      while(a[j]>pivot) j--;
+      if(i<=j) {t=a[i]; a[i]=a[j]; a[j]=t; i++; j--;}
+    }
+    if(k<=j) hi=j; else if(k>=i) lo=i; else break;
+  }
+  return(a[k]);
+}
 /// @endcond
 /*****************************************************************************/
 
@@ -177,3 +177,308 @@ int mtga_best_perp(
 /*****************************************************************************/
 
 /*****************************************************************************/
+/** Calculates Gjedde-Patlak plot x,y values for a block of ROI or pixel TACs.
+
+    Plot data is accepted exactly as in patlak_data(), but the input-side checks
+    and plot x values are computed only once for all TACs. Plot data is written
+    frame-major, i.e. the value of frame fi for TAC j is in x[fi*tac_nr+j], and
+    points that patlak_data() would leave out are set to NaN, so that the block
+    can be given as such to mtga_block_fit().
+
+   @sa patlak_data, logan_block_data, mtga_block_fit
+   @return Returns 0 if successful, or <0 in case of an error.
+ */
+int patlak_block_data(
+  /** Nr of samples. */
+  int data_nr,
+  /** Array of input concentrations. */
+  double *i,
+  /** Array of integrals (from zero to sample time) of input concentrations;
+      if reference region input, then remember to consider the frame length. */
+  double *ii,
+  /** Nr of TACs in the block. */
+  int tac_nr,
+  /** Array of pointers to the ROI or pixel concentration TACs, each with
+      data_nr samples. */
+  float **c,
+  /** Pointer to preallocated memory (at least size data_nr*tac_nr) where
+      MTGA plot x values will be written. */
+  double *x,
+  /** Pointer to preallocated memory (at least size data_nr*tac_nr) where
+      MTGA plot y values will be written. */
+  double *y
+) {
+  int fi, fj, j;
+  double divider_limit=1.0E-12, px, py, cv, *xr, *yr;
+
+  if(data_nr<0 || tac_nr<0 || i==NULL || ii==NULL || c==NULL || x==NULL || y==NULL)
+    return -1;
+  for(fi=0; fi<data_nr; fi++) {
+    xr=x+(size_t)fi*tac_nr; yr=y+(size_t)fi*tac_nr;
+    for(j=0; j<tac_nr; j++) xr[j]=yr[j]=nan("");
+    // check that input data is available
+    if(isnan(i[fi]) || isnan(ii[fi])) continue;
+    if(!(i[fi]>-1.0E+20 && i[fi]<+1.0E+20)) continue; 
+    if(!(ii[fi]>-1.0E+20 && ii[fi]<+1.0E+20)) continue; 
+    if(ii[fi]<0.0) {
+      // integral has been negative; drop the earlier points of the TACs 
+      // where this sample would have been checked
+      for(j=0; j<tac_nr; j++) {
+        cv=c[j][fi];
+        if(isnan(cv) || !(cv>-1.0E+20 && cv<+1.0E+20)) continue;
+        for(fj=0; fj<fi; fj++) x[(size_t)fj*tac_nr+j]=y[(size_t)fj*tac_nr+j]=nan("");
+      }
+      continue;
+    }
+    if(fabs(i[fi])<divider_limit) continue;
+    px=ii[fi]/i[fi];
+    if(!(px>-1.0E+20 && px<+1.0E+20)) continue;
+    if(px<0.0) continue;
+    for(j=0; j<tac_nr; j++) {
+      cv=c[j][fi];
+      if(isnan(cv) || !(cv>-1.0E+20 && cv<+1.0E+20)) continue;
+      py=cv/i[fi];
+      if(!(py>-1.0E+20 && py<+1.0E+20)) continue;
+      xr[j]=px; yr[j]=py;
+    }
+  }
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Calculates Logan plot x,y values for a block of ROI or pixel TACs.
+
+    Plot data is accepted exactly as in logan_data(). The layout of the
+    output is the same as in patlak_block_data().
+
+    @sa logan_data, patlak_block_data, mtga_block_fit
+    @return Returns 0 if successful, or <0 in case of an error. 
+ */
+int logan_block_data(
+  /** Nr of samples. */
+  int data_nr,
+  /** Array of input concentrations. */
+  double *i,
+  /** Array of integrals (from zero to sample time) of input concentrations;
+      if reference region input, then remember to consider the frame length. */
+  double *ii,
+  /** Nr of TACs in the block. */
+  int tac_nr,
+  /** Array of pointers to the ROI or pixel concentration TACs, each with
+      data_nr samples. */
+  float **c,
+  /** ROI integrals (from zero to frame middle time), frame-major like the 
+      plot data, i.e. ci[fi*tac_nr+j]. */
+  double *ci,
+  /** Reference region k2; set to <=0 if not needed. */
+  double k2,
+  /** Pointer to preallocated memory (at least size data_nr*tac_nr) where MTGA
+      plot x values will be written. */
+  double *x,
+  /** Pointer to preallocated memory (at least size data_nr*tac_nr) where MTGA
+      plot y values will be written. */
+  double *y
+) {
+  int fi, fj, j;
+  double divider_limit=1.0E-18, pi, cv, civ, px, py, *xr, *yr, *cir;
+
+  if(data_nr<0 || tac_nr<0 || i==NULL || ii==NULL || c==NULL || ci==NULL) return -1;
+  if(x==NULL || y==NULL) return -1;
+
+  for(fi=0; fi<data_nr; fi++) {
+    xr=x+(size_t)fi*tac_nr; yr=y+(size_t)fi*tac_nr; cir=ci+(size_t)fi*tac_nr;
+    for(j=0; j<tac_nr; j++) xr[j]=yr[j]=nan("");
+    // check that input data is available
+    if(isnan(i[fi]) || isnan(ii[fi])) continue;
+    if(!(i[fi]>-1.0E+30 && i[fi]<+1.0E+30)) continue; 
+    if(!(ii[fi]>-1.0E+30 && ii[fi]<+1.0E+30)) continue; 
+    // plot x numerator is the same for all TACs
+    if(k2>0.0) pi=ii[fi]+i[fi]/k2; else pi=ii[fi];
+    for(j=0; j<tac_nr; j++) {
+      cv=c[j][fi]; civ=cir[j];
+      if(isnan(cv) || isnan(civ)) continue;
+      if(!(cv>-1.0E+30 && cv<+1.0E+30)) continue; 
+      if(!(civ>-1.0E+30 && civ<+1.0E+30)) continue; 
+      // check that integrals have been >=0 all the time
+      if(ii[fi]<0.0 || civ<0.0) {
+        for(fj=0; fj<fi; fj++) x[(size_t)fj*tac_nr+j]=y[(size_t)fj*tac_nr+j]=nan("");
+        continue;
+      }
+      // check that dividers are not too close to zero
+      if(fabs(cv)<divider_limit) continue;
+      px=pi/cv;
+      if(!(px>-1.0E+30 && px<+1.0E+30)) continue;
+      py=civ/cv;
+      if(!(py>-1.0E+30 && py<+1.0E+30)) continue;
+      xr[j]=px; yr[j]=py;
+    }
+  }
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Solves the perpendicular regression line as in llsqperp(), from the means
+    and the sums of squared deviations of the plot points.
+
+    The sums can be accumulated in one pass over the plot points, for example
+    with Welford's method, therefore the plot data does not need to be stored.
+
+    @sa mtga_block_fit, llsqperp
+    @return Returns 0 if successful, and <>0 if line can not be fitted.
+ */
+int mtga_perp_line(
+  /** Nr of plot points. */
+  int nr,
+  /** Mean of plot x values. */
+  double mx,
+  /** Mean of plot y values. */
+  double my,
+  /** Sum of squared deviations of x values from their mean. */
+  double qxx,
+  /** Sum of squared deviations of y values from their mean. */
+  double qyy,
+  /** Sum of products of x and y deviations from their means. */
+  double qxy,
+  /** Slope is written here. */
+  double *slope,
+  /** Y axis intercept is written here. */
+  double *ic,
+  /** Sum of squared distances / nr is written here; enter NULL if not needed. */
+  double *ssd
+) {
+  int rnr;
+  double m1, m2, ssd1, ssd2;
+
+  if(slope==NULL || ic==NULL) return(1);
+  *slope=*ic=0.0; if(ssd!=NULL) *ssd=0.0;
+  if(nr<2 || qxx<1.0E-100 || qyy<1.0E-100) return(2);
+  rnr=quadratic(qxy, qxx-qyy, -qxy, &m1, &m2);
+  if(rnr==0) return(3);
+  /* sum of squared distances to the line through the means */
+  ssd1=(m1*m1*qxx-2.0*m1*qxy+qyy)/(m1*m1+1.0);
+  if(rnr==2) ssd2=(m2*m2*qxx-2.0*m2*qxy+qyy)/(m2*m2+1.0); else ssd2=ssd1;
+  if(rnr==2 && ssd2<ssd1) {ssd1=ssd2; m1=m2;}
+  *slope=m1; *ic=my-m1*mx; if(ssd!=NULL) *ssd=ssd1/(double)nr;
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Fits regression lines to a block of MTGA plots at once.
+
+    Plot data is given frame-major as written by patlak_block_data() and
+    logan_block_data(); points where x or y is NaN are not used.
+    The sums over plot points are accumulated for all TACs in the same loop,
+    which the compiler can vectorise, and the lines are then solved in closed
+    form. With method PEARSON the results are those of pearson(): slope, 
+    intercept, SD of slope in sd[], and residual SD of y values in ssd[].
+    With method PERP the results are those of llsqperp(): slope, intercept, 
+    and the sum of squared distances / nr in ssd[]; sd[] is set to zero.
+
+    @sa mtga_best_perp, patlak_block_data, logan_block_data, mtga_perp_line,
+        pearson, llsqperp
+    @return Returns 0 if successful, and <>0 in case of an error. Lines that
+     can not be fitted are marked with nr[j]=0 and zero results.
+ */
+int mtga_block_fit(
+  /** Nr of plot points per TAC. */
+  int data_nr,
+  /** Nr of TACs in the block. */
+  int tac_nr,
+  /** Plot x values, x[fi*tac_nr+j]. */
+  double *x,
+  /** Plot y values, y[fi*tac_nr+j]. */
+  double *y,
+  /** Line fit method; PEARSON or PERP. */
+  linefit_method method,
+  /** Slopes are written here (size tac_nr). */
+  double *slope,
+  /** Y axis intercepts are written here (size tac_nr). */
+  double *ic,
+  /** SD of slopes are written here (size tac_nr); enter NULL if not needed. */
+  double *sd,
+  /** Residuals are written here (size tac_nr); enter NULL if not needed. */
+  double *ssd,
+  /** Nr of plot points used in each fit is written here (size tac_nr). */
+  int *nr,
+  /** Work memory for at least 6*tac_nr doubles. */
+  double *work
+) {
+  int fi, j;
+  double *sn, *sx, *sy, *qxx, *qyy, *qxy, *xr, *yr;
+  double a, b, mx, my, f, e;
+
+  if(data_nr<0 || tac_nr<1 || x==NULL || y==NULL) return(1);
+  if(slope==NULL || ic==NULL || nr==NULL || work==NULL) return(1);
+  if(method!=PEARSON && method!=PERP) return(2);
+
+  sn=work; sx=sn+tac_nr; sy=sx+tac_nr; qxx=sy+tac_nr; qyy=qxx+tac_nr; qxy=qyy+tac_nr;
+  for(j=0; j<6*tac_nr; j++) work[j]=0.0;
+
+  /* Sums and means */
+  for(fi=0; fi<data_nr; fi++) {
+    xr=x+(size_t)fi*tac_nr; yr=y+(size_t)fi*tac_nr;
+    for(j=0; j<tac_nr; j++) {
+      if(isnan(xr[j]) || isnan(yr[j])) continue;
+      sn[j]+=1.0; sx[j]+=xr[j]; sy[j]+=yr[j];
+    }
+  }
+  for(j=0; j<tac_nr; j++) {
+    nr[j]=(int)sn[j];
+    if(nr[j]>0) {slope[j]=sx[j]/sn[j]; ic[j]=sy[j]/sn[j];} // means for now
+    else slope[j]=ic[j]=0.0;
+  }
+  /* Q's based on the means */
+  for(fi=0; fi<data_nr; fi++) {
+    xr=x+(size_t)fi*tac_nr; yr=y+(size_t)fi*tac_nr;
+    for(j=0; j<tac_nr; j++) {
+      if(isnan(xr[j]) || isnan(yr[j])) continue;
+      a=xr[j]-slope[j]; b=yr[j]-ic[j];
+      qxx[j]+=a*a; qyy[j]+=b*b; qxy[j]+=a*b;
+    }
+  }
+
+  /* Solve the lines */
+  for(j=0; j<tac_nr; j++) {
+    mx=slope[j]; my=ic[j];
+    slope[j]=ic[j]=0.0; if(sd!=NULL) sd[j]=0.0; if(ssd!=NULL) ssd[j]=0.0;
+    if(method==PERP) {
+      if(mtga_perp_line(nr[j], mx, my, qxx[j], qyy[j], qxy[j],
+                        slope+j, ic+j, ssd==NULL ? NULL : ssd+j)) nr[j]=0;
+    } else {
+      /* as in pearson() */
+      if(nr[j]<2) {nr[j]=0; continue;}
+      if(nr[j]==2) {
+        if(qxx[j]<1.0E-100) {nr[j]=0; continue;}
+        slope[j]=qxy[j]/qxx[j]; ic[j]=my-slope[j]*mx;
+        continue;
+      }
+      if(qxx[j]<1.0e-50 || qyy[j]<1.0e-50) {nr[j]=0; continue;}
+      slope[j]=qxy[j]/qxx[j];
+      ic[j]=(qxx[j]*sy[j] - sx[j]*qxy[j])/(sn[j]*qxx[j]);
+    }
+  }
+  if(method==PERP || (sd==NULL && ssd==NULL)) return(0);
+
+  /* Residuals of the traditional fit; qyy is not needed anymore */
+  for(j=0; j<tac_nr; j++) qyy[j]=0.0;
+  for(fi=0; fi<data_nr; fi++) {
+    xr=x+(size_t)fi*tac_nr; yr=y+(size_t)fi*tac_nr;
+    for(j=0; j<tac_nr; j++) {
+      if(isnan(xr[j]) || isnan(yr[j])) continue;
+      f=slope[j]*xr[j]+ic[j]-yr[j]; qyy[j]+=f*f;
+    }
+  }
+  for(j=0; j<tac_nr; j++) {
+    if(nr[j]<3) continue;
+    if(qyy[j]<=1.0e-12) e=0.0; else e=sqrt(qyy[j]/(double)(nr[j]-2));
+    if(ssd!=NULL) ssd[j]=e;
+    if(sd!=NULL) sd[j]=e/sqrt(qxx[j]);
+  }
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
@@ -10,25 +10,31 @@
 /** Max iterations for linear minimization inside powell() */
 int POWELL_LINMIN_MAXIT=100;
 /******************************************************************************/
-/* Local variables */
+/* Local data types */
 /// @cond
-int _powell_ncom;
-double _powell_pcom[MAX_PARAMETERS], _powell_xicom[MAX_PARAMETERS];
-double (*_powellFunc)(int, double*, void*);
-void *_powellFuncData;
-int _powell_func_calls;
+/** State of one powell() call; kept on the caller's stack so that
+    simultaneous fits in different threads do not share anything. */
+typedef struct {
+  int ncom;
+  double pcom[MAX_PARAMETERS];
+  double xicom[MAX_PARAMETERS];
+  double (*func)(int, double*, void*);
+  void *funcData;
+  int func_calls;
+} POWELL_STATE;
 /******************************************************************************/
 /* Local functions */
-void _powell_linmin(double *p, double *xi, int n, double *fret, int *itnr);
-double _powell_brent(double ax, double bx, double cx, double tol, double *xmin,
-      int *itnr, int dim);
-double _powell_f1dim(double x, int dim);
-void _powell_mnbrak(double *ax, double *bx, double *cx, double *fa, double *fb,
-      double *fc, int dim);
+static void _powell_linmin(POWELL_STATE *s, double *p, double *xi, int n,
+      double *fret, int *itnr);
+static double _powell_brent(POWELL_STATE *s, double ax, double bx, double cx,
+      double tol, double *xmin, int *itnr, int dim);
+static double _powell_f1dim(POWELL_STATE *s, double x, int dim);
+static void _powell_mnbrak(POWELL_STATE *s, double *ax, double *bx, double *cx,
+      double *fa, double *fb, double *fc, int dim);
 /* Local "inline" functions */
-double _powell_sqr(double x) {return (x*x);}
-void _powell_shft(double *a, double *b, double *c, double *d) {*a=*b; *b=*c; *c=*d;}
-double _powell_fmax(double a, double b) {return((a>b) ? a:b);}
+static double _powell_sqr(double x) {return (x*x);}
+static void _powell_shft(double *a, double *b, double *c, double *d) {*a=*b; *b=*c; *c=*d;}
+static double _powell_fmax(double a, double b) {return((a>b) ? a:b);}
 /// @endcond
 /******************************************************************************/
 
@@ -38,6 +44,9 @@ double _powell_fmax(double a, double b) {return((a>b) ? a:b);}
     2 if initial guess does not give finite function value,
     3 if final function value is NaN or infinite,
     and >3 in case of another error.
+    Optimizer state is local to the call, thus powell() is reentrant and can
+    be run in parallel threads, provided that the objective function does
+    not keep its own state in global variables (pass it in fundata instead).
     @sa simplex, tgo, bobyqa, nlopt1D
  */
 int powell(
@@ -67,6 +76,7 @@ int powell(
   double del, fp, fptt, t;
   double origp[MAX_PARAMETERS];
   int ftol_reached=0;
+  POWELL_STATE st;
 
 
   if(verbose>0) printf("in powell(,,%d,%g,%d,,)\n", parNr, ftol, *iterNr);
@@ -83,13 +93,13 @@ int powell(
   if((*iterNr)<1) return(24);
 
   /* SetUp */
-  _powellFunc=_fun;
-  _powellFuncData=fundata;
+  st.func=_fun;
+  st.funcData=fundata;
   iterMax=*iterNr; /* save the max nr of iterations */
-  _powell_ncom=parNr;
+  st.ncom=parNr;
   /* Function value at initial point */
-  _powell_func_calls=1;
-  *fret=(*_powellFunc)(parNr, p, _powellFuncData);
+  st.func_calls=1;
+  *fret=(*st.func)(parNr, p, st.funcData);
   if(verbose>10) printf("initial point fret=%g\n", *fret);
   if(!isfinite(*fret)) {
     if(verbose>0) printf("in powell(): objf failed at initial point.\n");
@@ -117,7 +127,7 @@ int powell(
       fptt=*fret;
       /* minimize along direction xit */
       pbIterNr=POWELL_LINMIN_MAXIT;
-      _powell_linmin(p, xit, parNr, fret, &pbIterNr);
+      _powell_linmin(&st, p, xit, parNr, fret, &pbIterNr);
       if(verbose>3) printf("iterNr in _powell_linmin() with p%d: %d\n",
                            i, pbIterNr);
       if(fabs(fptt-(*fret))>del) {del=fabs(fptt-(*fret)); ibig=i;}
@@ -141,12 +151,12 @@ int powell(
       ptt[j]=2.0*p[j]-pt[j]; xit[j]=p[j]-pt[j];
       pt[j]=p[j]; /* save the old starting point */
     }
-    fptt=(*_powellFunc)(parNr, ptt, _powellFuncData); _powell_func_calls++;
+    fptt=(*st.func)(parNr, ptt, st.funcData); st.func_calls++;
     if(fptt<fp) {
       t=2.0*(fp-2.0*(*fret)+fptt)*_powell_sqr(fp-(*fret)-del)-del*_powell_sqr(fp-fptt);
       if(t<0.0) {
         pbIterNr=POWELL_LINMIN_MAXIT;
-        _powell_linmin(p, xit, parNr, fret, &pbIterNr);
+        _powell_linmin(&st, p, xit, parNr, fret, &pbIterNr);
         if(verbose>3) printf("iterNr in _powell_linmin(): %d\n", pbIterNr);
         for(j=0; j<parNr; j++) {
           xi[j][ibig]=xi[j][parNr-1]; xi[j][parNr-1]=xit[j];}
@@ -155,7 +165,7 @@ int powell(
   } /* next iteration */
   if(verbose>1) {
     printf("iterNr := %d\n", *iterNr);
-    printf("nr of function calls := %d\n", _powell_func_calls);
+    printf("nr of function calls := %d\n", st.func_calls);
   }
 
   if(isnan(*fret) || !isfinite(*fret)) {
@@ -167,11 +177,11 @@ int powell(
     // if failed, then return initial guess
     for(j=0; j<parNr; j++) p[j]=origp[j];
     // and call function again so that any data saved there is correct
-    *fret=(*_powellFunc)(parNr, p, _powellFuncData);
+    *fret=(*st.func)(parNr, p, st.funcData);
     return(3);
   }
   // and call function again so that any data saved there is correct
-  *fret=(*_powellFunc)(parNr, p, _powellFuncData);
+  *fret=(*st.func)(parNr, p, st.funcData);
   if((*iterNr)>=iterMax) return(1);
   if(verbose>0) printf("out of powell() in good order.\n");
   return(0);
@@ -180,21 +190,22 @@ int powell(
 
 /******************************************************************************/
 /// @cond
-void _powell_linmin(double *p, double *xi, int n, double *fret, int *itnr)
-{
+static void _powell_linmin(
+  POWELL_STATE *s, double *p, double *xi, int n, double *fret, int *itnr
+) {
   int i;
   double xx, xmin, fx, fb, fa, bx, ax;
 
-  _powell_ncom=n;
-  for(i=0; i<n; i++) {_powell_pcom[i]=p[i]; _powell_xicom[i]=xi[i];}
+  s->ncom=n;
+  for(i=0; i<n; i++) {s->pcom[i]=p[i]; s->xicom[i]=xi[i];}
   ax=0.0; xx=1.0;
-  _powell_mnbrak(&ax, &xx, &bx, &fa, &fx, &fb, n);
-  *fret=_powell_brent(ax, xx, bx, 2.0e-4, &xmin, itnr, n);
+  _powell_mnbrak(s, &ax, &xx, &bx, &fa, &fx, &fb, n);
+  *fret=_powell_brent(s, ax, xx, bx, 2.0e-4, &xmin, itnr, n);
   for(i=0; i<n; i++) {xi[i]*=xmin; p[i]+=xi[i];}
 }
 /******************************************************************************/
-double _powell_brent(
-  double ax, double bx, double cx, double tol, double *xmin, int *itnr, int dim
+static double _powell_brent(
+  POWELL_STATE *s, double ax, double bx, double cx, double tol, double *xmin, int *itnr, int dim
 ) {
   //const int ITMAX = 100;
   const double CGOLD = 0.3819660;
@@ -204,7 +215,7 @@ double _powell_brent(
   double e=0.0, tol1, tol2, u, v, w, x, xm;
 
   a=(ax<cx ? ax:cx); b=(ax>cx ? ax:cx); x=w=v=bx;
-  fw=fv=fx=_powell_f1dim(x, dim);
+  fw=fv=fx=_powell_f1dim(s, x, dim);
   iterMax=*itnr;
   for(*itnr=0; *itnr<iterMax; (*itnr)++) {
     xm=0.5*(a+b); tol2=2.0*(tol1=tol*fabs(x)+ZEPS);
@@ -221,7 +232,7 @@ double _powell_brent(
       }
     } else {d=CGOLD*(e=(x>=xm ? a-x:b-x));}
     u=(fabs(d)>=tol1 ? x+d : x+copysign(tol1, d));
-    fu=_powell_f1dim(u, dim);
+    fu=_powell_f1dim(s, u, dim);
     if(fu<=fx) {
       if(u>=x) a=x; else b=x;
       _powell_shft(&v, &w, &x, &u); _powell_shft(&fv, &fw, &fx, &fu);
@@ -235,18 +246,18 @@ double _powell_brent(
   return(fx);
 }
 /******************************************************************************/
-double _powell_f1dim(double x, int dim)
+static double _powell_f1dim(POWELL_STATE *s, double x, int dim)
 {
   int i;
   double f, xt[MAX_PARAMETERS];
 
-  for(i=0; i<_powell_ncom; i++) xt[i]=_powell_pcom[i]+x*_powell_xicom[i];
-  f=(*_powellFunc)(dim, xt, _powellFuncData); _powell_func_calls++;
+  for(i=0; i<s->ncom; i++) xt[i]=s->pcom[i]+x*s->xicom[i];
+  f=(*s->func)(dim, xt, s->funcData); s->func_calls++;
   return(f);
 }
 /******************************************************************************/
-void _powell_mnbrak(
-  double *ax, double *bx, double *cx, double *fa, double *fb,
+static void _powell_mnbrak(
+  POWELL_STATE *s, double *ax, double *bx, double *cx, double *fa, double *fb,
   double *fc, int dim
 ) {
   const double GOLD = 1.618034;
@@ -254,30 +265,30 @@ void _powell_mnbrak(
   const double TINY = 1.0e-20;
   double ulim, u, r, q, fu, dum=0.0;
 
-  *fa=_powell_f1dim(*ax, dim); *fb=_powell_f1dim(*bx, dim);
+  *fa=_powell_f1dim(s, *ax, dim); *fb=_powell_f1dim(s, *bx, dim);
   if(*fb>*fa) {_powell_shft(&dum, ax, bx, &dum); _powell_shft(&dum, fb, fa, &dum);}
-  *cx=(*bx)+GOLD*(*bx-*ax); *fc=_powell_f1dim(*cx, dim);
+  *cx=(*bx)+GOLD*(*bx-*ax); *fc=_powell_f1dim(s, *cx, dim);
   while((*fb)>(*fc)) {
     r=(*bx-*ax)*(*fb-*fc); q=(*bx-*cx)*(*fb-*fa);
     u=(*bx)-((*bx-*cx)*q-(*bx-*ax)*r)/(2.0*copysign(_powell_fmax(fabs(q-r),TINY),q-r));
     ulim=(*bx)+GLIMIT*(*cx-*bx);
     if(((*bx)-u)*(u-(*cx)) > 0.0) {
-      fu=_powell_f1dim(u, dim);
+      fu=_powell_f1dim(s, u, dim);
       if(fu < *fc) {*ax=(*bx); *bx=u; *fa=(*fb); *fb=fu; return;}
       else if(fu > *fb) {*cx=u; *fc=fu; return;}
       u=(*cx)+GOLD*(*cx-*bx);
-      fu=_powell_f1dim(u, dim);
+      fu=_powell_f1dim(s, u, dim);
     } else if((*cx-u)*(u-ulim) > 0.0) {
-      fu=_powell_f1dim(u, dim);
+      fu=_powell_f1dim(s, u, dim);
       if(fu < *fc) {
-        q=*cx+GOLD*(*cx-*bx); r=_powell_f1dim(u, dim);
+        q=*cx+GOLD*(*cx-*bx); r=_powell_f1dim(s, u, dim);
         _powell_shft(bx, cx, &u, &q); _powell_shft(fb, fc, &fu, &r);
       }
     } else if((u-ulim)*(ulim-*cx) >= 0.0) {
-      u=ulim; fu=_powell_f1dim(u, dim);
+      u=ulim; fu=_powell_f1dim(s, u, dim);
     } else {
       u=(*cx)+GOLD*(*cx-*bx);
-      fu=_powell_f1dim(u, dim);
+      fu=_powell_f1dim(s, u, dim);
     }
     _powell_shft(ax, bx, cx, &u); _powell_shft(fa, fb, fc, &fu);
   }
@@ -12,6 +12,9 @@
 ///
 /******************************************************************************/
 #include "libtpcmodel.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 /******************************************************************************/
 #ifndef RAND_MAX
 /** Max nr for random nr generator */
@@ -30,10 +33,43 @@ int TGO_LOCAL_INSIDE = 1;
 /** Local optimization is done using Powell-Brent (0) or Bobyqa (1). */
 int TGO_LOCAL_OPT = 0;
 /******************************************************************************/
-/** Topographical minimization algorithm, that searches the global minimum of 
-    a function using clusterization. Calls a local minimization 
+/// @cond
+/** Objective function(s), their data, and random number source of one
+    TGO run; shared by tgo() and tgoParallel(). */
+typedef struct {
+  /** The object function */
+  double (*objf)(int, double*, void*);
+  /** Batched object function; NULL if not available */
+  void (*objfBatch)(int, int, double*, double*, void*);
+  /** Data to objective function, one for each thread; NULL if not needed */
+  void **objfData;
+  /** Nr of threads, and nr of items in objfData[] */
+  int threadNr;
+  /** Random number generator; NULL to use drand() */
+  MERTWI *mt;
+} TGO_RUN;
+/* Local functions */
+static int tgoRun(
+  TGO_RUN *run, double *lowlim, double *uplim, int dim, int neighNr,
+  double *fmin, double *gmin, int samNr, int tgoNr, int verbose);
+static void tgoEvaluate(
+  TGO_RUN *run, TGO_POINT *p, int *list, int n, int dim, double *buf);
+static int tgoLocalOpt(
+  TGO_RUN *run, TGO_POINT *p, int *list, int n, double *lowlim,
+  double *uplim, int dim, double bxtol, double btol, int bmaxeval,
+  int pitNr, double ptol, int plinmaxit, int verbose);
+static void tgoRandomPoints(
+  TGO_POINT *p, int parNr, int sNr, double *low, double *up, int st,
+  MERTWI *mt);
+/// @endcond
+/******************************************************************************/
+
+/******************************************************************************/
+/** Topographical minimization algorithm, that searches the global minimum of
+    a function using clusterization. Calls a local minimization
     algorithm. Based on an algorithm by Aimo Torn and Sami Viitanen.
     @return Returns 0, if ok.
+    @sa tgoParallel, powell, bobyqa
 */
 int tgo(
   /** Lower limits for the parameters */
@@ -62,14 +98,143 @@ int tgo(
   int tgoNr,
   /** Verbose level; if zero, then nothing is printed into stdout or stderr */
   int verbose
+) {
+  TGO_RUN run;
+
+  if(verbose>0) {printf("in tgo()\n"); fflush(stdout);}
+  if(objf==NULL) return(1);
+  run.objf=objf; run.objfBatch=NULL;
+  run.objfData=&objfData; run.threadNr=1;
+  run.mt=NULL;
+  /* Set seed for random number generator */
+  //srand(15345); srand(time(NULL));
+  drandSeed(1);
+
+  return(tgoRun(&run, lowlim, uplim, dim, neighNr, fmin, gmin, samNr, tgoNr,
+                verbose));
+} /* end tgo */
+/******************************************************************************/
+
+/******************************************************************************/
+/** Parallel version of tgo().
+
+    Object function values of the sampled points are computed with a single
+    call to the batched object function, if given, or otherwise in parallel
+    with objf. Local optimizations from the topographic minima are run
+    in parallel, too.
+
+    Each thread calls the object function with its own data from objfData[],
+    thus objf does not need to be thread-safe for one data item; objfData[0]
+    is used for the batch function and for the final optimization of the best
+    point, therefore any results that objf saves in its data (for example
+    the simulated TAC) are found in objfData[0] when function returns.
+
+    Parameters are sampled with the Mersenne Twister seeded with the given
+    seed, and the local optimizations do not depend on each other,
+    therefore results are the same regardless of the nr of threads.
+    @return Returns 0, if ok.
+    @sa tgo, powell, bobyqa, mertwiInitWithSeed64
+*/
+int tgoParallel(
+  /** Lower limits for the parameters */
+  double *lowlim,
+  /** Upper limits for the parameters */
+  double *uplim,
+  /** The object function */
+  double (*objf)(int, double*, void*),
+  /** The batched object function, which computes the function values for n
+   *  parameter sets, given as n x dim array, into an array of length n;
+   *  NULL if not available. */
+  void (*objfBatch)(int n, int dim, double *par, double *f, void *data),
+  /** Data to objective function, one for each thread; enter NULL if object
+   *  function needs no data, in which case only one thread is used, because
+   *  objf may not be reentrant */
+  void **objfData,
+  /** Nr of items in objfData[], and max nr of threads to use */
+  int objfDataNr,
+  /** Dimension = nr of parameters */
+  int dim,
+  /** Nr of neighbours to investigate */
+  int neighNr,
+  /** Function value at global minimum */
+  double *fmin,
+  /** Global minimum = parameter estimates */
+  double *gmin,
+  /** Nr of points to sample in one iteration */
+  int samNr,
+  /** Nr of TGO iterations; enter 0 to use the default */
+  int tgoNr,
+  /** Seed for the random number generator */
+  uint64_t seed,
+  /** Verbose level; if zero, then nothing is printed into stdout or stderr */
+  int verbose
+) {
+  TGO_RUN run;
+  MERTWI mt;
+
+  if(verbose>0) {printf("in tgoParallel()\n"); fflush(stdout);}
+  if(objf==NULL) return(1);
+  if(objfData!=NULL && objfDataNr<1) return(1);
+  run.objf=objf; run.objfBatch=objfBatch;
+  if(objfData!=NULL) {
+    run.objfData=objfData; run.threadNr=objfDataNr;
+  } else {
+    run.objfData=NULL; run.threadNr=1;
+  }
+  if(run.threadNr<1) run.threadNr=1;
+  mertwiInit(&mt); mertwiInitWithSeed64(&mt, seed);
+  run.mt=&mt;
+  if(verbose>1) printf("threadNr := %d\n", run.threadNr);
+
+  return(tgoRun(&run, lowlim, uplim, dim, neighNr, fmin, gmin, samNr, tgoNr,
+                verbose));
+} /* end tgoParallel */
+/******************************************************************************/
+
+/******************************************************************************/
+/// @cond
+/** Object function data for the calling thread; thread nr is used only
+    inside the parallel regions of TGO, elsewhere enter serial=1. */
+static void *tgoThreadData(TGO_RUN *run, int serial)
+{
+  if(run->objfData==NULL) return(NULL);
+#ifdef _OPENMP
+  if(!serial) return(run->objfData[omp_get_thread_num()]);
+#endif
+  return(run->objfData[0]);
+}
+/******************************************************************************/
+/** The TGO algorithm used by tgo() and tgoParallel().
+    @return Returns 0, if ok.
+ */
+static int tgoRun(
+  /** Object function and random number generator */
+  TGO_RUN *run,
+  /** Lower limits for the parameters */
+  double *lowlim,
+  /** Upper limits for the parameters */
+  double *uplim,
+  /** Dimension = nr of parameters */
+  int dim,
+  /** Nr of neighbours to investigate */
+  int neighNr,
+  /** Function value at global minimum */
+  double *fmin,
+  /** Global minimum = parameter estimates */
+  double *gmin,
+  /** Nr of points to sample in one iteration */
+  int samNr,
+  /** Nr of TGO iterations */
+  int tgoNr,
+  /** Verbose level */
+  int verbose
 ) {
   int i, j, k, l, IDmin, itNr, samplNr, topoNr, badNr, nevals=0, ret;
-  double *delta, temp, min, *tempp, deltaf, tol;
+  double *delta, temp, min, *tempp, deltaf, tol, *batch=NULL;
   TGO_POINT *sampled_points;
-  int fixed_n, fitted_n;
+  int fixed_n, fitted_n, listNr, *list;
 
 
-  if(verbose>0) {printf("in tgo()\n"); fflush(stdout);}
   if(TGO_LOCAL_OPT==1) {
     if(verbose>0) printf("local optimization routine: bobyqa\n");
   } else {
@@ -77,7 +242,7 @@ int tgo(
   }
 
   /* Check input */
-  if(lowlim==NULL || uplim==NULL || objf==NULL || dim<=0) return(1);
+  if(lowlim==NULL || uplim==NULL || dim<=0) return(1);
   if(fmin==NULL || gmin==NULL) return(1);
 
   /* Check if any of parameters is fixed */
@@ -96,7 +261,7 @@ int tgo(
     printf("neighNr := %d\n", neighNr);
     printf("tgoNr := %d\n", tgoNr);
     if(verbose>2) {
-      printf("iTGO limits: [%g,%g]", 1.0, 1.0);     
+      printf("iTGO limits: [%g,%g]", 1.0, 1.0);
       printf("iTGO limits: [%g,%g]", lowlim[0], uplim[0]);
       for(i=1; i<dim; i++) printf(" [%g,%g]", lowlim[i], uplim[i]);
       printf("\n");
@@ -106,7 +271,7 @@ int tgo(
 #endif
     fflush(stdout);
   }
-  
+
   /* Allocate memory */
   sampled_points=(TGO_POINT*)calloc(samplNr, sizeof(TGO_POINT));
   if(sampled_points==NULL) return(2);
@@ -116,34 +281,36 @@ int tgo(
   }
   delta=(double*)malloc(dim*sizeof(double));
   tempp=(double*)malloc(samplNr*sizeof(double));
-  if(delta==NULL || tempp==NULL) {free(sampled_points); return(2);}
-
-  /* Set seed for random number generator */
-  //srand(15345); srand(time(NULL));
-  drandSeed(1);
+  list=(int*)malloc(samplNr*sizeof(int));
+  if(run->objfBatch!=NULL)
+    batch=(double*)malloc(samplNr*(dim+1)*sizeof(double));
+  if(delta==NULL || tempp==NULL || list==NULL ||
+     (run->objfBatch!=NULL && batch==NULL))
+  {
+    free(sampled_points); free(delta); free(tempp); free(list); free(batch);
+    return(2);
+  }
 
   /*
    *  Iterative TGO, or non-iterative if tgoNr==1
    */
-  for(l=0; l<tgoNr; l++) {  
+  for(l=0; l<tgoNr; l++) {
     if(verbose>2) {printf("TGO Loop # %d: \n", l+1); fflush(stdout);}
 
     /*
      *  Sample N points in the feasible region and compute the object function
      *  values for those points which do not already have it.
      */
-    // printf("help! \n");
-    if(TGO_SQUARED_TRANSF==1)
-      tgoRandomParametersST(sampled_points, dim, samplNr, lowlim, uplim);
-    else
-      tgoRandomParameters(sampled_points, dim, samplNr, lowlim, uplim);
+    tgoRandomPoints(sampled_points, dim, samplNr, lowlim, uplim,
+                    TGO_SQUARED_TRANSF, run->mt);
 
-    // printf("help! \n");
+    for(i=listNr=0; i<samplNr; i++)
+      if(sampled_points[i].topomin==0) list[listNr++]=i;
+    tgoEvaluate(run, sampled_points, list, listNr, dim, batch);
     badNr=0;
-    for(i=0; i<samplNr; i++) if(sampled_points[i].topomin==0) {     
-      sampled_points[i].fvalue=objf(dim, sampled_points[i].par, objfData);
-    //  printf("help! \n");
-      /* If function return value was not normal then we'll try 
+    for(j=0; j<listNr; j++) {
+      i=list[j];
+      /* If function return value was not normal then we'll try
          later (twice) with new guesses */
       if(!isfinite(sampled_points[i].fvalue)) {
         badNr++;
@@ -160,17 +327,17 @@ int tgo(
     /* New guesses for bad points */
     k=0; while(k<2 && badNr>0) {
       badNr=0; k++;
-      for(i=0; i<samplNr; i++) 
+      for(i=listNr=0; i<samplNr; i++)
         if(sampled_points[i].topomin==0 && !isfinite(sampled_points[i].fvalue)) {
           /* sample a new random point */
-          if(TGO_SQUARED_TRANSF==1)
-            tgoRandomParametersST(sampled_points+i, dim, 1, lowlim, uplim);
-          else
-            tgoRandomParameters(sampled_points+i, dim, 1, lowlim, uplim);
-          /* compute the object function value for that */
-          sampled_points[i].fvalue=objf(dim, sampled_points[i].par, objfData);
-          if(!isfinite(sampled_points[i].fvalue)) badNr++;
+          tgoRandomPoints(sampled_points+i, dim, 1, lowlim, uplim,
+                          TGO_SQUARED_TRANSF, run->mt);
+          list[listNr++]=i;
         }
+      /* compute the object function values for those */
+      tgoEvaluate(run, sampled_points, list, listNr, dim, batch);
+      for(j=0; j<listNr; j++)
+        if(!isfinite(sampled_points[list[j]].fvalue)) badNr++;
       if(verbose>4 && badNr>0) printf("Nr of bad points: %d\n", badNr);
     }
 
@@ -185,19 +352,18 @@ int tgo(
       }
        fflush(stdout);
     }
-  // printf("hi %d %d %d",samplNr,badNr,neighNr );
     /* Object functions values must be good for at least NeigNr points */
     if(l==0 && (samplNr-badNr)<=neighNr) {
       if(verbose>0) {
         printf("Error in TGO: invalid function return value from all points.\n");
         fflush(stdout);
       }
-      free(sampled_points); free(delta); free(tempp);
+      free(sampled_points); free(delta); free(tempp); free(list); free(batch);
       return(3);
     }
 
     /*
-     *  For each point i find out if it is a "topografic minimum" 
+     *  For each point i find out if it is a "topografic minimum"
      *  = better than k neighbour points
      */
     /* Save the distances to point i in the vector tempp */
@@ -227,7 +393,7 @@ int tgo(
       /* Find the closest neighbours */
       /* At the same time, collect info for max fvalue of the neighbours
          and for the mean distance to every direction */
-      for(k=0; k<dim; k++) sampled_points[i].delta[k]=0.0; // Init delta array 
+      for(k=0; k<dim; k++) sampled_points[i].delta[k]=0.0; // Init delta array
       sampled_points[i].fvalrange=sampled_points[i].fvalue;
       for(j=0; j<neighNr; j++) {
         min=tempp[0]; IDmin=0;
@@ -235,14 +401,14 @@ int tgo(
         tempp[IDmin]=1e+99; // so that this will not be used again
         /* If point i is worse than any of the closest neighbours, then
            point i is not a topographic minimum; then stop this loop and go to
-           the next point i+1 */	  
+           the next point i+1 */
         if(isfinite(sampled_points[IDmin].fvalue) &&
           sampled_points[IDmin].fvalue<sampled_points[i].fvalue) break;
 
         /* Sum the distances to every direction for delta calculation */
         for(k=0; k<dim; k++)
           sampled_points[i].delta[k]+=
-            fabs(sampled_points[i].par[k]-sampled_points[IDmin].par[k]); 
+            fabs(sampled_points[i].par[k]-sampled_points[IDmin].par[k]);
         if(isfinite(sampled_points[IDmin].fvalue) &&
            sampled_points[IDmin].fvalue>sampled_points[i].fvalrange)
           sampled_points[i].fvalrange=sampled_points[IDmin].fvalue;
@@ -272,15 +438,15 @@ int tgo(
       sampled_points[IDmin].topomin=1;
       for(k=0; k<dim; k++)
         sampled_points[IDmin].delta[k]=0.1*(uplim[k]-lowlim[k]);
-      sampled_points[i].fvalrange+=100.0*fabs(sampled_points[i].fvalue);
+      sampled_points[IDmin].fvalrange+=100.0*fabs(sampled_points[IDmin].fvalue);
       if(verbose>2) {
-        printf("  ; therefore minimum was set to point %d at %e\n", 
+        printf("  ; therefore minimum was set to point %d at %e\n",
           IDmin, sampled_points[IDmin].fvalue);
          fflush(stdout);
       }
       topoNr=1;
     }
-    if(verbose>3) { // Print the best TM 
+    if(verbose>3) { // Print the best TM
       for(i=0, min=1e+99, IDmin=0; i<samplNr; i++)
         if(sampled_points[i].topomin==1) {
           if(isfinite(sampled_points[i].fvalue) && sampled_points[i].fvalue<min)
@@ -296,45 +462,13 @@ int tgo(
     if(TGO_LOCAL_INSIDE==1) {
       /* Local optimization for each TM */
       if(verbose>2) printf("local optimization for each TM\n");
-      for(i=0; i<samplNr; i++) if(sampled_points[i].topomin==1) {
-        //tol=sampled_points[IDmin].fvalue*1.0E-02;
-        //for(k=0; k<dim; k++) delta[k]=sampled_points[i].delta[k];
-        for(k=0; k<dim; k++) delta[k]=0.1*sampled_points[i].delta[k];
-        if(verbose>3) printf("point %d: original fvalue=%.2e\n",
-                             i+1, sampled_points[i].fvalue);
-        if(TGO_LOCAL_OPT==1) {
-          tol=1.0E-08; //tol=1.0E-09;
-          ret=bobyqa(dim, 0, sampled_points[i].par, lowlim, uplim, delta, 0.0, 1.0E-03, 
-                     1.0E-10, tol, tol, 2000, &nevals, 
-                     &sampled_points[i].fvalue, objf, objfData, NULL, verbose-3);
-          if(ret<0 && verbose>0) {
-            printf("bobyqa error %d\n", ret); fflush(stdout);}
-          if(ret<0 && ret!=BOBYQA_ROUNDOFF_LIMITED) {
-            free(sampled_points); free(delta); free(tempp);
-            return(5);
-          }
-          if(verbose>3) {
-            printf("  local opt => %.2e (nr of evals=%d)\n",
-                   sampled_points[i].fvalue, nevals);
-            fflush(stdout);
-          }
-        } else {
-          itNr=40; //itNr=100;
-          tol=1.0E-03; //tol=2.0E-03; //tol=1.0E-09;
-          POWELL_LINMIN_MAXIT=30; // 100;
-          ret=powell(sampled_points[i].par, delta, dim, tol, &itNr,
-                     &sampled_points[i].fvalue, objf, objfData, verbose-3);
-          if(ret>1 && verbose>0) {printf("powell error %d\n", ret); fflush(stdout);}
-          if(ret>3) {
-            free(sampled_points); free(delta); free(tempp);
-            return(5);
-          }
-          if(verbose>3) {
-            printf("  local opt => %.2e (itNr=%d)\n",
-                   sampled_points[i].fvalue, itNr);
-            fflush(stdout);
-          }
-        }
+      for(i=listNr=0; i<samplNr; i++)
+        if(sampled_points[i].topomin==1) list[listNr++]=i;
+      ret=tgoLocalOpt(run, sampled_points, list, listNr, lowlim, uplim, dim,
+                      1.0E-03, 1.0E-08, 2000, 40, 1.0E-03, 30, verbose);
+      if(ret!=0) {
+        free(sampled_points); free(delta); free(tempp); free(list); free(batch);
+        return(5);
       }
     } // end of local optimizations inside this iTGO loop
 
@@ -355,52 +489,20 @@ int tgo(
     }
   }
 
-  if(TGO_LOCAL_INSIDE==0) { 
+  for(i=listNr=0; i<samplNr; i++)
+    if(sampled_points[i].topomin==1) list[listNr++]=i;
+
+  if(TGO_LOCAL_INSIDE==0) {
     /*
      *  Use the points in TM as starting points for local optimization;
-     *  this first local opt is done only if not done already inside iTGO 
+     *  this first local opt is done only if not done already inside iTGO
      */
     if(verbose>2) {printf("Topographic minima:\n"); fflush(stdout);}
-    for(i=0; i<samplNr; i++) if(sampled_points[i].topomin==1) {
-      //tol=sampled_points[IDmin].fvalue*1.0E-02;
-      for(k=0; k<dim; k++) {
-        if(verbose>2) {printf("%e ", sampled_points[i].par[k]); fflush(stdout);}
-        delta[k]=0.1*sampled_points[i].delta[k];
-      }
-      if(verbose>3) {printf("=> %e ", sampled_points[i].fvalue); fflush(stdout);}
-      if(TGO_LOCAL_OPT==1) {
-        tol=1.0E-09; //tol=1.0E-09;
-        ret=bobyqa(dim, 0, sampled_points[i].par, lowlim, uplim, delta, 0.0, 1.0E-03, 
-                   1.0E-10, tol, tol, 2000, &nevals, 
-                   &sampled_points[i].fvalue, objf, objfData, NULL, verbose-3);
-        if(ret<0 && verbose>0) {
-          printf("bobyqa error %d\n", ret); fflush(stdout);}
-        if(ret<0 && ret!=BOBYQA_ROUNDOFF_LIMITED) {
-          free(sampled_points); free(delta); free(tempp);
-          return(5);
-        }
-        if(verbose>2) {
-          printf("local opt 1st round point %d => %e (nr of evals=%d)\n",
-            i+1, sampled_points[i].fvalue, nevals);
-          fflush(stdout);
-        }
-      } else {
-        itNr=50; //itNr=100; 
-        tol=1.0E-03; //tol=1.0E-04;
-        POWELL_LINMIN_MAXIT=60; // POWELL_LINMIN_MAXIT=50; // 100;
-        ret=powell(sampled_points[i].par, delta, dim, tol, &itNr,
-                 &sampled_points[i].fvalue, objf, objfData, verbose-3);
-        if(ret>1 && verbose>0) {printf("powell error %d\n", ret); fflush(stdout);}
-        if(ret>3) {
-          if(verbose>0) {printf("powell error %d\n", ret); fflush(stdout);}
-          free(sampled_points); free(delta); free(tempp);
-          return(5);
-        }
-        if(verbose>2) {
-          printf("=> %e (itNr=%d) ", sampled_points[i].fvalue, itNr);
-          fflush(stdout);
-        }
-      }
+    ret=tgoLocalOpt(run, sampled_points, list, listNr, lowlim, uplim, dim,
+                    1.0E-03, 1.0E-09, 2000, 50, 1.0E-03, 60, verbose);
+    if(ret!=0) {
+      free(sampled_points); free(delta); free(tempp); free(list); free(batch);
+      return(5);
     }
     if(verbose>0) { // Print the topographical minima after local optimization
       printf("Final topographical minima after local optimization\n");
@@ -413,41 +515,11 @@ int tgo(
   }
 
   /* Rerun of local optimization with smaller tolerance and delta */
-  for(i=0; i<samplNr; i++) if(sampled_points[i].topomin==1) {
-    //tol=sampled_points[IDmin].fvalue*1.0E-04;
-    for(k=0; k<dim; k++) delta[k]=0.1*sampled_points[i].delta[k];
-    if(TGO_LOCAL_OPT==1) {
-      tol=1.0E-10;
-      ret=bobyqa(dim, 0, sampled_points[i].par, lowlim, uplim, delta, 0.0, 1.0E-05, 
-                 1.0E-10, tol, tol, 1000, &nevals, 
-                 &sampled_points[i].fvalue, objf, objfData, NULL, verbose-3);
-      if(ret<0 && verbose>0) {
-        printf("bobyqa error %d\n", ret); fflush(stdout);}
-      if(ret<0 && ret!=BOBYQA_ROUNDOFF_LIMITED) {
-        free(sampled_points); free(delta); free(tempp);
-        return(5);
-      }
-      if(verbose>2) {
-        printf("local opt 2nd round point %d => %e (nr of evals=%d)\n",
-          i+1, sampled_points[i].fvalue, nevals);
-        fflush(stdout);
-      }
-    } else {
-      itNr=40; /*itNr=100;*/
-      tol=1.0E-04; //tol=1.0E-03; //tol=1.0E-08;
-      POWELL_LINMIN_MAXIT=60; // 100;
-      ret=powell(sampled_points[i].par, delta, dim, tol, &itNr,
-               &sampled_points[i].fvalue, objf, objfData, verbose-3);
-      if(ret>1 && verbose>0) {printf("powell error %d\n", ret); fflush(stdout);}
-      if(ret>3) {
-        free(sampled_points); free(delta); free(tempp);
-        return(6);
-      }
-      if(verbose>2) {
-        printf("=> %e (itNr=%d)\n", sampled_points[i].fvalue, itNr); 
-        fflush(stdout);
-      }
-    }
+  ret=tgoLocalOpt(run, sampled_points, list, listNr, lowlim, uplim, dim,
+                  1.0E-05, 1.0E-10, 1000, 40, 1.0E-04, 60, verbose);
+  if(ret!=0) {
+    free(sampled_points); free(delta); free(tempp); free(list); free(batch);
+    if(ret==1) return(5); else return(6);
   }
 
   if(verbose>0) { // Print the topographical minima after 2nd local optimization
@@ -472,7 +544,7 @@ int tgo(
   if(verbose>1) {
     printf("Best topographical minimum:");
     for(k=0; k<dim; k++) printf("%e ", sampled_points[IDmin].par[k]);
-    printf("-> %e \n", sampled_points[IDmin].fvalue); fflush(stdout); 
+    printf("-> %e \n", sampled_points[IDmin].fvalue); fflush(stdout);
   }
 
   /* Rerun of local optimization to the best point */
@@ -481,13 +553,14 @@ int tgo(
     for(k=0; k<dim; k++) delta[k]=deltaf*sampled_points[IDmin].delta[k];
     //for(k=0; k<dim; k++) delta[k]=deltaf*(uplim[k]-lowlim[k]);
     if(TGO_LOCAL_OPT==1) {
-      ret=bobyqa(dim, 0, sampled_points[IDmin].par, lowlim, uplim, delta, 0.0, tol, // !!! 
-                 1.0E-10, tol, tol, 5000, &nevals, 
-                 &sampled_points[IDmin].fvalue, objf, objfData, NULL, verbose-3);
+      ret=bobyqa(dim, 0, sampled_points[IDmin].par, lowlim, uplim, delta, 0.0, tol, // !!!
+                 1.0E-10, tol, tol, 5000, &nevals,
+                 &sampled_points[IDmin].fvalue, run->objf, tgoThreadData(run, 1),
+                 NULL, verbose-3);
       if(ret<0 && verbose>0) {
         printf("bobyqa error %d\n", ret); fflush(stdout);}
       if(ret<0 && ret!=BOBYQA_ROUNDOFF_LIMITED) {
-        free(sampled_points); free(delta); free(tempp);
+        free(sampled_points); free(delta); free(tempp); free(list); free(batch);
         return(5);
       }
       if(verbose>2) {
@@ -501,10 +574,11 @@ int tgo(
       itNr=100;
       POWELL_LINMIN_MAXIT=100; // 100;
       ret=powell(sampled_points[IDmin].par, delta, dim, tol, &itNr,
-                 &sampled_points[IDmin].fvalue, objf, objfData, verbose-3);
+                 &sampled_points[IDmin].fvalue, run->objf, tgoThreadData(run, 1),
+                 verbose-3);
       if(ret>1 && verbose>0) {printf("powell error %d\n", ret); fflush(stdout);}
       if(ret>3) {
-        free(sampled_points); free(delta); free(tempp);
+        free(sampled_points); free(delta); free(tempp); free(list); free(batch);
         return(7);
       }
       if(verbose>1) {
@@ -525,45 +599,191 @@ int tgo(
   if(!isfinite(sampled_points[IDmin].fvalue)) {
     if(verbose>0) {printf("TGO error: valid minimum value was not reached.\n");
     fflush(stdout);}
-    free(sampled_points); free(delta); free(tempp); return(9);
+    free(sampled_points); free(delta); free(tempp); free(list); free(batch);
+    return(9);
   }
 
   /* Exit TGO */
-  free(sampled_points); free(delta); free(tempp);
+  free(sampled_points); free(delta); free(tempp); free(list); free(batch);
   if(verbose>0) {printf("out of tgo\n"); fflush(stdout);}
   return(0);
-} /* end tgo */
+}
 /******************************************************************************/
-
+/** Compute the object function values for the listed points, with the
+    batched object function if available, otherwise in parallel if more
+    than one thread is set. */
+static void tgoEvaluate(
+  /** Object function */
+  TGO_RUN *run,
+  /** TGO points */
+  TGO_POINT *p,
+  /** Indices of the points to compute */
+  int *list,
+  /** Nr of indices in the list */
+  int n,
+  /** Nr of parameters */
+  int dim,
+  /** Work space of size samplNr*(dim+1), needed with batched function */
+  double *buf
+) {
+  int i, k;
+
+  if(n<1) return;
+  if(run->objfBatch!=NULL) {
+    double *par=buf, *f=buf+n*dim;
+    for(i=0; i<n; i++) for(k=0; k<dim; k++) par[i*dim+k]=p[list[i]].par[k];
+    run->objfBatch(n, dim, par, f, tgoThreadData(run, 1));
+    for(i=0; i<n; i++) p[list[i]].fvalue=f[i];
+    return;
+  }
+#pragma omp parallel for num_threads(run->threadNr) if(run->threadNr>1) schedule(static)
+  for(i=0; i<n; i++)
+    p[list[i]].fvalue=run->objf(dim, p[list[i]].par, tgoThreadData(run, 0));
+}
 /******************************************************************************/
-/** Create randomized parameters for TGO */
-void tgoRandomParameters(
+/** Local optimization starting from each listed point, in parallel if more
+    than one thread is set. Optimizations are independent of each other,
+    therefore the results do not depend on the nr of threads.
+    @return Returns 0 if ok, 1 if bobyqa failed, and 2 if powell failed.
+ */
+static int tgoLocalOpt(
+  /** Object function */
+  TGO_RUN *run,
+  /** TGO points; delta[] is used to set the initial step */
+  TGO_POINT *p,
+  /** Indices of the points to optimize */
+  int *list,
+  /** Nr of indices in the list */
+  int n,
+  /** Lower limits for the parameters */
+  double *lowlim,
+  /** Upper limits for the parameters */
+  double *uplim,
+  /** Nr of parameters */
+  int dim,
+  /** Relative parameter tolerance for bobyqa */
+  double bxtol,
+  /** Function value tolerance for bobyqa */
+  double btol,
+  /** Max nr of function evaluations in bobyqa */
+  int bmaxeval,
+  /** Max nr of iterations in powell */
+  int pitNr,
+  /** Function value tolerance for powell */
+  double ptol,
+  /** Max nr of iterations for linear minimization inside powell */
+  int plinmaxit,
+  /** Verbose level */
+  int verbose
+) {
+  int li, err=0;
+
+  if(TGO_LOCAL_OPT!=1) POWELL_LINMIN_MAXIT=plinmaxit;
+#pragma omp parallel for num_threads(run->threadNr) if(run->threadNr>1) \
+  schedule(dynamic) reduction(max:err)
+  for(li=0; li<n; li++) {
+    int i=list[li], k, ret, nevals=0, itNr;
+    double delta[MAX_PARAMS];
+
+    //for(k=0; k<dim; k++) delta[k]=p[i].delta[k];
+    for(k=0; k<dim; k++) delta[k]=0.1*p[i].delta[k];
+    if(verbose>3) printf("point %d: original fvalue=%.2e\n", i+1, p[i].fvalue);
+    if(TGO_LOCAL_OPT==1) {
+      ret=bobyqa(dim, 0, p[i].par, lowlim, uplim, delta, 0.0, bxtol,
+                 1.0E-10, btol, btol, bmaxeval, &nevals,
+                 &p[i].fvalue, run->objf, tgoThreadData(run, 0), NULL, verbose-3);
+      if(ret<0 && verbose>0) {printf("bobyqa error %d\n", ret); fflush(stdout);}
+      if(ret<0 && ret!=BOBYQA_ROUNDOFF_LIMITED) {if(err<1) err=1; continue;}
+      if(verbose>3) {
+        printf("  local opt of point %d => %.2e (nr of evals=%d)\n",
+               i+1, p[i].fvalue, nevals);
+        fflush(stdout);
+      }
+    } else {
+      itNr=pitNr;
+      ret=powell(p[i].par, delta, dim, ptol, &itNr,
+                 &p[i].fvalue, run->objf, tgoThreadData(run, 0), verbose-3);
+      if(ret>1 && verbose>0) {printf("powell error %d\n", ret); fflush(stdout);}
+      if(ret>3) {err=2; continue;}
+      if(verbose>3) {
+        printf("  local opt of point %d => %.2e (itNr=%d)\n",
+               i+1, p[i].fvalue, itNr);
+        fflush(stdout);
+      }
+    }
+  }
+  return(err);
+}
+/******************************************************************************/
+/** Random number in [0,1) from Mersenne Twister, or from drand() if mt
+    is NULL. */
+static double tgoDrand(MERTWI *mt)
+{
+  if(mt==NULL) return(drand());
+  return(mertwiRandomDouble2(mt));
+}
+/******************************************************************************/
+/** Create randomized parameters for TGO points that are not topographic
+    minima, either with even distribution or with square-root transformation.
+ */
+static void tgoRandomPoints(
   /** Pointer to list of TGO points */
   TGO_POINT *p,
   /** Nr of parameters in the point */
   int parNr,
   /** Nr of TGO points */
   int sNr,
-  /** List of lower limits for each parameter. */ 
+  /** List of lower limits for each parameter. */
   double *low,
-  /** List of upper limits for each parameter. */ 
-  double *up
+  /** List of upper limits for each parameter. */
+  double *up,
+  /** Square-root transformation (1) or even distribution (0) */
+  int st,
+  /** Random number generator; NULL to use drand() */
+  MERTWI *mt
 ) {
   int i, j;
-  double dif;
+  double v, stl, stu, dif;
 
   for(j=0; j<parNr; j++) {
     dif=up[j]-low[j];
     if(dif<=0.0) {
       for(i=0; i<sNr; i++) if(p[i].topomin==0) p[i].par[j]=low[j];
-    } else {
+    } else if(st!=1) {
       for(i=0; i<sNr; i++) if(p[i].topomin==0) {
         //p[i].par[j]=((double)rand()/(double)RAND_MAX) * dif + low[j];
-        p[i].par[j]= drand()*dif + low[j];
+        p[i].par[j]= tgoDrand(mt)*dif + low[j];
+      }
+    } else {
+      stl=copysign(sqrt(fabs(low[j])),low[j]); if(!isnormal(stl)) stl=0.0;
+      stu=copysign(sqrt(fabs(up[j])), up[j]); if(!isnormal(stu)) stu=0.0;
+      dif=stu-stl;
+      for(i=0; i<sNr; i++) if(p[i].topomin==0) {
+        v=tgoDrand(mt)*dif + stl;
+        p[i].par[j]=copysign(v*v, v);
       }
     }
   }
 }
+/// @endcond
+/******************************************************************************/
+
+/******************************************************************************/
+/** Create randomized parameters for TGO */
+void tgoRandomParameters(
+  /** Pointer to list of TGO points */
+  TGO_POINT *p,
+  /** Nr of parameters in the point */
+  int parNr,
+  /** Nr of TGO points */
+  int sNr,
+  /** List of lower limits for each parameter. */ 
+  double *low,
+  /** List of upper limits for each parameter. */ 
+  double *up
+) {
+  tgoRandomPoints(p, parNr, sNr, low, up, 0, NULL);
+}
 /******************************************************************************/
 /** Create randomized parameters for TGO with square-root transformation,
  *  that is, parameter distribution is biased towards low absolute value. */
@@ -579,23 +799,7 @@ void tgoRandomParametersST(
   /** List of upper limits for each parameter. */ 
   double *up
 ) {
-  int i, j;
-  double v, stl, stu, dif;
-
-  for(j=0; j<parNr; j++) {
-    dif=up[j]-low[j];
-    if(dif<=0.0) {
-      for(i=0; i<sNr; i++) if(p[i].topomin==0) p[i].par[j]=low[j];
-    } else {
-      stl=copysign(sqrt(fabs(low[j])),low[j]); if(!isnormal(stl)) stl=0.0;
-      stu=copysign(sqrt(fabs(up[j])), up[j]); if(!isnormal(stu)) stu=0.0;
-      dif=stu-stl;
-      for(i=0; i<sNr; i++) if(p[i].topomin==0) {
-        v=drand()*dif + stl;
-        p[i].par[j]=copysign(v*v, v);
-      }
-    }
-  }
+  tgoRandomPoints(p, parNr, sNr, low, up, 1, NULL);
 }
 /******************************************************************************/
 
@@ -0,0 +1,592 @@
+/// @file img_bfm.c
+/// @brief Functions for computing pixel-by-pixel the basis function
+///        method (BFM) fits of SRTM, 1TCM and irreversible 2TCM.
+///
+/*****************************************************************************/
+
+/*****************************************************************************/
+#include "libtpcmodext.h"
+/*****************************************************************************/
+
+/*****************************************************************************/
+/* Models supported by bfm_fit_image() */
+#define BFM_SRTM     0
+#define BFM_1TCM     1
+#define BFM_IRR2TCM  2
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Converts the linear coefficients of the best basis function into model
+    parameters. Coefficient x[0] belongs to the basis function, and x[1..]
+    to the fixed columns in the order they were given to bfm_fit_image().
+ */
+static void bfm_parameters(
+  /** BFM_SRTM, BFM_1TCM or BFM_IRR2TCM. */
+  int model,
+  /** Rate constant of the basis function. */
+  double theta,
+  /** Fitted coefficients. */
+  double *x,
+  /** Nr of fitted coefficients. */
+  int n,
+  /** Model parameters are written here. */
+  double *par
+) {
+  switch(model) {
+    case BFM_SRTM: /* Ct = R1*Cr + theta2*(Cr (x) exp(-theta3*t)) */
+      par[0]=x[1];
+      par[1]=x[0]+x[1]*theta;
+      if(theta>0.0) par[2]=par[1]/theta-1.0; else par[2]=0.0;
+      break;
+    case BFM_1TCM: /* Ct = K1*(Ca (x) exp(-k2*t)) + Va*Ca */
+      par[0]=x[0];
+      par[1]=theta;
+      if(n>1) par[2]=x[1]; else par[2]=0.0;
+      break;
+    case BFM_IRR2TCM: /* Ct = K1*k2/theta*(Ca (x) exp(-theta*t)) + Ki*AUC(Ca) + Va*Ca */
+      par[0]=x[1];
+      par[1]=x[0]+x[1];
+      par[2]=theta;
+      if(n>2) par[3]=x[2]; else par[3]=0.0;
+      break;
+  }
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Fits the basis functions to all pixel TACs of a dynamic image.
+
+    For each basis function i the design matrix [B_i, fix_1, ..., fix_k],
+    weighted with the square roots of frame weights, is QR factorised once.
+    Then each image row is processed as one block: for each basis function
+    the least squares solution and residual sum of squares of all pixels
+    in the row are computed with that factorisation, and the basis with the
+    lowest residual is kept per pixel. If non-negativity is required and
+    the QR solution has a negative coefficient, the same basis is solved
+    with NNLS instead. Rows are distributed over threads when compiled
+    with OpenMP.
+
+    @sa img_srtm_bfm, img_1tcm_bfm, img_irr2tcm_bfm, qr_decomp, qr_solve, nnls
+    @return Returns 0 if successful, and >0 in case of an error.
+ */
+static int bfm_fit_image(
+  /** Dynamic PET image. */
+  IMG *dyn_img,
+  /** Nr of frames included in the fit. */
+  int frame_nr,
+  /** Basis functions at PET frames; basis rate constants in size fields. */
+  DFT *bf,
+  /** Nr of fixed columns. */
+  int fixNr,
+  /** Fixed columns of the design matrix at PET frames. */
+  double **fix,
+  /** Require non-negative coefficients (1) or not (0). */
+  int nonneg,
+  /** BFM_SRTM, BFM_1TCM or BFM_IRR2TCM. */
+  int model,
+  /** Parameter images, allocated by the caller; NULL if not needed. */
+  IMG **par_img,
+  /** Nr of parameter images. */
+  int parNr,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose
+) {
+  int M=frame_nr, N=1+fixNr, bfNr=bf->voiNr;
+  int bi, m, n, ret, fail=0;
+  double *sw, *qrmem, *amem, *tau, **qr, *chain, *ccmem, **cchain;
+
+
+  if(verbose>0) printf("%s(dyn_img, %d, bf, %d, fix, %d, %d, par_img, %d)\n",
+    __func__, frame_nr, fixNr, nonneg, model, parNr);
+  if(bfNr<1 || M<=N || M>bf->frameNr) return(1);
+
+  /* Square roots of frame weights, and work space for factorisation */
+  sw=(double*)malloc(M*sizeof(double));
+  qrmem=(double*)malloc(bfNr*M*N*sizeof(double));
+  amem=(double*)malloc(bfNr*M*N*sizeof(double));
+  tau=(double*)malloc(bfNr*N*sizeof(double));
+  qr=(double**)malloc(bfNr*M*sizeof(double*));
+  chain=(double*)malloc(2*M*sizeof(double));
+  ccmem=(double*)malloc(M*N*sizeof(double));
+  cchain=(double**)malloc(M*sizeof(double*));
+  if(sw==NULL || qrmem==NULL || amem==NULL || tau==NULL || qr==NULL ||
+     chain==NULL || ccmem==NULL || cchain==NULL)
+  {
+    free(sw); free(qrmem); free(amem); free(tau); free(qr);
+    free(chain); free(ccmem); free(cchain);
+    return(2);
+  }
+  for(m=0; m<M; m++) {
+    if(dyn_img->isWeight && dyn_img->weight[m]>0.0) sw[m]=sqrt(dyn_img->weight[m]);
+    else if(dyn_img->isWeight) sw[m]=0.0;
+    else sw[m]=1.0;
+  }
+
+  /* Weighted design matrix of each basis function; QR factorisation is done
+     in place on a row-major copy, and a column-major copy is kept for NNLS */
+  for(m=0; m<M; m++) cchain[m]=ccmem+m*N;
+  for(bi=0, ret=0; bi<bfNr && ret==0; bi++) {
+    for(m=0; m<M; m++) {
+      qr[bi*M+m]=qrmem+(bi*M+m)*N;
+      qr[bi*M+m][0]=amem[(bi*N)*M+m]=sw[m]*bf->voi[bi].y[m];
+      for(n=1; n<N; n++) qr[bi*M+m][n]=amem[(bi*N+n)*M+m]=sw[m]*fix[n-1][m];
+    }
+    ret=qr_decomp(qr+bi*M, M, N, tau+bi*N, cchain, chain);
+  }
+  free(ccmem); free(cchain); free(chain);
+  if(ret) {
+    if(verbose>0) printf("QR factorisation failed.\n");
+    free(sw); free(qrmem); free(amem); free(tau); free(qr);
+    return(3);
+  }
+
+  /*
+   *  Compute pixel-by-pixel, one image row at a time
+   */
+  if(verbose>1) printf("fitting %d basis functions pixel-by-pixel\n", bfNr);
+  int dimx=dyn_img->dimx, rowNr=dyn_img->dimz*dyn_img->dimy;
+#pragma omp parallel
+  {
+    int row, zi, yi, xi, pi, fi, bbi, k, m, n, neg;
+    double rss, rnorm, sum, par[4];
+    /* Per-thread work space */
+    double *pb=(double*)malloc(dimx*M*sizeof(double));
+    double *bestx=(double*)malloc(dimx*N*sizeof(double));
+    double *bestrss=(double*)malloc(dimx*sizeof(double));
+    int *bestbi=(int*)malloc(dimx*sizeof(int));
+    char *use=(char*)malloc(dimx);
+    double *x=(double*)malloc(N*sizeof(double));
+    double *res=(double*)malloc(M*sizeof(double));
+    double *wchain=(double*)malloc(2*M*sizeof(double));
+    double *wmem=(double*)malloc(M*N*sizeof(double));
+    double **wcchain=(double**)malloc(M*sizeof(double*));
+    double *nmat=(double*)malloc(N*M*sizeof(double));
+    double **na=(double**)malloc(N*sizeof(double*));
+    double *nb=(double*)malloc(M*sizeof(double));
+    double *nzz=(double*)malloc(M*sizeof(double));
+    double *nwp=(double*)malloc(N*sizeof(double));
+    int *nindex=(int*)malloc(N*sizeof(int));
+    if(pb==NULL || bestx==NULL || bestrss==NULL || bestbi==NULL || use==NULL ||
+       x==NULL || res==NULL || wchain==NULL || wmem==NULL || wcchain==NULL ||
+       nmat==NULL || na==NULL || nb==NULL || nzz==NULL || nwp==NULL || nindex==NULL)
+    {
+#pragma omp atomic
+      fail++;
+    } else {
+      for(m=0; m<M; m++) wcchain[m]=wmem+m*N;
+      for(n=0; n<N; n++) na[n]=nmat+n*M;
+    }
+
+#pragma omp for schedule(dynamic,1)
+    for(row=0; row<rowNr; row++) {
+      if(fail) continue;
+      zi=row/dyn_img->dimy; yi=row%dyn_img->dimy;
+
+      /* Initiate pixel output values and collect the weighted pixel TACs */
+      for(xi=0; xi<dimx; xi++) {
+        for(pi=0; pi<parNr; pi++)
+          if(par_img[pi]!=NULL) par_img[pi]->m[zi][yi][xi][0]=0.0;
+        use[xi]=0; sum=0.0;
+        for(fi=0; fi<M; fi++) {
+          pb[xi*M+fi]=sw[fi]*dyn_img->m[zi][yi][xi][fi];
+          sum+=dyn_img->m[zi][yi][xi][fi];
+        }
+        /* if the sum of pixel values is <= 0, then do nothing */
+        if(sum>0.0) use[xi]=1;
+        bestrss[xi]=1.0E+300; bestbi[xi]=-1;
+      }
+
+      /* Basis functions in the outer loop, so that each factorisation is
+         used for the whole row before moving to the next one */
+      for(bbi=0; bbi<bfNr; bbi++) {
+        for(xi=0; xi<dimx; xi++) if(use[xi]) {
+          if(qr_solve(qr+bbi*M, M, N, tau+bbi*N, pb+xi*M, x, res, &rss,
+                      wcchain, wchain)) continue;
+          if(nonneg) {
+            for(n=0, neg=0; n<N; n++) if(x[n]<0.0) neg++;
+            if(neg) {
+              for(k=0; k<N*M; k++) nmat[k]=amem[bbi*N*M+k];
+              for(m=0; m<M; m++) nb[m]=pb[xi*M+m];
+              if(nnls(na, M, N, nb, x, &rnorm, nwp, nzz, nindex)>1) continue;
+              rss=rnorm*rnorm;
+            }
+          }
+          if(!(rss<bestrss[xi])) continue;
+          bestrss[xi]=rss; bestbi[xi]=bbi;
+          for(n=0; n<N; n++) bestx[xi*N+n]=x[n];
+        }
+      }
+
+      /* Parameters of the best basis function */
+      for(xi=0; xi<dimx; xi++) if(use[xi] && bestbi[xi]>=0) {
+        bfm_parameters(model, bf->voi[bestbi[xi]].size, bestx+xi*N, N, par);
+        for(pi=0; pi<parNr; pi++)
+          if(par_img[pi]!=NULL) par_img[pi]->m[zi][yi][xi][0]=par[pi];
+      }
+    } /* next row */
+
+    free(pb); free(bestx); free(bestrss); free(bestbi); free(use);
+    free(x); free(res); free(wchain); free(wmem); free(wcchain);
+    free(nmat); free(na); free(nb); free(nzz); free(nwp); free(nindex);
+  }
+
+  free(sw); free(qrmem); free(amem); free(tau); free(qr);
+  if(fail) return(2);
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Sets PET frame times into tac and the input curve into tac->voi[0],
+    frame mean values in y and integral at frame mid time in y2.
+    The curve is interpolated with interpolate4pet() if its sample times
+    differ from the PET frames, otherwise copied and integrated with
+    petintegral().
+    @return Returns 0 if successful, and >0 in case of an error.
+ */
+static int bfm_input_to_frames(
+  /** Input curve; sample times in minutes. */
+  DFT *input,
+  /** Dynamic PET image. */
+  IMG *dyn_img,
+  /** Nr of frames included in the fit. */
+  int frame_nr,
+  /** Initiated DFT where frame times and input curve are written. */
+  DFT *tac,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose
+) {
+  int fi, ret;
+
+  if(dftSetmem(tac, frame_nr, 1)!=0) return(1);
+  strcpy(tac->voi[0].voiname, "input");
+  tac->voiNr=1; tac->frameNr=frame_nr;
+  tac->timetype=DFT_TIME_STARTEND; tac->timeunit=input->timeunit;
+  for(fi=0; fi<tac->frameNr; fi++) {
+    tac->x1[fi]=dyn_img->start[fi]/60.;
+    tac->x2[fi]=dyn_img->end[fi]/60.;
+    tac->x[fi]=dyn_img->mid[fi]/60.;
+  }
+
+  ret=0;
+  if(input->frameNr<frame_nr) ret=1;
+  for(fi=0; fi<tac->frameNr && ret==0; fi++) {
+    if(input->x1[fi]>tac->x1[fi]+0.034 || input->x1[fi]<tac->x1[fi]-0.034) ret++;
+    if(input->x2[fi]>tac->x2[fi]+0.034 || input->x2[fi]<tac->x2[fi]-0.034) ret++;
+  }
+  if(ret>0) {
+    if(verbose>1) printf("using interpolate4pet() for input curve\n");
+    ret=interpolate4pet(input->x, input->voi[0].y, input->frameNr,
+      tac->x1, tac->x2, tac->voi[0].y, tac->voi[0].y2, NULL, tac->frameNr);
+  } else {
+    if(verbose>1) printf("copying input curve and using petintegral()\n");
+    for(fi=0; fi<tac->frameNr; fi++) tac->voi[0].y[fi]=input->voi[0].y[fi];
+    ret=petintegral(tac->x1, tac->x2, tac->voi[0].y, tac->frameNr,
+      tac->voi[0].y2, NULL);
+  }
+  if(ret) return(2);
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Allocates a single-frame parameter image with the header of dyn_img.
+    @return Returns 0 if successful, and >0 in case of an error.
+ */
+static int bfm_allocate(
+  /** Dynamic PET image. */
+  IMG *dyn_img,
+  /** Nr of frames included in the fit. */
+  int frame_nr,
+  /** Parameter image; nothing is done if NULL. */
+  IMG *img,
+  /** Unit of the parameter. */
+  int unit
+) {
+  if(img==NULL) return(0);
+  imgEmpty(img);
+  if(imgAllocate(img, dyn_img->dimz, dyn_img->dimy, dyn_img->dimx, 1)) return(1);
+  if(imgCopyhdr(dyn_img, img)) {imgEmpty(img); return(2);}
+  img->unit=unit;
+  img->decayCorrection=IMG_DC_NONCORRECTED; img->isWeight=0;
+  img->start[0]=dyn_img->start[0]; img->end[0]=dyn_img->end[frame_nr-1];
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Computing pixel-by-pixel the simplified reference tissue model (SRTM)
+    with the basis function method.
+
+    Basis functions Cr(t) (x) exp(-theta3*t) are calculated with bf_srtm()
+    for theta3 values spaced logarithmically between t3min and t3max, and
+    the linear coefficients R1 and theta2 are fitted for each basis function
+    without constraints (Gunn et al. 1997).
+    Frame weights of dyn_img are used if available.
+
+    @sa bf_srtm, img_1tcm_bfm, img_irr2tcm_bfm
+    @return Returns 0 if successful, and >0 in case of an error.
+ */
+int img_srtm_bfm(
+  /** Pointer to the reference region TAC. Sample times in minutes.
+      Curve is interpolated to PET frame times, if necessary. */
+  DFT *ref,
+  /** Pointer to dynamic PET image data.
+      Image and reference data must be in the same calibration units. */
+  IMG *dyn_img,
+  /** Nr of frames that will be included in the fit [3-frame_nr]. */
+  int frame_nr,
+  /** Nr of basis functions. */
+  int bfNr,
+  /** Minimum of theta3 (1/min). */
+  double t3min,
+  /** Maximum of theta3 (1/min). */
+  double t3max,
+  /** Pointer to initiated IMG structure where R1 values will be placed;
+      enter NULL, if not needed. */
+  IMG *r1_img,
+  /** Pointer to initiated IMG structure where k2 values will be placed;
+      enter NULL, if not needed. */
+  IMG *k2_img,
+  /** Pointer to initiated IMG structure where BPnd values will be placed;
+      enter NULL, if not needed. */
+  IMG *bp_img,
+  /** Pointer to a string (allocated for at least 64 chars) where error message
+      or other execution status will be written; enter NULL, if not needed. */
+  char *status,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose
+) {
+  int ret;
+  DFT tac, bf;
+  double *fix[1];
+  IMG *par_img[3];
+
+
+  if(verbose>0) printf("%s(ref, dyn_img, %d, %d, %g, %g, ...)\n",
+    __func__, frame_nr, bfNr, t3min, t3max);
+  /* Initial check for the arguments */
+  if(status!=NULL) sprintf(status, "invalid data");
+  if(dyn_img->status!=IMG_STATUS_OCCUPIED || dyn_img->dimt<1) return(1);
+  if(ref==NULL || ref->frameNr<1) return(1);
+  if(frame_nr>dyn_img->dimt || frame_nr<3) return(1);
+  if(r1_img==NULL && k2_img==NULL && bp_img==NULL) return(1);
+
+  /* Reference TAC at PET frames, and its basis functions */
+  dftInit(&tac); dftInit(&bf);
+  if(bfm_input_to_frames(ref, dyn_img, frame_nr, &tac, verbose)) {
+    if(status!=NULL) sprintf(status, "cannot interpolate reference data");
+    dftEmpty(&tac); return(2);
+  }
+  if(bf_srtm(tac.x, tac.voi[0].y, frame_nr, bfNr, t3min, t3max, &bf)) {
+    if(status!=NULL) sprintf(status, "cannot calculate basis functions");
+    dftEmpty(&tac); dftEmpty(&bf); return(3);
+  }
+
+  /* Result images */
+  ret=bfm_allocate(dyn_img, frame_nr, r1_img, CUNIT_UNITLESS);
+  if(!ret) ret=bfm_allocate(dyn_img, frame_nr, k2_img, CUNIT_PER_MIN);
+  if(!ret) ret=bfm_allocate(dyn_img, frame_nr, bp_img, CUNIT_UNITLESS);
+  if(ret) {
+    if(status!=NULL) sprintf(status, "cannot allocate memory for result image");
+    dftEmpty(&tac); dftEmpty(&bf); return(4);
+  }
+
+  fix[0]=tac.voi[0].y;
+  par_img[0]=r1_img; par_img[1]=k2_img; par_img[2]=bp_img;
+  ret=bfm_fit_image(dyn_img, frame_nr, &bf, 1, fix, 0, BFM_SRTM, par_img, 3,
+                    verbose-1);
+  dftEmpty(&tac); dftEmpty(&bf);
+  if(ret) {
+    if(status!=NULL) sprintf(status, "cannot fit basis functions");
+    return(5);
+  }
+  if(status!=NULL) sprintf(status, "ok");
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Computing pixel-by-pixel the one-tissue compartment model (1TCM)
+    with the basis function method.
+
+    Basis functions Ca(t) (x) exp(-k2*t) are calculated with bfRadiowater()
+    for k2 values spaced logarithmically between k2min and k2max, and
+    non-negative K1 (and Va, if requested) are fitted for each basis function.
+    Frame weights of dyn_img are used if available.
+
+    @sa bfRadiowater, img_srtm_bfm, img_irr2tcm_bfm
+    @return Returns 0 if successful, and >0 in case of an error.
+ */
+int img_1tcm_bfm(
+  /** Pointer to the TAC data to be used as model input. Sample times in minutes. */
+  DFT *input,
+  /** Pointer to dynamic PET image data.
+      Image and input data must be in the same calibration units. */
+  IMG *dyn_img,
+  /** Nr of frames that will be included in the fit [3-frame_nr]. */
+  int frame_nr,
+  /** Nr of basis functions. */
+  int bfNr,
+  /** Minimum of k2 (1/min). */
+  double k2min,
+  /** Maximum of k2 (1/min). */
+  double k2max,
+  /** Pointer to initiated IMG structure where K1 values will be placed;
+      enter NULL, if not needed. */
+  IMG *k1_img,
+  /** Pointer to initiated IMG structure where k2 values will be placed;
+      enter NULL, if not needed. */
+  IMG *k2_img,
+  /** Pointer to initiated IMG structure where vascular volume fractions will
+      be placed; enter NULL, if Va is not to be fitted. */
+  IMG *va_img,
+  /** Pointer to a string (allocated for at least 64 chars) where error message
+      or other execution status will be written; enter NULL, if not needed. */
+  char *status,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose
+) {
+  int ret;
+  DFT tac, bf;
+  double *fix[1];
+  IMG *par_img[3];
+
+
+  if(verbose>0) printf("%s(input, dyn_img, %d, %d, %g, %g, ...)\n",
+    __func__, frame_nr, bfNr, k2min, k2max);
+  /* Initial check for the arguments */
+  if(status!=NULL) sprintf(status, "invalid data");
+  if(dyn_img->status!=IMG_STATUS_OCCUPIED || dyn_img->dimt<1) return(1);
+  if(input==NULL || input->frameNr<3) return(1);
+  if(frame_nr>dyn_img->dimt || frame_nr<3) return(1);
+  if(k1_img==NULL && k2_img==NULL && va_img==NULL) return(1);
+
+  /* Input at PET frames, and the basis functions */
+  dftInit(&tac); dftInit(&bf);
+  if(bfm_input_to_frames(input, dyn_img, frame_nr, &tac, verbose)) {
+    if(status!=NULL) sprintf(status, "cannot interpolate input data");
+    dftEmpty(&tac); return(2);
+  }
+  if(bfRadiowater(input, &tac, &bf, bfNr, k2min, k2max, status, verbose-1)) {
+    dftEmpty(&tac); dftEmpty(&bf); return(3);
+  }
+
+  /* Result images */
+  ret=bfm_allocate(dyn_img, frame_nr, k1_img, CUNIT_ML_PER_ML_PER_MIN);
+  if(!ret) ret=bfm_allocate(dyn_img, frame_nr, k2_img, CUNIT_PER_MIN);
+  if(!ret) ret=bfm_allocate(dyn_img, frame_nr, va_img, CUNIT_ML_PER_ML);
+  if(ret) {
+    if(status!=NULL) sprintf(status, "cannot allocate memory for result image");
+    dftEmpty(&tac); dftEmpty(&bf); return(4);
+  }
+
+  fix[0]=tac.voi[0].y;
+  par_img[0]=k1_img; par_img[1]=k2_img; par_img[2]=va_img;
+  ret=bfm_fit_image(dyn_img, frame_nr, &bf, va_img!=NULL ? 1 : 0, fix, 1,
+                    BFM_1TCM, par_img, 3, verbose-1);
+  dftEmpty(&tac); dftEmpty(&bf);
+  if(ret) {
+    if(status!=NULL) sprintf(status, "cannot fit basis functions");
+    return(5);
+  }
+  if(status!=NULL) sprintf(status, "ok");
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Computing pixel-by-pixel the irreversible two-tissue compartment model
+    with the basis function method.
+
+    Basis functions Ca(t) (x) exp(-theta*t), theta=k2+k3, are calculated with
+    bfIrr2TCM() for theta values spaced linearly between thetamin and
+    thetamax, and non-negative K1*k2/theta and Ki (and Va, if requested)
+    are fitted for each basis function.
+    Frame weights of dyn_img are used if available.
+
+    @sa bfIrr2TCM, img_1tcm_bfm, img_srtm_bfm, img_patlak
+    @return Returns 0 if successful, and >0 in case of an error.
+ */
+int img_irr2tcm_bfm(
+  /** Pointer to the TAC data to be used as model input. Sample times in minutes. */
+  DFT *input,
+  /** Pointer to dynamic PET image data.
+      Image and input data must be in the same calibration units. */
+  IMG *dyn_img,
+  /** Nr of frames that will be included in the fit [3-frame_nr]. */
+  int frame_nr,
+  /** Nr of basis functions. */
+  int bfNr,
+  /** Minimum of k2+k3 (1/min). */
+  double thetamin,
+  /** Maximum of k2+k3 (1/min). */
+  double thetamax,
+  /** Pointer to initiated IMG structure where Ki values will be placed;
+      enter NULL, if not needed. */
+  IMG *ki_img,
+  /** Pointer to initiated IMG structure where K1 values will be placed;
+      enter NULL, if not needed. */
+  IMG *k1_img,
+  /** Pointer to initiated IMG structure where (k2+k3) values will be placed;
+      enter NULL, if not needed. */
+  IMG *k2k3_img,
+  /** Pointer to initiated IMG structure where vascular volume fractions will
+      be placed; enter NULL, if Va is not to be fitted. */
+  IMG *va_img,
+  /** Pointer to a string (allocated for at least 64 chars) where error message
+      or other execution status will be written; enter NULL, if not needed. */
+  char *status,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose
+) {
+  int ret;
+  DFT tac, bf;
+  double *fix[2];
+  IMG *par_img[4];
+
+
+  if(verbose>0) printf("%s(input, dyn_img, %d, %d, %g, %g, ...)\n",
+    __func__, frame_nr, bfNr, thetamin, thetamax);
+  /* Initial check for the arguments */
+  if(status!=NULL) sprintf(status, "invalid data");
+  if(dyn_img->status!=IMG_STATUS_OCCUPIED || dyn_img->dimt<1) return(1);
+  if(input==NULL || input->frameNr<3) return(1);
+  if(frame_nr>dyn_img->dimt || frame_nr<4) return(1);
+  if(ki_img==NULL && k1_img==NULL && k2k3_img==NULL && va_img==NULL) return(1);
+
+  /* Input and its integral at PET frames, and the basis functions */
+  dftInit(&tac); dftInit(&bf);
+  if(bfm_input_to_frames(input, dyn_img, frame_nr, &tac, verbose)) {
+    if(status!=NULL) sprintf(status, "cannot interpolate input data");
+    dftEmpty(&tac); return(2);
+  }
+  if(bfIrr2TCM(input, &tac, &bf, bfNr, thetamin, thetamax, status, verbose-1)) {
+    dftEmpty(&tac); dftEmpty(&bf); return(3);
+  }
+
+  /* Result images */
+  ret=bfm_allocate(dyn_img, frame_nr, ki_img, CUNIT_ML_PER_ML_PER_MIN);
+  if(!ret) ret=bfm_allocate(dyn_img, frame_nr, k1_img, CUNIT_ML_PER_ML_PER_MIN);
+  if(!ret) ret=bfm_allocate(dyn_img, frame_nr, k2k3_img, CUNIT_PER_MIN);
+  if(!ret) ret=bfm_allocate(dyn_img, frame_nr, va_img, CUNIT_ML_PER_ML);
+  if(ret) {
+    if(status!=NULL) sprintf(status, "cannot allocate memory for result image");
+    dftEmpty(&tac); dftEmpty(&bf); return(4);
+  }
+
+  fix[0]=tac.voi[0].y2; fix[1]=tac.voi[0].y;
+  par_img[0]=ki_img; par_img[1]=k1_img; par_img[2]=k2k3_img; par_img[3]=va_img;
+  ret=bfm_fit_image(dyn_img, frame_nr, &bf, va_img!=NULL ? 2 : 1, fix, 1,
+                    BFM_IRR2TCM, par_img, 4, verbose-1);
+  dftEmpty(&tac); dftEmpty(&bf);
+  if(ret) {
+    if(status!=NULL) sprintf(status, "cannot fit basis functions");
+    return(5);
+  }
+  if(status!=NULL) sprintf(status, "ok");
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
@@ -35,8 +35,8 @@ int img_k1_using_ki(
   /** Verbose level; if zero, then nothing is printed to stderr or stdout */
   int verbose
 ) {
-  int zi, yi, xi, fi, ret=0;
-  int nnls_n=2, nnls_m, m;
+  int fi, ret=0;
+  int nnls_n=2, nnls_m;
   DFT tac;
   clock_t fitStart, fitFinish;
 
@@ -50,6 +50,8 @@ int img_k1_using_ki(
   if(status!=NULL) sprintf(status, "invalid data");
   if(dyn_img->status!=IMG_STATUS_OCCUPIED || dyn_img->dimt<1) return(1);
   if(ki_img->status!=IMG_STATUS_OCCUPIED || ki_img->dimt<1) return(1);
+  if(ki_img->dimz!=dyn_img->dimz || ki_img->dimy!=dyn_img->dimy ||
+     ki_img->dimx!=dyn_img->dimx) return(1);
   if(input==NULL || input->frameNr<1) return(1);
   if(frame_nr>dyn_img->dimt) return(1);
   if(k1_img==NULL) return(1);
@@ -158,55 +160,61 @@ int img_k1_using_ki(
   }
 
   /*
-   *  Allocate memory required by NNLS; C99 !!!
+   *  Compute pixel-by-pixel, one tile of pixels at a time
    */
-  if(verbose>1) fprintf(stdout, "allocating memory for NNLS\n");
+  if(verbose>1) printf("computing K1 pixel-by-pixel\n");
   nnls_m=frame_nr;
+  const int tileNr=imgTileNr(dyn_img, IMG_TILE_SIZE);
+#pragma omp parallel
+  {
+  /* Memory required by NNLS, and pixel TAC and its integral, for each
+     thread; C99 !!! */
   double *nnls_a[nnls_n], nnls_mat[nnls_n][nnls_m], nnls_b[nnls_m],
           nnls_zz[nnls_m];
   double nnls_x[nnls_n], nnls_wp[nnls_n], nnls_rnorm;
   int nnls_index[nnls_n];
+  double y[nnls_m], y2[nnls_m];
   nnls_a[0]=nnls_mat[0];
   nnls_a[1]=nnls_mat[1];
 
-  /*
-   *  Compute pixel-by-pixel
-   */
-  if(verbose>1) printf("computing K1 pixel-by-pixel\n");
-  for(zi=0; zi<dyn_img->dimz; zi++) {
-    for(yi=0; yi<dyn_img->dimy; yi++) {
-      for(xi=0; xi<dyn_img->dimx; xi++) {
-        /* Initiate pixel output values */
-        k1_img->m[zi][yi][xi][0]=0.0;
-        if(k2k3_img!=NULL) k2k3_img->m[zi][yi][xi][0]=0.0;
-
-        /* Copy and integrate pixel curve */
-        for(m=0; m<nnls_m; m++) tac.voi[1].y[m]=dyn_img->m[zi][yi][xi][m];
-        ret=petintegral(tac.x1, tac.x2, tac.voi[1].y, tac.frameNr,
-                        tac.voi[1].y2, NULL);
-        if(ret) continue;
-        /* if AUC at the end is <= 0, then do nothing */
-        if(tac.voi[1].y2[nnls_m-1]<=0.0) continue;       
-
-        /* Fill the NNLS data matrix */
-        for(m=0; m<nnls_m; m++) {
-          nnls_a[0][m]=tac.voi[0].y2[m];
-          nnls_a[1][m]=ki_img->m[zi][yi][xi][0]*tac.voi[0].y3[m]-tac.voi[1].y2[m];
-          nnls_b[m]=tac.voi[1].y[m];
-        }
-        
-        /* NNLS */
-        ret=nnls(nnls_a, nnls_m, nnls_n, nnls_b, nnls_x, &nnls_rnorm,
-                 nnls_wp, nnls_zz, nnls_index);
-        if(ret>1) { /* no solution is possible */
-          continue;
-        } else if(ret==1) { /* max iteration count exceeded */ }
-        k1_img->m[zi][yi][xi][0]=nnls_x[0];
-        if(k2k3_img!=NULL) k2k3_img->m[zi][yi][xi][0]=nnls_x[1];
-        
-      } /* next column */
-    } /* next row */
-  } /* next plane */
+#pragma omp for schedule(dynamic)
+  for(int ti=0; ti<tileNr; ti++) {
+    IMG_TILE dtile, kitile, k1tile, k2k3tile;
+    imgGetTile(dyn_img, IMG_TILE_SIZE, ti, &dtile);
+    imgGetTile(ki_img, IMG_TILE_SIZE, ti, &kitile);
+    imgGetTile(k1_img, IMG_TILE_SIZE, ti, &k1tile);
+    if(k2k3_img!=NULL) imgGetTile(k2k3_img, IMG_TILE_SIZE, ti, &k2k3tile);
+    for(int i=0; i<dtile.pxlNr; i++) {
+      /* Initiate pixel output values */
+      k1tile.tac[i]=0.0;
+      if(k2k3_img!=NULL) k2k3tile.tac[i]=0.0;
+
+      /* Copy and integrate pixel curve */
+      float *ptac=dtile.tac+(size_t)i*dtile.frameNr;
+      for(int m=0; m<nnls_m; m++) y[m]=ptac[m];
+      if(petintegral(tac.x1, tac.x2, y, tac.frameNr, y2, NULL)) continue;
+      /* if AUC at the end is <= 0, then do nothing */
+      if(y2[nnls_m-1]<=0.0) continue;
+
+      /* Fill the NNLS data matrix */
+      double ki=kitile.tac[(size_t)i*kitile.frameNr];
+      for(int m=0; m<nnls_m; m++) {
+        nnls_a[0][m]=tac.voi[0].y2[m];
+        nnls_a[1][m]=ki*tac.voi[0].y3[m]-y2[m];
+        nnls_b[m]=y[m];
+      }
+
+      /* NNLS */
+      int nret=nnls(nnls_a, nnls_m, nnls_n, nnls_b, nnls_x, &nnls_rnorm,
+                    nnls_wp, nnls_zz, nnls_index);
+      if(nret>1) { /* no solution is possible */
+        continue;
+      } else if(nret==1) { /* max iteration count exceeded */ }
+      k1tile.tac[i]=nnls_x[0];
+      if(k2k3_img!=NULL) k2k3tile.tac[i]=nnls_x[1];
+    } /* next pixel */
+  } /* next tile */
+  }
   dftEmpty(&tac);
 
   fitFinish=clock(); //printf("CLOCKS_PER_SEC=%ld\n", CLOCKS_PER_SEC);
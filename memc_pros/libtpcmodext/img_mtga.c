@@ -11,7 +11,7 @@
 
 /*****************************************************************************/
 /** Computing pixel-by-pixel the graphical analysis for irreversible PET tracers (Gjedde-Patlak plot).
-    @sa img_logan, llsqperp, patlak_data, mtga_best_perp
+    @sa img_logan, patlak_block_data, mtga_block_fit, mtga_best_perp
     @return Returns 0 if successful, and >0 in case of an error.
  */
 int img_patlak(
@@ -46,9 +46,8 @@ int img_patlak(
   /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
   int verbose
 ) {
-  int zi, yi, xi, fi, nr, pn, ret=0;
+  int fi, nr, ret=0;
   DFT tac;
-  double *plotData, *xaxis, *yaxis, slope, ic, f;
 
 
   if(verbose>0) {
@@ -166,62 +165,93 @@ int img_patlak(
     if(verbose>9) imgInfo(ic_img);
   }
 
-  /* Allocate memory for graphical analysis plot data */
-  plotData=malloc(2*nr*sizeof(double));
-  if(plotData==NULL) {
-    sprintf(status, "cannot allocate memory for plots");
-    imgEmpty(ic_img); imgEmpty(ki_img); dftEmpty(&tac); return(25);
-  }
-  xaxis=plotData; yaxis=plotData+nr;
-
   /* Calculate threshold */
   thrs*=tac.voi[0].y2[tac.frameNr-1];
   if(verbose>1) printf("  threshold-AUC := %g\n", thrs);
 
   /*
-   *  Compute pixel-by-pixel
+   *  Compute pixel-by-pixel; plots of one tile of pixels are computed and
+   *  fitted as a block, and tiles are processed in parallel
    */
   if(verbose>1) printf("computing MTGA pixel-by-pixel\n");
+  const int tileNr=imgTileNr(dyn_img, IMG_TILE_SIZE);
+  ret=0;
+#pragma omp parallel
+  {
+  /* Memory for graphical analysis plot data, for each thread */
+  const int bsize=IMG_TILE_SIZE;
+  double *plotData=malloc((2*nr + 2*nr*bsize + 8*bsize)*sizeof(double));
+  int *bnr=malloc(2*bsize*sizeof(int));
+  float **bc=malloc(bsize*sizeof(float*));
   float pxlauc[dyn_img->dimt];
-  int best_nr;
-  for(zi=0; zi<dyn_img->dimz; zi++) {
-    for(yi=0; yi<dyn_img->dimy; yi++) {
-      for(xi=0; xi<dyn_img->dimx; xi++) {
-        /* Initiate pixel output values */
-        ki_img->m[zi][yi][xi][0]=0.0;
-        if(ic_img!=NULL) ic_img->m[zi][yi][xi][0]=0.0;
-        /* Check for threshold */
-        ret=fpetintegral(dyn_img->start, dyn_img->end, dyn_img->m[zi][yi][xi], 
-                         dyn_img->dimt, pxlauc, NULL);
-        if(ret) continue;
-        if((pxlauc[dyn_img->dimt-1]/60.0) < thrs) continue;
-        /* Calculate Patlak plot data */
-        for(fi=0; fi<tac.frameNr; fi++) tac.voi[1].y[fi]=dyn_img->m[zi][yi][xi][start+fi];
-        pn=patlak_data(nr, tac.voi[0].y, tac.voi[0].y2, tac.voi[1].y, xaxis, yaxis);
-        /* Line fit */
-        if(fit_range==PRESET || pn<MTGA_BEST_MIN_NR) {
-          ret=llsqperp(xaxis, yaxis, pn, &slope, &ic, &f);
-          best_nr=pn;
-        } else {
-          ret=mtga_best_perp(xaxis, yaxis, pn, &slope, &ic, &f, &best_nr);
-        }
-        if(ret==0) {
-          ki_img->m[zi][yi][xi][0]=slope;
-          if(ic_img!=NULL) ic_img->m[zi][yi][xi][0]=ic;
-          if(nr_img!=NULL) nr_img->m[zi][yi][xi][0]=best_nr;
-        }
-      } /* next column */
-    } /* next row */
-  } /* next plane */
+  if(plotData==NULL || bnr==NULL || bc==NULL) {
+#pragma omp atomic write
+    ret=1;
+  }
+  double *xaxis=plotData, *yaxis=xaxis+nr;
+  double *xblock=yaxis+nr, *yblock=xblock+nr*bsize;
+  double *bslope=yblock+nr*bsize, *bic=bslope+bsize, *work=bic+bsize;
+  int *bxi=bnr+bsize;
 
-  free(plotData); dftEmpty(&tac);
+#pragma omp for schedule(dynamic)
+  for(int ti=0; ti<tileNr; ti++) {
+    if(plotData==NULL || bnr==NULL || bc==NULL) continue;
+    IMG_TILE dtile, kitile, ictile, nrtile;
+    imgGetTile(dyn_img, IMG_TILE_SIZE, ti, &dtile);
+    imgGetTile(ki_img, IMG_TILE_SIZE, ti, &kitile);
+    if(ic_img!=NULL) imgGetTile(ic_img, IMG_TILE_SIZE, ti, &ictile);
+    if(nr_img!=NULL) imgGetTile(nr_img, IMG_TILE_SIZE, ti, &nrtile);
+    /* Collect the tile pixels that pass the threshold */
+    int tac_nr=0;
+    for(int i=0; i<dtile.pxlNr; i++) {
+      float *ptac=dtile.tac+(size_t)i*dtile.frameNr;
+      /* Initiate pixel output values */
+      kitile.tac[i]=0.0;
+      if(ic_img!=NULL) ictile.tac[i]=0.0;
+      /* Check for threshold */
+      if(fpetintegral(dyn_img->start, dyn_img->end, ptac, dyn_img->dimt,
+                      pxlauc, NULL)) continue;
+      if((pxlauc[dyn_img->dimt-1]/60.0) < thrs) continue;
+      bc[tac_nr]=ptac+start; bxi[tac_nr]=i; tac_nr++;
+    }
+    if(tac_nr==0) continue;
+    /* Calculate Patlak plot data and fit the lines of the whole tile */
+    patlak_block_data(nr, tac.voi[0].y, tac.voi[0].y2, tac_nr, bc, xblock, yblock);
+    mtga_block_fit(nr, tac_nr, xblock, yblock, PERP, bslope, bic, NULL, NULL, bnr, work);
+    for(int ri=0; ri<tac_nr; ri++) {
+      int i=bxi[ri], best_nr=bnr[ri], pn, fret=(best_nr>0 ? 0 : 1);
+      double slope=bslope[ri], ic=bic[ri], f;
+      if(fit_range!=PRESET) {
+        /* Search the best range from the plot points of this pixel */
+        pn=0;
+        for(int fj=0; fj<nr; fj++) {
+          f=yblock[(size_t)fj*tac_nr+ri]; if(isnan(f)) continue;
+          xaxis[pn]=xblock[(size_t)fj*tac_nr+ri]; yaxis[pn++]=f;
+        }
+        if(pn>=MTGA_BEST_MIN_NR)
+          fret=mtga_best_perp(xaxis, yaxis, pn, &slope, &ic, &f, &best_nr);
+      }
+      if(fret==0) {
+        kitile.tac[i]=slope;
+        if(ic_img!=NULL) ictile.tac[i]=ic;
+        if(nr_img!=NULL) nrtile.tac[i]=best_nr;
+      }
+    } /* next pixel */
+  } /* next tile */
+  free(plotData); free(bnr); free(bc);
+  }
+  dftEmpty(&tac);
+  if(ret) {
+    sprintf(status, "cannot allocate memory for plots");
+    imgEmpty(ic_img); imgEmpty(ki_img); return(25);
+  }
   return(0);
 }
 /*****************************************************************************/
 
 /*****************************************************************************/
 /** Computing pixel-by-pixel the graphical analysis for reversible PET tracers (Logan plot).
-    @sa img_patlak, llsqperp, logan_data, mtga_best_perp
+    @sa img_patlak, logan_block_data, mtga_block_fit, mtga_best_perp
     @return Returns 0 if successful, and >0 in case of an error.
  */
 int img_logan(
@@ -258,10 +288,8 @@ int img_logan(
   /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
   int verbose
 ) {
-  int zi, yi, xi, fi, nr, pn, ret=0;
+  int fi, nr, ret=0;
   DFT tac;
-  double *plotData, *xaxis, *yaxis, slope, ic, f;
-  double aucrat;
 
 
   if(verbose>0) {
@@ -379,67 +407,99 @@ int img_logan(
     if(verbose>9) imgInfo(ic_img);
   }
 
-  /* Allocate memory for graphical analysis plot data */
-  plotData=malloc(2*nr*sizeof(double));
-  if(plotData==NULL) {
-    sprintf(status, "cannot allocate memory for plots");
-    imgEmpty(ic_img); imgEmpty(vt_img); dftEmpty(&tac); 
-    return(25);
-  }
-  xaxis=plotData; yaxis=plotData+nr;
-  float pxlauc[dyn_img->dimt];
-
   /* Calculate threshold */
   thrs*=tac.voi[0].y2[tac.frameNr-1];
   if(verbose>1) printf("  threshold-AUC := %g\n", thrs);
 
   /*
-   *  Compute pixel-by-pixel
+   *  Compute pixel-by-pixel; plots of one tile of pixels are computed and
+   *  fitted as a block, and tiles are processed in parallel
    */
   if(verbose>1) printf("computing MTGA pixel-by-pixel\n");
-  int best_nr;
-  for(zi=0; zi<dyn_img->dimz; zi++) {
-    for(yi=0; yi<dyn_img->dimy; yi++) {
-      for(xi=0; xi<dyn_img->dimx; xi++) {
-        /* Initiate pixel output values */
-        vt_img->m[zi][yi][xi][0]=0.0;
-        if(ic_img!=NULL) ic_img->m[zi][yi][xi][0]=0.0;
-        if(nr_img!=NULL) nr_img->m[zi][yi][xi][0]=0.0;
-        /* Copy TTAC values */
-        for(fi=0; fi<tac.frameNr; fi++) tac.voi[1].y[fi]=dyn_img->m[zi][yi][xi][start+fi];
-        /* Compute TTAC AUC(0-t) and check for threshold */
-        ret=fpetintegral(dyn_img->start, dyn_img->end, dyn_img->m[zi][yi][xi], 
-                         dyn_img->dimt, pxlauc, NULL);
-        if(ret) continue;
-        if((pxlauc[dyn_img->dimt-1]/60.0) < thrs) continue;
-        for(fi=0; fi<tac.frameNr; fi++)
-          tac.voi[1].y2[fi]=pxlauc[start+fi]/60.0; // conc*sec -> conc*min
-        /* Calculate Logan plot data */
-        pn=logan_data(nr, tac.voi[0].y, tac.voi[0].y2, tac.voi[1].y, tac.voi[1].y2, k2, xaxis, yaxis);
-        /* Line fit */
-        if(fit_range==PRESET || pn<MTGA_BEST_MIN_NR) {
-          ret=llsqperp(xaxis, yaxis, pn, &slope, &ic, &f);
-          best_nr=pn;
-        } else {
-          ret=mtga_best_perp(xaxis, yaxis, pn, &slope, &ic, &f, &best_nr);
-        }
-        if(ret!=0) continue; // line fit failed
-        /* Use 10xAUCratio as upper limit to prevent image where only 
-           noise-induced hot spots can be seen */
-        aucrat=tac.voi[1].y2[tac.frameNr-1]/tac.voi[0].y2[tac.frameNr-1];
-        if(slope>10.0*aucrat) {
-          if(verbose>50) printf("%g > 10 x %g\n", slope, aucrat);
-          slope=10.0*aucrat;
-        }
-        /* copy result to pixels */
-        vt_img->m[zi][yi][xi][0]=slope;
-        if(ic_img!=NULL) ic_img->m[zi][yi][xi][0]=-ic;
-        if(nr_img!=NULL) nr_img->m[zi][yi][xi][0]=best_nr;
-      } /* next column */
-    } /* next row */
-  } /* next plane */
+  const int tileNr=imgTileNr(dyn_img, IMG_TILE_SIZE);
+  ret=0;
+#pragma omp parallel
+  {
+  /* Memory for graphical analysis plot data, for each thread */
+  const int bsize=IMG_TILE_SIZE;
+  double *plotData=malloc((2*nr + 4*nr*bsize + 8*bsize)*sizeof(double));
+  int *bnr=malloc(2*bsize*sizeof(int));
+  float **bc=malloc(bsize*sizeof(float*));
+  float pxlauc[dyn_img->dimt];
+  if(plotData==NULL || bnr==NULL || bc==NULL) {
+#pragma omp atomic write
+    ret=1;
+  }
+  double *xaxis=plotData, *yaxis=xaxis+nr;
+  double *xblock=yaxis+nr, *yblock=xblock+nr*bsize;
+  double *ciblock=yblock+nr*bsize, *civox=ciblock+nr*bsize;
+  double *bslope=civox+nr*bsize, *bic=bslope+bsize, *work=bic+bsize;
+  int *bxi=bnr+bsize;
 
-  free(plotData); dftEmpty(&tac);
+#pragma omp for schedule(dynamic)
+  for(int ti=0; ti<tileNr; ti++) {
+    if(plotData==NULL || bnr==NULL || bc==NULL) continue;
+    IMG_TILE dtile, vttile, ictile, nrtile;
+    imgGetTile(dyn_img, IMG_TILE_SIZE, ti, &dtile);
+    imgGetTile(vt_img, IMG_TILE_SIZE, ti, &vttile);
+    if(ic_img!=NULL) imgGetTile(ic_img, IMG_TILE_SIZE, ti, &ictile);
+    if(nr_img!=NULL) imgGetTile(nr_img, IMG_TILE_SIZE, ti, &nrtile);
+    /* Collect the tile pixels that pass the threshold, with their AUCs */
+    int tac_nr=0;
+    for(int i=0; i<dtile.pxlNr; i++) {
+      float *ptac=dtile.tac+(size_t)i*dtile.frameNr;
+      /* Initiate pixel output values */
+      vttile.tac[i]=0.0;
+      if(ic_img!=NULL) ictile.tac[i]=0.0;
+      if(nr_img!=NULL) nrtile.tac[i]=0.0;
+      /* Compute TTAC AUC(0-t) and check for threshold */
+      if(fpetintegral(dyn_img->start, dyn_img->end, ptac, dyn_img->dimt,
+                      pxlauc, NULL)) continue;
+      if((pxlauc[dyn_img->dimt-1]/60.0) < thrs) continue;
+      for(int fj=0; fj<nr; fj++)
+        civox[tac_nr*nr+fj]=pxlauc[start+fj]/60.0; // conc*sec -> conc*min
+      bc[tac_nr]=ptac+start; bxi[tac_nr]=i; tac_nr++;
+    }
+    if(tac_nr==0) continue;
+    for(int ri=0; ri<tac_nr; ri++) for(int fj=0; fj<nr; fj++)
+      ciblock[(size_t)fj*tac_nr+ri]=civox[ri*nr+fj];
+    /* Calculate Logan plot data and fit the lines of the whole tile */
+    logan_block_data(nr, tac.voi[0].y, tac.voi[0].y2, tac_nr, bc, ciblock, k2, xblock, yblock);
+    mtga_block_fit(nr, tac_nr, xblock, yblock, PERP, bslope, bic, NULL, NULL, bnr, work);
+    for(int ri=0; ri<tac_nr; ri++) {
+      int i=bxi[ri], best_nr=bnr[ri], pn, fret=(best_nr>0 ? 0 : 1);
+      double slope=bslope[ri], ic=bic[ri], f;
+      if(fit_range!=PRESET) {
+        /* Search the best range from the plot points of this pixel */
+        pn=0;
+        for(int fj=0; fj<nr; fj++) {
+          f=yblock[(size_t)fj*tac_nr+ri]; if(isnan(f)) continue;
+          xaxis[pn]=xblock[(size_t)fj*tac_nr+ri]; yaxis[pn++]=f;
+        }
+        if(pn>=MTGA_BEST_MIN_NR)
+          fret=mtga_best_perp(xaxis, yaxis, pn, &slope, &ic, &f, &best_nr);
+      }
+      if(fret!=0) continue; // line fit failed
+      /* Use 10xAUCratio as upper limit to prevent image where only 
+         noise-induced hot spots can be seen */
+      double aucrat=civox[ri*nr+nr-1]/tac.voi[0].y2[tac.frameNr-1];
+      if(slope>10.0*aucrat) {
+        if(verbose>50) printf("%g > 10 x %g\n", slope, aucrat);
+        slope=10.0*aucrat;
+      }
+      /* copy result to pixels */
+      vttile.tac[i]=slope;
+      if(ic_img!=NULL) ictile.tac[i]=-ic;
+      if(nr_img!=NULL) nrtile.tac[i]=best_nr;
+    } /* next pixel */
+  } /* next tile */
+  free(plotData); free(bnr); free(bc);
+  }
+  dftEmpty(&tac);
+  if(ret) {
+    sprintf(status, "cannot allocate memory for plots");
+    imgEmpty(ic_img); imgEmpty(vt_img); return(25);
+  }
   return(0);
 }
 /*****************************************************************************/
@@ -0,0 +1,493 @@
+/// @file img_mtga_stream.c
+/// @brief Functions for computing pixel-by-pixel the MTGA
+///        (Gjedde-Patlak and Logan plot) from dynamic image read frame-by-frame.
+/// @author Vesa Oikonen
+///
+/*****************************************************************************/
+
+/*****************************************************************************/
+#include "libtpcmodext.h"
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Initiate the IMG_MTGA_STREAM struct before any use.
+    @sa imgMtgaStreamEmpty, imgMtgaStreamSetup
+ */
+void imgMtgaStreamInit(
+  /** Pointer to MTGA stream struct. */
+  IMG_MTGA_STREAM *s
+) {
+  if(s==NULL) return;
+  memset(s, 0, sizeof(IMG_MTGA_STREAM));
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Free the memory allocated in IMG_MTGA_STREAM struct.
+    @sa imgMtgaStreamInit
+ */
+void imgMtgaStreamEmpty(
+  /** Pointer to MTGA stream struct. */
+  IMG_MTGA_STREAM *s
+) {
+  if(s==NULL) return;
+  free(s->_fdata); free(s->_ddata); free(s->input_ii);
+  imgMtgaStreamInit(s);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Prepare for computing the pixel-by-pixel Gjedde-Patlak or Logan plot
+    frame-by-frame with imgMtgaStreamAddFrame().
+
+    Only the running sums of the line fit and of the pixel AUCs are kept in
+    memory, which takes about the same space as 16 image frames, therefore
+    dynamic images with a large nr of frames can be processed one frame at a
+    time. Line is always fitted to the preset range of frames.
+    @sa imgMtgaStreamAddFrame, imgMtgaStreamResult, img_patlak, img_logan
+    @return Returns 0 if successful, and >0 in case of an error.
+ */
+int imgMtgaStreamSetup(
+  /** Pointer to initiated MTGA stream struct. */
+  IMG_MTGA_STREAM *s,
+  /** Pointer to the TAC data to be used as model input. Sample times in
+      minutes. Curve is interpolated to PET frame times, if necessary;
+      the data must be kept available until all frames have been added. */
+  DFT *input,
+  /** Pointer to one frame of the dynamic image, for image dimensions. */
+  IMG *img,
+  /** The range of frames where line is fitted, given as the frame start here
+      and next the end index, i.e. [0..frame_nr-1]. */
+  int start,
+  /** The range of frames where line is fitted, given as the frame start above
+      and here the end index, i.e. [0..frame_nr-1]. */
+  int end,
+  /** Compute Gjedde-Patlak (0) or Logan (1) plot. */
+  int logan,
+  /** Reference region k2 for Logan plot; set to <=0 if not needed. */
+  double k2,
+  /** Pointer to a string (allocated for at least 64 chars) where error message
+      or other execution status will be written; enter NULL, if not needed. */
+  char *status,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose
+) {
+  if(verbose>0) printf("%s(input, img, %d, %d, %d, %g)\n", __func__, start, end, logan, k2);
+  if(status!=NULL) sprintf(status, "invalid data");
+  if(s==NULL || img==NULL || img->status!=IMG_STATUS_OCCUPIED) return(1);
+  if(input==NULL || input->frameNr<1) return(2);
+  if(end-start<1) return(3);
+  if(start<0) return(4);
+  imgMtgaStreamEmpty(s);
+
+  /* Convert input time units to min */
+  if(input->timeunit==TUNIT_SEC) dftTimeunitConversion(input, TUNIT_MIN);
+  s->input=input; s->logan=logan; s->k2=k2;
+  s->start=start; s->end=end;
+  s->dimz=img->dimz; s->dimy=img->dimy; s->dimx=img->dimx;
+  s->input_auc=nan("");
+
+  /* With image-derived input, the input values at frame times are used as
+     such, and integral is calculated with petintegral() as in img_patlak() */
+  if(input->timetype==DFT_TIME_STARTEND) {
+    s->input_ii=(double*)malloc(input->frameNr*sizeof(double));
+    if(s->input_ii==NULL ||
+       petintegral(input->x1, input->x2, input->voi[0].y, input->frameNr,
+                   s->input_ii, NULL)!=0)
+    {
+      free(s->input_ii); s->input_ii=NULL;
+    }
+  }
+
+  /* Allocate memory for the pixel data */
+  size_t pxlNr=(size_t)s->dimz*s->dimy*s->dimx;
+  s->_fdata=(float*)calloc(4*pxlNr, sizeof(float));
+  s->_ddata=(double*)calloc(6*pxlNr, sizeof(double));
+  if(s->_fdata==NULL || s->_ddata==NULL) {
+    if(status!=NULL) sprintf(status, "out of memory");
+    imgMtgaStreamEmpty(s); return(11);
+  }
+  s->last_y=s->_fdata; s->box=s->last_y+pxlNr; s->auc=s->box+pxlNr;
+  s->auc_fit=s->auc+pxlNr;
+  s->sn=s->_ddata; s->mx=s->sn+pxlNr; s->my=s->mx+pxlNr;
+  s->qxx=s->my+pxlNr; s->qyy=s->qxx+pxlNr; s->qxy=s->qyy+pxlNr;
+  if(status!=NULL) sprintf(status, "ok");
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/// @cond
+/** Input value and integral at the given frame, in min, as in img_patlak(). */
+static int imgMtgaStreamInput(
+  IMG_MTGA_STREAM *s, double t1, double t2, double *i, double *ii
+) {
+  DFT *input=s->input;
+  if(s->input_ii!=NULL) {
+    /* Use the input sample with the same frame times, if available */
+    double accepted_timedif=2.2/60.0;
+    for(int k=0; k<input->frameNr; k++) {
+      if(fabs(input->x1[k]-t1)>accepted_timedif) continue;
+      if(fabs(input->x2[k]-t2)>accepted_timedif) continue;
+      *i=input->voi[0].y[k]; *ii=s->input_ii[k];
+      return(0);
+    }
+  }
+  return(interpolate4pet(input->x, input->voi[0].y, input->frameNr,
+                         &t1, &t2, i, ii, NULL, 1));
+}
+/// @endcond
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Add the next frame of the dynamic image to the pixel-by-pixel Gjedde-Patlak
+    or Logan plot.
+
+    Frames must be added in order, starting from the first frame of the image,
+    also the frames after the line fit range, because the pixel AUCs for the
+    threshold are calculated over the whole image, like in img_patlak() and
+    img_logan().
+    @sa imgMtgaStreamSetup, imgMtgaStreamResult, imgReadFrame
+    @return Returns 0 if successful, 7 if input data does not cover the fit
+     range, and other value >0 in case of an error.
+ */
+int imgMtgaStreamAddFrame(
+  /** Pointer to MTGA stream struct, prepared with imgMtgaStreamSetup(). */
+  IMG_MTGA_STREAM *s,
+  /** Pointer to IMG containing the frame. */
+  IMG *img,
+  /** Index of the frame in the IMG [0..dimt-1]; usually 0. */
+  int frame_index,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose
+) {
+  if(verbose>0) printf("%s(s, img, %d)\n", __func__, frame_index);
+  if(s==NULL || s->_fdata==NULL) return(1);
+  if(img==NULL || img->status!=IMG_STATUS_OCCUPIED) return(2);
+  if(frame_index<0 || frame_index>=img->dimt) return(2);
+  if(img->dimz!=s->dimz || img->dimy!=s->dimy || img->dimx!=s->dimx) return(3);
+
+  const int fi=s->frameNr;
+  const float x1=img->start[frame_index], x2=img->end[frame_index];
+  if(x2-x1<0.0) return(4);
+
+  /* Frame times for the pixel AUCs, as in fpetintegral() */
+  float x=0.5*(x1+x2), last_x=s->last_x, last_x2=s->last_x2;
+  float xdist=x-last_x;
+  if(last_x>0.0 && xdist<=0.0) return(5);
+  if(fi==0 && x1>x2-x1) last_x2=last_x=x1; // big gap in the beginning is eliminated
+  if(fi==s->start) {s->fit_start=x1; s->_fit_start_mid=x;}
+  if(fi==s->end) {
+    s->fit_end=x2;
+    /* Check that input contains samples until at least 80% of line fit range */
+    DFT *input=s->input;
+    if(input->x[input->frameNr-1] < (0.2*s->_fit_start_mid+0.8*x)/60.0) return(7);
+  }
+
+  /* Input data for plot, if frame is inside the fit range */
+  int fit=0;
+  double iv=nan(""), iiv=nan(""), px=nan(""), pi=nan("");
+  if(fi>=s->start && fi<=s->end && x>=0.0) {
+    if(imgMtgaStreamInput(s, x1/60.0, x2/60.0, &iv, &iiv)!=0) return(6);
+    if(fi==s->end) s->input_auc=iiv;
+    fit=1;
+    if(isnan(iv) || isnan(iiv)) fit=0;
+    else if(s->logan==0) {
+      /* as in patlak_block_data() */
+      if(!(iv>-1.0E+20 && iv<+1.0E+20) || !(iiv>-1.0E+20 && iiv<+1.0E+20)) fit=0;
+      else if(iiv<0.0) fit=-1; // earlier points are dropped
+      else if(fabs(iv)<1.0E-12) fit=0;
+      else {
+        px=iiv/iv;
+        if(!(px>-1.0E+20 && px<+1.0E+20) || px<0.0) fit=0;
+      }
+    } else {
+      /* as in logan_block_data() */
+      if(!(iv>-1.0E+30 && iv<+1.0E+30) || !(iiv>-1.0E+30 && iiv<+1.0E+30)) fit=0;
+      else if(s->k2>0.0) pi=iiv+iv/s->k2; else pi=iiv;
+    }
+  }
+  if(verbose>2) printf("frame %d: fit=%d input=%g auc=%g\n", fi+1, fit, iv, iiv);
+
+  /*
+   *  Update pixel AUCs and line fit sums
+   */
+  const int dimy=s->dimy, dimx=s->dimx;
+#pragma omp parallel for schedule(static)
+  for(int zi=0; zi<s->dimz; zi++) {
+    size_t i=(size_t)zi*dimy*dimx;
+    for(int yi=0; yi<dimy; yi++) for(int xi=0; xi<dimx; xi++, i++) {
+      float y=img->m[zi][yi][xi][frame_index];
+      /* pixel AUC from zero to frame middle time, as in fpetintegral() */
+      if(x>=0.0) {
+        float ly=s->last_y[i];
+        float sl=(y-ly)/xdist;
+        float gap=(x1-last_x2)*(ly+sl*((last_x2+x1)/2.0-last_x));
+        float half=(x-x1)*(ly+sl*((x1+x)/2.0-last_x));
+        s->auc[i]=s->box[i]+gap+half;
+        s->box[i]+=gap+(x2-x1)*y;
+        s->last_y[i]=y;
+      }
+      if(fi==s->end) s->auc_fit[i]=s->auc[i]/60.0; // conc*sec -> conc*min
+      if(fit==0) continue;
+      /* plot point of this pixel */
+      double cv=y, pxv, pyv;
+      if(isnan(cv)) continue;
+      if(s->logan==0) {
+        if(!(cv>-1.0E+20 && cv<+1.0E+20)) continue;
+        if(fit<0) { // drop the earlier points
+          s->sn[i]=s->mx[i]=s->my[i]=s->qxx[i]=s->qyy[i]=s->qxy[i]=0.0;
+          continue;
+        }
+        pxv=px; pyv=cv/iv;
+        if(!(pyv>-1.0E+20 && pyv<+1.0E+20)) continue;
+      } else {
+        double civ=s->auc[i]/60.0; // conc*sec -> conc*min
+        if(isnan(civ)) continue;
+        if(!(cv>-1.0E+30 && cv<+1.0E+30)) continue;
+        if(!(civ>-1.0E+30 && civ<+1.0E+30)) continue;
+        if(iiv<0.0 || civ<0.0) { // integrals must have been >=0 all the time
+          s->sn[i]=s->mx[i]=s->my[i]=s->qxx[i]=s->qyy[i]=s->qxy[i]=0.0;
+          continue;
+        }
+        if(fabs(cv)<1.0E-18) continue;
+        pxv=pi/cv; if(!(pxv>-1.0E+30 && pxv<+1.0E+30)) continue;
+        pyv=civ/cv; if(!(pyv>-1.0E+30 && pyv<+1.0E+30)) continue;
+      }
+      /* Welford's update of the means and sums of squared deviations */
+      double n=s->sn[i]+1.0, dx=pxv-s->mx[i], dy=pyv-s->my[i];
+      s->sn[i]=n; s->mx[i]+=dx/n; s->my[i]+=dy/n;
+      s->qxx[i]+=dx*(pxv-s->mx[i]); s->qyy[i]+=dy*(pyv-s->my[i]);
+      s->qxy[i]+=dx*(pyv-s->my[i]);
+    } /* next pixel */
+  } /* next plane */
+
+  if(x>=0.0) {s->last_x=x; s->last_x2=x2;}
+  s->frameNr++;
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Fit the pixel-by-pixel Gjedde-Patlak or Logan plot lines after all frames
+    have been added, and write the results in images like img_patlak() and
+    img_logan() with fit range PRESET.
+    @sa imgMtgaStreamSetup, imgMtgaStreamAddFrame
+    @return Returns 0 if successful, and >0 in case of an error.
+ */
+int imgMtgaStreamResult(
+  /** Pointer to MTGA stream struct, where all frames have been added. */
+  IMG_MTGA_STREAM *s,
+  /** Pointer to one frame of the dynamic image, for image header. */
+  IMG *img,
+  /** Threshold as fraction of input AUC. */
+  float thrs,
+  /** Pointer to initiated IMG structure where Ki (Patlak) or Vt/DVR (Logan)
+      values will be placed. */
+  IMG *slope_img,
+  /** Pointer to initiated IMG structure where plot y axis intercept values
+      (times -1 for Logan plot) will be placed; enter NULL, if not needed. */
+  IMG *ic_img,
+  /** Pointer to initiated IMG structure where the number of plot data points
+      actually used in the fit is written; enter NULL, when not needed. */
+  IMG *nr_img,
+  /** Pointer to a string (allocated for at least 64 chars) where error message
+      or other execution status will be written; enter NULL, if not needed. */
+  char *status,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose
+) {
+  int zi, yi, xi, ret;
+  IMG *rimg[3]={slope_img, ic_img, nr_img};
+
+  if(verbose>0) printf("%s(s, img, %g, ...)\n", __func__, thrs);
+  if(status!=NULL) sprintf(status, "invalid data");
+  if(s==NULL || s->_fdata==NULL || img==NULL || slope_img==NULL) return(1);
+  if(s->frameNr<=s->end) {
+    if(status!=NULL) sprintf(status, "frames missing from the fit range");
+    return(2);
+  }
+  if(!(s->input_auc>-1.0E+30 && s->input_auc<+1.0E+30)) {
+    if(status!=NULL) sprintf(status, "cannot interpolate input data");
+    return(3);
+  }
+
+  /* Allocate result images and fill the header info */
+  for(int ri=0; ri<3; ri++) if(rimg[ri]!=NULL) {
+    imgEmpty(rimg[ri]);
+    ret=imgAllocateWithHeader(rimg[ri], s->dimz, s->dimy, s->dimx, 1, img);
+    if(ret) {
+      if(status!=NULL) sprintf(status, "cannot setup memory for result image");
+      for(int rj=0; rj<=ri; rj++) if(rimg[rj]!=NULL) imgEmpty(rimg[rj]);
+      return(21);
+    }
+    rimg[ri]->decayCorrection=IMG_DC_NONCORRECTED; rimg[ri]->isWeight=0;
+    rimg[ri]->start[0]=s->fit_start; rimg[ri]->end[0]=s->fit_end;
+  }
+  if(s->logan==0) slope_img->unit=CUNIT_ML_PER_ML_PER_MIN;
+  else slope_img->unit=CUNIT_ML_PER_ML;
+  if(ic_img!=NULL) {
+    if(s->logan==0) ic_img->unit=CUNIT_ML_PER_ML; else ic_img->unit=CUNIT_UNITLESS;
+  }
+  if(nr_img!=NULL) nr_img->unit=CUNIT_UNITLESS;
+
+  /* Calculate threshold */
+  thrs*=s->input_auc;
+  if(verbose>1) printf("  threshold-AUC := %g\n", thrs);
+
+  /* Fit the lines */
+  size_t i=0;
+  for(zi=0; zi<s->dimz; zi++) for(yi=0; yi<s->dimy; yi++) for(xi=0; xi<s->dimx; xi++, i++) {
+    double slope, ic, aucrat;
+    slope_img->m[zi][yi][xi][0]=0.0;
+    if(ic_img!=NULL) ic_img->m[zi][yi][xi][0]=0.0;
+    if(nr_img!=NULL) nr_img->m[zi][yi][xi][0]=0.0;
+    if(!(s->auc[i]/60.0>=thrs)) continue;
+    if(mtga_perp_line((int)s->sn[i], s->mx[i], s->my[i], s->qxx[i], s->qyy[i],
+                      s->qxy[i], &slope, &ic, NULL)) continue;
+    if(s->logan!=0) {
+      /* Use 10xAUCratio as upper limit to prevent image where only
+         noise-induced hot spots can be seen */
+      aucrat=s->auc_fit[i]/s->input_auc;
+      if(slope>10.0*aucrat) slope=10.0*aucrat;
+      ic=-ic;
+    }
+    slope_img->m[zi][yi][xi][0]=slope;
+    if(ic_img!=NULL) ic_img->m[zi][yi][xi][0]=ic;
+    if(nr_img!=NULL) nr_img->m[zi][yi][xi][0]=s->sn[i];
+  }
+
+  if(status!=NULL) sprintf(status, "ok");
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/// @cond
+/** Read the dynamic image frame-by-frame and compute Patlak or Logan plot. */
+static int img_mtga_stream(
+  DFT *input, const char *petfile, int start, int end, float thrs, int logan,
+  double k2, IMG *slope_img, IMG *ic_img, IMG *nr_img, char *status, int verbose
+) {
+  IMG img;
+  IMG_MTGA_STREAM s;
+  int fi=0, ret;
+
+  if(petfile==NULL) return(1);
+  imgInit(&img); imgMtgaStreamInit(&s);
+  while((ret=imgReadFrame(petfile, fi+1, &img, 0)) == 0) {
+    if(fi==0) {
+      ret=imgMtgaStreamSetup(&s, input, &img, start, end, logan, k2, status,
+                             verbose-1);
+      if(ret) {imgEmpty(&img); return(ret);}
+    }
+    ret=imgMtgaStreamAddFrame(&s, &img, 0, verbose-1);
+    if(ret) {
+      if(status!=NULL) {
+        if(ret==7) sprintf(status, "too few input samples");
+        else sprintf(status, "invalid frame %d", fi+1);
+      }
+      imgEmpty(&img); imgMtgaStreamEmpty(&s); return(30+ret);
+    }
+    fi++;
+  } /* next frame */
+  if(ret!=STATUS_NOMATRIX || fi==0) {
+    if(status!=NULL) sprintf(status, "cannot read %s", petfile);
+    imgEmpty(&img); imgMtgaStreamEmpty(&s); return(7);
+  }
+  if(verbose>1) printf("%d frames processed\n", fi);
+  ret=imgMtgaStreamResult(&s, &img, thrs, slope_img, ic_img, nr_img, status,
+                          verbose-1);
+  imgEmpty(&img); imgMtgaStreamEmpty(&s);
+  return(ret);
+}
+/// @endcond
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Computing pixel-by-pixel the Gjedde-Patlak plot like img_patlak() with fit
+    range PRESET, reading the dynamic image file one frame at a time, thus
+    the whole dynamic image is never kept in memory.
+    @sa img_patlak, img_logan_stream, imgMtgaStreamSetup
+    @return Returns 0 if successful, and >0 in case of an error.
+ */
+int img_patlak_stream(
+  /** Pointer to the TAC data to be used as model input. Sample times in minutes.
+      Curve is interpolated to PET frame times, if necessary. */
+  DFT *input,
+  /** Name of dynamic PET image file, in a format supported by imgReadFrame().
+      Image and input data must be in the same calibration units. */
+  const char *petfile,
+  /** The range of frames where line is fitted, given as the frame start here
+      and next the end index, i.e. [0..frame_nr-1]. */
+  int start,
+  /** The range of frames where line is fitted, given as the frame start above
+      and here the end index, i.e. [0..frame_nr-1]. */
+  int end,
+  /** Threshold as fraction of input AUC. */
+  float thrs,
+  /** Pointer to initiated IMG structure where Ki values will be placed. */
+  IMG *ki_img,
+  /** Pointer to initiated IMG structure where plot y axis intercept values
+      will be placed; enter NULL, if not needed. */
+  IMG *ic_img,
+  /** Pointer to initiated IMG structure where the number of plot data points
+      actually used in the fit is written; enter NULL, when not needed. */
+  IMG *nr_img,
+  /** Pointer to a string (allocated for at least 64 chars) where error message
+      or other execution status will be written; enter NULL, if not needed. */
+  char *status,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose
+) {
+  if(verbose>0) printf("%s(input, %s, %d, %d, %g, ...)\n", __func__, petfile, start, end, thrs);
+  return(img_mtga_stream(input, petfile, start, end, thrs, 0, 0.0,
+                         ki_img, ic_img, nr_img, status, verbose));
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Computing pixel-by-pixel the Logan plot like img_logan() with fit
+    range PRESET, reading the dynamic image file one frame at a time, thus
+    the whole dynamic image is never kept in memory.
+    @sa img_logan, img_patlak_stream, imgMtgaStreamSetup
+    @return Returns 0 if successful, and >0 in case of an error.
+ */
+int img_logan_stream(
+  /** Pointer to the TAC data to be used as model input. Sample times in minutes.
+      Curve is interpolated to PET frame times, if necessary. */
+  DFT *input,
+  /** Name of dynamic PET image file, in a format supported by imgReadFrame().
+      Image and input data must be in the same calibration units. */
+  const char *petfile,
+  /** The range of frames where line is fitted, given as the frame start here
+      and next the end index, i.e. [0..frame_nr-1]. */
+  int start,
+  /** The range of frames where line is fitted, given as the frame start above
+      and here the end index, i.e. [0..frame_nr-1]. */
+  int end,
+  /** Threshold as fraction of input AUC. */
+  float thrs,
+  /** Reference region k2; set to <=0 if not needed. */
+  double k2,
+  /** Pointer to initiated IMG structure where Vt (or DVR) values will be placed. */
+  IMG *vt_img,
+  /** Pointer to initiated IMG structure where plot y axis intercept values
+      times -1 will be placed; enter NULL, if not needed. */
+  IMG *ic_img,
+  /** Pointer to initiated IMG structure where the number of plot data points
+      actually used in the fit is written; enter NULL, when not needed. */
+  IMG *nr_img,
+  /** Pointer to a string (allocated for at least 64 chars) where error message
+      or other execution status will be written; enter NULL, if not needed. */
+  char *status,
+  /** Verbose level; if zero, then nothing is printed to stderr or stdout. */
+  int verbose
+) {
+  if(verbose>0) printf("%s(input, %s, %d, %d, %g, %g, ...)\n", __func__, petfile, start, end, thrs, k2);
+  return(img_mtga_stream(input, petfile, start, end, thrs, 1, k2,
+                         vt_img, ic_img, nr_img, status, verbose));
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
@@ -15,6 +15,14 @@ extern "C" int patlak_c(unsigned int frameNr, double *t0, double *t1,double *tac
                unsigned int llsq_model,
                unsigned int isweight, double *weights) ;
 
+extern "C" int patlak_plot_c(unsigned int frameNr, double *t0, double *t1, double *ctt,
+               double tstart, double tstop, double *theta, double *ci, int *mode,
+               int *first, int *last, int verbose);
+
+extern "C" int patlak_block_c(int frameNr, int first, int last, double *theta,
+               double *ci, int *mode, int tac_nr, float **tac, double *x, double *y,
+               double *work, double *ki, double *ic, double *kisd, int *nr);
+
 extern "C" double Func (const arma::vec& vals_inp, arma::vec* grad_out, void* opt_data);
 
 extern "C" int main(int argc, float* argv[]);
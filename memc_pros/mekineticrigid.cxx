@@ -8,6 +8,9 @@
 #include <iostream>
 #include <stdlib.h>
 #include <iomanip>
+#include <cmath>
+#include <algorithm>
+#include <vector>
 #include "optim.hpp"
 #include "spline.h"
 // #include "tgo.h"
@@ -22,6 +25,24 @@ namespace sitk = itk::simple;
 
 
 
+// contiguous copy of the dynamic image and the voxel-independent Patlak
+// plot data, filled once in meKineticRigid for the buffered objective
+//
+struct ll_buffer
+{
+	std::vector<float> frames;    // frame-major, frames[iframe*nvox + voxel]
+	int dims[3];
+	double spacing[3];
+	double origin[3];
+	double direction[9];
+	double invdirection[9];
+	std::vector<double> theta;    // Patlak plot x, per frame
+	std::vector<double> ci;       // input at frame times
+	std::vector<int> mode;        // see patlak_plot_c()
+	int first;
+	int last;
+};
+
 // global
 //
 struct ll_data
@@ -41,6 +62,7 @@ struct ll_data
 	double *plasma_t;
 	double *plasma_c;
     sitk::Image imgs;
+	ll_buffer *buffer;    // NULL: evaluate through SimpleITK
 };
 // Definition of IDL string
 typedef struct{
@@ -51,16 +73,267 @@ typedef struct{
 
 
 
+// b-spline interpolate the rigid motion of the fitted frames (Findex) to
+// every frame; rigmotions gets nframe*6 values
+static void InterpolateMotion(ll_data *objfn_data, double *vals, std::vector<float> &rigmotions)
+{
+	int nframe = objfn_data->nframe;
+	int pparNr = (objfn_data->parNr)/6;
+	int *index = objfn_data->index;
+	int *Findex = objfn_data->Findex;
+
+	std::vector<double> X(pparNr),Y1(pparNr),Y2(pparNr),Y3(pparNr),Y4(pparNr),Y5(pparNr),Y6(pparNr);
+	std::vector<float> rigmotions1(nframe);
+	std::vector<float> rigmotions2(nframe);
+	std::vector<float> rigmotions3(nframe);
+	std::vector<float> rigmotions4(nframe);
+	std::vector<float> rigmotions5(nframe);
+	std::vector<float> rigmotions6(nframe);
+
+	for(int iframe=0;iframe<nframe;iframe++ ) {
+		int tmpIndex = index[iframe];     // - 1;
+		rigmotions1[iframe] = vals[tmpIndex*6];
+		rigmotions2[iframe] = vals[tmpIndex*6+1];
+		rigmotions3[iframe] = vals[tmpIndex*6+2];
+		rigmotions4[iframe] = vals[tmpIndex*6+3];
+		rigmotions5[iframe] = vals[tmpIndex*6+4];
+		rigmotions6[iframe] = vals[tmpIndex*6+5];
+	}
+
+	// interpoalte for each individual frame
+	for (int ipar=0;ipar<pparNr;ipar++  ) {
+		int tmpIndex2 = Findex[ipar];      // - 1;
+		X[ipar] = objfn_data->plasma_t[tmpIndex2];
+		Y1[ipar] = rigmotions1[tmpIndex2];
+		Y2[ipar] = rigmotions2[tmpIndex2];
+		Y3[ipar] = rigmotions3[tmpIndex2];
+		Y4[ipar] = rigmotions4[tmpIndex2];
+		Y5[ipar] = rigmotions5[tmpIndex2];
+		Y6[ipar] = rigmotions6[tmpIndex2];
+	}
+
+	tk::spline s1; s1.set_points(X,Y1); tk::spline s2; s2.set_points(X,Y2);
+	tk::spline s3; s3.set_points(X,Y3); tk::spline s4; s4.set_points(X,Y4);
+	tk::spline s5; s5.set_points(X,Y5); tk::spline s6; s6.set_points(X,Y6);
+
+	rigmotions.resize(nframe*6);
+	for (int iframe=0;iframe<nframe;iframe++) {
+		rigmotions[iframe*6]   = s1(objfn_data->plasma_t[iframe]);
+		rigmotions[iframe*6+1] = s2(objfn_data->plasma_t[iframe]);
+		rigmotions[iframe*6+2] = s3(objfn_data->plasma_t[iframe]);
+		rigmotions[iframe*6+3] = s4(objfn_data->plasma_t[iframe]);
+		rigmotions[iframe*6+4] = s5(objfn_data->plasma_t[iframe]);
+		rigmotions[iframe*6+5] = s6(objfn_data->plasma_t[iframe]);
+	}
+}
+
+
+
+// copy the image into ll_buffer and prepare the Patlak plot; returns 0 when
+// the buffered objective can be used
+static int PrepareBuffer(ll_data *opt_data, ll_buffer *buf)
+{
+	sitk::Image imgs = opt_data->imgs;
+	if (imgs.GetDimension() != 4) { return 1; }
+	if (imgs.GetPixelID() != sitk::sitkFloat32) { imgs = sitk::Cast(imgs, sitk::sitkFloat32); }
+
+	std::vector<unsigned int> size = imgs.GetSize();
+	std::vector<double> spacing = imgs.GetSpacing();
+	std::vector<double> origin = imgs.GetOrigin();
+	std::vector<double> direction = imgs.GetDirection();     // 4x4, row-major
+	if ((int)size[3] != opt_data->nframe) { return 2; }
+
+	for (int i=0;i<3;i++) {
+		buf->dims[i] = size[i];
+		buf->spacing[i] = spacing[i];
+		buf->origin[i] = origin[i];
+		for (int j=0;j<3;j++) { buf->direction[i*3+j] = direction[i*4+j]; }
+	}
+	const double *d = buf->direction;
+	double det = d[0]*(d[4]*d[8]-d[5]*d[7]) - d[1]*(d[3]*d[8]-d[5]*d[6]) + d[2]*(d[3]*d[7]-d[4]*d[6]);
+	if (fabs(det) < 1.0e-12) { return 3; }
+	double *id = buf->invdirection;
+	id[0] = (d[4]*d[8]-d[5]*d[7])/det;  id[1] = (d[2]*d[7]-d[1]*d[8])/det;  id[2] = (d[1]*d[5]-d[2]*d[4])/det;
+	id[3] = (d[5]*d[6]-d[3]*d[8])/det;  id[4] = (d[0]*d[8]-d[2]*d[6])/det;  id[5] = (d[2]*d[3]-d[0]*d[5])/det;
+	id[6] = (d[3]*d[7]-d[4]*d[6])/det;  id[7] = (d[1]*d[6]-d[0]*d[7])/det;  id[8] = (d[0]*d[4]-d[1]*d[3])/det;
+
+	int nframe = opt_data->nframe;
+	buf->theta.resize(nframe);
+	buf->ci.resize(nframe);
+	buf->mode.resize(nframe);
+	int ret = patlak_plot_c(nframe, opt_data->plasma_tt, opt_data->plasma_t, opt_data->plasma_c,
+	                        (double)opt_data->tstart, (double)opt_data->tstop, &buf->theta[0], &buf->ci[0],
+	                        &buf->mode[0], &buf->first, &buf->last, 0);
+	if (ret != 0) { return 4; }
+
+	size_t nvox = (size_t)size[0]*size[1]*size[2];
+	const float *pixels = imgs.GetBufferAsFloat();
+	buf->frames.assign(pixels, pixels + nvox*nframe);
+	return 0;
+}
+
+
+
+// index-space form of the Euler3DTransform that Func0 builds for a frame:
+// the input continuous index of output voxel i is A*i + b, stored as
+// a[0..8] = A (row-major) and a[9..11] = b
+static void FrameAffine(const ll_buffer *buf, const double *motion, double *a)
+{
+	// Euler3DTransform, default ZXY order: R = Rz*Rx*Ry
+	double cx = cos(motion[0]), sx = sin(motion[0]);
+	double cy = cos(motion[1]), sy = sin(motion[1]);
+	double cz = cos(motion[2]), sz = sin(motion[2]);
+	double R[9] = { cz*cy - sz*sx*sy, -sz*cx, cz*sy + sz*sx*cy,
+	                sz*cy + cz*sx*sy,  cz*cx, sz*sy - cz*sx*cy,
+	                -cx*sy,            sx,    cx*cy };
+	const double *D = buf->direction, *Di = buf->invdirection;
+	const double *s = buf->spacing, *o = buf->origin;
+
+	// rotation centre: physical point of continuous index dims/2
+	double c[3], u[3], q[3], RD[9], M[9];
+	for (int i=0;i<3;i++) { u[i] = s[i]*buf->dims[i]/2.0; }
+	for (int i=0;i<3;i++) { c[i] = o[i] + D[i*3]*u[0] + D[i*3+1]*u[1] + D[i*3+2]*u[2]; }
+
+	for (int i=0;i<3;i++) for (int j=0;j<3;j++) {
+		RD[i*3+j] = R[i*3]*D[j] + R[i*3+1]*D[3+j] + R[i*3+2]*D[6+j]; }
+	for (int i=0;i<3;i++) for (int j=0;j<3;j++) {
+		M[i*3+j] = Di[i*3]*RD[j] + Di[i*3+1]*RD[3+j] + Di[i*3+2]*RD[6+j]; }
+	for (int i=0;i<3;i++) for (int j=0;j<3;j++) { a[i*3+j] = M[i*3+j]*s[j]/s[i]; }
+
+	// b = S^-1 D^-1 (R(o-c) + c + t - o)
+	for (int i=0;i<3;i++) {
+		q[i] = R[i*3]*(o[0]-c[0]) + R[i*3+1]*(o[1]-c[1]) + R[i*3+2]*(o[2]-c[2]) + c[i] + motion[3+i] - o[i]; }
+	for (int i=0;i<3;i++) { a[9+i] = (Di[i*3]*q[0] + Di[i*3+1]*q[1] + Di[i*3+2]*q[2])/s[i]; }
+}
+
+
+
+// linear interpolation at a continuous index with the conventions of
+// sitk::Resample: zero outside [-0.5, size-0.5), edge voxels repeated inside
+static inline float Trilinear(const float *vol, const int *dims, double jx, double jy, double jz)
+{
+	const int nx = dims[0], ny = dims[1], nz = dims[2];
+	const bool inside = jx >= -0.5 && jx < nx-0.5 && jy >= -0.5 && jy < ny-0.5 && jz >= -0.5 && jz < nz-0.5;
+	double bx = std::min(std::max(std::floor(jx), -1.0), (double)nx);
+	double by = std::min(std::max(std::floor(jy), -1.0), (double)ny);
+	double bz = std::min(std::max(std::floor(jz), -1.0), (double)nz);
+	double fx = jx - bx, fy = jy - by, fz = jz - bz;
+	int x0 = std::min(std::max((int)bx, 0), nx-1), x1 = std::min(std::max((int)bx+1, 0), nx-1);
+	int y0 = std::min(std::max((int)by, 0), ny-1), y1 = std::min(std::max((int)by+1, 0), ny-1);
+	int z0 = std::min(std::max((int)bz, 0), nz-1), z1 = std::min(std::max((int)bz+1, 0), nz-1);
+	const float *p00 = vol + ((size_t)z0*ny + y0)*nx, *p01 = vol + ((size_t)z0*ny + y1)*nx;
+	const float *p10 = vol + ((size_t)z1*ny + y0)*nx, *p11 = vol + ((size_t)z1*ny + y1)*nx;
+	double v00 = p00[x0] + fx*(p00[x1]-p00[x0]);
+	double v01 = p01[x0] + fx*(p01[x1]-p01[x0]);
+	double v10 = p10[x0] + fx*(p10[x1]-p10[x0]);
+	double v11 = p11[x0] + fx*(p11[x1]-p11[x0]);
+	double v0 = v00 + fy*(v01-v00), v1 = v10 + fy*(v11-v10);
+	return inside ? (float)(v0 + fz*(v1-v0)) : 0.0f;
+}
+
+
+
+// Func0 on ll_buffer: frames are resampled row by row into a voxel-major
+// TAC tile, the foreground TACs of the row are Patlak fitted as one block
+// and their KiSD summed, without SimpleITK
+static double Func0Buffer(ll_data *objfn_data, double *vals)
+{
+	const ll_buffer *buf = objfn_data->buffer;
+	const int nframe = objfn_data->nframe;
+	const int *index = objfn_data->index;
+	const int nx = buf->dims[0], ny = buf->dims[1], nz = buf->dims[2];
+	const size_t nvox = (size_t)nx*ny*nz;
+	const long nrow = (long)ny*nz;
+
+	std::vector<float> rigmotions;
+	if (objfn_data->slowmotion) { InterpolateMotion(objfn_data, vals, rigmotions); }
+
+	std::vector<double> affine(nframe*12);
+	for (int iframe=0;iframe<nframe;iframe++) {
+		if (index[iframe] == 0) { continue; }
+		double motion[6];
+		for (int i=0;i<6;i++) {
+			motion[i] = objfn_data->slowmotion ? rigmotions[iframe*6+i] : vals[index[iframe]*6+i]; }
+		FrameAffine(buf, motion, &affine[iframe*12]);
+	}
+
+	double *theta = const_cast<double*>(&buf->theta[0]);
+	double *ci = const_cast<double*>(&buf->ci[0]);
+	int *mode = const_cast<int*>(&buf->mode[0]);
+
+	// per-row sums, added in row order so the result does not depend on threads
+	std::vector<double> rowvar(nrow, 0.0);
+	const int ndata = buf->last - buf->first + 1;
+	long nfailed = 0;
+#pragma omp parallel reduction(+:nfailed)
+	{
+		std::vector<float> tile((size_t)nx*nframe);
+		std::vector<float*> tacs(nx);
+		std::vector<double> plotx((size_t)ndata*nx), ploty((size_t)ndata*nx), work(6*nx);
+		std::vector<double> ki(nx), ic(nx), kisd(nx);
+		std::vector<int> nr(nx);
+#pragma omp for schedule(dynamic,4)
+		for (long row=0;row<nrow;row++) {
+			const double jrow = (double)(row % ny), jplane = (double)(row / ny);
+			for (int iframe=0;iframe<nframe;iframe++) {
+				const float *vol = &buf->frames[(size_t)iframe*nvox];
+				float *dst = &tile[iframe];
+				if (index[iframe] == 0) {
+					const float *src = vol + (size_t)row*nx;
+					for (int jcol=0;jcol<nx;jcol++) { dst[(size_t)jcol*nframe] = src[jcol]; }
+					continue;
+				}
+				const double *a = &affine[iframe*12];
+				const double bx = a[1]*jrow + a[2]*jplane + a[9];
+				const double by = a[4]*jrow + a[5]*jplane + a[10];
+				const double bz = a[7]*jrow + a[8]*jplane + a[11];
+#pragma omp simd
+				for (int jcol=0;jcol<nx;jcol++) {
+					dst[(size_t)jcol*nframe] = Trilinear(vol, buf->dims, bx + a[0]*jcol, by + a[3]*jcol, bz + a[6]*jcol); }
+			}
+
+			int ntac = 0;
+			for (int jcol=0;jcol<nx;jcol++) {
+				float *tac = &tile[(size_t)jcol*nframe];
+				double tacsum = 0.0;
+				for (int iframe=0;iframe<nframe;iframe++) { tacsum += tac[iframe]; }
+				if (tacsum < 0.1) { continue; }      // skip the background
+				tacs[ntac++] = tac;
+			}
+			if (ntac == 0) { continue; }
+
+			// Patlak fit of all foreground voxels of the row at once; a voxel
+			// whose line could not be fitted has nr 0 and adds nothing
+			if (patlak_block_c(nframe, buf->first, buf->last, theta, ci, mode, ntac, &tacs[0],
+			                   &plotx[0], &ploty[0], &work[0], &ki[0], &ic[0], &kisd[0], &nr[0]) != 0) {
+				nfailed += ntac; continue; }
+			double var = 0.0;
+			for (int j=0;j<ntac;j++) {
+				if (nr[j] == 0) { nfailed++; continue; }
+				var += fabs(kisd[j]); }
+			rowvar[row] = var;
+		}
+	}
+	if (nfailed > 0) { printf("patlak fitting error in %ld voxels! \n", nfailed); }
+
+	double var = 0.0;
+	for (long row=0;row<nrow;row++) { var += rowvar[row]; }
+	return var;
+}
+
+
+
 extern "C" double Func0(int parNr, double *vals, void *opt_data)
 {
 // printf("evaluate func once...");
 	const char *debugfile  = "debug.txt";
 	ll_data* objfn_data = reinterpret_cast<ll_data*>(opt_data);
 	int verbose = objfn_data->verbose;
+	// verbose runs write the intermediate images, which needs SimpleITK
+	if (verbose != 1 && objfn_data->buffer != NULL) { return Func0Buffer(objfn_data, vals); }
 	int slowmotion = objfn_data->slowmotion;
 	int nframe = objfn_data->nframe;
 	// int parNr  = objfn_data->parNr;
-	int pparNr = (objfn_data->parNr)/6;
 	int *index = objfn_data->index; 
 	int *Findex = objfn_data->Findex;
 	float *rigmotion = objfn_data->rigmotion;
@@ -68,52 +341,8 @@ extern "C" double Func0(int parNr, double *vals, void *opt_data)
 	std::vector<unsigned int> dims = imgs.GetSize();
 	sitk::Image imgs1 = sitk::Image( dims , sitk::sitkFloat32);
 
-	std::vector<float> rigmotions(nframe*6);    //nframe*6
-	std::vector<double> X(pparNr),Y1(pparNr),Y2(pparNr),Y3(pparNr),Y4(pparNr),Y5(pparNr),Y6(pparNr);
-    if (slowmotion) {
-		// b-spline interpoolate rigmotion
-		std::vector<float> rigmotions1(nframe); 
-		std::vector<float> rigmotions2(nframe); 
-		std::vector<float> rigmotions3(nframe); 
-		std::vector<float> rigmotions4(nframe); 
-		std::vector<float> rigmotions5(nframe); 
-		std::vector<float> rigmotions6(nframe); 
-
-		for(int iframe=0;iframe<nframe;iframe++ ) { 
-			int tmpIndex = index[iframe];     // - 1;
-			rigmotions1[iframe] = vals[tmpIndex*6];
-			rigmotions2[iframe] = vals[tmpIndex*6+1];
-			rigmotions3[iframe] = vals[tmpIndex*6+2];
-			rigmotions4[iframe] = vals[tmpIndex*6+3];
-			rigmotions5[iframe] = vals[tmpIndex*6+4];
-			rigmotions6[iframe] = vals[tmpIndex*6+5]; printf("%d \n", iframe);
-		}
-
-		// interpoalte for each individual frame
-		for (int ipar;ipar<pparNr;ipar++  ) {
-			int tmpIndex2 = Findex[ipar];      // - 1;
-			X[ipar] = objfn_data->plasma_t[tmpIndex2]; 
-			Y1[ipar] = rigmotions1[tmpIndex2]; 
-			Y2[ipar] = rigmotions2[tmpIndex2]; 
-			Y3[ipar] = rigmotions3[tmpIndex2]; 
-			Y4[ipar] = rigmotions4[tmpIndex2]; 
-			Y5[ipar] = rigmotions5[tmpIndex2]; 
-			Y6[ipar] = rigmotions6[tmpIndex2]; 
-		}
-
-		tk::spline s1; s1.set_points(X,Y1); tk::spline s2; s2.set_points(X,Y2);
-		tk::spline s3; s3.set_points(X,Y3); tk::spline s4; s4.set_points(X,Y4);
-		tk::spline s5; s5.set_points(X,Y5); tk::spline s6; s6.set_points(X,Y6);
-
-		for (int iframe=0;iframe<nframe;iframe++) {
-			rigmotions[iframe*6]   = s1(objfn_data->plasma_t[iframe]);
-			rigmotions[iframe*6+1] = s2(objfn_data->plasma_t[iframe]);
-			rigmotions[iframe*6+2] = s3(objfn_data->plasma_t[iframe]);
-			rigmotions[iframe*6+3] = s4(objfn_data->plasma_t[iframe]);
-			rigmotions[iframe*6+4] = s5(objfn_data->plasma_t[iframe]);
-			rigmotions[iframe*6+5] = s6(objfn_data->plasma_t[iframe]);printf("%d \n", iframe);
-		}
-	}
+	std::vector<float> rigmotions;
+	if (slowmotion) { InterpolateMotion(objfn_data, vals, rigmotions); }
 
     // sitk::Image resampled_vectorout(dims,sitk::sitkVectorFloat32,objfn_data->nframe);
 	std::vector<sitk::Image> resampled_vectorout;
@@ -350,6 +579,7 @@ extern "C"  int meKineticRigid(int argc, float* argv[])     //meKineticRigid
 	opt_data.Findex      =  (int *)   argv[13];
 	opt_data.verbose     =  *(int *)   argv[14];
 	opt_data.slowmotion  =  *(int *)   argv[15];
+	opt_data.buffer      =  NULL;
 
 
 
@@ -358,6 +588,12 @@ extern "C"  int meKineticRigid(int argc, float* argv[])     //meKineticRigid
 	reader.SetFileName( imgfilename );
 	opt_data.imgs = reader.Execute();
 
+	// frame-major copy of the image for the buffered objective
+	ll_buffer buffer;
+	int bufret = PrepareBuffer(&opt_data, &buffer);
+	if (bufret == 0) { opt_data.buffer = &buffer; }
+	else { printf("meKineticRigid: buffered evaluation not available (%d), using SimpleITK \n", bufret); }
+
     if (opt_data.verbose == 1 ) {
 		FILE *pfile = fopen(debugfile, "a+");
 		fprintf(pfile, "test, %d supplied\n", argc);
@@ -558,6 +558,7 @@ extern "C" int patlak_c(unsigned int frameNr, double *t0, double *t1,double *tac
 
   // clean memory! dftEmpty(&temp);
   resEmpty(&res); dftEmpty(&input); dftEmpty(&data); 
+  return(1);
 
 
 //  fclose(pfile);
@@ -568,3 +569,114 @@ extern "C" int patlak_c(unsigned int frameNr, double *t0, double *t1,double *tac
   //  free(ct)  ;
   //  free(t)  ;  
 }
+/*****************************************************************************/
+
+/*****************************************************************************/
+/**
+ *  Voxel-independent part of the Patlak plot.
+ *
+ *  Interpolates and integrates the input curve at the PET frame times as
+ *  patlak_c() does, and stores for each frame the plot x value (theta), the
+ *  interpolated input concentration (ci) and how the frame enters the
+ *  traditional regression of patlak_c(): mode 0 = never, 1 = always,
+ *  2 = only if its dv does not exceed the dv of the last frame (the
+ *  close-to-zero check of the first frames, which depends on the TAC).
+ *  @return 0 if successful, otherwise the error codes of patlak_c().
+ */
+extern "C" int patlak_plot_c(unsigned int frameNr, double *t0, double *t1, double *ctt,
+               double tstart, double tstop, double *theta, double *ci, int *mode,
+               int *first, int *last, int verbose)
+{
+  DFT        data, input, temp;
+  int        fi, ret, dataNr, n=(int)frameNr;
+  double    *ici;
+
+  if(n<1 || t0==NULL || t1==NULL || ctt==NULL) return(1);
+  if(theta==NULL || ci==NULL || mode==NULL || first==NULL || last==NULL) return(1);
+
+  dftInit(&data); dftInit(&input); dftInit(&temp);
+  if(dftSetmem(&data, n, 1) || dftSetmem(&temp, n, 1) || dftSetmem(&input, n, 1)) {
+    printf("out of memory\n");
+    dftEmpty(&data); dftEmpty(&temp); dftEmpty(&input); return(3);
+  }
+  data.voiNr=temp.voiNr=1; data.frameNr=temp.frameNr=n;
+  data._type=temp._type=DFT_FORMAT_PLAIN;
+  data.timeunit=temp.timeunit=2;
+  data.timetype=temp.timetype=3;
+  for(fi=0; fi<n; fi++) {
+    data.x1[fi]=temp.x1[fi]=t0[fi];
+    data.x2[fi]=temp.x2[fi]=t1[fi];
+    data.x[fi]=temp.x[fi]=0.5*(t0[fi]+t1[fi]);
+    data.voi[0].y[fi]=0.0;
+    temp.voi[0].y[fi]=ctt[fi];
+  }
+
+  /* Interpolate and integrate input to pet times */
+  ret=dftInterpolate(&temp, &data, &input, NULL, verbose);
+  dftEmpty(&temp);
+  if(ret!=0) {dftEmpty(&data); dftEmpty(&input); return(4);}
+
+  /* Get and check fit time range */
+  ret=dftTimeunitConversion(&data, TUNIT_MIN);
+  if(ret) printf( "Warning: check that regional data times are in minutes.");
+  dataNr=fittime_from_dft(&data, &tstart, &tstop, first, last, verbose-8);
+  if(dataNr<2) {
+    printf( "Error: cannot make plot from less than 2 points.");
+    dftEmpty(&data); dftEmpty(&input); return(2);
+  }
+
+  /* Plot x values and the frames taking part in the fit */
+  ici=input.voi[0].y2;
+  for(fi=n-1; fi>=0; fi--) {
+    ci[fi]=input.voi[0].y[fi];
+    if(ci[fi]==0.0) {theta[fi]=0.0; mode[fi]=0; continue;}
+    theta[fi]=ici[fi]/ci[fi]; mode[fi]=1;
+    if(data.x[fi]<0.1*data.x[n-1]) {
+      if(theta[fi]>theta[n-1]) {theta[fi]=0.0; mode[fi]=0;} else mode[fi]=2;
+    }
+  }
+  /* Set x weight to 0, if integral is still <=0 */
+  for(fi=n-1; fi>=0; fi--) if(ici[fi]<=0.0) break;
+  for(; fi>=0; fi--) mode[fi]=0;
+
+  dftEmpty(&input); dftEmpty(&data);
+  return(0);
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/**
+ *  Traditional Patlak regression (llsq_model 0 in patlak_c()) of a block of
+ *  TACs, using the plot data from patlak_plot_c().
+ *  Plot data of the fit range is written frame-major into x and y (size
+ *  (last-first+1)*tac_nr each) and the lines are fitted with mtga_block_fit(),
+ *  so ki, ic and kisd equal output[0..2] of patlak_c() for the same TACs.
+ *  Work memory must hold 6*tac_nr doubles.
+ *  @return 0 if successful, otherwise >0.
+ */
+extern "C" int patlak_block_c(int frameNr, int first, int last, double *theta,
+               double *ci, int *mode, int tac_nr, float **tac, double *x, double *y,
+               double *work, double *ki, double *ic, double *kisd, int *nr)
+{
+  int        fi, j, dataNr=last-first+1;
+  double     dv, *xr, *yr;
+
+  if(frameNr<1 || first<0 || last>=frameNr || dataNr<1 || tac_nr<1) return(1);
+  if(theta==NULL || ci==NULL || mode==NULL || tac==NULL) return(1);
+
+  for(fi=first; fi<=last; fi++) {
+    xr=x+(size_t)(fi-first)*tac_nr; yr=y+(size_t)(fi-first)*tac_nr;
+    for(j=0; j<tac_nr; j++) {
+      xr[j]=yr[j]=nan("");
+      if(mode[fi]==0) continue;
+      dv=(double)tac[j][fi]/ci[fi];
+      if(mode[fi]==2) {
+        /* close-to-zero check against the last frame of this TAC */
+        if(dv>(ci[frameNr-1]!=0.0 ? (double)tac[j][frameNr-1]/ci[frameNr-1] : 0.0)) continue;
+      }
+      xr[j]=theta[fi]; yr[j]=dv;
+    }
+  }
+  return(mtga_block_fit(dataNr, tac_nr, x, y, PEARSON, ki, ic, kisd, NULL, nr, work));
+}
+/*****************************************************************************/
@@ -0,0 +1,258 @@
+/** @file convolut.c
+ *  @brief Linear convolution for discrete data, using FFT with long data.
+ */
+/*****************************************************************************/
+#include "tpcclibConfig.h"
+/*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <string.h>
+/*****************************************************************************/
+#include "tpccm.h"
+/*****************************************************************************/
+#ifndef CONVOLUT_FFT_LIMIT
+/** Direct convolution is used when n*m is smaller than this, FFT otherwise. */
+#define CONVOLUT_FFT_LIMIT 65536.0
+#endif
+#ifndef CONVOLUT_PLAN_NR
+/** Nr of FFT plans (one per FFT length) that are kept in the cache. */
+#define CONVOLUT_PLAN_NR 8
+#endif
+/*****************************************************************************/
+/// @cond
+/** Precomputed tables for radix-2 FFT of one length. */
+typedef struct {
+  /** FFT length, power of two */
+  int N;
+  /** Bit-reversal permutation, N items */
+  int *rev;
+  /** Cosines and sines of the twiddle factors, N/2 items each */
+  double *c, *s;
+} CONVOLUT_PLAN;
+/** Plans cached by FFT length; created when first needed, read-only after that. */
+static CONVOLUT_PLAN convolutPlan[CONVOLUT_PLAN_NR];
+static int convolutPlanNr=0;
+/// @endcond
+/*****************************************************************************/
+
+/*****************************************************************************/
+/// @cond
+/** Direct convolution sum, for the first n samples. */
+static void convolveDirect(
+  double *data, const int n, double *kernel, const int m, double *out
+) {
+  for(int di=0; di<n; di++) {
+    double sum=0.0;
+    int kn=(di<m-1) ? di+1 : m;
+    for(int k=0; k<kn; k++) sum+=data[di-k]*kernel[k];
+    out[di]=sum;
+  }
+}
+
+/** Compute the FFT tables for length N.
+    @return 0 when successful, otherwise 1.
+ */
+static int convolutMakePlan(CONVOLUT_PLAN *p, const int N)
+{
+  p->rev=(int*)malloc(N*sizeof(int));
+  p->c=(double*)malloc(N*sizeof(double));
+  if(p->rev==NULL || p->c==NULL) {free(p->rev); free(p->c); return 1;}
+  p->N=N; p->s=p->c+N/2;
+  int bits=0; while((1<<bits)<N) bits++;
+  for(int i=0; i<N; i++) {
+    int r=0;
+    for(int b=0; b<bits; b++) if(i&(1<<b)) r|=1<<(bits-1-b);
+    p->rev[i]=r;
+  }
+  for(int i=0; i<N/2; i++) {
+    p->c[i]=cos(2.0*M_PI*(double)i/(double)N);
+    p->s[i]=-sin(2.0*M_PI*(double)i/(double)N);
+  }
+  return 0;
+}
+
+/** Get the FFT plan for length N from cache, making it if necessary.
+    Plans are not replaced when cache is full, because other threads may be
+    using them.
+    @return Pointer to the plan, or NULL in case of an error or if cache is full.
+ */
+static CONVOLUT_PLAN *convolutGetPlan(const int N)
+{
+  CONVOLUT_PLAN *plan=NULL;
+#pragma omp critical(convolutPlanCache)
+  {
+    for(int i=0; i<convolutPlanNr; i++)
+      if(convolutPlan[i].N==N) {plan=convolutPlan+i; break;}
+    if(plan==NULL && convolutPlanNr<CONVOLUT_PLAN_NR &&
+       convolutMakePlan(convolutPlan+convolutPlanNr, N)==0)
+      plan=convolutPlan+convolutPlanNr++;
+  }
+  return(plan);
+}
+
+/** In-place radix-2 FFT of complex data (interleaved real and imaginary
+    parts); inverse transform (dir<0) is not scaled. */
+static void convolutFFT(CONVOLUT_PLAN *p, double *z, const int dir)
+{
+  const int N=p->N;
+  for(int i=0; i<N; i++) {
+    int j=p->rev[i];
+    if(j>i) {
+      double t;
+      t=z[2*i]; z[2*i]=z[2*j]; z[2*j]=t;
+      t=z[2*i+1]; z[2*i+1]=z[2*j+1]; z[2*j+1]=t;
+    }
+  }
+  for(int len=2; len<=N; len<<=1) {
+    int half=len/2, step=N/len;
+    for(int i=0; i<N; i+=len) {
+      for(int k=0; k<half; k++) {
+        double wr=p->c[k*step], wi=dir<0 ? -p->s[k*step] : p->s[k*step];
+        double *a=z+2*(i+k), *b=z+2*(i+k+half);
+        double tr=b[0]*wr-b[1]*wi, ti=b[0]*wi+b[1]*wr;
+        b[0]=a[0]-tr; b[1]=a[1]-ti;
+        a[0]+=tr; a[1]+=ti;
+      }
+    }
+  }
+}
+/// @endcond
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** @brief Calculates the convolution sum of a discrete real data set data[0..n-1] and
+    discretized response functions kernel[0..m-1], using FFT.
+    @details Convolution is not aware of the step size (default is 1); if step size is
+    not 1, the step size must be taken into account either when computing the kernel
+    or by scaling the convolution sum.
+    The data set is transformed only once, and two kernels are convolved in each
+    inverse transform, therefore convolving the same input function with many
+    kernels is much faster than convolving them one at a time.
+    FFT tables are cached by the transform length, and can be freed with
+    convolve1DFFTFree().
+    @remark Results differ from the direct convolution sum by rounding errors,
+    relative to the largest values.
+    @sa convolve1DBatch, convolve1DFFTFree
+    @return Function returns 0 when successful, 1 if input data is not valid, and 2
+    in case of memory allocation error.
+*/
+int convolve1DFFT(
+  /** Data array of length n to be convolved, including any user-defined zero-padding. */
+  double *data,
+  /** Nr of data values. */
+  const int n,
+  /** Response function values in an array of length kernelNr*m; kernels are
+      stored one after another. */
+  double *kernel,
+  /** Length of one kernel. */
+  const int m,
+  /** Nr of kernels. */
+  const int kernelNr,
+  /** The convolved sums are returned in out[0..kernelNr*n-1], one after another;
+      this must not overlap the input data. */
+  double *out
+) {
+  if(n<1 || m<1 || kernelNr<1 || data==NULL || kernel==NULL || out==NULL || out==data)
+    return 1;
+
+  /* Transform length must cover the linear convolution of the first n samples */
+  int N=2; while(N<n+m-1) N<<=1;
+  CONVOLUT_PLAN *plan=convolutGetPlan(N), tmpPlan;
+  if(plan==NULL) { // cache is full, therefore use tables for this call only
+    if(convolutMakePlan(&tmpPlan, N)) return 2;
+    plan=&tmpPlan;
+  }
+  double *spec=(double*)malloc(4*N*sizeof(double));
+  if(spec==NULL) {
+    if(plan==&tmpPlan) {free(tmpPlan.rev); free(tmpPlan.c);}
+    return 2;
+  }
+  double *z=spec+2*N;
+
+  /* Transform the data */
+  for(int i=0; i<n; i++) {spec[2*i]=data[i]; spec[2*i+1]=0.0;}
+  for(int i=2*n; i<2*N; i++) spec[i]=0.0;
+  convolutFFT(plan, spec, 1);
+
+  /* Two kernels at a time, one as real and one as imaginary part; since
+     both convolutions are real, they are separated in the inverse transform */
+  const double f=1.0/(double)N;
+  for(int ki=0; ki<kernelNr; ki+=2) {
+    double *k1=kernel+ki*m, *k2=(ki+1<kernelNr) ? k1+m : NULL;
+    for(int i=0; i<m; i++) {z[2*i]=k1[i]; z[2*i+1]=(k2!=NULL) ? k2[i] : 0.0;}
+    for(int i=2*m; i<2*N; i++) z[i]=0.0;
+    convolutFFT(plan, z, 1);
+    for(int i=0; i<N; i++) {
+      double re=z[2*i]*spec[2*i]-z[2*i+1]*spec[2*i+1];
+      double im=z[2*i]*spec[2*i+1]+z[2*i+1]*spec[2*i];
+      z[2*i]=re; z[2*i+1]=im;
+    }
+    convolutFFT(plan, z, -1);
+    double *o=out+ki*n;
+    for(int i=0; i<n; i++) o[i]=f*z[2*i];
+    if(k2!=NULL) {o+=n; for(int i=0; i<n; i++) o[i]=f*z[2*i+1];}
+  }
+
+  free(spec);
+  if(plan==&tmpPlan) {free(tmpPlan.rev); free(tmpPlan.c);}
+  return 0;
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** @brief Calculates the convolution sum of a discrete real data set data[0..n-1] and
+    one or more discretized response functions kernel[0..m-1].
+    @details Direct convolution sum is computed with short data, and FFT with long
+    data, when n*m is at least CONVOLUT_FFT_LIMIT.
+    @sa convolve1DFFT
+    @return Function returns 0 when successful, 1 if input data is not valid, and 2
+    in case of memory allocation error.
+*/
+int convolve1DBatch(
+  /** Data array of length n to be convolved, including any user-defined zero-padding. */
+  double *data,
+  /** Nr of data values. */
+  const int n,
+  /** Response function values in an array of length kernelNr*m; kernels are
+      stored one after another. */
+  double *kernel,
+  /** Length of one kernel. */
+  const int m,
+  /** Nr of kernels. */
+  const int kernelNr,
+  /** The convolved sums are returned in out[0..kernelNr*n-1], one after another;
+      this must not overlap the input data. */
+  double *out
+) {
+  if(n<1 || m<1 || kernelNr<1 || data==NULL || kernel==NULL || out==NULL || out==data)
+    return 1;
+  /* Use FFT with long data; fall back to direct sum if out of memory */
+  if((double)n*(double)m>=CONVOLUT_FFT_LIMIT &&
+     convolve1DFFT(data, n, kernel, m, kernelNr, out)==0)
+    return 0;
+  for(int ki=0; ki<kernelNr; ki++)
+    convolveDirect(data, n, kernel+ki*m, m, out+ki*n);
+  return 0;
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
+/** Free the FFT tables cached by convolve1DFFT().
+    Do not call while convolutions are running in other threads.
+    @sa convolve1DFFT
+ */
+void convolve1DFFTFree()
+{
+#pragma omp critical(convolutPlanCache)
+  {
+    for(int i=0; i<convolutPlanNr; i++) {
+      free(convolutPlan[i].rev); free(convolutPlan[i].c);
+    }
+    convolutPlanNr=0;
+  }
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
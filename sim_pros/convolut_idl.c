@@ -19,9 +19,9 @@
     @details Convolution is not aware of the step size (default is 1); if step size is not 1
     (it usually isn't), the step size must be taken into account either when computing the kernel
     or by scaling the convolution sum.
-    @remark This function does not use FFT, which would be faster with very large dataset,
-    but slightly less precise.
-    @sa tacInterpolateToEqualLengthFrames
+    @remark FFT is used with very large dataset, which is faster, but slightly less
+    precise.
+    @sa tacInterpolateToEqualLengthFrames, convolut_batch_idl, convolve1DBatch
     @return Function returns 0 when successful, or 1 if input data is not valid.
 */
 int convolut_idl(int argc, float * argv[])
@@ -44,7 +44,6 @@ int convolut_idl(int argc, float * argv[])
   double *kernel;
   int     m;
   double *out;
-printf("this is a test!");
   /* read in parameters */	
   data            =  (double *)  argv[0];
   n               =  *(int *)    argv[1];
@@ -52,24 +51,37 @@ printf("this is a test!");
   m               =  *(int *)    argv[3];
   out             =  (double*)   argv[4];
 
-printf("this is a test!%d %d",n,m);
-  if(n<1 || m<1 || data==NULL || kernel==NULL || out==NULL || out==data) return 1;
+  /* direct sum with short data, FFT with long data */
+  return(convolve1DBatch(data, n, kernel, m, 1, out));
+}
+/*****************************************************************************/
 
-  for(int di=0; di<n; di++) out[di]=0.0;
+/*****************************************************************************/
+/** @brief Calculates the convolution sums of a discrete real data set data[0..n-1] and
+    several discretized response functions, each of length m.
+    @details For example, convolves an input function with the residue functions of
+    all voxels at once; with long data FFT of the input function is computed only once.
+    @sa convolut_idl, convolve1DBatch
+    @return Function returns 0 when successful, or >0 in case of an error.
+*/
+int convolut_batch_idl(int argc, float * argv[])
+{
+  double *data;
+  int     n;
+  double *kernel;
+  int     m;
+  int     kernelNr;
+  double *out;
 
-  for(int di=m-1; di<n; di++) {
-    int dj=di;
-    for(int k=0; k<m; k++)
-      out[di] += data[dj--] * kernel[k];
-  }
+  /* read in parameters */	
+  data            =  (double *)  argv[0];
+  n               =  *(int *)    argv[1];
+  kernel          =  (double*)   argv[2];   // kernelNr x m
+  m               =  *(int *)    argv[3];
+  kernelNr        =  *(int *)    argv[4];
+  out             =  (double*)   argv[5];   // kernelNr x n
 
-  for(int di=0; di<n && di<m-1; di++) {
-    int k=0;
-    for(int dj=di; dj>=0; dj--)
-      out[di] += data[dj] * kernel[k++];
-  }
-printf("this is a test!%f %f",out[0],out[200]);
-  return 0;
+  return(convolve1DBatch(data, n, kernel, m, kernelNr, out));
 }
 /*****************************************************************************/
 
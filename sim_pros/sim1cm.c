@@ -218,3 +218,96 @@ int simC1_i(
 /*****************************************************************************/
 
 /*****************************************************************************/
+/** Simulate tissue TACs using 1 tissue compartmental model and plasma TAC,
+    at plasma TAC times, for many sets of rate constants at once.
+     
+    @details
+    Numerically the same recurrence as simC1(), with the parameter sets in
+    structure-of-arrays layout so that the loop over sets is vectorised.
+    Simulated TACs are written frame-major, ct[i*n+j] being frame i of
+    parameter set j; memory for n*nr values must be allocated in the
+    calling program.
+  
+    The units of rate constants must be related to the time unit; 1/min and min,
+    or 1/sec and sec.
+   
+    @sa simC1, simC2_batch
+    @return Function returns 0 when succesful, else a value >= 1.
+ */
+int simC1_batch(
+  /** Array of time values */
+  double *t,
+  /** Array of arterial activities */
+  double *ca,
+  /** Number of values in TACs */
+  const int nr,
+  /** Number of parameter sets */
+  const int n,
+  /** Rate constants K1 of all parameter sets */
+  const double *k1,
+  /** Rate constants k2 of all parameter sets */
+  const double *k2,
+  /** Pointer for n*nr simulated values; must be allocated */
+  double *ct,
+  /** Working memory for 2*n values, or NULL to allocate it here */
+  double *work
+) {
+  int i, j;
+  double dt2, cai, ca_last, t_last;
+  double *ct1_last, *ct1i_last, *buf=NULL;
+
+
+  /* Check for data */
+  if(nr<2 || n<1) return 1;
+  if(t==NULL || ca==NULL || ct==NULL || k1==NULL || k2==NULL) return 2;
+
+  /* Check actual parameter number */
+  for(j=0; j<n; j++) if(!(k1[j]>=0.0)) return 3;
+
+  if(work==NULL) {
+    buf=(double*)malloc(2*n*sizeof(double)); if(buf==NULL) return 4;
+    work=buf;
+  }
+  ct1_last=work; ct1i_last=work+n;
+  for(j=0; j<2*n; j++) work[j]=0.0;
+
+  /* Calculate curves */
+  t_last=0.0; if(t[0]<t_last) t_last=t[0]; 
+  cai=ca_last=0.0;
+  for(i=0; i<nr; i++) {
+    double *cti=ct+(size_t)i*n;
+    /* delta time / 2 */
+    dt2=0.5*(t[i]-t_last);
+    /* calculate values */
+    if(dt2<0.0) {
+      if(buf!=NULL) free(buf);
+      return 5;
+    } else if(dt2>0.0) {
+      /* arterial integral */
+      cai+=(ca[i]+ca_last)*dt2;
+#pragma omp simd
+      for(j=0; j<n; j++) {
+        double ct1, ct1i;
+        /* tissue compartment and its integral */
+        ct1 = (k1[j]*cai - k2[j]*(ct1i_last[j]+dt2*ct1_last[j])) / (1.0 + dt2*k2[j]);
+        ct1i = ct1i_last[j] + dt2*(ct1_last[j]+ct1);
+        /* set very small values to zero */
+        cti[j]=ct1; if(fabs(cti[j])<1.0e-12) cti[j]=0.0;
+        /* prepare to the next loop */
+        ct1_last[j]=ct1; ct1i_last[j]=ct1i;
+      }
+    } else {
+      for(j=0; j<n; j++) {
+        cti[j]=ct1_last[j]; if(fabs(cti[j])<1.0e-12) cti[j]=0.0;
+      }
+    }
+    /* prepare to the next loop */
+    t_last=t[i]; ca_last=ca[i];
+  }
+
+  if(buf!=NULL) free(buf);
+  return 0;
+}
+/*****************************************************************************/
+
+/*****************************************************************************/
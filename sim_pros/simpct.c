@@ -68,19 +68,8 @@ int simpct
   // convolve ctt and data
   if(n<1 || m<1 || data==NULL || ctt==NULL || tac==NULL || tac==data) return 1;
 
-  for(int di=0; di<n; di++) tac[di]=0.0;
-
-  for(int di=m-1; di<n; di++) {
-    int dj=di;
-    for(int k=0; k<m; k++)
-      tac[di] += data[dj--] * ctt[k];
-  }
-
-  for(int di=0; di<n && di<m-1; di++) {
-    int k=0;
-    for(int dj=di; dj>=0; dj--)
-      tac[di] += data[dj] * ctt[k++];
-  }
+  /* direct sum with short data, FFT with long data */
+  if(convolve1DBatch(data, n, ctt, m, 1, tac)) return 1;
 
   cbf = cbf*6000;    // scale back to input
   return 0;
@@ -72,19 +72,8 @@ int simpct_idl(int argc, float * argv[])
 
   if(n<1 || m<1 || data==NULL || ctt==NULL || tac==NULL || tac==data) { return 1; }
 
-  for(int di=0; di<n; di++) tac[di]=0.0;
-
-  for(int di=m-1; di<n; di++) {
-    int dj=di;
-    for(int k=0; k<m; k++)
-      tac[di] += data[dj--] * ctt[k];
-  }
-
-  for(int di=0; di<n && di<m-1; di++) {
-    int k=0;
-    for(int dj=di; dj>=0; dj--)
-      tac[di] += data[dj] * ctt[k++];
-  }
+  /* direct sum with short data, FFT with long data */
+  if(convolve1DBatch(data, n, ctt, m, 1, tac)) { return 1; }
 
  cbf         = cbf*6000.0;    // need to scale back to original!  
 // printf("test here! %d %f %f",frameNr,cbf,mtt);
@@ -93,3 +82,56 @@ int simpct_idl(int argc, float * argv[])
 }
 /*****************************************************************************/
 
+/*****************************************************************************/
+/** @brief Simulates perfusion CT TACs for many sets of CBF, MTT and delay
+    with one arterial input function, as in simpct_idl().
+    @details Residue functions of all parameter sets are convolved with the input
+    function at once; with long data FFT of the input function is computed only once.
+    @sa simpct_idl, convolve1DBatch
+    @return Function returns 0 when successful, or >0 in case of an error.
+*/
+int simpct_batch_idl(int argc, float * argv[])
+{
+  double *ts;
+  double *ctt;
+  int    frameNr;
+  double *cbf;
+  double *mtt;
+  double *delay;
+  int    parNr;
+  double *tac;
+
+  /* read in parameters */	
+  ts            =  (double *)    argv[0];
+  ctt           =  (double *)    argv[1];
+  frameNr       =  *(int *)      argv[2];
+  cbf           =  (double *)    argv[3];   // parNr values
+  mtt           =  (double *)    argv[4];   // parNr values
+  delay         =  (double *)    argv[5];   // parNr values
+  parNr         =  *(int *)      argv[6];
+  tac           =  (double *)    argv[7];   // parNr x frameNr
+
+  if(frameNr<1 || parNr<1 || ts==NULL || ctt==NULL || tac==NULL ||
+     cbf==NULL || mtt==NULL || delay==NULL) { return 1; }
+
+  /* residue functions of all parameter sets */
+  int n=frameNr;
+  double *data=(double*)malloc((size_t)parNr*n*sizeof(double));
+  if(data==NULL) { return 2; }
+  for(int j=0; j<parNr; j++) {
+    double f=cbf[j]/6000.0;              //% ml/100ml/min = 1/(100*60s)
+    double *r=data+(size_t)j*n;
+    for(int i=0; i<n; i++) {
+      r[i]=f*exp( -(ts[i]-mtt[j]-delay[j]));
+      if(ts[i] < mtt[j]+delay[j]) { r[i] = f; }
+      if(ts[i] < delay[j]) { r[i] = 0.0; }
+    }
+  }
+
+  /* convolve the input function with each of them */
+  int ret=convolve1DBatch(ctt, n, data, n, parNr, tac);
+  free(data);
+  if(ret) { return 1; }
+  return 0;
+}
+/*****************************************************************************/
@@ -6,7 +6,15 @@
 #   . ~/bin/batchmake.sh
 #  
 # make sure run sed -i 's/\r//' batchmake.sh first
+#
+# fabber_core and the models are built with OpenMP, so the VB voxel loops
+# run on the number of threads given with --threads. FSL 6 uses armawrap for
+# newmat, which has no Tracer; with the FSL 5 newmat library the threads are
+# disabled at compile time. Build serially with
+#   FABBER_OMPFLAGS= batchmake
 function batchmake() {
+# default.mk puts USRCXXFLAGS in CXXFLAGS, which the fabber link lines use too
+local -x USRCXXFLAGS="${FABBER_OMPFLAGS--fopenmp}"
 cd /home/tsun/bin/fsl/install/src/fabber_core
 make cleana
 make install -j4
@@ -107,8 +107,8 @@ void PetFwdModel::Initialize(FabberRunData &rundata)
     pprecision1 = rundata.GetDoubleDefault("pprecision1", 1e-8); 
     pprecision2 = rundata.GetDoubleDefault("pprecision2", 1e-8); 
     nsample = rundata.GetDoubleDefault("nsample", 2);    //default is 2
-    plasma_t = (double *)malloc(nsample*sizeof(double));
-    plasma_c = (double *)malloc(nsample*sizeof(double));
+    plasma_t.resize(nsample);
+    plasma_c.resize(nsample);
         
 
     // m_include_offset = rundata.GetBool("use-offset");
@@ -122,6 +122,7 @@ void PetFwdModel::Initialize(FabberRunData &rundata)
         fscanf(myFile, "%lf", &plasma_t[i]);
         LOG << plasma_t[i] << endl;
     }
+    fclose(myFile);
     // plasma_t = fabber::read_matrix_file(designFile);
 
     designFile = rundata.GetString("plasma_c");
@@ -133,10 +134,8 @@ void PetFwdModel::Initialize(FabberRunData &rundata)
         fscanf(myFile, "%lf", &plasma_c[i]);
         LOG << plasma_c[i] << endl;
     }
+    fclose(myFile);
     // plasma_c = fabber::read_matrix_file(designFile);
-
-	free(plasma_t);
-	free(plasma_c);
 }
 
 int PetFwdModel::NumParams() const
@@ -220,24 +219,17 @@ void PetFwdModel::HardcodedInitialDists(MVNDist &prior, MVNDist &posterior) cons
 // such as an interim residual or AIF curve
 void PetFwdModel::Evaluate(const ColumnVector &params, ColumnVector &result) const
 {
-
-    int ret;
-    double *results;
     // Check we have been given the right number of parameters
     assert(params.Nrows() == NumParams());
-    result.ReSize(data.Nrows());
-
-    results = (double *)malloc(nsample*sizeof(double));
-    ret=simC1(plasma_t, plasma_c, nsample, params(1),params(2), results);
+    if (result.Nrows() != data.Nrows())
+        result.ReSize(data.Nrows());
 
-    std::vector<double> result1(results, results + nsample);
-    for (int i = 1; i <= data.Nrows(); i++)
-    {
-        // result(i) = result1[i];
-        result(i) = *(results+i-1);    // start from first image
-    }
-     
-	free(results);
+    // Simulate straight into the result storage; the simulation is causal, so
+    // frames beyond the data are not needed and missing frames are left at zero
+    int nr = min(nsample, data.Nrows());
+    result = 0.0;
+    if (simC1(&plasma_t[0], &plasma_c[0], nr, params(1), params(2), result.Store()) != 0)
+        result = 0.0;
 
     // char cmd[100];
     // char *tmp1 = "/home/tsun/IDL86/bin/envi54/idl/bin/idl -rt=forwardmodeltosave.sav -quiet -args ";
@@ -260,3 +252,18 @@ void PetFwdModel::Evaluate(const ColumnVector &params, ColumnVector &result) con
 
 }
 
+// The Jacobian comes from the sensitivity recurrence of simC1_d in the same pass
+// over the plasma curve, instead of 2 extra simulations per parameter
+bool PetFwdModel::Gradient(const ColumnVector &params, Matrix &grad) const
+{
+    int num_params = NumParams();
+    assert(params.Nrows() == num_params);
+    if (grad.Nrows() != data.Nrows() || grad.Ncols() != num_params)
+        grad.ReSize(data.Nrows(), num_params);
+
+    // NEWMAT stores by row, so the K1 and k2 derivatives are written directly into
+    // columns 1 and 2; the spillover column, if any, stays zero as Evaluate does not use it
+    int nr = min(nsample, data.Nrows());
+    grad = 0.0;
+    return simC1_d(&plasma_t[0], &plasma_c[0], nr, params(1), params(2), NULL, grad.Store(), num_params) == 0;
+}
@@ -17,6 +17,7 @@
 #include "sim1cm.c"
 
 #include <string>
+#include <vector>
 
 class PetFwdModel : public FwdModel {
 public:
@@ -36,6 +37,9 @@ public:
     void NameParams(std::vector<std::string>& names) const;
     void HardcodedInitialDists(MVNDist& prior, MVNDist& posterior) const;
     void Evaluate(const NEWMAT::ColumnVector& params, NEWMAT::ColumnVector& result) const;
+    // Analytic Jacobian from the sensitivity recurrence of the simulation, used by
+    // LinearizedFwdModel::ReCentre instead of finite differences of Evaluate
+    bool Gradient(const NEWMAT::ColumnVector& params, NEWMAT::Matrix& grad) const;
 
 private:
     bool m_include_offset;
@@ -44,8 +48,8 @@ private:
 protected:
     // NEWMAT::ColumnVector plasma_c;
     // NEWMAT::ColumnVector plasma_t;
-    double *plasma_c;
-    double *plasma_t;
+    std::vector<double> plasma_c;
+    std::vector<double> plasma_t;
     int     nsample;
     double  pmean1;
     double  pmean2;
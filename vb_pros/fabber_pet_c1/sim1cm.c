@@ -148,6 +148,104 @@ int simC1(
 }
 /*****************************************************************************/
 
+/*****************************************************************************/
+/** Simulate tissue TAC and its partial derivatives with respect to the rate
+    constants using 1 tissue compartmental model and plasma TAC,
+    at plasma TAC times.
+     
+    @details
+    The derivatives are computed with the sensitivity recurrence obtained by
+    differentiating the trapezoidal recurrence of simC1(), so the TAC and
+    its Jacobian are computed in one pass over the data, and the TAC is
+    identical to the one given by simC1().
+    Derivatives are written row by row into dct, dct[i*dstride] being
+    d(ct[i])/dK1 and dct[i*dstride+1] being d(ct[i])/dk2; this allows
+    writing directly into a row-major matrix with dstride columns.
+  
+    The units of rate constants must be related to the time unit; 1/min and min,
+    or 1/sec and sec.
+   
+    @sa simC1
+    @return Function returns 0 when succesful, else a value >= 1.
+ */
+int simC1_d(
+  /** Array of time values */
+  double *t,
+  /** Array of arterial activities */
+  double *ca,
+  /** Number of values in TACs */
+  const int nr,
+  /** Rate constant of the model */
+  const double k1,
+  /** Rate constant of the model */
+  const double k2,
+  /** Pointer for TAC array to be simulated, or NULL */
+  double *ct,
+  /** Pointer for derivative array, nr rows of dstride values; must be
+      allocated */
+  double *dct,
+  /** Distance between consecutive rows in dct; at least 2 */
+  const int dstride
+) {
+  int i;
+  double dt2, div, u, du1, du2;
+  double cai, ca_last, t_last;
+  double ct1, ct1_last;
+  double ct1i, ct1i_last;
+  double d1, d1_last, d1i, d1i_last; /* derivatives with respect to k1 */
+  double d2, d2_last, d2i, d2i_last; /* derivatives with respect to k2 */
+
+
+  /* Check for data */
+  if(nr<2) return 1;
+  if(t==NULL || ca==NULL || dct==NULL || dstride<2) return 2;
+
+  /* Check actual parameter number */
+  if(!(k1>=0.0)) return 3;
+
+  /* Calculate curves */
+  t_last=0.0; if(t[0]<t_last) t_last=t[0]; 
+  cai=ca_last=0.0;
+  ct1_last=ct1i_last=0.0;
+  ct1=ct1i=0.0;
+  d1_last=d1i_last=d2_last=d2i_last=0.0;
+  d1=d1i=d2=d2i=0.0;
+  for(i=0; i<nr; i++) {
+    /* delta time / 2 */
+    dt2=0.5*(t[i]-t_last);
+    /* calculate values */
+    if(dt2<0.0) {
+      return 5;
+    } else if(dt2>0.0) {
+      /* arterial integral */
+      cai+=(ca[i]+ca_last)*dt2;
+      /* tissue compartment and its integral */
+      div=1.0+dt2*k2;
+      u=ct1i_last+dt2*ct1_last;
+      ct1 = (k1*cai - k2*u) / div;
+      ct1i = ct1i_last + dt2*(ct1_last+ct1);
+      /* derivatives of the above */
+      du1=d1i_last+dt2*d1_last;
+      d1 = (cai - k2*du1) / div;
+      d1i = d1i_last + dt2*(d1_last+d1);
+      du2=d2i_last+dt2*d2_last;
+      d2 = (-u - k2*du2 - dt2*ct1) / div;
+      d2i = d2i_last + dt2*(d2_last+d2);
+    }
+    /* copy values to argument arrays; set very small values to zero */
+    if(ct!=NULL) {ct[i]=ct1; if(fabs(ct[i])<1.0e-12) ct[i]=0.0;}
+    dct[i*dstride]=d1; dct[i*dstride+1]=d2;
+    /* prepare to the next loop */
+    t_last=t[i]; ca_last=ca[i];
+    ct1_last=ct1; ct1i_last=ct1i;
+    d1_last=d1; d1i_last=d1i;
+    d2_last=d2; d2i_last=d2i;
+  }
+
+  return 0;
+}
+/*****************************************************************************/
+
 /*****************************************************************************/
 /** Simulate tissue TAC using 1 tissue compartmental model and plasma TAC,
     at plasma TAC times.
@@ -112,6 +112,127 @@ int simC2(
 }
 /*****************************************************************************/
 
+/*****************************************************************************/
+/** Simulate tissue TAC and its partial derivatives with respect to the rate
+    constants using two-tissue compartment model and plasma TAC,
+    at plasma TAC times.
+     
+    @details
+    The derivatives are computed with the sensitivity recurrence obtained by
+    differentiating the trapezoidal recurrence of simC2(), so the TAC and
+    its Jacobian are computed in one pass over the data, and the TAC is
+    identical to the one given by simC2().
+    Derivatives are written row by row into dct, dct[i*dstride+j] being
+    d(ct[i])/dkj for j=0..3 (K1, k2, k3, k4); this allows writing directly
+    into a row-major matrix with dstride columns.
+  
+    The units of rate constants must be related to the time unit; 1/min and min,
+    or 1/sec and sec.
+   
+    @return Function returns 0 when succesful, else a value >= 1.
+    @sa simC2, simC1_d
+ */
+int simC2_d(
+  /** Array of time values */
+  double *t,
+  /** Array of arterial activities */
+  double *ca,
+  /** Number of values in TACs */
+  const int nr,
+  /** Rate constant of the model */
+  const double k1,
+  /** Rate constant of the model */
+  const double k2,
+  /** Rate constant of the model */
+  const double k3,
+  /** Rate constant of the model */
+  const double k4,
+  /** Pointer for TAC array to be simulated, or NULL */
+  double *ct,
+  /** Pointer for derivative array, nr rows of dstride values; must be
+      allocated */
+  double *dct,
+  /** Distance between consecutive rows in dct; at least 4 */
+  const int dstride
+) {
+  int i, j;
+  double dt2, r, u, v, a, b, div;
+  double da, db, dr, du, dv, dn;
+  double cai, ca_last, t_last;
+  double ct1, ct1_last, ct2, ct2_last;
+  double ct1i, ct1i_last, ct2i, ct2i_last;
+  /* derivatives of the compartments and their integrals, per parameter */
+  double d1[4], d1i[4], d2[4], d2i[4];
+
+
+  /* Check for data */
+  if(nr<2) return 1;
+  if(t==NULL || ca==NULL || dct==NULL || dstride<4) return 2;
+
+  /* Check parameters */
+  if(k1<0.0) return 3;
+
+  /* Calculate curves */
+  t_last=0.0; if(t[0]<t_last) t_last=t[0];
+  cai=ca_last=0.0;
+  ct1_last=ct2_last=ct1i_last=ct2i_last=0.0;
+  ct1=ct2=ct1i=ct2i=0.0;
+  for(j=0; j<4; j++) d1[j]=d1i[j]=d2[j]=d2i[j]=0.0;
+  for(i=0; i<nr; i++) {
+    /* delta time / 2 */
+    dt2=0.5*(t[i]-t_last);
+    /* calculate values */
+    if(dt2<0.0) {
+      return 5;
+    } else if(dt2>0.0) {
+      /* arterial integral */
+      cai+=(ca[i]+ca_last)*dt2;
+      /* Calculate partial results */
+      r=1.0+k4*dt2;
+      u=ct1i_last+dt2*ct1_last;
+      v=ct2i_last+dt2*ct2_last;
+      a=k2+(k3/r); b=k4/r; div=1.0+dt2*a;
+      /* 1st tissue compartment and its integral */
+      ct1 = ( k1*cai - a*u + b*v ) / div;
+      ct1i = ct1i_last + dt2*(ct1_last+ct1);
+      /* 2nd tissue compartment and its integral */
+      ct2 = (k3*ct1i - k4*v) / r;
+      ct2i = ct2i_last + dt2*(ct2_last+ct2);
+      /* derivatives; d1, d1i, d2 and d2i still hold the previous values */
+      for(j=0; j<4; j++) {
+        dr=da=db=0.0; dn=0.0;
+        switch(j) {
+          case 0: dn=cai; break;
+          case 1: da=1.0; break;
+          case 2: da=1.0/r; break;
+          case 3: dr=dt2; da=-k3*dt2/(r*r); db=1.0/(r*r); break;
+        }
+        du=d1i[j]+dt2*d1[j];
+        dv=d2i[j]+dt2*d2[j];
+        dn+= -da*u - a*du + db*v + b*dv;
+        d1i[j]+=dt2*d1[j];
+        d1[j]=(dn - ct1*dt2*da) / div;
+        d1i[j]+=dt2*d1[j];
+        d2i[j]+=dt2*d2[j];
+        d2[j]=k3*d1i[j] - k4*dv - ct2*dr;
+        if(j==2) d2[j]+=ct1i; else if(j==3) d2[j]-=v;
+        d2[j]/=r;
+        d2i[j]+=dt2*d2[j];
+      }
+    }
+    /* copy values to argument arrays; set very small values to zero */
+    if(ct!=NULL) {ct[i]=ct1+ct2; if(fabs(ct[i])<1.0e-12) ct[i]=0.0;}
+    for(j=0; j<4; j++) dct[i*dstride+j]=d1[j]+d2[j];
+    /* prepare to the next loop */
+    t_last=t[i]; ca_last=ca[i];
+    ct1_last=ct1; ct1i_last=ct1i;
+    ct2_last=ct2; ct2i_last=ct2i;
+  }
+
+  return 0;
+}
+/*****************************************************************************/
+
 /*****************************************************************************/
 /** Simulate tissue TAC using two-tissue compartment model and plasma TAC, 
     at plasma TAC times.
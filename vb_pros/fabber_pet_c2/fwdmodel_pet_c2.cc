@@ -116,8 +116,8 @@ void PetFwdModel::Initialize(FabberRunData &rundata)
 	pprecision3 = rundata.GetDoubleDefault("pprecision3", 1e-8); 
     pprecision4 = rundata.GetDoubleDefault("pprecision4", 1e-8); 
     nsample = rundata.GetDoubleDefault("nsample", 2);    //default is 2
-    plasma_t = (double *)malloc(nsample*sizeof(double));
-    plasma_c = (double *)malloc(nsample*sizeof(double));
+    plasma_t.resize(nsample);
+    plasma_c.resize(nsample);
         
 
     m_include_offset = rundata.GetBool("use-offset");
@@ -133,6 +133,7 @@ void PetFwdModel::Initialize(FabberRunData &rundata)
         fscanf(myFile, "%lf", &plasma_t[i]);
         LOG << plasma_t[i] << endl;
     }
+    fclose(myFile);
     // plasma_t = fabber::read_matrix_file(designFile);
 
     designFile = rundata.GetString("plasma_c");
@@ -144,10 +145,8 @@ void PetFwdModel::Initialize(FabberRunData &rundata)
         fscanf(myFile, "%lf", &plasma_c[i]);
         LOG << plasma_c[i] << endl;
     }
+    fclose(myFile);
     // plasma_c = fabber::read_matrix_file(designFile);
-     
-    free(plasma_t);
-	free(plasma_c);
 }
 
 int PetFwdModel::NumParams() const
@@ -233,27 +232,41 @@ void PetFwdModel::HardcodedInitialDists(MVNDist &prior, MVNDist &posterior) cons
 // such as an interim residual or AIF curve
 void PetFwdModel::Evaluate(const ColumnVector &params, ColumnVector &result) const
 {
-
     int ret;
-    double *results;
     // Check we have been given the right number of parameters
     assert(params.Nrows() == NumParams());
-    result.ReSize(data.Nrows());
+    if (result.Nrows() != data.Nrows())
+        result.ReSize(data.Nrows());
 
-    results = (double *)malloc(nsample*sizeof(double));
-    if (m_usesrtm) { ret=simSRTM(plasma_t, plasma_c, nsample, params(1),params(2),params(3), results); }
-    else if (m_usertcm) { ret=simRTCM(plasma_t, plasma_c, nsample, params(1),params(2),params(3),params(4), results, NULL, NULL);  }
-    else { ret=simC2(plasma_t, plasma_c, nsample, params(1),params(2),params(3),params(4), results, NULL, NULL); }
-	
-    std::vector<double> result1(results, results + nsample);
-    for (int i = 1; i <= data.Nrows(); i++)
-    {
-        // result(i) = result1[i];
-        result(i) = *(results+i-1);    // start from first image
-    }
-	
-	free(results);
+    // Simulate straight into the result storage; the simulations are causal, so
+    // frames beyond the data are not needed and missing frames are left at zero
+    int nr = min(nsample, data.Nrows());
+    double *t = &plasma_t[0], *c = &plasma_c[0];
+    result = 0.0;
+    if (m_usesrtm) { ret=simSRTM(t, c, nr, params(1),params(2),params(3), result.Store()); }
+    else if (m_usertcm) { ret=simRTCM(t, c, nr, params(1),params(2),params(3),params(4), result.Store(), NULL, NULL);  }
+    else { ret=simC2(t, c, nr, params(1),params(2),params(3),params(4), result.Store(), NULL, NULL); }
+    if (ret != 0)
+        result = 0.0;
+}
 
+// The Jacobian of the 2-tissue model comes from the sensitivity recurrence of simC2_d
+// in the same pass over the plasma curve, instead of 2 extra simulations per parameter.
+// The reference tissue models have no analytic version and are differentiated numerically.
+bool PetFwdModel::Gradient(const ColumnVector &params, Matrix &grad) const
+{
+    if (m_usesrtm || m_usertcm)
+        return false;
 
-}
+    int num_params = NumParams();
+    assert(params.Nrows() == num_params);
+    if (grad.Nrows() != data.Nrows() || grad.Ncols() != num_params)
+        grad.ReSize(data.Nrows(), num_params);
 
+    // NEWMAT stores by row, so the rate constant derivatives are written directly into
+    // columns 1-4; the spillover column, if any, stays zero as Evaluate does not use it
+    int nr = min(nsample, data.Nrows());
+    grad = 0.0;
+    return simC2_d(&plasma_t[0], &plasma_c[0], nr, params(1),params(2),params(3),params(4),
+                  NULL, grad.Store(), num_params) == 0;
+}
@@ -31,6 +31,10 @@ int simC1_i(
   double *t, double *cai, const int nr, 
   const double k1, const double k2, double *ct
 );
+int simC1_d(
+  double *t, double *ca, const int nr, 
+  const double k1, const double k2, double *ct, double *dct, const int dstride
+);
 /*****************************************************************************/
 
 /*****************************************************************************/
@@ -40,6 +44,11 @@ int simC2(
   const double k1, const double k2, const double k3, const double k4,
   double *ct, double *cta, double *ctb
 );
+int simC2_d(
+  double *t, double *ca, const int nr, 
+  const double k1, const double k2, const double k3, const double k4,
+  double *ct, double *dct, const int dstride
+);
 int simC2_i(
   double *t, double *cai, const int nr, 
   const double k1, const double k2, const double k3, const double k4,
@@ -72,7 +72,19 @@
 #include <math.h>
 #include <algorithm>
 #include <utility>
-#include <dlfcn.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// The voxel loops create and combine newmat objects on every thread. The
+// newmat library of FSL 5 records each call in a static Tracer chain, which is
+// not thread safe; EXCEPTION_LIB is the include guard of its myexcept.h. The
+// armawrap newmat of FSL 6 has no Tracer. Define FABBER_NEWMAT_TRACER to fit
+// serially with any other newmat build which traces.
+#if defined(_OPENMP) && !defined(EXCEPTION_LIB) && !defined(FABBER_NEWMAT_TRACER)
+#define VB_THREADS 1
+#endif
 using namespace std;
 using namespace NEWIMAGE;
 using NEWMAT::Matrix;
@@ -122,6 +134,20 @@ static OptionSpec OPTIONS[] = {
         "N=nonspatial, M=Markov random field, P=Penny, A=ARD",
         OPT_NONREQ, "N+" },
     { "update-spatial-prior-on-first-iteration", OPT_BOOL, "", OPT_NONREQ, "" },
+    { "threads", OPT_INT, "Number of threads to fit voxels with (0 = OpenMP default)",
+        OPT_NONREQ, "1" },
+    { "nlm-sigma", OPT_FLOAT, "Noise level assumed by the non-local means step of the n prior",
+        OPT_NONREQ, "0.006" },
+    { "nlm-h", OPT_FLOAT, "Non-local means filtering strength as a multiple of nlm-sigma",
+        OPT_NONREQ, "1.2" },
+    { "nlm-search-radius", OPT_INT, "In-plane radius of the non-local means search window",
+        OPT_NONREQ, "3" },
+    { "nlm-search-radius-z", OPT_INT, "Through-plane radius of the non-local means search window",
+        OPT_NONREQ, "1" },
+    { "nlm-patch-radius", OPT_INT, "In-plane radius of the non-local means patches", OPT_NONREQ,
+        "3" },
+    { "nlm-patch-radius-z", OPT_INT, "Through-plane radius of the non-local means patches",
+        OPT_NONREQ, "1" },
     { "locked-linear-from-mvn", OPT_MVN, "MVN file containing fixed centres for linearization",
         OPT_NONREQ, "" },
     { "" },
@@ -178,6 +204,25 @@ void Vb::Initialize(FwdModel *fwd_model, FabberRunData &rundata)
 
     // Locked linearizations, if requested
     m_locked_linear = rundata.GetStringDefault("locked-linear-from-mvn", "") != "";
+
+    // Voxels can be fitted concurrently, in spatial mode one colour class at a time
+    m_nthreads = rundata.GetIntDefault("threads", 1, 0);
+#ifndef VB_THREADS
+    if (m_nthreads != 1)
+        WARN_ONCE("threads ignored, build with OpenMP against a newmat without Tracer");
+#endif
+}
+
+Vb::~Vb()
+{
+    for (unsigned int i = 0; i < m_thread_models.size(); i++)
+    {
+        delete m_thread_models[i];
+    }
+    for (unsigned int i = 0; i < m_thread_noise.size(); i++)
+    {
+        delete m_thread_noise[i];
+    }
 }
 
 void Vb::InitializeNoiseFromParam(FabberRunData &rundata, NoiseParams *dist, string param_key)
@@ -310,6 +355,11 @@ void Vb::SetupPerVoxelDists(FabberRunData &rundata)
 }
 
 void Vb::PassModelData(int v)
+{
+    PassModelData(v, m_model);
+}
+
+void Vb::PassModelData(int v, FwdModel *model)
 {
     // Pass in data, coords and supplemental data for this voxel
     ColumnVector data = m_origdata->Column(v);
@@ -317,11 +367,11 @@ void Vb::PassModelData(int v)
     if (m_suppdata->Ncols() > 0)
     {
         ColumnVector suppy = m_suppdata->Column(v);
-        m_model->PassData(v, data, vcoords, suppy);
+        model->PassData(v, data, vcoords, suppy);
     }
     else
     {
-        m_model->PassData(v, data, vcoords);
+        model->PassData(v, data, vcoords);
     }
 }
 
@@ -374,18 +424,19 @@ void Vb::IgnoreVoxel(int v)
 /**
  * Calculate free energy. Note that this is currently unused in spatial VB
  */
-double Vb::CalculateF(int v, string label, double Fprior)
+double Vb::CalculateF(int v, string label, double Fprior, const NoiseModel *noise)
 {
     double F = 1234.5678;
     if (m_needF)
     {
-        F = m_noise->CalcFreeEnergy(*m_ctx->noise_post[v - 1], *m_ctx->noise_prior[v - 1],
+        F = noise->CalcFreeEnergy(*m_ctx->noise_post[v - 1], *m_ctx->noise_prior[v - 1],
             m_ctx->fwd_post[v - 1], m_ctx->fwd_prior[v - 1], m_lin_model[v - 1],
             m_origdata->Column(v));
         F += Fprior;
         resultFs[v - 1] = F;
         if (m_printF)
         {
+#pragma omp critical(vb_log)
             LOG << "Vb::F" << label << " = " << F << endl;
         }
     }
@@ -394,16 +445,19 @@ double Vb::CalculateF(int v, string label, double Fprior)
 
 void Vb::DebugVoxel(int v, const string &where)
 {
-    LOG << where << " - voxel " << v << " of " << m_nvoxels << endl;
-    LOG << "Prior means: " << endl << m_ctx->fwd_prior[v - 1].means.t();
-    LOG << "Prior precisions: " << endl << m_ctx->fwd_prior[v - 1].GetPrecisions();
-    LOG << "Posterior means: " << endl << m_ctx->fwd_post[v - 1].means.t();
-    LOG << "Noise prior means: " << endl << m_ctx->noise_prior[v - 1]->OutputAsMVN().means.t();
-    LOG << "Noise prior precisions: " << endl
-        << m_ctx->noise_prior[v - 1]->OutputAsMVN().GetPrecisions();
-    LOG << "Centre: " << endl << m_lin_model[v - 1].Centre();
-    LOG << "Offset: " << endl << m_lin_model[v - 1].Offset();
-    LOG << "Jacobian: " << endl << m_lin_model[v - 1].Jacobian() << endl;
+#pragma omp critical(vb_log)
+    {
+        LOG << where << " - voxel " << v << " of " << m_nvoxels << endl;
+        LOG << "Prior means: " << endl << m_ctx->fwd_prior[v - 1].means.t();
+        LOG << "Prior precisions: " << endl << m_ctx->fwd_prior[v - 1].GetPrecisions();
+        LOG << "Posterior means: " << endl << m_ctx->fwd_post[v - 1].means.t();
+        LOG << "Noise prior means: " << endl << m_ctx->noise_prior[v - 1]->OutputAsMVN().means.t();
+        LOG << "Noise prior precisions: " << endl
+            << m_ctx->noise_prior[v - 1]->OutputAsMVN().GetPrecisions();
+        LOG << "Centre: " << endl << m_lin_model[v - 1].Centre();
+        LOG << "Offset: " << endl << m_lin_model[v - 1].Offset();
+        LOG << "Jacobian: " << endl << m_lin_model[v - 1].Jacobian() << endl;
+    }
 }
 
 bool Vb::IsSpatial(FabberRunData &rundata) const
@@ -556,6 +610,58 @@ void Vb::DoCalculations(FabberRunData &rundata)
     delete m_ctx;
 }
 
+int Vb::NumThreads() const
+{
+    int nthreads = 1;
+#ifdef VB_THREADS
+    nthreads = (m_nthreads > 0) ? m_nthreads : omp_get_max_threads();
+    if (nthreads > m_nvoxels)
+        nthreads = m_nvoxels;
+#endif
+    return nthreads;
+}
+
+/**
+ * Create one forward model instance per worker thread
+ *
+ * The forward model keeps the current voxel's data (and PetFwdModel its
+ * input curves) as members, so every thread needs its own instance.
+ * Thread 0 keeps the model we were initialized with. The extra instances
+ * are kept until destruction because the per-voxel linearized models
+ * refer to them.
+ */
+void Vb::CreateThreadModels(FabberRunData &rundata, int nthreads, vector<FwdModel *> &models)
+{
+    models.assign(nthreads, m_model);
+    for (int t = 1; t < nthreads; t++)
+    {
+        FwdModel *model = FwdModel::NewFromName(rundata.GetString("model"));
+        model->SetLogger(m_log);
+        model->Initialize(rundata);
+        m_thread_models.push_back(model);
+        models[t] = model;
+    }
+}
+
+/**
+ * Create one noise model instance per worker thread
+ *
+ * The white noise model builds its Qi matrices for the data length on first
+ * use and keeps them in the instance, so threads cannot share one instance.
+ */
+void Vb::CreateThreadNoiseModels(
+    FabberRunData &rundata, int nthreads, vector<const NoiseModel *> &noises)
+{
+    noises.assign(nthreads, m_noise.get());
+    for (int t = 1; t < nthreads; t++)
+    {
+        NoiseModel *noise = NoiseModel::NewFromName(rundata.GetString("noise"));
+        noise->Initialize(rundata);
+        m_thread_noise.push_back(noise);
+        noises[t] = noise;
+    }
+}
+
 void Vb::DoCalculationsVoxelwise(FabberRunData &rundata)
 {
     vector<Parameter> params;
@@ -574,166 +680,285 @@ void Vb::DoCalculationsVoxelwise(FabberRunData &rundata)
     // }
     // /////////////////////////////////
 
+    bool failed = false;
+    string fail_msg;
+    int nthreads = NumThreads();
 
-
-    // Loop over voxels
-    for (int v = 1; v <= m_nvoxels; v++)
+    if (nthreads <= 1)
     {
-        PassModelData(v);
-
-        m_ctx->v = v;
-        m_ctx->it = 0;
-
-        // Save our model parameters in case we need to revert later.
-        // Note need to save prior in case ARD is being used
-        NoiseParams *const noisePosteriorSave = m_ctx->noise_post[v - 1]->Clone();
-        MVNDist fwdPosteriorSave(m_ctx->fwd_post[v - 1]);
-        MVNDist fwdPriorSave(m_ctx->fwd_prior[v - 1]);
-
-        // Give an indication of the progress through the voxels;
-        rundata.Progress(v, m_nvoxels);
-        double F = 1234.5678;
-
-        try
+        // Loop over voxels
+        for (int v = 1; v <= m_nvoxels; v++)
         {
-            m_lin_model[v - 1].ReCentre(m_ctx->fwd_post[v - 1].means);
-            m_conv[v - 1]->Reset();
-					
-            // START the VB updates and run through the relevant iterations (according to the
-            // convergence testing)
-            do
-            {
-                double Fprior = 0;
-
-                if (m_conv[v - 1]->NeedRevert()) // revert to previous solution if the convergence
-                                                 // detector calls for it
+            // Give an indication of the progress through the voxels;
+            rundata.Progress(v, m_nvoxels);
+            FitVoxel(rundata, v, m_model, m_noise.get(), priors, params);
+        }
+    }
+    else
+    {
+#ifdef _OPENMP
+        // Voxels are independent in the non-spatial case
+        LOG << "Vb::Voxelwise calculation using " << nthreads << " threads" << endl;
+        vector<FwdModel *> models;
+        vector<const NoiseModel *> noises;
+        CreateThreadModels(rundata, nthreads, models);
+        CreateThreadNoiseModels(rundata, nthreads, noises);
+
+        int ndone = 0;
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 1)
+        for (int v = 1; v <= m_nvoxels; v++)
+        {
+            bool skip;
+#pragma omp critical(vb_fail)
+            skip = failed;
+            if (skip)
+                continue;
 
-					
-					
+            FwdModel *model = models[omp_get_thread_num()];
+            const NoiseModel *noise = noises[omp_get_thread_num()];
+            m_lin_model[v - 1] = LinearizedFwdModel(model);
+            try
+            {
+                FitVoxel(rundata, v, model, noise, priors, params);
+            }
+            catch (std::exception &e)
+            {
+#pragma omp critical(vb_fail)
                 {
-                    *m_ctx->noise_post[v - 1] = *noisePosteriorSave;
-                    m_ctx->fwd_post[v - 1] = fwdPosteriorSave;
-                    m_ctx->fwd_prior[v - 1] = fwdPriorSave;
-                    m_lin_model[v - 1].ReCentre(m_ctx->fwd_post[v - 1].means);
-                    if (m_debug)
-                        DebugVoxel(v, "Reverted");
+                    if (!failed)
+                        fail_msg = e.what();
+                    failed = true;
                 }
-
-                // Save old values if called for
-                if (m_conv[v - 1]->NeedSave())
+            }
+            catch (NEWMAT::Exception &e)
+            {
+#pragma omp critical(vb_fail)
                 {
-                    *noisePosteriorSave = *m_ctx->noise_post[v - 1]; // copy values, not pointer!
-                    fwdPosteriorSave = m_ctx->fwd_post[v - 1];
-                    fwdPriorSave = m_ctx->fwd_prior[v - 1];
+                    if (!failed)
+                        fail_msg = e.what();
+                    failed = true;
                 }
-
-                for (int k = 0; k < m_num_params; k++)
+            }
+            catch (...)
+            {
+#pragma omp critical(vb_fail)
                 {
-                    Fprior += priors[k]->ApplyToMVN(&m_ctx->fwd_prior[v - 1], *m_ctx, rundata, params[k]);
+                    if (!failed)
+                        fail_msg = "Vb::Unknown error in voxel " + stringify(v);
+                    failed = true;
                 }
+            }
 
-                if (m_debug)
-                    DebugVoxel(v, "Applied priors");
+#pragma omp critical(vb_progress)
+            {
+                ++ndone;
+                rundata.Progress(ndone, m_nvoxels);
+            }
+        }
+#endif
+    }
 
-                F = CalculateF(v, "before", Fprior);
+    for (unsigned int i = 0; i < priors.size(); i++)
+    {
+        delete priors[i];
+    }
 
-                m_noise->UpdateTheta(*m_ctx->noise_post[v - 1], m_ctx->fwd_post[v - 1],
-                    m_ctx->fwd_prior[v - 1], m_lin_model[v - 1], m_origdata->Column(v), NULL,
-                    m_conv[v - 1]->LMalpha());
+    // Exceptions cannot leave the parallel region, so a voxel that
+    // halted the run is reported here instead
+    if (failed)
+        throw FabberInternalError(fail_msg);
+}
 
-                if (m_debug)
-                    DebugVoxel(v, "Updated params");
+/**
+ * Run all VB iterations for a single voxel using the given forward and
+ * noise models
+ *
+ * m_lin_model[v-1] must wrap the same model instance. Only the entries for
+ * voxel v in the run context and result vectors are written, apart from the
+ * shared current voxel/iteration which the priors read and which is therefore
+ * only set while holding the prior lock.
+ */
+void Vb::FitVoxel(FabberRunData &rundata, int v, FwdModel *model, const NoiseModel *noise,
+    vector<Prior *> &priors, vector<Parameter> &params)
+{
+    PassModelData(v, model);
+    int it = 0;
 
-                F = CalculateF(v, "theta", Fprior);
+    // Save our model parameters in case we need to revert later.
+    // Note need to save prior in case ARD is being used
+    NoiseParams *const noisePosteriorSave = m_ctx->noise_post[v - 1]->Clone();
+    MVNDist fwdPosteriorSave(m_ctx->fwd_post[v - 1]);
+    MVNDist fwdPriorSave(m_ctx->fwd_prior[v - 1]);
 
-                m_noise->UpdateNoise(*m_ctx->noise_post[v - 1], *m_ctx->noise_prior[v - 1],
-                    m_ctx->fwd_post[v - 1], m_lin_model[v - 1], m_origdata->Column(v));
+    double F = 1234.5678;
 
-                if (m_debug)
-                    DebugVoxel(v, "Updated noise");
+    try
+    {
+        m_lin_model[v - 1].ReCentre(m_ctx->fwd_post[v - 1].means);
+        m_conv[v - 1]->Reset();
 
-                F = CalculateF(v, "phi", Fprior);
+        // START the VB updates and run through the relevant iterations (according to the
+        // convergence testing)
+        do
+        {
+            double Fprior = 0;
 
-                // Linearization update
-                // Update the linear model before doing Free energy calculation
-                // (and ready for next round of theta and phi updates)
+            if (m_conv[v - 1]->NeedRevert()) // revert to previous solution if the convergence
+                                             // detector calls for it
+            {
+                *m_ctx->noise_post[v - 1] = *noisePosteriorSave;
+                m_ctx->fwd_post[v - 1] = fwdPosteriorSave;
+                m_ctx->fwd_prior[v - 1] = fwdPriorSave;
                 m_lin_model[v - 1].ReCentre(m_ctx->fwd_post[v - 1].means);
-
                 if (m_debug)
-                    DebugVoxel(v, "Re-centered");
+                    DebugVoxel(v, "Reverted");
+            }
 
-                F = CalculateF(v, "lin", Fprior);
+            // Save old values if called for
+            if (m_conv[v - 1]->NeedSave())
+            {
+                *noisePosteriorSave = *m_ctx->noise_post[v - 1]; // copy values, not pointer!
+                fwdPosteriorSave = m_ctx->fwd_post[v - 1];
+                fwdPriorSave = m_ctx->fwd_prior[v - 1];
+            }
 
-/////////////////////////////////              
-                if (m_have_mask && (m_mask[v-1]==1.) && (m_num_params > 2))
+            // No exception may leave the critical section, so any error is
+            // kept and thrown again outside it
+            bool prior_failed = false;
+            string prior_msg;
+#pragma omp critical(vb_prior)
+            {
+                m_ctx->v = v;
+                m_ctx->it = it;
+                try
                 {
-                    // force k3, k4 to zero
-                    m_ctx->fwd_post[v - 1].means(3) = 0.0;
-                    m_ctx->fwd_post[v - 1].means(4) = 0.0;
+                    for (int k = 0; k < m_num_params; k++)
+                    {
+                        Fprior += priors[k]->ApplyToMVN(
+                            &m_ctx->fwd_prior[v - 1], *m_ctx, rundata, params[k]);
+                    }
                 }
-/////////////////////////////////       
+                catch (NEWMAT::Exception &e)
+                {
+                    prior_failed = true;
+                    prior_msg = e.what();
+                }
+                catch (std::exception &e)
+                {
+                    prior_failed = true;
+                    prior_msg = e.what();
+                }
+                catch (...)
+                {
+                    prior_failed = true;
+                    prior_msg = "Vb::Unknown error applying priors in voxel " + stringify(v);
+                }
+            }
+            if (prior_failed)
+                throw FabberInternalError(prior_msg);
+
+            if (m_debug)
+                DebugVoxel(v, "Applied priors");
+
+            F = CalculateF(v, "before", Fprior, noise);
+
+            noise->UpdateTheta(*m_ctx->noise_post[v - 1], m_ctx->fwd_post[v - 1],
+                m_ctx->fwd_prior[v - 1], m_lin_model[v - 1], m_origdata->Column(v), NULL,
+                m_conv[v - 1]->LMalpha());
+
+            if (m_debug)
+                DebugVoxel(v, "Updated params");
 
-                ++m_ctx->it;
+            F = CalculateF(v, "theta", Fprior, noise);
 
-            } while (!m_conv[v - 1]->Test(F));
+            noise->UpdateNoise(*m_ctx->noise_post[v - 1], *m_ctx->noise_prior[v - 1],
+                m_ctx->fwd_post[v - 1], m_lin_model[v - 1], m_origdata->Column(v));
 
+            if (m_debug)
+                DebugVoxel(v, "Updated noise");
+
+            F = CalculateF(v, "phi", Fprior, noise);
+
+            // Linearization update
+            // Update the linear model before doing Free energy calculation
+            // (and ready for next round of theta and phi updates)
+            m_lin_model[v - 1].ReCentre(m_ctx->fwd_post[v - 1].means);
 
             if (m_debug)
-                LOG << "Converged after " << m_ctx->it << " iterations" << endl;
+                DebugVoxel(v, "Re-centered");
 
-            // Revert to old values at last stage if required
-            if (m_conv[v - 1]->NeedRevert())
+            F = CalculateF(v, "lin", Fprior, noise);
+
+/////////////////////////////////
+            if (m_have_mask && (m_mask[v-1]==1.) && (m_num_params > 2))
             {
-                *m_ctx->noise_post[v - 1] = *noisePosteriorSave;
-                m_ctx->fwd_post[v - 1] = fwdPosteriorSave;
-                m_ctx->fwd_prior[v - 1] = fwdPriorSave;
-                m_lin_model[v - 1].ReCentre(m_ctx->fwd_post[v - 1].means);
+                // force k3, k4 to zero
+                m_ctx->fwd_post[v - 1].means(3) = 0.0;
+                m_ctx->fwd_post[v - 1].means(4) = 0.0;
             }
+/////////////////////////////////
 
-            delete noisePosteriorSave;
-        }
-        catch (FabberInternalError &e)
-        {
-            LOG << "Vb::Internal error for voxel " << v << " at " << m_coords->Column(v).t()
-                << " : " << e.what() << endl;
+            ++it;
 
-            if (m_halt_bad_voxel)
-                throw;
-        }
-        catch (NEWMAT::Exception &e)
-        {
-            LOG << "Vb::NEWMAT exception for voxel " << v << " at " << m_coords->Column(v).t()
-                << " : " << e.what() << endl;
+        } while (!m_conv[v - 1]->Test(F));
 
-            if (m_halt_bad_voxel)
-                throw;
-        }
-
-        // now write the results to resultMVNs
-        try
+        if (m_debug)
         {
-            resultMVNs.at(v - 1)
-                = new MVNDist(m_ctx->fwd_post[v - 1], m_ctx->noise_post[v - 1]->OutputAsMVN());
-            if (m_needF)
-                resultFs.at(v - 1) = F;
+#pragma omp critical(vb_log)
+            LOG << "Converged after " << it << " iterations" << endl;
         }
-        catch (...)
+
+        // Revert to old values at last stage if required
+        if (m_conv[v - 1]->NeedRevert())
         {
-            // Even that can fail, due to results being singular
-            LOG << "Vb::Can't give any sensible answer for this voxel; outputting zero +- "
-                   "identity\n";
-            MVNDist *tmp = new MVNDist(m_log);
-            tmp->SetSize(m_ctx->fwd_post[v - 1].means.Nrows()
-                + m_ctx->noise_post[v - 1]->OutputAsMVN().means.Nrows());
-            tmp->SetCovariance(IdentityMatrix(tmp->means.Nrows()));
-            resultMVNs.at(v - 1) = tmp;
-            if (m_needF)
-                resultFs.at(v - 1) = F;
+            *m_ctx->noise_post[v - 1] = *noisePosteriorSave;
+            m_ctx->fwd_post[v - 1] = fwdPosteriorSave;
+            m_ctx->fwd_prior[v - 1] = fwdPriorSave;
+            m_lin_model[v - 1].ReCentre(m_ctx->fwd_post[v - 1].means);
         }
+
+        delete noisePosteriorSave;
     }
-    for (unsigned int i = 0; i < priors.size(); i++)
+    catch (FabberInternalError &e)
     {
-        delete priors[i];
+#pragma omp critical(vb_log)
+        LOG << "Vb::Internal error for voxel " << v << " at " << m_coords->Column(v).t()
+            << " : " << e.what() << endl;
+
+        if (m_halt_bad_voxel)
+            throw;
+    }
+    catch (NEWMAT::Exception &e)
+    {
+#pragma omp critical(vb_log)
+        LOG << "Vb::NEWMAT exception for voxel " << v << " at " << m_coords->Column(v).t()
+            << " : " << e.what() << endl;
+
+        if (m_halt_bad_voxel)
+            throw;
+    }
+
+    // now write the results to resultMVNs
+    try
+    {
+        resultMVNs.at(v - 1)
+            = new MVNDist(m_ctx->fwd_post[v - 1], m_ctx->noise_post[v - 1]->OutputAsMVN());
+        if (m_needF)
+            resultFs.at(v - 1) = F;
+    }
+    catch (...)
+    {
+        // Even that can fail, due to results being singular
+#pragma omp critical(vb_log)
+        LOG << "Vb::Can't give any sensible answer for this voxel; outputting zero +- "
+               "identity\n";
+        MVNDist *tmp = new MVNDist(m_log);
+        tmp->SetSize(m_ctx->fwd_post[v - 1].means.Nrows()
+            + m_ctx->noise_post[v - 1]->OutputAsMVN().means.Nrows());
+        tmp->SetCovariance(IdentityMatrix(tmp->means.Nrows()));
+        resultMVNs.at(v - 1) = tmp;
+        if (m_needF)
+            resultFs.at(v - 1) = F;
     }
 }
 
@@ -756,13 +981,11 @@ void Vb::DoCalculationsSpatial(FabberRunData &rundata)
     m_model->GetParameters(rundata, params);
     vector<Prior *> priors = PriorFactory(rundata).CreatePriors(params);
 
-	LOG << "tessst!"<<endl;
     /////////////////////////////////
     // string stringuse_img = params[0].options.find("image")->second;
     string stringuse_img = rundata.GetStringDefault("PSP_byname1_image", "");
     bool use_img = (stringuse_img != "");
     if (use_img) {
-			LOG << "tessst!"<<endl;
         for (int v = 1; v <= m_nvoxels; v++)
         {
             m_ctx->v = v;
@@ -772,11 +995,40 @@ void Vb::DoCalculationsSpatial(FabberRunData &rundata)
             }
         }
     }
-    LOG << "TEST " << use_img << endl;
 
     // LOG << "check me here" << m_ctx->fwd_prior[10000].means(1) << " "<<m_ctx->fwd_post[100000].means(2) <<" "<<m_ctx->fwd_prior[10].means(3) << " "<<m_ctx->fwd_prior[10].means(4) ;
     /////////////////////////////////
 
+    // Colour classes and per-thread models for the parallel sweep
+    int nthreads = NumThreads();
+    vector<FwdModel *> models;
+    vector<const NoiseModel *> noises;
+    if (nthreads > 1)
+    {
+        LOG << "Vb::Spatial calculation using " << nthreads << " threads" << endl;
+        ColourVoxels(params);
+        CreateThreadModels(rundata, nthreads, models);
+        CreateThreadNoiseModels(rundata, nthreads, noises);
+    }
+
+    // Settings for the non-local means step of the n prior
+    NlmSettings nlm;
+    if (params[0].prior_type == PRIOR_SPATIAL_n)
+    {
+        nlm.sigma = rundata.GetDoubleDefault("nlm-sigma", 0.006);
+        nlm.h = rundata.GetDoubleDefault("nlm-h", 1.2);
+        nlm.search = rundata.GetIntDefault("nlm-search-radius", 3, 0);
+        nlm.search_z = rundata.GetIntDefault("nlm-search-radius-z", 1, 0);
+        nlm.patch = rundata.GetIntDefault("nlm-patch-radius", 3, 0);
+        nlm.patch_z = rundata.GetIntDefault("nlm-patch-radius-z", 1, 0);
+        if (m_spatial_dims < 3)
+        {
+            nlm.search_z = 0;
+            nlm.patch_z = 0;
+        }
+        m_nlm_values.resize(m_nvoxels);
+    }
+
     // Spatial loop currently uses a global convergence detector FIXME
     // needs to change
     CountingConvergenceDetector conv;
@@ -790,91 +1042,28 @@ void Vb::DoCalculationsSpatial(FabberRunData &rundata)
         LOG << endl << "*** Spatial iteration *** " << (m_ctx->it + 1) << endl;
 
     /////////////////////////////////
-    // Start non-local means filetr at current iteration
+    // Start non-local means filter at current iteration
     // 
     if (params[0].prior_type == PRIOR_SPATIAL_n && m_ctx->it > 10)   //skip fitting at first iteration
-    {        
-    void *imglib;
-    int (*extopenimage)(float *, float *,unsigned int,unsigned int,unsigned int,unsigned int,
-    float,float,float,float,float,float,float,float,float,unsigned int,unsigned int,unsigned int,
-    unsigned int,unsigned int,unsigned int);
-    int imghandle;
-    LOG << "hello" << endl;
-    imglib = dlopen("./libnlm.so", RTLD_LAZY);
-    if (!imglib) 
-       { fprintf(stderr, "dlopen failed: %s\n", dlerror()); 
-         exit(EXIT_FAILURE); };
-
-      
+    {
         for (int k = 1; k <= m_num_params; k++)
         {
-
-            float *m_image_tofilter;
-            m_image_tofilter = (float *)malloc(m_nvoxels*sizeof(float));
             for (int v = 1; v <= m_nvoxels; v++)
             {
-                *(m_image_tofilter+v-1) = m_ctx->fwd_post[v - 1].means(k);      
+                m_nlm_values[v - 1] = m_ctx->fwd_post[v - 1].means(k);
             }
 
-            unsigned int debug = 1;
-            unsigned int sizex = 256;
-            unsigned int sizey = 256;
-            unsigned int  sizez = 2;
-            float spacingx = 1.0;
-            float spacingy = 1.0;
-            float spacingz = 1.0;
-            float offsetx = 0.0;
-            float offsety = 0.0;
-            float offsetz = 0.0;
-            float iSigma           =  0.006;  //0.2 k2
-            float iH               =  1.2;  
-            float iPs              =  2.0;
-            unsigned int iRadiusSearchx   =  3;
-            unsigned int iRadiusSearchy   =  3;
-            unsigned int iRadiusSearchz   =  1;
-            unsigned int iRadiusCompx     =  3;
-            unsigned int iRadiusCompy     =  3;
-            unsigned int iRadiusCompz     =  1;
-            float *m_image_filter; 
-            m_image_filter = (float *)malloc(m_nvoxels*sizeof(float));
-LOG << "hi" << endl;
-            if (imglib !=NULL) {
-                *(void **)(&extopenimage) = dlsym(imglib, "nlm");   
-                imghandle = extopenimage(m_image_tofilter, m_image_filter, 
-                                                    debug, sizex, sizey, sizez, spacingx, spacingy, spacingz, 
-                                                    offsetx, offsety, offsetz, 
-                                                    iSigma, iH, iPs, iRadiusSearchx, iRadiusSearchy,iRadiusSearchz, 
-                                                    iRadiusCompx,iRadiusCompy,iRadiusCompz);
-LOG << "hi" << endl;
-            // int success = nlm(m_image_tofilter, m_image_filter, 
-            //                             debug, sizex, sizey, sizez, spacingx, spacingy, spacingz, 
-            //                             offsetx, offsety, offsetz, 
-            //                             iSigma, iH, iPs, iRadiusSearchx, iRadiusSearchy,iRadiusSearchz, 
-            //                             iRadiusCompx,iRadiusCompy,iRadiusCompz );
-            for (int vv = 1; vv <= m_nvoxels; vv++)
+            NlmFilter(m_nlm_values, nlm);
+
+            Matrix paramMean;
+            paramMean.ReSize(1, m_nvoxels);
+            for (int v = 1; v <= m_nvoxels; v++)
             {
-                m_ctx->fwd_post[vv - 1].means(k) =  *(m_image_filter+vv-1);
-            }
-            LOG << "hi" << endl;
-            // free(m_image_filter);
+                m_ctx->fwd_post[v - 1].means(k) = m_nlm_values[v - 1];
+                paramMean(1, v) = m_nlm_values[v - 1];
             }
-
-        // free(m_image_tofilter);
-LOG << "hi" << endl;
-        int nVoxels = resultMVNs.size();
-        Matrix paramMean;
-        paramMean.ReSize(1, nVoxels);
-        for (int v = 1; v <= m_nvoxels; v++)
-        {
-            resultMVNs[v - 1]
-            = new MVNDist(m_ctx->fwd_post[v - 1], m_ctx->noise_post[v - 1]->OutputAsMVN());
-            MVNDist result = *resultMVNs[v - 1];
-            paramMean(1, v) = result.means(k);
+            rundata.SaveVoxelData("mean_" + params.at(k - 1).name + "_iter" + stringify(m_ctx->it) + "filter", paramMean);
         }
-        m_model->GetParameters(rundata, params);
-        rundata.SaveVoxelData("mean_" + params.at(k - 1).name + "_iter" + stringify(m_ctx->it) + "filter", paramMean);
-      }
-      
     }
     /////////////////////////////////
 
@@ -883,49 +1072,38 @@ LOG << "hi" << endl;
         rundata.Progress(m_ctx->it+1, maxits);
         double Fprior = 0;
 
-        // ITERATE OVER VOXELS
-        for (int v = 1; v <= m_nvoxels; v++)
+        if (nthreads > 1)
         {
-            m_ctx->v = v;
-            PassModelData(v);
-
-            // The steps below are essentially the same as regular VB, although
-            // the code looks different as the per-voxel dists are set up at the
-            // start rather than as we go
-            try
+            Fglobal = SpatialSweepParallel(rundata, priors, params, models, noises);
+        }
+        else
+        {
+            // ITERATE OVER VOXELS
+            for (int v = 1; v <= m_nvoxels; v++)
             {
-                Fprior = 0;
+                m_ctx->v = v;
+                PassModelData(v);
 
-                // Apply prior updates for spatial or ARD priors
-                for (int k = 0; k < m_num_params; k++)
+                // The steps below are essentially the same as regular VB, although
+                // the code looks different as the per-voxel dists are set up at the
+                // start rather than as we go
+                try
                 {
-                    if (params[0].prior_type == (PRIOR_NORMAL || PRIOR_DEFAULT)) {
-                      LOG << "waht?" << endl;
-                       Fprior += priors[k]->ApplyToMVN(&m_ctx->fwd_prior[v - 1], *m_ctx, rundata, params[k]);
-                    } else {
-                        if (m_ctx->it < 1) {
-                            LOG << "waht" << endl;
-                            // allow use the prior information when combining the spatial prior
-                            Fprior += priors[k]->ApplyToMVN_(&m_ctx->fwd_prior[v - 1], *m_ctx, rundata, params[k]);
-                        }
-                        if (m_ctx->it >= 1) { 
-                            Fprior += priors[k]->ApplyToMVN(&m_ctx->fwd_prior[v - 1], *m_ctx, rundata, params[k]);
-                        }
-                    }
-                }
-                if (m_debug)
-                    DebugVoxel(v, "Priors set");
+                    // Apply prior updates for spatial or ARD priors
+                    Fprior = ApplySpatialPriors(rundata, v, priors, params);
+                    if (m_debug)
+                        DebugVoxel(v, "Priors set");
 
 
-                // Ignore voxels where numerical issues have occurred
-                if (std::find(m_ctx->ignore_voxels.begin(), m_ctx->ignore_voxels.end(), v)
-                    != m_ctx->ignore_voxels.end())
-                {
-                    LOG << "Ignoring voxel " << v << endl;
-                    continue;
-                }
+                    // Ignore voxels where numerical issues have occurred
+                    if (std::find(m_ctx->ignore_voxels.begin(), m_ctx->ignore_voxels.end(), v)
+                        != m_ctx->ignore_voxels.end())
+                    {
+                        LOG << "Ignoring voxel " << v << endl;
+                        continue;
+                    }
 
-                CalculateF(v, "before", Fprior);
+                    CalculateF(v, "before", Fprior, m_noise.get());
 
 
 // /////////////// debug spatial image prior
@@ -954,84 +1132,85 @@ LOG << "hi" << endl;
 
 // LOG << "check me here" << m_ctx->fwd_prior[v - 1].means(1) << " "<<m_ctx->fwd_prior[v - 1].means(2) <<" "<<m_ctx->fwd_prior[v - 1].means(3) << " "<<m_ctx->fwd_prior[v - 1].means(4) ;
 
-                m_noise->UpdateTheta(*m_ctx->noise_post[v - 1], m_ctx->fwd_post[v - 1],
-                    m_ctx->fwd_prior[v - 1], m_lin_model[v - 1], m_origdata->Column(v), NULL, 0);
-                if (m_debug)
-                    DebugVoxel(v, "Theta updated");
+                    m_noise->UpdateTheta(*m_ctx->noise_post[v - 1], m_ctx->fwd_post[v - 1],
+                        m_ctx->fwd_prior[v - 1], m_lin_model[v - 1], m_origdata->Column(v), NULL, 0);
+                    if (m_debug)
+                        DebugVoxel(v, "Theta updated");
 
 
-                CalculateF(v, "theta", Fprior);
-            }
-            catch (FabberInternalError &e)
-            {
-                LOG << "Vb::Internal error for voxel " << v << " at " << m_coords->Column(v).t()
-                    << " : " << e.what() << endl;
+                    CalculateF(v, "theta", Fprior, m_noise.get());
+                }
+                catch (FabberInternalError &e)
+                {
+                    LOG << "Vb::Internal error for voxel " << v << " at " << m_coords->Column(v).t()
+                        << " : " << e.what() << endl;
 
-                if (m_halt_bad_voxel)
-                    throw;
-                else
-                    IgnoreVoxel(v);
-            }
-            catch (NEWMAT::Exception &e)
-            {
-                LOG << "Vb::NEWMAT exception for voxel " << v << " at " << m_coords->Column(v).t()
-                    << " : " << e.what() << endl;
+                    if (m_halt_bad_voxel)
+                        throw;
+                    else
+                        IgnoreVoxel(v);
+                }
+                catch (NEWMAT::Exception &e)
+                {
+                    LOG << "Vb::NEWMAT exception for voxel " << v << " at " << m_coords->Column(v).t()
+                        << " : " << e.what() << endl;
 
-                if (m_halt_bad_voxel)
-                    throw;
-                else
-                    IgnoreVoxel(v);
+                    if (m_halt_bad_voxel)
+                        throw;
+                    else
+                        IgnoreVoxel(v);
+                }
             }
-        }
 
 
-        Fglobal = 0;
-        for (int v = 1; v <= m_nvoxels; v++)
-        {
-            try {
-                // Ignore voxels where numerical issues have occurred
-                if (std::find(m_ctx->ignore_voxels.begin(), m_ctx->ignore_voxels.end(), v)
-                    != m_ctx->ignore_voxels.end())
-                {
-                    LOG << "Ignoring voxel " << v << endl;
-                    continue;
-                }
+            Fglobal = 0;
+            for (int v = 1; v <= m_nvoxels; v++)
+            {
+                try {
+                    // Ignore voxels where numerical issues have occurred
+                    if (std::find(m_ctx->ignore_voxels.begin(), m_ctx->ignore_voxels.end(), v)
+                        != m_ctx->ignore_voxels.end())
+                    {
+                        LOG << "Ignoring voxel " << v << endl;
+                        continue;
+                    }
 
-                PassModelData(v);
+                    PassModelData(v);
 
-                m_noise->UpdateNoise(*m_ctx->noise_post[v - 1], *m_ctx->noise_prior[v - 1],
-                    m_ctx->fwd_post[v - 1], m_lin_model[v - 1], m_origdata->Column(v));
-                if (m_debug)
-                    DebugVoxel(v, "Noise updated");
+                    m_noise->UpdateNoise(*m_ctx->noise_post[v - 1], *m_ctx->noise_prior[v - 1],
+                        m_ctx->fwd_post[v - 1], m_lin_model[v - 1], m_origdata->Column(v));
+                    if (m_debug)
+                        DebugVoxel(v, "Noise updated");
 
-                CalculateF(v, "noise", Fprior);
+                    CalculateF(v, "noise", Fprior, m_noise.get());
 
-                if (!m_locked_linear)
-                    m_lin_model[v - 1].ReCentre(m_ctx->fwd_post[v - 1].means);
-                if (m_debug)
-                    DebugVoxel(v, "Re-centre");
+                    if (!m_locked_linear)
+                        m_lin_model[v - 1].ReCentre(m_ctx->fwd_post[v - 1].means);
+                    if (m_debug)
+                        DebugVoxel(v, "Re-centre");
 
-                Fglobal += CalculateF(v, "lin", Fprior);
-            }
-            catch (FabberInternalError &e)
-            {
-                LOG << "Vb::Internal error for voxel " << v << " at " << m_coords->Column(v).t()
-                    << " : " << e.what() << endl;
+                    Fglobal += CalculateF(v, "lin", Fprior, m_noise.get());
+                }
+                catch (FabberInternalError &e)
+                {
+                    LOG << "Vb::Internal error for voxel " << v << " at " << m_coords->Column(v).t()
+                        << " : " << e.what() << endl;
 
-                if (m_halt_bad_voxel)
-                    throw;
-                else
-                    IgnoreVoxel(v);
-            }
-            catch (NEWMAT::Exception &e)
-            {
-                LOG << "Vb::NEWMAT exception for voxel " << v << " at " << m_coords->Column(v).t()
-                    << " : " << e.what() << endl;
+                    if (m_halt_bad_voxel)
+                        throw;
+                    else
+                        IgnoreVoxel(v);
+                }
+                catch (NEWMAT::Exception &e)
+                {
+                    LOG << "Vb::NEWMAT exception for voxel " << v << " at " << m_coords->Column(v).t()
+                        << " : " << e.what() << endl;
 
-                if (m_halt_bad_voxel)
-                    throw;
-                else
-                    IgnoreVoxel(v);
+                    if (m_halt_bad_voxel)
+                        throw;
+                    else
+                        IgnoreVoxel(v);
+                }
             }
         }
 
@@ -1053,34 +1232,14 @@ LOG << "hi" << endl;
     int nVoxels = resultMVNs.size();
     for (int k = 1; k <= m_num_params; k++)
     {
+        // Posterior means are all that is saved, the result MVNs are
+        // only built once the iterations have finished
         Matrix paramMean;
         paramMean.ReSize(1, nVoxels);
         for (int v = 1; v <= m_nvoxels; v++)
         {
-            try {
-                resultMVNs[v - 1]
-                = new MVNDist(m_ctx->fwd_post[v - 1], m_ctx->noise_post[v - 1]->OutputAsMVN());
-                MVNDist result = *resultMVNs[v - 1];
-                paramMean(1, v) = result.means(k);
-                // // add later
-                // if (m_needF)
-                // resultFs.at(v - 1) = F;
-            }
-            catch (...) {
-                // Even that can fail, due to results being singular
-                LOG << "Vb::Can't give any sensible answer for this voxel; outputting zero +- "
-                    "identity\n";
-                MVNDist *tmp = new MVNDist(m_log);
-                tmp->SetSize(m_ctx->fwd_post[v - 1].means.Nrows()
-                    + m_ctx->noise_post[v - 1]->OutputAsMVN().means.Nrows());
-                tmp->SetCovariance(IdentityMatrix(tmp->means.Nrows()));
-                resultMVNs.at(v - 1) = tmp;
-                // // add later
-                // if (m_needF)
-                // resultFs.at(v - 1) = F;
-            }
+            paramMean(1, v) = m_ctx->fwd_post[v - 1].means(k);
         }
-        m_model->GetParameters(rundata, params);
         rundata.SaveVoxelData("mean_" + params.at(k - 1).name + "_iter" + stringify(m_ctx->it), paramMean);
     }
 
@@ -1155,6 +1314,385 @@ LOG << "hi" << endl;
     }
 }
 
+/**
+ * Non-local means filter of one parameter map, in place
+ *
+ * values holds one value per voxel in voxel order. Each voxel is replaced by
+ * the mean of the masked voxels in its search window, weighted by
+ * exp(-d2 / h^2) where d2 is the mean squared difference between the patches
+ * around the two voxels and h = nlm.h * nlm.sigma. Positions outside the mask
+ * read as zero. The zero-padded volume is built on the first call from the
+ * voxel co-ordinates and reused, so later calls only scatter the values.
+ */
+void Vb::NlmFilter(vector<float> &values, const NlmSettings &nlm)
+{
+    const int pad = nlm.search + nlm.patch;
+    const int padz = nlm.search_z + nlm.patch_z;
+    const long sy = m_coords->Row(1).Maximum() + 1 + 2 * pad;
+    const long sz = sy * (m_coords->Row(2).Maximum() + 1 + 2 * pad);
+
+    if (m_nlm_pos.empty())
+    {
+        const long nvol = sz * (m_coords->Row(3).Maximum() + 1 + 2 * padz);
+        m_nlm_volume.assign(nvol, 0.0f);
+        m_nlm_mask.assign(nvol, 0);
+        m_nlm_pos.resize(m_nvoxels);
+        for (int v = 1; v <= m_nvoxels; v++)
+        {
+            long x = (*m_coords)(1, v) + pad;
+            long y = (*m_coords)(2, v) + pad;
+            long z = (*m_coords)(3, v) + padz;
+            m_nlm_pos[v - 1] = z * sz + y * sy + x;
+            m_nlm_mask[m_nlm_pos[v - 1]] = 1;
+        }
+    }
+
+    for (int v = 0; v < m_nvoxels; v++)
+    {
+        m_nlm_volume[m_nlm_pos[v]] = values[v];
+    }
+
+    const float *vol = &m_nlm_volume[0];
+    const char *mask = &m_nlm_mask[0];
+    // A patch is patchrows contiguous rows of patchw voxels each
+    const int patchw = 2 * nlm.patch + 1;
+    const int patchrows = (2 * nlm.patch_z + 1) * patchw;
+    const double hh = nlm.h * nlm.sigma;
+    const double scale = 1.0 / (hh * hh * patchrows * patchw);
+
+    // No newmat objects are used here, so the filter is threaded in every
+    // OpenMP build, not just those where NumThreads() allows the voxel loops
+    int nthreads = 1;
+#ifdef _OPENMP
+    nthreads = (m_nthreads > 0) ? m_nthreads : omp_get_max_threads();
+#endif
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 64)
+    for (int v = 0; v < m_nvoxels; v++)
+    {
+        const long c = m_nlm_pos[v];
+        double wsum = 0.0;
+        double sum = 0.0;
+        for (int dz = -nlm.search_z; dz <= nlm.search_z; dz++)
+        {
+            for (int dy = -nlm.search; dy <= nlm.search; dy++)
+            {
+                for (int dx = -nlm.search; dx <= nlm.search; dx++)
+                {
+                    const long j = c + dz * sz + dy * sy + dx;
+                    if (!mask[j])
+                        continue;
+
+                    // Patch distance, one contiguous row at a time
+                    float d2 = 0.0f;
+                    for (int qz = -nlm.patch_z; qz <= nlm.patch_z; qz++)
+                    {
+                        for (int qy = -nlm.patch; qy <= nlm.patch; qy++)
+                        {
+                            const float *a = vol + c + qz * sz + qy * sy - nlm.patch;
+                            const float *b = vol + j + qz * sz + qy * sy - nlm.patch;
+#pragma omp simd reduction(+ : d2)
+                            for (int qx = 0; qx < patchw; qx++)
+                            {
+                                float t = a[qx] - b[qx];
+                                d2 += t * t;
+                            }
+                        }
+                    }
+
+                    double w = exp(-d2 * scale);
+                    wsum += w;
+                    sum += w * vol[j];
+                }
+            }
+        }
+        // The voxel itself is always in its own search window so wsum >= 1
+        values[v] = sum / wsum;
+    }
+}
+
+/**
+ * Apply the prior updates for one voxel in spatial mode
+ *
+ * Priors read the current voxel and iteration from the run context, and
+ * the first voxel of a sweep also refreshes the global spatial precision,
+ * so this must never run concurrently.
+ */
+double Vb::ApplySpatialPriors(
+    FabberRunData &rundata, int v, vector<Prior *> &priors, vector<Parameter> &params)
+{
+    double Fprior = 0;
+    m_ctx->v = v;
+    for (int k = 0; k < m_num_params; k++)
+    {
+        if (params[0].prior_type == (PRIOR_NORMAL || PRIOR_DEFAULT)) {
+           Fprior += priors[k]->ApplyToMVN(&m_ctx->fwd_prior[v - 1], *m_ctx, rundata, params[k]);
+        } else {
+            if (m_ctx->it < 1) {
+                // allow use the prior information when combining the spatial prior
+                Fprior += priors[k]->ApplyToMVN_(&m_ctx->fwd_prior[v - 1], *m_ctx, rundata, params[k]);
+            }
+            if (m_ctx->it >= 1) { 
+                Fprior += priors[k]->ApplyToMVN(&m_ctx->fwd_prior[v - 1], *m_ctx, rundata, params[k]);
+            }
+        }
+    }
+    return Fprior;
+}
+
+/**
+ * Split the voxels into colour classes for the parallel spatial sweep
+ *
+ * Two voxels get different colours whenever the prior of one reads the
+ * posterior of the other: nearest and next-nearest neighbours for the MRF
+ * priors and, for the non-local means prior, the similarity window of every
+ * voxel in the search window. Voxels are coloured greedily in index order,
+ * which reduces to the usual red-black split when only the 6-connected
+ * neighbours are involved. The dependencies need not be symmetric (the NLM
+ * windows are cut at the mask boundary), so the colouring uses the
+ * symmetrised relation: a voxel avoids the colours of the voxels it reads
+ * and of the already coloured voxels which read it.
+ */
+void Vb::ColourVoxels(const vector<Parameter> &params)
+{
+    bool nlm = false;
+    for (unsigned int k = 0; k < params.size(); k++)
+    {
+        if (params[k].prior_type == PRIOR_SPATIAL_n)
+            nlm = true;
+    }
+
+    vector<int> colour(m_nvoxels, -1);
+    // taken[c] == v if colour c is used by a voxel which v depends on, or
+    // which depends on v
+    vector<int> taken;
+    // blocked[v-1] holds the colours of earlier voxels which read voxel v
+    vector<vector<int> > blocked(m_nvoxels);
+    vector<int> deps;
+    vector<const NeighbourCSR *> reads;
+    reads.push_back(&m_nbr_csr);
+    reads.push_back(&m_nbr2_csr);
+    if (nlm)
+    {
+        reads.push_back(&m_nbrn_csr);
+        reads.push_back(&m_nbrnn_csr);
+    }
+
+    m_colours.clear();
+    for (int v = 1; v <= m_nvoxels; v++)
+    {
+        deps.clear();
+        for (unsigned int r = 0; r < reads.size(); r++)
+        {
+            const NeighbourCSR &nbr = *reads[r];
+            deps.insert(deps.end(), nbr.index.begin() + nbr.start[v - 1],
+                nbr.index.begin() + nbr.start[v]);
+        }
+
+        // The non-local means prior also compares the similarity windows
+        // of each voxel in the search window
+        if (nlm)
+        {
+            for (int i = m_nbrn_csr.start[v - 1]; i < m_nbrn_csr.start[v]; i++)
+            {
+                int u = m_nbrn_csr.index[i];
+                deps.insert(deps.end(), m_nbrnn_csr.index.begin() + m_nbrnn_csr.start[u - 1],
+                    m_nbrnn_csr.index.begin() + m_nbrnn_csr.start[u]);
+            }
+        }
+        std::sort(deps.begin(), deps.end());
+        deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+
+        for (unsigned int i = 0; i < deps.size(); i++)
+        {
+            int c = colour[deps[i] - 1];
+            if (c >= 0)
+                taken[c] = v;
+        }
+        for (unsigned int i = 0; i < blocked[v - 1].size(); i++)
+            taken[blocked[v - 1][i]] = v;
+        vector<int>().swap(blocked[v - 1]);
+
+        unsigned int c = 0;
+        while (c < taken.size() && taken[c] == v)
+            c++;
+        if (c == taken.size())
+        {
+            taken.push_back(0);
+            m_colours.push_back(vector<int>());
+        }
+        colour[v - 1] = c;
+        m_colours[c].push_back(v);
+
+        // Later voxels which v reads must not share its colour either
+        for (unsigned int i = 0; i < deps.size(); i++)
+        {
+            if (deps[i] > v)
+                blocked[deps[i] - 1].push_back(c);
+        }
+    }
+
+    LOG << "Vb::Spatial sweep uses " << m_colours.size() << " colour classes" << endl;
+}
+
+/**
+ * Deal with voxels which failed during a parallel update
+ *
+ * Voxels are handled in index order after the parallel section, either
+ * halting the run or removing them from further updates.
+ */
+void Vb::HandleBadVoxels(vector<pair<int, string> > &bad, vector<char> &ignored)
+{
+    std::sort(bad.begin(), bad.end());
+    for (unsigned int i = 0; i < bad.size(); i++)
+    {
+        int v = bad[i].first;
+        LOG << "Vb::" << bad[i].second << " for voxel " << v << " at "
+            << m_coords->Column(v).t() << endl;
+
+        if (m_halt_bad_voxel)
+            throw FabberInternalError(bad[i].second);
+        else
+        {
+            IgnoreVoxel(v);
+            ignored[v - 1] = 1;
+        }
+    }
+    bad.clear();
+}
+
+/**
+ * Run one spatial VB iteration over all voxels using the colour classes
+ *
+ * Within a colour class no voxel's prior reads the posterior of another, so
+ * the theta updates of a class can run concurrently. Classes are visited in
+ * order, giving a Gauss-Seidel sweep in colour order rather than voxel order,
+ * so results differ slightly from the serial sweep but do not depend on the
+ * number of threads. The priors of a class are applied serially before its
+ * theta updates - see ApplySpatialPriors. Noise and linearization updates
+ * only touch the voxel itself and run over all voxels at once.
+ *
+ * @return Free energy summed over voxels in index order
+ */
+double Vb::SpatialSweepParallel(FabberRunData &rundata, vector<Prior *> &priors,
+    vector<Parameter> &params, vector<FwdModel *> &models, vector<const NoiseModel *> &noises)
+{
+    double Fglobal = 0;
+#ifdef _OPENMP
+    int nthreads = models.size();
+    vector<double> Fprior(m_nvoxels, 0.0);
+    vector<double> Fvox(m_nvoxels, 0.0);
+    vector<char> ignored(m_nvoxels, 0);
+    for (unsigned int i = 0; i < m_ctx->ignore_voxels.size(); i++)
+        ignored[m_ctx->ignore_voxels[i] - 1] = 1;
+    vector<pair<int, string> > bad;
+
+    for (unsigned int c = 0; c < m_colours.size(); c++)
+    {
+        const vector<int> &cv = m_colours[c];
+        const int n = cv.size();
+
+        for (int i = 0; i < n; i++)
+        {
+            int v = cv[i];
+            try
+            {
+                Fprior[v - 1] = ApplySpatialPriors(rundata, v, priors, params);
+                if (m_debug)
+                    DebugVoxel(v, "Priors set");
+            }
+            catch (FabberInternalError &e)
+            {
+                bad.push_back(make_pair(v, string("Internal error: ") + e.what()));
+            }
+            catch (NEWMAT::Exception &e)
+            {
+                bad.push_back(make_pair(v, string("NEWMAT exception: ") + e.what()));
+            }
+            if (ignored[v - 1])
+                LOG << "Ignoring voxel " << v << endl;
+        }
+        HandleBadVoxels(bad, ignored);
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 16)
+        for (int i = 0; i < n; i++)
+        {
+            int v = cv[i];
+            if (ignored[v - 1])
+                continue;
+            const NoiseModel *noise = noises[omp_get_thread_num()];
+            try
+            {
+                CalculateF(v, "before", Fprior[v - 1], noise);
+                noise->UpdateTheta(*m_ctx->noise_post[v - 1], m_ctx->fwd_post[v - 1],
+                    m_ctx->fwd_prior[v - 1], m_lin_model[v - 1], m_origdata->Column(v), NULL, 0);
+                if (m_debug)
+                    DebugVoxel(v, "Theta updated");
+                CalculateF(v, "theta", Fprior[v - 1], noise);
+            }
+            catch (FabberInternalError &e)
+            {
+#pragma omp critical(vb_fail)
+                bad.push_back(make_pair(v, string("Internal error: ") + e.what()));
+            }
+            catch (NEWMAT::Exception &e)
+            {
+#pragma omp critical(vb_fail)
+                bad.push_back(make_pair(v, string("NEWMAT exception: ") + e.what()));
+            }
+        }
+        HandleBadVoxels(bad, ignored);
+    }
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 16)
+    for (int v = 1; v <= m_nvoxels; v++)
+    {
+        if (ignored[v - 1])
+            continue;
+        FwdModel *model = models[omp_get_thread_num()];
+        const NoiseModel *noise = noises[omp_get_thread_num()];
+        try
+        {
+            PassModelData(v, model);
+
+            noise->UpdateNoise(*m_ctx->noise_post[v - 1], *m_ctx->noise_prior[v - 1],
+                m_ctx->fwd_post[v - 1], m_lin_model[v - 1], m_origdata->Column(v));
+            if (m_debug)
+                DebugVoxel(v, "Noise updated");
+
+            CalculateF(v, "noise", Fprior[v - 1], noise);
+
+            // Re-linearize with this thread's model instance
+            if (!m_locked_linear)
+            {
+                LinearizedFwdModel lin(model);
+                lin.ReCentre(m_ctx->fwd_post[v - 1].means);
+                m_lin_model[v - 1] = lin;
+            }
+            if (m_debug)
+                DebugVoxel(v, "Re-centre");
+
+            Fvox[v - 1] = CalculateF(v, "lin", Fprior[v - 1], noise);
+        }
+        catch (FabberInternalError &e)
+        {
+#pragma omp critical(vb_fail)
+            bad.push_back(make_pair(v, string("Internal error: ") + e.what()));
+        }
+        catch (NEWMAT::Exception &e)
+        {
+#pragma omp critical(vb_fail)
+            bad.push_back(make_pair(v, string("NEWMAT exception: ") + e.what()));
+        }
+    }
+    HandleBadVoxels(bad, ignored);
+
+    for (int v = 1; v <= m_nvoxels; v++)
+        Fglobal += Fvox[v - 1];
+#endif
+    return Fglobal;
+}
+
 void Vb::CheckCoordMatrixCorrectlyOrdered(const Matrix &coords)
 {
     // Only 3D
@@ -1181,40 +1719,77 @@ void Vb::CheckCoordMatrixCorrectlyOrdered(const Matrix &coords)
     }
 }
 
-// Binary search for data(index) == num
-// Assumes data is sorted ascending!!
-// Either returns an index such that data(index) == num
-//   or -1 if num is not present in data.
-static inline int binarySearch(const ColumnVector &data, int num)
+/**
+ * Grow each voxel's neighbourhood by one ring per round
+ *
+ * Neighbours of the current neighbours which are not already listed (and
+ * are not the voxel itself) are added in front of the existing list.
+ * Membership is tracked with a stamp per voxel rather than searching the
+ * growing lists.
+ */
+static void ExpandNeighbours(NeighbourCSR &nbr, int nVoxels, int rounds)
 {
-    int first = 1, last = data.Nrows();
-
-    while (first <= last)
+    vector<int> stamp(nVoxels, 0);
+    int mark = 0;
+    vector<int> added;
+    for (int r = 0; r < rounds; r++)
     {
-        int test = (first + last) / 2;
-
-        if (data(test) < num)
-        {
-            first = test + 1;
-        }
-        else if (data(test) > num)
+        NeighbourCSR grown;
+        grown.start.resize(nVoxels + 1);
+        grown.index.reserve(nbr.index.size() * 3);
+        for (int vid = 1; vid <= nVoxels; vid++)
         {
-            last = test - 1;
-        }
-        else if (data(test) == num)
-        {
-            return test;
-        }
-        else
-        {
-            assert(false); // logic error!  data wasn't sorted?
+            ++mark;
+            stamp[vid - 1] = mark;
+            for (int i = nbr.start[vid - 1]; i < nbr.start[vid]; i++)
+                stamp[nbr.index[i] - 1] = mark;
+
+            added.clear();
+            for (int i = nbr.start[vid - 1]; i < nbr.start[vid]; i++)
+            {
+                int n1id = nbr.index[i];
+                for (int j = nbr.start[n1id - 1]; j < nbr.start[n1id]; j++)
+                {
+                    int n2id = nbr.index[j];
+                    if (stamp[n2id - 1] != mark)
+                    {
+                        stamp[n2id - 1] = mark;
+                        added.push_back(n2id);
+                    }
+                }
+            }
+
+            grown.start[vid - 1] = grown.index.size();
+            grown.index.insert(grown.index.end(), added.begin(), added.end());
+            grown.index.insert(grown.index.end(), nbr.index.begin() + nbr.start[vid - 1],
+                nbr.index.begin() + nbr.start[vid]);
         }
+        grown.start[nVoxels] = grown.index.size();
+        nbr.start.swap(grown.start);
+        nbr.index.swap(grown.index);
+    }
+}
+
+/**
+ * Copy CSR neighbour lists into the per-voxel vectors used by the priors
+ */
+static void CopyNeighbours(const NeighbourCSR &nbr, vector<vector<int> > &lists)
+{
+    const int nVoxels = nbr.start.size() - 1;
+    lists.resize(nVoxels);
+    for (int v = 1; v <= nVoxels; v++)
+    {
+        lists[v - 1].assign(
+            nbr.index.begin() + nbr.start[v - 1], nbr.index.begin() + nbr.start[v]);
     }
-    return -1;
 }
 
 /**
  * Calculate nearest and second-nearest neighbours for the voxels
+ *
+ * Voxels are located through a dense volume mapping each offset to its
+ * voxel index, and every neighbourhood is first built in compressed sparse
+ * row form before being copied into the run context.
  */
 void Vb::CalcNeighbours(const Matrix &coords)
 {
@@ -1223,24 +1798,29 @@ void Vb::CalcNeighbours(const Matrix &coords)
         return;
 
     // Voxels must be ordered by increasing z, y and x values respectively
-    // otherwise binary search for voxel by offset will not work
+    // otherwise the neighbour lists will not be in the expected order
     CheckCoordMatrixCorrectlyOrdered(coords);
 
-    // Create a column vector with one entry per voxel.
-    ColumnVector offsets(nVoxels);
-
     // Populate offsets with the offset into the
     // matrix of each voxel. We assume that co-ordinates
     // could be zero but not negative
     int xsize = coords.Row(1).Maximum() + 1;
     int ysize = coords.Row(2).Maximum() + 1;
+    int zsize = coords.Row(3).Maximum() + 1;
+    vector<int> offsets(nVoxels);
+
+    // Dense lookup from offset to voxel index (indexed from 1, 0 if there
+    // is no voxel at that position)
+    const int nvol = xsize * ysize * zsize;
+    vector<int> voxelAt(nvol, 0);
     for (int v = 1; v <= nVoxels; v++)
     {
         int x = coords(1, v);
         int y = coords(2, v);
         int z = coords(3, v);
         int offset = z * xsize * ysize + y * xsize + x;
-        offsets(v) = offset;
+        offsets[v - 1] = offset;
+        voxelAt[offset] = v;
     }
 
     // Delta is a list of offsets to find nearest
@@ -1264,27 +1844,27 @@ void Vb::CalcNeighbours(const Matrix &coords)
     // However note we still need the full list of 3D deltas for later
     int max_delta = m_spatial_dims * 2 - 1;
 
-    // Neighbours is a vector of vectors, so each voxel
-    // will have an entry which is a vector of its neighbours, so we have 4 (2D) and 6 (3D)
-    m_ctx->neighbours.resize(nVoxels);
+    // Each voxel has an entry listing its neighbours, so we have 4 (2D) and 6 (3D)
+    NeighbourCSR &nbr = m_nbr_csr;
+    nbr.start.assign(nVoxels + 1, 0);
+    nbr.index.clear();
+    nbr.index.reserve(nVoxels * (max_delta + 1));
 
-    // Go through each voxel. Note that offsets is indexed from 1 not 0
-    // however the offsets themselves (potentially) start at 0. 
     for (int vid = 1; vid <= nVoxels; vid++)
     {
+        nbr.start[vid - 1] = nbr.index.size();
+
         // Get the voxel offset into the matrix
-        int pos = int(offsets(vid));
+        int pos = offsets[vid - 1];
 
         // Now search for neighbours
         for (int n = 0; n <= max_delta; n++)
         {
             // is there a voxel at this neighbour position?
-            // indexed from 1; id == -1 if not found.
-            int id = binarySearch(offsets, pos + delta[n]);
-
-            // No such voxel: continue
-            if (id < 0)
+            int npos = pos + delta[n];
+            if (npos < 0 || npos >= nvol || voxelAt[npos] == 0)
                 continue;
+            int id = voxelAt[npos];
 
             // Check for wrap-around
 
@@ -1314,30 +1894,36 @@ void Vb::CalcNeighbours(const Matrix &coords)
             }
 
             // If we get this far, add it to the list
-            m_ctx->neighbours.at(vid - 1).push_back(id);
+            nbr.index.push_back(id);
         }
     }
+    nbr.start[nVoxels] = nbr.index.size();
 
     // Similar algorithm but looking for Neighbours-of-neighbours, excluding self,
     // but including duplicates if there are two routes to get there
     // (diagonally connected), so we have 4+4 (2D) ?(3D) neighbours?
-    m_ctx->neighbours2.resize(nVoxels);
+    NeighbourCSR &nbr2 = m_nbr2_csr;
+    nbr2.start.assign(nVoxels + 1, 0);
+    nbr2.index.clear();
+    nbr2.index.reserve(nVoxels * (max_delta + 1) * max_delta);
 
     for (int vid = 1; vid <= nVoxels; vid++)
     {
+        nbr2.start[vid - 1] = nbr2.index.size();
+
         // Go through the list of neighbours for each voxel.
-        for (unsigned n1 = 0; n1 < m_ctx->neighbours.at(vid - 1).size(); n1++)
+        for (int n1 = nbr.start[vid - 1]; n1 < nbr.start[vid]; n1++)
         {
             // n1id is the voxel index (not the offset) of the neighbour
-            int n1id = m_ctx->neighbours[vid - 1].at(n1);
+            int n1id = nbr.index[n1];
             int checkNofN = 0;
             // Go through each of it's neighbours. Add each, apart from original voxel
-            for (unsigned n2 = 0; n2 < m_ctx->neighbours.at(n1id - 1).size(); n2++)
+            for (int n2 = nbr.start[n1id - 1]; n2 < nbr.start[n1id]; n2++)
             {
-                int n2id = m_ctx->neighbours[n1id - 1].at(n2);
+                int n2id = nbr.index[n2];
                 if (n2id != vid)
                 {
-                    m_ctx->neighbours2[vid - 1].push_back(n2id);
+                    nbr2.index.push_back(n2id);
                 }
                 else
                     checkNofN++;
@@ -1350,16 +1936,14 @@ void Vb::CalcNeighbours(const Matrix &coords)
             }
         }
     }
+    nbr2.start[nVoxels] = nbr2.index.size();
 
 ////////////////////////////////
     int search_w = 3;
     int similarity_w = 3;
     // Start looking for Neighbours for non-local means filtering, which is a bit different from above,
     // for instance, a width of 3 indicates a neighbour of 3*3 (2D) or 3*3*3 (3D)
-    // A brutal way is to search the neighbours for each voxel, but alternatively we can search the neighbor (maybe many times?)
-    // of the nearst neighbours, which can be slower when the window width is large
-    m_ctx->neighboursn.resize(nVoxels);
-    m_ctx->neighboursnn.resize(nVoxels);
+    // The wider windows are grown one ring at a time from the nearest neighbours
     vector<int> deltan;
     deltan.push_back(1);              // next row
     deltan.push_back(-1);             // prev row
@@ -1389,139 +1973,41 @@ void Vb::CalcNeighbours(const Matrix &coords)
     deltan.push_back(-xsize * ysize-xsize-1); // prev slice
 
     int max_deltan = pow(3,m_spatial_dims) - 2;
+    NeighbourCSR &nbrn = m_nbrn_csr;
+    nbrn.start.assign(nVoxels + 1, 0);
+    nbrn.index.clear();
+    nbrn.index.reserve(nVoxels * (max_deltan + 1));
     for (int vid = 1; vid <= nVoxels; vid++)
     {
+        nbrn.start[vid - 1] = nbrn.index.size();
+
         // Get the voxel offset into the matrix
-        int pos = int(offsets(vid));
+        int pos = offsets[vid - 1];
 
-        // Now search for neighbours
+        // Now search for neighbours. Note no wrap-around check here
         for (int n = 0; n <= max_deltan; n++)
         {
             // is there a voxel at this neighbour position?
-            // indexed from 1; id == -1 if not found.
-            int id = binarySearch(offsets, pos + deltan[n]);
-
-            // No such voxel: continue
-            if (id < 0)
+            int npos = pos + deltan[n];
+            if (npos < 0 || npos >= nvol || voxelAt[npos] == 0)
                 continue;
 
-            // Check for wrap-around
-
-            // Don't check for wrap around on final co-ord
-            // PREVIOUSLY		if (delta.size() >= n + 2)
-            // Changed (fixed)? because if spatialDims != 3 we still need
-            // to check for wrap around in y-coordinate FIXME check
-            if (n < 0)      ///////?
-            {
-                bool ignore = false;
-                if (deltan[n] > 0)
-                {
-                    int test = deltan[n + 2];
-                    if (test > 0)
-                        ignore = (pos % test) >= test - deltan[n];
-                }
-                else
-                {
-                    int test = -deltan[n + 2];
-                    if (test > 0)
-                        ignore = (pos % test) < -deltan[n];
-                }
-                if (ignore)
-                {
-                    continue;
-                }
-            }
-
             // If we get this far, add it to the list
-            m_ctx->neighboursn.at(vid - 1).push_back(id);
-            m_ctx->neighboursnn.at(vid - 1).push_back(id);
+            nbrn.index.push_back(voxelAt[npos]);
         }
     }
+    nbrn.start[nVoxels] = nbrn.index.size();
 
-
-std::vector<std::vector<int> > neighbourstmp;
-neighbourstmp.resize(nVoxels);
-for (int i=1; i<search_w-2; i++) {   // skip first iteration
-    // neighbourstmp.resize(nVoxels);
-    for (int vid = 1; vid <= nVoxels; vid++)
-    {
-        // Go through the list of neighbours for each voxel.
-        for (unsigned n1 = 0; n1 < m_ctx->neighboursn.at(vid - 1).size(); n1++)
-        {
-            // n1id is the voxel index (not the offset) of the neighbour
-            int n1id = m_ctx->neighboursn[vid - 1].at(n1);
-            int checkNofN = 0;
-            // Go through each of it's neighbours. Add each, apart from original voxel
-            for (unsigned n2 = 0; n2 < m_ctx->neighboursn.at(n1id - 1).size(); n2++)
-            {
-                int n2id = m_ctx->neighboursn[n1id - 1].at(n2);
-// LOG << "hi " << n2id << endl;
-                bool test1 = (std::find(m_ctx->neighboursn[vid-1].begin(), m_ctx->neighboursn[vid-1].end(), n2id) != m_ctx->neighboursn[vid-1].end());
-// LOG << "hi" << test1 << endl;
-                bool test2 = (std::find(neighbourstmp[vid-1].begin(), neighbourstmp[vid-1].end(), n2id) != neighbourstmp[vid-1].end());
-                bool test = test1 || test2;
-// LOG << "hi" << test2 << endl;
-                if ((n2id != vid) && !test )
-                {
-// LOG << "hi" << endl;
-                    neighbourstmp[vid - 1].push_back(n2id);
-                }
-                else
-                    checkNofN++;
-            }
-// LOG << "checkNofN" << checkNofN << endl;
-            // if (checkNofN != 1)
-            // {
-            //     throw FabberInternalError("Each of this voxel's neighbours must have "
-            //                               "this voxel as a neighbour");
-            // }
-        }
-    }
-    for (int vid = 1; vid <= nVoxels; vid++)
-    { m_ctx->neighboursn[vid-1].insert( m_ctx->neighboursn[vid-1].begin(),neighbourstmp[vid-1].begin(), neighbourstmp[vid-1].end()); 
-      neighbourstmp[vid-1].clear();  }
-}
-
-
-// neighbourstmp[vid-1].clear(); 
-for (int i=1; i<similarity_w-2; i++) {   // skip first iteration
-
-    // neighbourstmp.resize(nVoxels);
-    for (int vid = 1; vid <= nVoxels; vid++)
-    {
-        // Go through the list of neighbours for each voxel.
-        for (unsigned n1 = 0; n1 < m_ctx->neighboursnn.at(vid - 1).size(); n1++)
-        {
-            // n1id is the voxel index (not the offset) of the neighbour
-            int n1id = m_ctx->neighboursnn[vid - 1].at(n1);
-            int checkNofN = 0;
-            // Go through each of it's neighbours. Add each, apart from original voxel
-            for (unsigned n2 = 0; n2 < m_ctx->neighboursnn.at(n1id - 1).size(); n2++)
-            {
-                int n2id = m_ctx->neighboursnn[n1id - 1].at(n2);
-                bool test = (std::find(m_ctx->neighboursnn[vid-1].begin(), m_ctx->neighboursnn[vid-1].end(), n2id) != m_ctx->neighboursnn[vid-1].end())
-                  || (std::find(neighbourstmp[vid-1].begin(), neighbourstmp[vid-1].end(), n2id) != neighbourstmp[vid-1].end());
-                if (n2id != vid && !test )
-                {
-                    neighbourstmp[vid - 1].push_back(n2id);
-                }
-                else
-                    checkNofN++;
-            }
-
-            // if (checkNofN != 1)
-            // {
-            //     throw FabberInternalError("Each of this voxel's neighbours must have "
-            //                               "this voxel as a neighbour");
-            // }
-        }
-    }
-    for (int vid = 1; vid <= nVoxels; vid++)
-    { m_ctx->neighboursnn[vid-1].insert( m_ctx->neighboursnn[vid-1].begin(),neighbourstmp[vid-1].begin(), neighbourstmp[vid-1].end()); 
-      neighbourstmp[vid-1].clear();  }
-}
+    // Search and similarity windows start out identical
+    m_nbrnn_csr = nbrn;
+    ExpandNeighbours(m_nbrn_csr, nVoxels, search_w - 3);
+    ExpandNeighbours(m_nbrnn_csr, nVoxels, similarity_w - 3);
 //////////////////////
 
+    CopyNeighbours(m_nbr_csr, m_ctx->neighbours);
+    CopyNeighbours(m_nbr2_csr, m_ctx->neighbours2);
+    CopyNeighbours(m_nbrn_csr, m_ctx->neighboursn);
+    CopyNeighbours(m_nbrnn_csr, m_ctx->neighboursnn);
 }
 
 void Vb::SaveResults(FabberRunData &rundata) const
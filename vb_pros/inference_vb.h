@@ -75,8 +75,46 @@
 // #include "nlm.cxx"
 
 #include <string>
+#include <utility>
 #include <vector>
 
+class Prior;
+
+/**
+ * Neighbour lists for all voxels in compressed sparse row form
+ *
+ * The neighbours of voxel v (numbered from 1) are
+ * index[start[v-1]] ... index[start[v]-1].
+ */
+struct NeighbourCSR
+{
+    std::vector<int> start;
+    std::vector<int> index;
+};
+
+/**
+ * Settings for the non-local means step of the PRIOR_SPATIAL_n prior.
+ * Radii are in voxels
+ */
+struct NlmSettings
+{
+    NlmSettings()
+        : sigma(0.006)
+        , h(1.2)
+        , search(3)
+        , search_z(1)
+        , patch(3)
+        , patch_z(1)
+    {
+    }
+    double sigma;
+    double h;
+    int search;
+    int search_z;
+    int patch;
+    int patch_z;
+};
+
 class Vb : public InferenceTechnique
 {
 public:
@@ -95,9 +133,12 @@ public:
         , m_num_mcsteps(0)
         , m_spatial_dims(-1)
         , m_locked_linear(false)
+        , m_nthreads(1)
     {
     }
 
+    virtual ~Vb();
+
     virtual void GetOptions(vector<OptionSpec> &opts) const;
     virtual std::string GetDescription() const;
     virtual string GetVersion() const;
@@ -123,6 +164,12 @@ protected:
      */
     void PassModelData(int voxel);
 
+    /**
+     * Pass the voxel's data to a specific model instance, e.g. one
+     * owned by a worker thread
+     */
+    void PassModelData(int voxel, FwdModel *model);
+
     /**
      * Determine whether we need spatial VB mode
      *
@@ -137,16 +184,72 @@ protected:
      */
     virtual void DoCalculationsVoxelwise(FabberRunData &data);
 
+    /**
+     * Run the VB iterations to convergence for one voxel in voxelwise
+     * mode and store its result MVN
+     */
+    void FitVoxel(FabberRunData &rundata, int v, FwdModel *model, const NoiseModel *noise,
+        std::vector<Prior *> &priors, std::vector<Parameter> &params);
+
     /**
      * Do calculations loop in spatial mode (i.e. one iteration of all
      * voxels, then next iteration of all voxels, etc)
      */
     virtual void DoCalculationsSpatial(FabberRunData &data);
 
+    /**
+     * Non-local means filter of a parameter map given in voxel order
+     */
+    void NlmFilter(std::vector<float> &values, const NlmSettings &nlm);
+
+    /**
+     * Apply prior updates for one voxel in spatial mode and return the
+     * free energy contribution
+     */
+    double ApplySpatialPriors(FabberRunData &rundata, int v, std::vector<Prior *> &priors,
+        std::vector<Parameter> &params);
+
+    /**
+     * Partition voxels into colour classes such that no voxel's prior
+     * depends on another voxel of the same class
+     */
+    void ColourVoxels(const std::vector<Parameter> &params);
+
+    /**
+     * One spatial iteration over all voxels, updating each colour class
+     * concurrently. Returns the global free energy
+     */
+    double SpatialSweepParallel(FabberRunData &rundata, std::vector<Prior *> &priors,
+        std::vector<Parameter> &params, std::vector<FwdModel *> &models,
+        std::vector<const NoiseModel *> &noises);
+
+    /**
+     * Log voxels which failed in a parallel section and either halt or
+     * ignore them from now on
+     */
+    void HandleBadVoxels(std::vector<std::pair<int, std::string> > &bad, std::vector<char> &ignored);
+
+    /**
+     * Number of worker threads to use, 1 if built without OpenMP or
+     * against a newmat library with the Tracer
+     */
+    int NumThreads() const;
+
+    /**
+     * Create per-thread forward model instances. Entry 0 is the main model
+     */
+    void CreateThreadModels(FabberRunData &rundata, int nthreads, std::vector<FwdModel *> &models);
+
+    /**
+     * Create per-thread noise model instances. Entry 0 is the main noise model
+     */
+    void CreateThreadNoiseModels(
+        FabberRunData &rundata, int nthreads, std::vector<const NoiseModel *> &noises);
+
     /**
      * Calculate free energy if required, and display if required
      */
-    double CalculateF(int v, std::string label, double Fprior);
+    double CalculateF(int v, std::string label, double Fprior, const NoiseModel *noise);
 
     /**
      * Output detailed debugging information for a voxel
@@ -258,6 +361,38 @@ protected:
      */
     bool m_locked_linear;
 
+    /** Number of worker threads, 0 to use the OpenMP default */
+    int m_nthreads;
+
+    /** Extra forward model instances owned by worker threads */
+    std::vector<FwdModel *> m_thread_models;
+
+    /** Extra noise model instances owned by worker threads */
+    std::vector<NoiseModel *> m_thread_noise;
+
+    /**
+     * Nearest, next-nearest, non-local search and similarity neighbours as
+     * built by CalcNeighbours. The per-voxel lists in the run context are
+     * copies of these which IgnoreVoxel may later prune
+     */
+    NeighbourCSR m_nbr_csr;
+    NeighbourCSR m_nbr2_csr;
+    NeighbourCSR m_nbrn_csr;
+    NeighbourCSR m_nbrnn_csr;
+
+    /**
+     * Buffers for the non-local means step, kept across iterations: the
+     * parameter map in voxel order, the zero-padded volume and mask, and
+     * each voxel's position in the padded volume
+     */
+    std::vector<float> m_nlm_values;
+    std::vector<float> m_nlm_volume;
+    std::vector<char> m_nlm_mask;
+    std::vector<long> m_nlm_pos;
+
+    /** Voxel indices of each colour class for the parallel spatial sweep */
+    std::vector<std::vector<int> > m_colours;
+
     bool m_have_mask;
 
     NEWMAT::RowVector m_mask;
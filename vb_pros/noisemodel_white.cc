@@ -83,6 +83,36 @@ using MISCMATHS::digamma;
 using namespace NEWMAT;
 using namespace std;
 
+// NEWMAT keeps a Matrix by rows and the lower triangle of a SymmetricMatrix by rows,
+// so the kernels below work on the raw storage. Each Qi is a 0/1 diagonal, i.e. a mask
+// of the samples that use that phi, so the Qis are kept only as the phi index of each
+// sample and all phis are updated in one pass over the samples.
+
+// Linearised residual of one sample, data - g(centre) + J (centre - means)
+static inline double SampleResidual(
+    const Real *jrow, int nParams, double d, double offset, const Real *centre, const Real *means)
+{
+    double k = d - offset;
+    for (int p = 0; p < nParams; p++)
+        k += jrow[p] * (centre[p] - means[p]);
+    return k;
+}
+
+// Quadratic form j' S j of one Jacobian row with a packed symmetric matrix
+static inline double SampleCovTrace(const Real *jrow, int nParams, const Real *sym)
+{
+    double w = 0;
+    for (int p = 0; p < nParams; p++)
+    {
+        const Real *srow = sym + p * (p + 1) / 2;
+        double a = 0;
+        for (int q = 0; q < p; q++)
+            a += srow[q] * jrow[q];
+        w += jrow[p] * (2 * a + srow[p] * jrow[p]);
+    }
+    return w;
+}
+
 NoiseModel *WhiteNoiseModel::NewInstance()
 {
     return new WhiteNoiseModel();
@@ -178,18 +208,18 @@ void WhiteNoiseModel::Initialize(FabberRunData &args)
 
 int WhiteNoiseModel::NumParams()
 {
-    return Qis.size();
+    return m_phi_nsamples.size();
 }
 WhiteParams *WhiteNoiseModel::NewParams() const
 {
-    return new WhiteParams(Qis.size());
+    return new WhiteParams(m_phi_nsamples.size());
 }
 void WhiteNoiseModel::HardcodedInitialDists(NoiseParams &priorIn, NoiseParams &posteriorIn) const
 {
     WhiteParams &prior = dynamic_cast<WhiteParams &>(priorIn);
     WhiteParams &posterior = dynamic_cast<WhiteParams &>(posteriorIn);
 
-    int nPhis = Qis.size();
+    int nPhis = m_phi_nsamples.size();
     assert(nPhis > 0);
     //    prior.resize(nPhis);
     //    posterior.resize(nPhis);
@@ -225,7 +255,7 @@ void WhiteNoiseModel::HardcodedInitialDists(NoiseParams &priorIn, NoiseParams &p
 
 void WhiteNoiseModel::MakeQis(int dataLen) const
 {
-    if (!Qis.empty() && Qis[0].Nrows() == dataLen)
+    if (!m_phi_nsamples.empty() && (int)m_sample_phi.size() == dataLen)
         return; // Qis are already up-to-date
 
     // Read the pattern string into a vector pat
@@ -261,26 +291,28 @@ void WhiteNoiseModel::MakeQis(int dataLen) const
 
     LOG << "WhiteNoiseMode::Pattern of phis used is " << pat << endl;
 
-    // Regenerate Qis. This is a vector of
-    // diagonal matrices, one for each parameter (Phi).
-    // Each matrix is the same size as the length of the data.
-    Qis.clear();
-    DiagonalMatrix zeroes(dataLen);
-    zeroes = 0.0;
-    Qis.resize(nPhis, zeroes); // initialize all to zero
-
-    // For each sample in the timeseries, find the
-    // appropriate parameter (phi) from the pattern
-    // and set the diagonal element in the Qi matrix
-    // to 1. So each Qi matrix has elements to define
-    // what samples it applies to
+    // Masked time points as a bitmap over the samples
+    vector<char> masked(dataLen + 1, 0);
+    for (unsigned m = 0; m < m_masked_tpoints.size(); m++)
+    {
+        if (m_masked_tpoints[m] >= 1 && m_masked_tpoints[m] <= dataLen)
+            masked[m_masked_tpoints[m]] = 1;
+    }
+
+    // Regenerate Qis. For each sample in the timeseries, find the
+    // appropriate parameter (phi) from the pattern, so that the
+    // sample belongs to Qi of that phi, unless it is masked. The
+    // number of samples of each phi is the trace of its Qi.
+    m_sample_phi.assign(dataLen, -1);
+    m_phi_nsamples.assign(nPhis, 0);
     for (int d = 1; d <= dataLen; d++)
     {
         // Only flag a time point as relevant if it is not masked
-        if (std::find(m_masked_tpoints.begin(), m_masked_tpoints.end(), d)
-            == m_masked_tpoints.end())
+        if (!masked[d])
         {
-            Qis.at(pat.at(d - 1) - 1)(d, d) = 1;
+            int i = pat.at(d - 1) - 1;
+            m_sample_phi[d - 1] = i;
+            m_phi_nsamples[i]++;
         }
     }
 }
@@ -292,32 +324,39 @@ void WhiteNoiseModel::UpdateNoise(NoiseParams &noise, const NoiseParams &noisePr
     const WhiteParams &prior = dynamic_cast<const WhiteParams &>(noisePrior);
 
     const Matrix &J = linear.Jacobian();
-    ColumnVector k = data - linear.Offset() + J * (linear.Centre() - theta.means);
+    const SymmetricMatrix &Sigma = theta.GetCovariance();
+    const int nTimes = data.Nrows();
+    const int nParams = J.Ncols();
 
     // Check there are the same number of Qis in this model and in the
     // prior and posterior parameter sets.
-    MakeQis(data.Nrows());
-    const int nPhis = Qis.size();
+    MakeQis(nTimes);
+    const int nPhis = m_phi_nsamples.size();
     assert(nPhis == posterior.nPhis);
     assert(nPhis == prior.nPhis);
 
+    // This is calculating the 2nd and 3rd terms of RHS of Eq (22) in Chappel et al 2009,
+    // k'*Qi*k + Tr(Sigma*J'*Qi*J), for all phis in one pass over the samples
+    vector<double> tmp(nPhis, 0.0);
+    for (int t = 0; t < nTimes; t++)
+    {
+        const int i = m_sample_phi[t];
+        if (i < 0)
+            continue;
+        const Real *jrow = J.Store() + t * nParams;
+        double k = SampleResidual(jrow, nParams, data.Store()[t], linear.Offset().Store()[t],
+            linear.Centre().Store(), theta.means.Store());
+        tmp[i] += k * k + SampleCovTrace(jrow, nParams, Sigma.Store());
+    }
+
     // Update each phi distribution in turn
     for (int i = 1; i <= nPhis; i++)
     {
-        // Each Phi matrix is a diagonal matrix of same size size as the
-        // number of time samples in the data
-        const DiagonalMatrix &Qi = Qis[i - 1];
-
-        // This is calculating the 2nd and 3rd terms of RHS of Eq (22) in Chappel et al 2009
-        double tmp = (k.t() * Qi * k).AsScalar() + (theta.GetCovariance() * J.t() * Qi * J).Trace();
-
         // This is Eq (22) in Chappel et al 2009
-        posterior.phis[i - 1].b = 1 / (tmp * 0.5 + 1 / prior.phis[i - 1].b);
+        posterior.phis[i - 1].b = 1 / (tmp[i - 1] * 0.5 + 1 / prior.phis[i - 1].b);
 
         // Number of data sample points which use this parameter.
-        // Should be an integer
-        double nTimes = Qi.Trace();
-        assert(nTimes == int(nTimes));
+        double nTimes = m_phi_nsamples[i - 1];
 
         // This is Eq (21) in Chappel et al 2009
         posterior.phis[i - 1].c = (nTimes - 1) * 0.5 + prior.phis[i - 1].c;
@@ -342,26 +381,52 @@ void WhiteNoiseModel::UpdateTheta(const NoiseParams &noiseIn, MVNDist &theta,
     const ColumnVector &gml = linear.Offset();
     const Matrix &J = linear.Jacobian();
 
+    const int nTimes = data.Nrows();
+    const int nParams = J.Ncols();
+
     // Make sure Qis are up-to-date
-    MakeQis(data.Nrows());
-    assert(Qis.size() == (unsigned)noise.nPhis);
+    MakeQis(nTimes);
+    assert(m_phi_nsamples.size() == (unsigned)noise.nPhis);
 
     // Marginalize over phi distributions
     // Qis are diagonal matrices with 1 only where that phi applies.
-    // Adding up all the Qis will give you the identity matrix.
-    DiagonalMatrix X(data.Nrows());
-    X = 0;
-    for (unsigned i = 1; i <= Qis.size(); i++)
-        X += Qis[i - 1] * noise.phis[i - 1].CalcMean();
+    // Adding up all the Qis gives the identity, so X = sum(Qi * phi_i) weights
+    // every unmasked sample by the mean of its phi. J'*X*J, J'*X*(data - gml + J*ml)
+    // and J'*X*(data - gml) are accumulated sample by sample without forming X.
+    SymmetricMatrix Ltmp(nParams);
+    ColumnVector mTmp(nParams), JtXd(nParams);
+    Ltmp = 0;
+    mTmp = 0;
+    JtXd = 0;
+    Real *l = Ltmp.Store();
+    vector<double> phi(noise.nPhis);
+    for (int i = 0; i < noise.nPhis; i++)
+        phi[i] = noise.phis[i].CalcMean();
+    for (int t = 0; t < nTimes; t++)
+    {
+        const int i = m_sample_phi[t];
+        if (i < 0)
+            continue;
+        double x = phi[i];
+        const Real *jrow = J.Store() + t * nParams;
+        double d = data.Store()[t] - gml.Store()[t];
+        double r = d;
+        for (int p = 0; p < nParams; p++)
+            r += jrow[p] * ml.Store()[p];
+        for (int p = 0; p < nParams; p++)
+        {
+            double xj = x * jrow[p];
+            Real *lrow = l + p * (p + 1) / 2;
+            for (int c = 0; c <= p; c++)
+                lrow[c] += xj * jrow[c];
+            mTmp.Store()[p] += xj * r;
+            JtXd.Store()[p] += xj * d;
+        }
+    }
 
     // Update Lambda (model precisions)
     //
     // This is Eq (19) in Chappel et al (2009)
-    //
-    // use << instead of = because this is considered a lossy assignment
-    // (since NEWMAT isn't smart enough to know J'*X*J is always symmetric)
-    SymmetricMatrix Ltmp;
-    Ltmp << J.t() * X * J;
     theta.SetPrecisions(thetaPrior.GetPrecisions() + Ltmp);
 
     // Error checking
@@ -377,8 +442,7 @@ void WhiteNoiseModel::UpdateTheta(const NoiseParams &noiseIn, MVNDist &theta,
 
     // Update m (model means)
     //
-    // This is the first term of RHS of Eq (20) in Chappel et al (2009)
-    ColumnVector mTmp = J.t() * X * (data - gml + J * ml);
+    // mTmp is the first term of RHS of Eq (20) in Chappel et al (2009)
     if (LMalpha <= 0.0)
     {
         // Normal update (NB the LM update reduces to this when alpha=0 strictly)
@@ -398,7 +462,7 @@ void WhiteNoiseModel::UpdateTheta(const NoiseParams &noiseIn, MVNDist &theta,
         precdiag << prec;
 
         // a different (but equivalent) form for the LM update
-        Delta = J.t() * X * (data - gml) + thetaPrior.GetPrecisions() * thetaPrior.means
+        Delta = JtXd + thetaPrior.GetPrecisions() * thetaPrior.means
             - thetaPrior.GetPrecisions() * ml;
         try
         {
@@ -426,13 +490,12 @@ double WhiteNoiseModel::CalcFreeEnergy(const NoiseParams &noiseIn, const NoisePa
     const MVNDist &theta, const MVNDist &thetaPrior, const LinearFwdModel &linear,
     const ColumnVector &data) const
 {
-    const int nPhis = Qis.size();
+    const int nPhis = m_phi_nsamples.size();
     const WhiteParams &noise = dynamic_cast<const WhiteParams &>(noiseIn);
     const WhiteParams &noisePrior = dynamic_cast<const WhiteParams &>(noisePriorIn);
 
     // Calculate some matrices we will need
     const Matrix &J = linear.Jacobian();
-    ColumnVector k = data - linear.Offset() + J * (linear.Centre() - theta.means);
     const SymmetricMatrix &Linv = theta.GetCovariance();
 
     // some values we will need
@@ -464,7 +527,7 @@ double WhiteNoiseModel::CalcFreeEnergy(const NoiseParams &noiseIn, const NoisePa
         expectedLogPhiDist += -gammaln(ci) - ci * log(si) - ci + (ci - 1) * (digamma(ci) + log(si));
 
         expectedLogPosteriorParts[0] += (digamma(ci) + log(si))
-            * ((Qis[i].Trace()) * 0.5 + ciPrior - 1); // nTimes using phi_{i+1} = Qis[i].Trace()
+            * (m_phi_nsamples[i] * 0.5 + ciPrior - 1); // nTimes using phi_{i+1} = Qis[i].Trace()
 
         expectedLogPosteriorParts[9]
             += -gammaln(ciPrior) - ciPrior * log(siPrior) - si * ci / siPrior;
@@ -472,8 +535,16 @@ double WhiteNoiseModel::CalcFreeEnergy(const NoiseParams &noiseIn, const NoisePa
 
     expectedLogPosteriorParts[1] = 0; //*NB not required
 
-    expectedLogPosteriorParts[2]
-        = -0.5 * (k.t() * k).AsScalar() - 0.5 * (J.t() * J * Linv).Trace(); //*NB remove Qsum
+    // -0.5 * k'*k - 0.5 * Tr(J'*J*Linv), summed per sample
+    double kk = 0;
+    for (int t = 0; t < data.Nrows(); t++)
+    {
+        const Real *jrow = J.Store() + t * nTheta;
+        double k = SampleResidual(jrow, nTheta, data.Store()[t], linear.Offset().Store()[t],
+            linear.Centre().Store(), theta.means.Store());
+        kk += k * k + SampleCovTrace(jrow, nTheta, Linv.Store());
+    }
+    expectedLogPosteriorParts[2] = -0.5 * kk; //*NB remove Qsum
 
     expectedLogPosteriorParts[3] = +0.5 * thetaPrior.GetPrecisions().LogDeterminant().LogValue()
         - 0.5 * nTimes * log(2 * M_PI) - 0.5 * nTheta * log(2 * M_PI);